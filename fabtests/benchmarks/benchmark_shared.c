@@ -31,14 +31,194 @@
  * SOFTWARE.
  */
 
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if HAVE_SCHED_SETAFFINITY == 1
+#include <sched.h>
+#endif
 
 #include <rdma/fi_errno.h>
 
 #include "shared.h"
 #include "benchmark_shared.h"
 
+static void ft_bind_cpu(int cpu)
+{
+#if HAVE_SCHED_SETAFFINITY == 1
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		FT_PRINTERR("sched_setaffinity", -errno);
+#else
+	FT_ERR("binding to a cpu is not supported on this platform");
+#endif
+}
+
+/*
+ * NUMA placement comparison (-N): the benchmark runs twice, with the
+ * client bound to a cpu on the server's node and then to a cpu on another
+ * node, and the latency of each size is reported for both placements.
+ * Resources are opened again for each pass, so that memory the provider
+ * places on the caller's node follows the client.
+ */
+#define FT_NUMA_MAX_NODES 64
+#define FT_NUMA_MAX_SIZES 64
+
+int ft_numa_compare;
+
+static struct {
+	int	node[2];	/* server's node, then another node */
+	int	server_cpu;
+	int	client_cpu[2];
+	int	pass;
+	int	cnt;
+	size_t	size[FT_NUMA_MAX_SIZES];
+	float	usec[2][FT_NUMA_MAX_SIZES];
+} numa;
+
+/* Returns the first cnt cpus listed for a node, or < cnt if it has fewer */
+static int ft_numa_node_cpus(int node, int *cpus, int cnt)
+{
+	char path[64], list[1024], *tok, *save;
+	int first, last, i = 0;
+	FILE *file;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+
+	if (!fgets(list, sizeof(list), file))
+		list[0] = '\0';
+	fclose(file);
+
+	for (tok = strtok_r(list, ",\n", &save); tok && i < cnt;
+	     tok = strtok_r(NULL, ",\n", &save)) {
+		switch (sscanf(tok, "%d-%d", &first, &last)) {
+		case 1:
+			last = first;
+			/* fall through */
+		case 2:
+			for (; first <= last && i < cnt; first++)
+				cpus[i++] = first;
+			break;
+		default:
+			break;
+		}
+	}
+	return i;
+}
+
+static int ft_numa_find_cpus(void)
+{
+	int node, cpus[2], found = 0;
+
+	for (node = 0; node < FT_NUMA_MAX_NODES && found < 2; node++) {
+		if (!found && ft_numa_node_cpus(node, cpus, 2) == 2) {
+			numa.node[0] = node;
+			numa.server_cpu = cpus[0];
+			numa.client_cpu[0] = cpus[1];
+			found = 1;
+		} else if (found && ft_numa_node_cpus(node, cpus, 1) == 1) {
+			numa.node[1] = node;
+			numa.client_cpu[1] = cpus[0];
+			found = 2;
+		}
+	}
+
+	if (found < 2) {
+		FT_ERR("-N needs two NUMA nodes with cpus, one with at least two");
+		return -FI_ENODATA;
+	}
+	return 0;
+}
+
+static void ft_numa_record(struct timespec *start, struct timespec *end)
+{
+	int i;
+
+	for (i = 0; i < numa.cnt; i++) {
+		if (numa.size[i] == opts.transfer_size)
+			break;
+	}
+	if (i == numa.cnt) {
+		if (numa.cnt == ARRAY_SIZE(numa.size))
+			return;
+		numa.size[numa.cnt++] = opts.transfer_size;
+	}
+	numa.usec[numa.pass][i] = (float) get_elapsed(start, end, MICRO) /
+				  opts.iterations / 2;
+}
+
+static void ft_numa_report(void)
+{
+	char str[FT_STR_LEN];
+	float diff;
+	int i;
+
+	printf("\nserver on cpu %d, client on cpu %d (node %d) and cpu %d "
+	       "(node %d)\n", numa.server_cpu, numa.client_cpu[0],
+	       numa.node[0], numa.client_cpu[1], numa.node[1]);
+	printf("%-8s%13s%13s%13s%9s\n", "bytes", "same usec",
+	       "cross usec", "diff usec", "diff %");
+	for (i = 0; i < numa.cnt; i++) {
+		diff = numa.usec[1][i] - numa.usec[0][i];
+		printf("%-8s%13.2f%13.2f%13.2f%8.1f%%\n",
+		       size_str(str, numa.size[i]), numa.usec[0][i],
+		       numa.usec[1][i], diff, numa.usec[0][i] ?
+		       100 * diff / numa.usec[0][i] : 0);
+	}
+}
+
+int ft_numa_run(int (*run)(void))
+{
+	struct fi_info *base_hints;
+	int ret;
+
+	ret = ft_numa_find_cpus();
+	if (ret)
+		return ret;
+
+	/* the out of band socket outlives the resources of each pass */
+	opts.options |= FT_OPT_OOB_CTRL;
+
+	base_hints = fi_dupinfo(hints);
+	if (!base_hints)
+		return -FI_ENOMEM;
+
+	for (numa.pass = 0; numa.pass < 2; numa.pass++) {
+		if (numa.pass) {
+			ft_free_res();
+			hints = fi_dupinfo(base_hints);
+			if (!hints) {
+				ret = -FI_ENOMEM;
+				break;
+			}
+		}
+
+		ft_bind_cpu(opts.dst_addr ? numa.client_cpu[numa.pass] :
+			    numa.server_cpu);
+		ret = run();
+		if (ret)
+			break;
+	}
+
+	fi_freeinfo(base_hints);
+	if (!ret)
+		ft_numa_report();
+	return ret;
+}
+
 void ft_parse_benchmark_opts(int op, char *optarg)
 {
 	switch (op) {
@@ -54,6 +234,12 @@ void ft_parse_benchmark_opts(int op, char *optarg)
 	case 'W':
 		opts.window_size = atoi(optarg);
 		break;
+	case 'A':
+		ft_bind_cpu(atoi(optarg));
+		break;
+	case 'N':
+		ft_numa_compare = 1;
+		break;
 	default:
 		break;
 	}
@@ -64,6 +250,9 @@ void ft_benchmark_usage(void)
 	FT_PRINT_OPTS_USAGE("-v", "enables data_integrity checks");
 	FT_PRINT_OPTS_USAGE("-k", "force prefix mode");
 	FT_PRINT_OPTS_USAGE("-j", "maximum inject message size");
+	FT_PRINT_OPTS_USAGE("-A <cpu>", "bind the process to a cpu");
+	FT_PRINT_OPTS_USAGE("-N", "compare latency with the peers on the "
+			    "same and on different NUMA nodes");
 	FT_PRINT_OPTS_USAGE("-W", "window size* (for bandwidth tests)\n\n"
 			"* The following condition is required to have at least "
 			"one window\nsize # of messsages to be sent: "
@@ -119,6 +308,9 @@ int pingpong(void)
 	else
 		show_perf(NULL, opts.transfer_size, opts.iterations, &start, &end, 2);
 
+	if (ft_numa_compare)
+		ft_numa_record(&start, &end);
+
 	return 0;
 }
 
@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2020 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under the BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Connection scaling benchmark.
+ *
+ * Next to the control connection, the client opens a number of MSG
+ * connections (-n) to the server, all sharing one domain, EQ and a pair
+ * of CQs kept apart from the control connection.  Each iteration the
+ * client sends one message over every connection, and the server keeps
+ * one receive posted on each of them.  The message rate shows how the
+ * provider's progress engine copes with the number of sockets, e.g.
+ * FI_TCP_IO_ENGINE=epoll against FI_TCP_IO_ENGINE=uring.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <rdma/fi_errno.h>
+#include <rdma/fi_cm.h>
+
+#include <shared.h>
+#include "benchmark_shared.h"
+
+/* connection requests in flight while the client connects */
+#define SCALE_CONNECT_WINDOW	128
+
+static int conns = 64;
+static struct fid_ep **scale_eps;
+static struct fid_cq *scale_txcq, *scale_rxcq;
+static struct fi_context *scale_ctx;
+static char *scale_rx_buf;
+static struct fid_mr *scale_rx_mr;
+static void *scale_rx_desc;
+
+static int scale_wait_cm(uint32_t expected, struct fi_eq_cm_entry *entry)
+{
+	uint32_t event;
+	ssize_t rd;
+
+	rd = fi_eq_sread(eq, &event, entry, sizeof(*entry), -1, 0);
+	if (rd != sizeof(*entry)) {
+		FT_PROCESS_EQ_ERR(rd, eq, "fi_eq_sread", "connect");
+		return (int) rd;
+	}
+
+	if (event != expected) {
+		FT_ERR("unexpected CM event %d", event);
+		return -FI_EOTHER;
+	}
+	return 0;
+}
+
+static int scale_open_ep(struct fi_info *info, int i)
+{
+	int ret;
+
+	ret = fi_endpoint(domain, info, &scale_eps[i], NULL);
+	if (ret) {
+		FT_PRINTERR("fi_endpoint", ret);
+		return ret;
+	}
+
+	return ft_enable_ep(scale_eps[i], eq, NULL, scale_txcq, scale_rxcq,
+			    NULL, NULL);
+}
+
+static int scale_post_recv(int i)
+{
+	ssize_t ret;
+
+	ret = fi_recv(scale_eps[i], scale_rx_buf +
+		      (size_t) i * opts.transfer_size, opts.transfer_size,
+		      scale_rx_desc, 0, &scale_ctx[i]);
+	if (ret) {
+		FT_PRINTERR("fi_recv", ret);
+		return (int) ret;
+	}
+	return 0;
+}
+
+static int scale_connect(void)
+{
+	struct fi_eq_cm_entry entry;
+	int i, ret, pending = 0;
+
+	for (i = 0; i < conns; i++) {
+		ret = scale_open_ep(fi, i);
+		if (ret)
+			return ret;
+
+		ret = fi_connect(scale_eps[i], fi->dest_addr, NULL, 0);
+		if (ret) {
+			FT_PRINTERR("fi_connect", ret);
+			return ret;
+		}
+
+		if (++pending == SCALE_CONNECT_WINDOW) {
+			ret = scale_wait_cm(FI_CONNECTED, &entry);
+			if (ret)
+				return ret;
+			pending--;
+		}
+	}
+
+	while (pending--) {
+		ret = scale_wait_cm(FI_CONNECTED, &entry);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int scale_accept(void)
+{
+	struct fi_eq_cm_entry entry;
+	uint32_t event;
+	int accepted = 0, connected = 0, ret;
+	ssize_t rd;
+
+	while (connected < conns) {
+		rd = fi_eq_sread(eq, &event, &entry, sizeof(entry), -1, 0);
+		if (rd != sizeof(entry)) {
+			FT_PROCESS_EQ_ERR(rd, eq, "fi_eq_sread", "accept");
+			return (int) rd;
+		}
+
+		switch (event) {
+		case FI_CONNREQ:
+			ret = accepted < conns ?
+			      scale_open_ep(entry.info, accepted) : -FI_EOTHER;
+			if (!ret)
+				ret = scale_post_recv(accepted);
+			if (!ret)
+				ret = fi_accept(scale_eps[accepted], NULL, 0);
+			fi_freeinfo(entry.info);
+			if (ret) {
+				FT_PRINTERR("fi_accept", ret);
+				return ret;
+			}
+			accepted++;
+			break;
+		case FI_CONNECTED:
+			connected++;
+			break;
+		default:
+			FT_ERR("unexpected CM event %d", event);
+			return -FI_EOTHER;
+		}
+	}
+	return 0;
+}
+
+static int scale_read_cq(struct fid_cq *cq, int *left, bool repost)
+{
+	struct fi_cq_entry comp[64];
+	ssize_t ret;
+	int i, err;
+
+	ret = fi_cq_read(cq, comp, MIN(ARRAY_SIZE(comp), (size_t) *left));
+	if (ret == -FI_EAGAIN)
+		return 0;
+	if (ret == -FI_EAVAIL)
+		return ft_cq_readerr(cq);
+	if (ret < 0) {
+		FT_PRINTERR("fi_cq_read", ret);
+		return (int) ret;
+	}
+
+	*left -= (int) ret;
+	for (i = 0; repost && i < ret; i++) {
+		err = scale_post_recv((int) ((struct fi_context *)
+				      comp[i].op_context - scale_ctx));
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int scale_send_all(void)
+{
+	int i, ret, left = conns;
+	ssize_t rc;
+
+	for (i = 0; i < conns; i++) {
+		while ((rc = fi_send(scale_eps[i], tx_buf, opts.transfer_size,
+				     mr_desc, 0, &scale_ctx[i])) == -FI_EAGAIN) {
+			ret = scale_read_cq(scale_txcq, &left, false);
+			if (ret)
+				return ret;
+		}
+		if (rc) {
+			FT_PRINTERR("fi_send", rc);
+			return (int) rc;
+		}
+	}
+
+	while (left) {
+		ret = scale_read_cq(scale_txcq, &left, false);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int scale_recv_all(void)
+{
+	int ret, left = conns;
+
+	while (left) {
+		ret = scale_read_cq(scale_rxcq, &left, true);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int scale_test(void)
+{
+	int64_t elapsed;
+	double msgs;
+	int i, ret;
+
+	for (i = 0; i < opts.iterations + opts.warmup_iterations; i++) {
+		if (i == opts.warmup_iterations) {
+			ret = ft_sync();
+			if (ret)
+				return ret;
+			ft_start();
+		}
+
+		ret = opts.dst_addr ? scale_send_all() : scale_recv_all();
+		if (ret)
+			return ret;
+	}
+	ft_stop();
+
+	elapsed = get_elapsed(&start, &end, MICRO);
+	msgs = (double) conns * opts.iterations;
+	printf("%-10s%-12s%-10s%-14s%-12s\n", "conns", "msgs", "time",
+	       "msgs/sec", "usec/msg");
+	printf("%-10d%-12.0f%-10.2f%-14.0f%-12.3f\n", conns, msgs,
+	       elapsed / 1e6, msgs / (elapsed / 1e6), elapsed / msgs);
+	return 0;
+}
+
+static void scale_free_res(void)
+{
+	int i;
+
+	for (i = 0; scale_eps && i < conns; i++)
+		FT_CLOSE_FID(scale_eps[i]);
+	FT_CLOSE_FID(scale_rx_mr);
+	FT_CLOSE_FID(scale_txcq);
+	FT_CLOSE_FID(scale_rxcq);
+	free(scale_eps);
+	free(scale_ctx);
+	free(scale_rx_buf);
+}
+
+static int run(void)
+{
+	struct fi_cq_attr attr = {
+		.format = FI_CQ_FORMAT_CONTEXT,
+		.wait_obj = FI_WAIT_NONE,
+	};
+	int ret;
+
+	ret = ft_init_fabric_cm();
+	if (ret)
+		return ret;
+
+	/* room for a completion from every connection */
+	attr.size = conns;
+	ret = fi_cq_open(domain, &attr, &scale_txcq, NULL);
+	if (ret) {
+		FT_PRINTERR("fi_cq_open", ret);
+		return ret;
+	}
+	ret = fi_cq_open(domain, &attr, &scale_rxcq, NULL);
+	if (ret) {
+		FT_PRINTERR("fi_cq_open", ret);
+		return ret;
+	}
+
+	scale_eps = calloc(conns, sizeof(*scale_eps));
+	scale_ctx = calloc(conns, sizeof(*scale_ctx));
+	scale_rx_buf = calloc(conns, opts.transfer_size);
+	if (!scale_eps || !scale_ctx || !scale_rx_buf)
+		return -FI_ENOMEM;
+
+	if (fi->domain_attr->mr_mode & FI_MR_LOCAL) {
+		ret = fi_mr_reg(domain, scale_rx_buf,
+				(size_t) conns * opts.transfer_size,
+				FI_RECV, 0, FT_TX_MR_KEY + 1, 0,
+				&scale_rx_mr,
+				NULL);
+		if (ret) {
+			FT_PRINTERR("fi_mr_reg", ret);
+			return ret;
+		}
+		scale_rx_desc = fi_mr_desc(scale_rx_mr);
+	}
+
+	ret = opts.dst_addr ? scale_connect() : scale_accept();
+	if (ret)
+		return ret;
+
+	ret = scale_test();
+	if (ret)
+		return ret;
+
+	return ft_finalize();
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	opts = INIT_OPTS;
+	opts.iterations = 100;
+	opts.warmup_iterations = 10;
+	opts.transfer_size = 64;
+	opts.options |= FT_OPT_SIZE;
+
+	hints = fi_allocinfo();
+	if (!hints)
+		return EXIT_FAILURE;
+
+	while ((op = getopt(argc, argv, "hn:" CS_OPTS INFO_OPTS BENCHMARK_OPTS)) != -1) {
+		switch (op) {
+		case 'n':
+			conns = atoi(optarg);
+			break;
+		default:
+			ft_parse_benchmark_opts(op, optarg);
+			ft_parseinfo(op, optarg, hints, &opts);
+			ft_parsecsopts(op, optarg, &opts);
+			break;
+		case '?':
+		case 'h':
+			ft_csusage(argv[0], "Message rate over many MSG connections.");
+			FT_PRINT_OPTS_USAGE("-n <conns>",
+				"number of connections (default 64)");
+			ft_benchmark_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc)
+		opts.dst_addr = argv[optind];
+
+	if (conns <= 0) {
+		FT_ERR("invalid number of connections");
+		return EXIT_FAILURE;
+	}
+
+	hints->ep_attr->type = FI_EP_MSG;
+	hints->caps = FI_MSG;
+	hints->mode = FI_CONTEXT;
+	hints->domain_attr->mr_mode = opts.mr_mode;
+	hints->domain_attr->threading = FI_THREAD_DOMAIN;
+
+	ret = run();
+
+	scale_free_res();
+	ft_free_res();
+	return ft_exit_code(ret);
+}
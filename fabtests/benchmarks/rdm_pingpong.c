@@ -99,7 +99,7 @@ int main(int argc, char **argv)
 	hints->domain_attr->mr_mode = opts.mr_mode;
 	hints->domain_attr->threading = FI_THREAD_DOMAIN;
 
-	ret = run();
+	ret = ft_numa_compare ? ft_numa_run(run) : run();
 
 	ft_free_res();
 	return ft_exit_code(ret);
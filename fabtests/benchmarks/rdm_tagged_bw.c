@@ -30,12 +30,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <string.h>
 
 #include <rdma/fi_errno.h>
 
 #include <shared.h>
 #include "benchmark_shared.h"
 
+/* Selects rxm's rendezvous protocol.  Must be set before the provider
+ * is loaded, i.e. before the first fi_getinfo call. */
+static int set_rndv_proto(char *proto)
+{
+	if (!strcmp(proto, "read"))
+		return setenv("FI_OFI_RXM_RNDV_WRITE_MIN", "0", 1);
+	if (!strcmp(proto, "write"))
+		return setenv("FI_OFI_RXM_RNDV_WRITE_MIN", "1", 1);
+
+	fprintf(stderr, "Unknown rendezvous protocol: %s\n", proto);
+	return -1;
+}
+
 static int run(void)
 {
 	int i, ret = 0;
@@ -77,8 +91,12 @@ int main(int argc, char **argv)
 	if (!hints)
 		return EXIT_FAILURE;
 
-	while ((op = getopt(argc, argv, "h" CS_OPTS INFO_OPTS BENCHMARK_OPTS)) != -1) {
+	while ((op = getopt(argc, argv, "R:h" CS_OPTS INFO_OPTS BENCHMARK_OPTS)) != -1) {
 		switch (op) {
+		case 'R':
+			if (set_rndv_proto(optarg))
+				return EXIT_FAILURE;
+			break;
 		default:
 			ft_parse_benchmark_opts(op, optarg);
 			ft_parseinfo(op, optarg, hints, &opts);
@@ -88,6 +106,8 @@ int main(int argc, char **argv)
 		case 'h':
 			ft_csusage(argv[0], "Bandwidth test for RDM endpoints using tagged messages.");
 			ft_benchmark_usage();
+			FT_PRINT_OPTS_USAGE("-R <read|write>",
+				"rendezvous protocol for large messages (ofi_rxm)");
 			return EXIT_FAILURE;
 		}
 	}
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2020 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under the BSD license
+ * below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Tag matching microbenchmark.
+ *
+ * The server pre-posts a configurable number of tagged receives, each with a
+ * distinct tag, and the client then sends one message to every receive in
+ * the reverse order they were posted.  With a linear receive queue each
+ * incoming message has to walk past all of the older receives, so the time
+ * per message on the server grows with the queue depth.
+ *
+ * With -u the order is turned around: the client sends every message before
+ * the server posts any receive, and the server then posts its receives in
+ * the reverse order the messages arrived.  This measures the cost of
+ * searching the unexpected message queue instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <rdma/fi_errno.h>
+#include <rdma/fi_tagged.h>
+
+#include <shared.h>
+#include "benchmark_shared.h"
+
+/* keep clear of the tags used by ft_sync */
+#define MATCH_TAG_BASE	(1ULL << 32)
+
+static int depth = 1023;
+static int unexp;
+static struct fi_context *match_ctx;
+
+/*
+ * Never read past the completions of this test, so that the CQ entries of
+ * the sync and finalize messages are left for the common code.
+ */
+static int match_drain_cq(struct fid_cq *cq, int *cnt)
+{
+	struct fi_cq_tagged_entry comp[16];
+	ssize_t ret;
+
+	ret = fi_cq_read(cq, comp, MIN(ARRAY_SIZE(comp),
+				       (size_t) (depth - *cnt)));
+	if (ret > 0) {
+		*cnt += (int) ret;
+		return 0;
+	}
+	if (ret == -FI_EAGAIN)
+		return 0;
+	if (ret == -FI_EAVAIL)
+		return ft_cq_readerr(cq);
+
+	FT_PRINTERR("fi_cq_read", ret);
+	return (int) ret;
+}
+
+static int match_post_recvs(int reverse)
+{
+	ssize_t ret;
+	int i, n;
+
+	for (n = 0; n < depth; n++) {
+		i = reverse ? depth - 1 - n : n;
+		ret = fi_trecv(ep, rx_buf, opts.transfer_size, mr_desc,
+			       remote_fi_addr, MATCH_TAG_BASE + i, 0,
+			       &match_ctx[i]);
+		if (ret) {
+			FT_PRINTERR("fi_trecv", ret);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static int match_send_all(int reverse)
+{
+	ssize_t ret;
+	int i, n, cnt = 0;
+
+	for (n = 0; n < depth; n++) {
+		i = reverse ? depth - 1 - n : n;
+		do {
+			ret = fi_tsend(ep, tx_buf, opts.transfer_size, mr_desc,
+				       remote_fi_addr, MATCH_TAG_BASE + i,
+				       &match_ctx[i]);
+			if (ret == -FI_EAGAIN) {
+				ret = match_drain_cq(txcq, &cnt);
+				if (ret)
+					return ret;
+				ret = -FI_EAGAIN;
+			}
+		} while (ret == -FI_EAGAIN);
+		if (ret) {
+			FT_PRINTERR("fi_tsend", ret);
+			return ret;
+		}
+	}
+
+	while (cnt < depth) {
+		ret = match_drain_cq(txcq, &cnt);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int match_wait_recvs(void)
+{
+	int ret, cnt = 0;
+
+	while (cnt < depth) {
+		ret = match_drain_cq(rxcq, &cnt);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int match_iter_expected(void)
+{
+	int ret;
+
+	if (!opts.dst_addr) {
+		ret = match_post_recvs(0);
+		if (ret)
+			return ret;
+	}
+
+	/* receives are posted before the client starts sending */
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	ft_start();
+	ret = opts.dst_addr ? match_send_all(1) : match_wait_recvs();
+	ft_stop();
+	return ret;
+}
+
+static int match_iter_unexp(void)
+{
+	int ret;
+
+	if (opts.dst_addr) {
+		ft_start();
+		ret = match_send_all(0);
+		ft_stop();
+		if (ret)
+			return ret;
+	}
+
+	/* all messages have been sent before the server posts receives */
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	if (!opts.dst_addr) {
+		ft_start();
+		ret = match_post_recvs(1);
+		if (!ret)
+			ret = match_wait_recvs();
+		ft_stop();
+		if (ret)
+			return ret;
+	}
+
+	/* keep the next round of sends out of this round's queue */
+	return ft_sync();
+}
+
+static int match_test(void)
+{
+	int64_t elapsed = 0;
+	int i, ret;
+
+	for (i = 0; i < opts.iterations + opts.warmup_iterations; i++) {
+		ret = unexp ? match_iter_unexp() : match_iter_expected();
+		if (ret)
+			return ret;
+
+		if (i >= opts.warmup_iterations)
+			elapsed += get_elapsed(&start, &end, NANO);
+	}
+
+	printf("%-10s%-10s%-10s%-12s%-12s\n", "queue", "depth", "msgs", "time",
+	       "usec/msg");
+	printf("%-10s%-10d%-10d%-12.2f%-12.3f\n", unexp ? "unexp" : "posted",
+	       depth, depth * opts.iterations, elapsed / 1e9,
+	       elapsed / 1e3 / ((double) depth * opts.iterations));
+	return 0;
+}
+
+static int run(void)
+{
+	int ret;
+
+	ret = ft_init_fabric();
+	if (ret)
+		return ret;
+
+	if (fi->rx_attr->size < (size_t) depth) {
+		FT_ERR("receive queue depth %d exceeds rx size %zu",
+		       depth, fi->rx_attr->size);
+		return -FI_EINVAL;
+	}
+
+	match_ctx = calloc(depth, sizeof(*match_ctx));
+	if (!match_ctx)
+		return -FI_ENOMEM;
+
+	ret = match_test();
+	if (!ret)
+		ret = ft_finalize();
+
+	free(match_ctx);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	opts = INIT_OPTS;
+	opts.iterations = 10;
+	opts.warmup_iterations = 1;
+	opts.transfer_size = 64;
+	opts.options |= FT_OPT_SIZE;
+
+	hints = fi_allocinfo();
+	if (!hints)
+		return EXIT_FAILURE;
+
+	while ((op = getopt(argc, argv, "hn:u" CS_OPTS INFO_OPTS BENCHMARK_OPTS)) != -1) {
+		switch (op) {
+		case 'n':
+			depth = atoi(optarg);
+			break;
+		case 'u':
+			unexp = 1;
+			break;
+		default:
+			ft_parse_benchmark_opts(op, optarg);
+			ft_parseinfo(op, optarg, hints, &opts);
+			ft_parsecsopts(op, optarg, &opts);
+			break;
+		case '?':
+		case 'h':
+			ft_csusage(argv[0], "Tag matching test for RDM endpoints.");
+			FT_PRINT_OPTS_USAGE("-n <depth>",
+				"number of pre-posted receives (default 1023)");
+			FT_PRINT_OPTS_USAGE("-u", "match against unexpected "
+				"messages instead of posted receives");
+			ft_benchmark_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc)
+		opts.dst_addr = argv[optind];
+
+	if (depth <= 0) {
+		FT_ERR("invalid receive queue depth");
+		return EXIT_FAILURE;
+	}
+
+	hints->ep_attr->type = FI_EP_RDM;
+	hints->caps = FI_TAGGED;
+	hints->mode = FI_CONTEXT;
+	hints->domain_attr->mr_mode = opts.mr_mode;
+	hints->domain_attr->threading = FI_THREAD_DOMAIN;
+	/* one extra receive is kept posted for ft_finalize */
+	hints->rx_attr->size = depth + 1;
+
+	ret = run();
+
+	ft_free_res();
+	return ft_exit_code(ret);
+}
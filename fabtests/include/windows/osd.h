@@ -111,6 +111,14 @@ static inline char* strsep(char **stringp, const char *delim)
 	return ptr;
 }
 
+static inline int setenv(const char *name, const char *value, int overwrite)
+{
+	if (!overwrite && getenv(name))
+		return 0;
+
+	return _putenv_s(name, value) ? -1 : 0;
+}
+
 #define _SC_PAGESIZE	30
 
 static long int sysconf(int name)
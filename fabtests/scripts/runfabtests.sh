@@ -138,6 +138,7 @@ short_tests=(
 	"fi_msg_pingpong -I 5 -v"
 	"fi_msg_bw -I 5"
 	"fi_msg_bw -I 5 -v"
+	"fi_msg_conn_scale -I 5 -n 16"
 	"fi_rma_bw -e msg -o write -I 5"
 	"fi_rma_bw -e msg -o read -I 5"
 	"fi_rma_bw -e msg -o writedata -I 5"
@@ -154,6 +155,7 @@ short_tests=(
 	"fi_rdm_tagged_pingpong -I 5 -v"
 	"fi_rdm_tagged_bw -I 5"
 	"fi_rdm_tagged_bw -I 5 -v"
+	"fi_rdm_tagged_match -I 2 -n 64"
 	"fi_dgram_pingpong -I 5"
 )
 
@@ -164,6 +166,7 @@ standard_tests=(
 	"fi_msg_pingpong -k -v"
 	"fi_msg_bw"
 	"fi_msg_bw -v"
+	"fi_msg_conn_scale"
 	"fi_rma_bw -e msg -o write"
 	"fi_rma_bw -e msg -o read"
 	"fi_rma_bw -e msg -o writedata"
@@ -182,6 +185,7 @@ standard_tests=(
 	"fi_rdm_tagged_pingpong -v"
 	"fi_rdm_tagged_bw"
 	"fi_rdm_tagged_bw -v"
+	"fi_rdm_tagged_match"
 	"fi_dgram_pingpong"
 	"fi_dgram_pingpong -k"
 )
@@ -200,6 +204,16 @@ complex_tests=(
 	"fi_ubertest"
 )
 
+# Run with FI_OFI_RXM_USE_SHM=1 when ofi_rxm peers share a node
+rxm_shm_tests=(
+	"fi_rdm"
+	"fi_rdm_tagged_bw -I 5 -v"
+	"fi_rma_bw -e rdm -o write -I 5"
+	"fi_rma_bw -e rdm -o read -I 5"
+	"fi_rma_bw -e rdm -o writedata -I 5"
+	"fi_rdm_atomic -I 5 -o all"
+)
+
 multinode_tests=(
 	"fi_multinode -C msg"
 	"fi_multinode -C rma"
@@ -471,6 +485,20 @@ function cs_test {
 	fi
 }
 
+function rxm_shm_test {
+	local test=$1
+	local saved_env=$EXPORT_ENV
+	local saved_excludes=$cur_excludes
+
+	# The ofi_rxm exclude file is written for the MSG provider, while
+	# these go through shm
+	cur_excludes=${input_excludes}
+	EXPORT_ENV="$EXPORT_ENV export FI_OFI_RXM_USE_SHM=1 ;"
+	cs_test "$test"
+	EXPORT_ENV=$saved_env
+	cur_excludes=$saved_excludes
+}
+
 function set_cfg_file {
 	local cfg_file
 	local parent=$UTIL
@@ -704,6 +732,12 @@ function main {
 			for test in "${functional_tests[@]}"; do
 				cs_test "$test"
 			done
+
+			if [[ $UTIL == "ofi_rxm" && $SERVER == $CLIENT ]]; then
+				for test in "${rxm_shm_tests[@]}"; do
+					rxm_shm_test "$test"
+				done
+			fi
 		;;
 		short)
 			for test in "${short_tests[@]}"; do
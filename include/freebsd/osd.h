@@ -95,6 +95,16 @@ static inline size_t ofi_process_vm_writev(pid_t pid,
 	return -FI_ENOSYS;
 }
 
+static inline int ofi_numa_node(void)
+{
+	return -1;
+}
+
+static inline int ofi_numa_prefer(void *addr, size_t len, int node)
+{
+	return -FI_ENOSYS;
+}
+
 #endif /* _FREEBSD_OSD_H_ */
 
 
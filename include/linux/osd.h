@@ -39,6 +39,7 @@
 #include <byteswap.h>
 #include <endian.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <string.h>
 #include <assert.h>
 
@@ -125,4 +126,42 @@ static inline size_t ofi_process_vm_writev(pid_t pid,
 		       remote_iov, riovcnt, flags);
 }
 
+#ifndef MPOL_PREFERRED
+# define MPOL_PREFERRED 1
+#endif
+
+/* NUMA node of the CPU the caller is running on, or -1 if unknown */
+static inline int ofi_numa_node(void)
+{
+#if HAVE_DECL___NR_GETCPU
+	unsigned int cpu, node;
+
+	if (syscall(__NR_getcpu, &cpu, &node, NULL))
+		return -1;
+	return (int) node;
+#else
+	return -1;
+#endif
+}
+
+/* Ask the kernel to allocate the pages of a mapping on the given node */
+static inline int ofi_numa_prefer(void *addr, size_t len, int node)
+{
+#if HAVE_DECL___NR_MBIND
+	unsigned long mask;
+
+	if (node < 0 || node >= (int) (sizeof(mask) * 8))
+		return -FI_EINVAL;
+
+	mask = 1UL << node;
+	/* the kernel ignores the last bit of maxnode */
+	if (syscall(__NR_mbind, addr, len, MPOL_PREFERRED, &mask,
+		    sizeof(mask) * 8 + 1, 0))
+		return -errno;
+	return 0;
+#else
+	return -FI_ENOSYS;
+#endif
+}
+
 #endif /* _LINUX_OSD_H_ */
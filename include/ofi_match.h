@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2020 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Hashed message matching queue.
+ *
+ * Holds either posted receives or unexpected messages and finds the oldest
+ * entry that matches a (source, tag, ignore) key.  FI_ADDR_UNSPEC on either
+ * side acts as a source wildcard and ignore bits as tag wildcards.
+ *
+ * Entries without ignore bits are hashed on (addr, tag), where addr may be
+ * FI_ADDR_UNSPEC.  Entries with ignore bits are kept on a separate wildcard
+ * list.  Every entry is also linked on an ordered list of the whole queue.
+ * A lookup with a fully specified key only has to check the two buckets the
+ * key can land in plus the wildcard list, and picks the candidate with the
+ * lowest sequence number, which preserves posting order across all three.
+ * Lookups with wildcard keys fall back to walking the ordered list.
+ *
+ * Sequence numbers start in the middle of their range so that entries can
+ * be put back in front of the queue (e.g. a partially consumed multi-recv
+ * buffer) without renumbering the rest.
+ */
+
+#ifndef _OFI_MATCH_H_
+#define _OFI_MATCH_H_
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <ofi_list.h>
+#include <rdma/fabric.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ofi_match_entry {
+	struct dlist_entry	entry;		/* ordered list */
+	struct dlist_entry	hash_entry;	/* hash bucket or wildcard list */
+	uint64_t		seq;
+	fi_addr_t		addr;
+	uint64_t		tag;
+	uint64_t		ignore;
+};
+
+struct ofi_match_queue {
+	struct dlist_entry	list;
+	struct dlist_entry	wildcard;
+	struct dlist_entry	*hash;
+	size_t			hash_mask;
+	uint64_t		seq;
+};
+
+static inline int
+ofi_match_entry_matches(struct ofi_match_entry *entry, fi_addr_t addr,
+			uint64_t tag, uint64_t ignore)
+{
+	ignore |= entry->ignore;
+	return (entry->addr == FI_ADDR_UNSPEC || addr == FI_ADDR_UNSPEC ||
+		entry->addr == addr) &&
+	       ((entry->tag | ignore) == (tag | ignore));
+}
+
+int ofi_match_queue_init(struct ofi_match_queue *queue, size_t size);
+void ofi_match_queue_close(struct ofi_match_queue *queue);
+
+/* The caller sets addr, tag and ignore in the entry before inserting it */
+void ofi_match_queue_insert(struct ofi_match_queue *queue,
+			    struct ofi_match_entry *entry);
+/* Insert ahead of every entry already queued */
+void ofi_match_queue_insert_head(struct ofi_match_queue *queue,
+				 struct ofi_match_entry *entry);
+/* Re-hash an entry whose addr or tag changed, keeping its place in order */
+void ofi_match_queue_update(struct ofi_match_queue *queue,
+			    struct ofi_match_entry *entry);
+void ofi_match_queue_remove(struct ofi_match_queue *queue,
+			    struct ofi_match_entry *entry);
+struct ofi_match_entry *
+ofi_match_queue_find(struct ofi_match_queue *queue, fi_addr_t addr,
+		     uint64_t tag, uint64_t ignore);
+
+static inline int ofi_match_queue_empty(struct ofi_match_queue *queue)
+{
+	return dlist_empty(&queue->list);
+}
+
+static inline struct ofi_match_entry *
+ofi_match_queue_remove_first(struct ofi_match_queue *queue, fi_addr_t addr,
+			     uint64_t tag, uint64_t ignore)
+{
+	struct ofi_match_entry *entry;
+
+	entry = ofi_match_queue_find(queue, addr, tag, ignore);
+	if (entry)
+		ofi_match_queue_remove(queue, entry);
+	return entry;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _OFI_MATCH_H_ */
@@ -39,6 +39,7 @@
 #include <stddef.h>
 
 #include <ofi_atom.h>
+#include <ofi_indexer.h>
 #include <ofi_proto.h>
 #include <ofi_mem.h>
 #include <ofi_rbuf.h>
@@ -50,7 +51,7 @@ extern "C" {
 #endif
 
 
-#define SMR_VERSION	1
+#define SMR_VERSION	5
 
 #ifdef HAVE_ATOMICS
 #define SMR_FLAG_ATOMIC	(1 << 0)
@@ -183,38 +184,77 @@ struct smr_ep_name {
 	struct dlist_entry entry;
 };
 
+/*
+ * Peer regions are mapped on first use rather than at AV insert.  ref counts
+ * the users of a mapped region and is biased by -SMR_PEER_UNMAPPED while the
+ * region is not mapped, so a failed increment sends the caller to the slow
+ * path in smr_map_acquire.  A region can only be unmapped when ref is 0.
+ * Removing a peer that is still in use sets del_pending, and the last
+ * smr_peer_release does the unmap.
+ */
+#define SMR_PEER_UNMAPPED	(1 << 30)
+
 struct smr_peer {
 	struct smr_addr		peer;
 	struct smr_region	*region;
+	ofi_atomic32_t		ref;
+	int			accessed;
+	int			del_pending;
+	struct dlist_entry	lru_entry;
 };
 
-#define SMR_MAX_PEERS	256
-
+/*
+ * The peer map is indexed by AV index and grows as addresses are inserted.
+ * Peers are allocated on first use and stay in place until the map is freed,
+ * so lookups from the data path do not need to take the map lock.
+ *
+ * At most max_mapped regions of other processes are kept mapped.  When the
+ * limit is reached, a region that is not in use is unmapped, picked from
+ * lru_list with a second chance (clock) scan on the accessed bit.
+ */
 struct smr_map {
-	fastlock_t	lock;
-	struct smr_peer	peers[SMR_MAX_PEERS];
+	fastlock_t		lock;
+	const struct fi_provider *prov;
+	struct index_map	peers;
+	int			num_peers; /* highest index in use + 1 */
+
+	struct dlist_entry	lru_list;
+	size_t			num_mapped;
+	size_t			max_mapped;
+
+	/* statistics, read through FI_OPT_SHM_MAP_STATS */
+	size_t			map_cnt;
+	size_t			unmap_cnt;
+	size_t			over_limit_cnt;
 };
 
+static inline struct smr_peer *smr_map_peer(struct smr_map *map, int id)
+{
+	return id < 0 ? NULL : ofi_idm_lookup(&map->peers, id);
+}
+
 struct smr_region {
 	uint8_t		version;
 	uint8_t		resv;
 	uint16_t	flags;
 	int		pid;
+	int		node; /* NUMA node the region is placed on, or -1 */
 	uint8_t		cma_cap;
 	void		*base_addr;
-	fastlock_t	lock; /* lock for shm access
-				 Must hold smr->lock before tx/rx cq locks
-				 in order to progress or post recv */
+	fastlock_t	lock; /* protects the inject and sar pools and sar_cnt.
+				 Leaf lock: taken with the tx/rx cq lock held,
+				 never held while acquiring another lock */
 	struct smr_map	*map;
 
 	size_t		total_size;
-	size_t		cmd_cnt; /* Doubles as a tracker for number of cmds AND
+	ofi_atomic64_t	cmd_cnt; /* Doubles as a tracker for number of cmds AND
 				    number of inject buffers available for use,
 				    to ensure 1:1 ratio of cmds to inject bufs.
 				    Might not always be paired consistently with
 				    cmd alloc/free depending on protocol
 				    (Ex. unexpected messages, RMA requests) */
 	size_t		sar_cnt;
+	size_t		max_peers; /* number of entries in the peer data array */
 
 	/* offsets from start of smr_region */
 	size_t		cmd_queue_offset;
@@ -250,18 +290,163 @@ struct smr_sar_buf {
 	uint8_t		buf[SMR_SAR_SIZE];
 };
 
+/*
+ * Staging buffer used by the SAR protocol, one per peer with a transfer in
+ * flight.  The sender fills segments and the receiver drains them in ring
+ * order, so the two sides can work on up to seg_cnt segments concurrently.
+ * seg_offset is relative to the smr_sar_msg itself, which keeps it valid in
+ * every process that maps the region.
+ */
+#define SMR_SAR_MIN_SEGS	2
+
 struct smr_sar_msg {
-	struct smr_sar_buf	sar[2];
+	uint64_t		seg_cnt;
+	uint64_t		seg_offset;
+};
+
+static inline struct smr_sar_buf *smr_sar_seg(struct smr_sar_msg *sar_msg,
+					      int i)
+{
+	return (struct smr_sar_buf *) ((char *) sar_msg +
+				       sar_msg->seg_offset) + i;
+}
+
+static inline int smr_sar_idle(struct smr_sar_msg *sar_msg)
+{
+	int i;
+
+	for (i = 0; i < sar_msg->seg_cnt; i++) {
+		if (smr_sar_seg(sar_msg, i)->status != SMR_SAR_FREE)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Lock-free multi-producer, single-consumer command queue.
+ *
+ * Each slot carries a sequence number.  The slot for position pos is free
+ * for a producer when seq == pos and holds a posted command when
+ * seq == pos + 1.  Senders first reserve command credits (cmd_cnt), then
+ * claim consecutive positions with a fetch-add on tail, fill the slots and
+ * publish them by advancing seq.  The owner of the region consumes from
+ * head without taking the region lock and hands a slot back by setting
+ * seq to pos + size.
+ *
+ * A credit is only returned once its slot has been handed back, including
+ * the credit the sender returns when it reaps a response, which the owner
+ * may write before it discards the command.  The slots a sender claims are
+ * therefore always free and posting never waits on the owner.
+ *
+ * Multi-command operations (e.g. RMA) claim all of their positions at once
+ * and publish them back to front, so the owner sees the whole group as
+ * soon as the first command is ready.
+ */
+struct smr_cmd_queue_entry {
+	ofi_atomic64_t	seq;
+	struct smr_cmd	cmd;
+};
+
+struct smr_cmd_queue {
+	size_t		size;
+	size_t		size_mask;
+	int64_t		head;	/* owner only */
+	/* keep the consumer and producer indices on separate cache lines */
+	uint8_t		pad[64 - 2 * sizeof(size_t) - sizeof(int64_t)];
+	ofi_atomic64_t	tail;
+	struct smr_cmd_queue_entry entry[];
 };
 
-OFI_DECLARE_CIRQUE(struct smr_cmd, smr_cmd_queue);
+static inline void smr_cmd_queue_init(struct smr_cmd_queue *queue, size_t size)
+{
+	size_t i;
+
+	assert(size == roundup_power_of_two(size));
+	queue->size = size;
+	queue->size_mask = size - 1;
+	queue->head = 0;
+	ofi_atomic_initialize64(&queue->tail, 0);
+	for (i = 0; i < size; i++)
+		ofi_atomic_initialize64(&queue->entry[i].seq, i);
+}
+
+static inline struct smr_cmd_queue_entry *
+smr_cmd_queue_entry(struct smr_cmd_queue *queue, int64_t pos)
+{
+	return &queue->entry[pos & queue->size_mask];
+}
+
+/* Returns the command at the head of the queue, or NULL if none is posted */
+static inline struct smr_cmd *smr_cmd_queue_head(struct smr_cmd_queue *queue)
+{
+	struct smr_cmd_queue_entry *entry;
+
+	entry = smr_cmd_queue_entry(queue, queue->head);
+	if (ofi_atomic_get64(&entry->seq) != queue->head + 1)
+		return NULL;
+
+	return &entry->cmd;
+}
+
+/* Returns the command following the head, which belongs to the same group */
+static inline struct smr_cmd *smr_cmd_queue_next(struct smr_cmd_queue *queue)
+{
+	struct smr_cmd_queue_entry *entry;
+
+	entry = smr_cmd_queue_entry(queue, queue->head + 1);
+	assert(ofi_atomic_get64(&entry->seq) == queue->head + 2);
+
+	return &entry->cmd;
+}
+
+static inline void smr_cmd_queue_discard(struct smr_cmd_queue *queue)
+{
+	struct smr_cmd_queue_entry *entry;
+
+	entry = smr_cmd_queue_entry(queue, queue->head);
+	ofi_atomic_set64(&entry->seq, queue->head + queue->size);
+	queue->head++;
+}
+
+/*
+ * Copy cnt commands into the queue.  The caller must hold cnt credits from
+ * smr_cmd_queue_reserve(), which guarantees the claimed slots are free.
+ * Returns the position of the last command, see smr_cmd_queue_consumed().
+ */
+static inline int64_t smr_cmd_queue_post(struct smr_cmd_queue *queue,
+					 const struct smr_cmd *cmd, int cnt)
+{
+	struct smr_cmd_queue_entry *entry;
+	int64_t pos;
+	int i;
+
+	pos = ofi_atomic_add64(&queue->tail, cnt) - cnt;
+	for (i = cnt - 1; i >= 0; i--) {
+		entry = smr_cmd_queue_entry(queue, pos + i);
+		assert(ofi_atomic_get64(&entry->seq) == pos + i);
+		entry->cmd = cmd[i];
+		ofi_atomic_set64(&entry->seq, pos + i + 1);
+	}
+
+	return pos + cnt - 1;
+}
+
+/* Whether the owner has handed back the slot posted at pos */
+static inline int smr_cmd_queue_consumed(struct smr_cmd_queue *queue,
+					 int64_t pos)
+{
+	return ofi_atomic_get64(&smr_cmd_queue_entry(queue, pos)->seq) !=
+	       pos + 1;
+}
+
 OFI_DECLARE_CIRQUE(struct smr_resp, smr_resp_queue);
 DECLARE_SMR_FREESTACK(struct smr_inject_buf, smr_inject_pool);
 DECLARE_SMR_FREESTACK(struct smr_sar_msg, smr_sar_pool);
 
+/* Only valid while holding a reference, see smr_peer_acquire() */
 static inline struct smr_region *smr_peer_region(struct smr_region *smr, int i)
 {
-	return smr->map->peers[i].region;
+	return ((struct smr_peer *) ofi_idm_at(&smr->map->peers, i))->region;
 }
 static inline struct smr_cmd_queue *smr_cmd_queue(struct smr_region *smr)
 {
@@ -283,6 +468,13 @@ static inline struct smr_sar_pool *smr_sar_pool(struct smr_region *smr)
 {
 	return (struct smr_sar_pool *) ((char *) smr + smr->sar_pool_offset); 
 }
+static inline int smr_remote_node(struct smr_region *smr,
+				  struct smr_region *peer_smr)
+{
+	return smr->node >= 0 && peer_smr->node >= 0 &&
+	       smr->node != peer_smr->node;
+}
+
 static inline const char *smr_name(struct smr_region *smr)
 {
 	return (const char *) smr + smr->name_offset;
@@ -293,19 +485,81 @@ static inline void smr_set_map(struct smr_region *smr, struct smr_map *map)
 	smr->map = map;
 }
 
+/* Claim cnt command slots (and their inject buffers) on smr */
+static inline int smr_cmd_queue_reserve(struct smr_region *smr, int cnt)
+{
+	if (ofi_atomic_sub64(&smr->cmd_cnt, cnt) < 0) {
+		ofi_atomic_add64(&smr->cmd_cnt, cnt);
+		return -FI_EAGAIN;
+	}
+	return 0;
+}
+
+static inline void smr_cmd_queue_release(struct smr_region *smr, int cnt)
+{
+	ofi_atomic_add64(&smr->cmd_cnt, cnt);
+}
+
+/* Callers must hold a command credit, which backs one inject buffer */
+static inline struct smr_inject_buf *smr_inject_buf_get(struct smr_region *smr)
+{
+	struct smr_inject_buf *tx_buf;
+
+	fastlock_acquire(&smr->lock);
+	tx_buf = smr_freestack_pop(smr_inject_pool(smr));
+	fastlock_release(&smr->lock);
+
+	return tx_buf;
+}
+
+static inline void smr_inject_buf_put(struct smr_region *smr,
+				      struct smr_inject_buf *tx_buf)
+{
+	fastlock_acquire(&smr->lock);
+	smr_freestack_push(smr_inject_pool(smr), tx_buf);
+	fastlock_release(&smr->lock);
+}
+
+static inline struct smr_sar_msg *smr_sar_buf_get(struct smr_region *smr)
+{
+	struct smr_sar_msg *sar_msg = NULL;
+
+	fastlock_acquire(&smr->lock);
+	if (smr->sar_cnt) {
+		sar_msg = smr_freestack_pop(smr_sar_pool(smr));
+		smr->sar_cnt--;
+	}
+	fastlock_release(&smr->lock);
+
+	return sar_msg;
+}
+
+static inline void smr_sar_buf_put(struct smr_region *smr,
+				   struct smr_sar_msg *sar_msg)
+{
+	fastlock_acquire(&smr->lock);
+	smr_freestack_push(smr_sar_pool(smr), sar_msg);
+	smr->sar_cnt++;
+	fastlock_release(&smr->lock);
+}
+
 struct smr_attr {
 	const char	*name;
 	size_t		rx_count;
 	size_t		tx_count;
+	size_t		peer_count;
+	size_t		sar_seg_count; /* segments per SAR staging buffer */
 };
 
 size_t smr_calculate_size_offsets(size_t tx_count, size_t rx_count,
-				  size_t *cmd_offset, size_t *resp_offset,
-				  size_t *inject_offset, size_t *sar_offset,
-				  size_t *peer_offset, size_t *name_offset);
+				  size_t peer_count, size_t sar_seg_count,
+				  size_t *cmd_offset,
+				  size_t *resp_offset, size_t *inject_offset,
+				  size_t *sar_offset, size_t *peer_offset,
+				  size_t *name_offset);
 void	smr_cma_check(struct smr_region *region, struct smr_region *peer_region);
 void	smr_cleanup(void);
-int	smr_map_create(const struct fi_provider *prov, int peer_count,
+int	smr_map_create(const struct fi_provider *prov, size_t max_mapped,
 		       struct smr_map **map);
 int	smr_map_to_region(const struct fi_provider *prov,
 			  struct smr_peer *peer_buf);
@@ -315,9 +569,43 @@ void	smr_exchange_all_peers(struct smr_region *region);
 int	smr_map_add(const struct fi_provider *prov,
 		    struct smr_map *map, const char *name, int id);
 void	smr_map_del(struct smr_map *map, int id);
+void	smr_map_put_deleted(struct smr_map *map, int id);
 void	smr_map_free(struct smr_map *map);
+int	smr_map_acquire(struct smr_map *map, int id,
+			struct smr_region **region);
+
+static inline int smr_peer_tryacquire(struct smr_peer *peer)
+{
+	if (ofi_atomic_inc32(&peer->ref) > 0) {
+		peer->accessed = 1;
+		return 1;
+	}
+	ofi_atomic_dec32(&peer->ref);
+	return 0;
+}
 
-struct smr_region *smr_map_get(struct smr_map *map, int id);
+/* Takes a reference on the region of peer id, mapping it if needed */
+static inline int smr_peer_acquire(struct smr_region *smr, int id,
+				   struct smr_region **peer_smr)
+{
+	struct smr_peer *peer;
+
+	peer = ofi_idm_at(&smr->map->peers, id);
+	if (OFI_LIKELY(smr_peer_tryacquire(peer))) {
+		*peer_smr = peer->region;
+		return 0;
+	}
+	return smr_map_acquire(smr->map, id, peer_smr);
+}
+
+static inline void smr_peer_release(struct smr_region *smr, int id)
+{
+	struct smr_peer *peer;
+
+	peer = ofi_idm_at(&smr->map->peers, id);
+	if (OFI_UNLIKELY(ofi_atomic_dec32(&peer->ref) == -SMR_PEER_UNMAPPED))
+		smr_map_put_deleted(smr->map, id);
+}
 
 int	smr_create(const struct fi_provider *prov, struct smr_map *map,
 		   const struct smr_attr *attr, struct smr_region **smr);
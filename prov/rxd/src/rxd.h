@@ -59,7 +59,7 @@
 #ifndef _RXD_H_
 #define _RXD_H_
 
-#define RXD_PROTOCOL_VERSION 	(2)
+#define RXD_PROTOCOL_VERSION 	(3)
 
 #define RXD_MAX_MTU_SIZE	4096
 
@@ -74,6 +74,8 @@
 
 #define RXD_PKT_IN_USE		(1 << 0)
 #define RXD_PKT_ACKED		(1 << 1)
+#define RXD_PKT_SACKED		(1 << 2)
+#define RXD_PKT_RETX		(1 << 3)
 
 #define RXD_REMOTE_CQ_DATA	(1 << 0)
 #define RXD_NO_TX_COMP		(1 << 1)
@@ -139,7 +141,10 @@ struct rxd_peer {
 	struct dlist_entry rx_list;
 	struct dlist_entry rma_rx_list;
 	struct dlist_entry unacked;
-	struct dlist_entry buf_pkts;
+
+	/* Packets received out of order, indexed by seq_no */
+	struct rxd_pkt_entry *buf_pkts[RXD_SACK_WINDOW];
+	uint16_t buf_pkts_cnt;
 };
 
 struct rxd_addr {
@@ -151,18 +151,70 @@ static void rxd_complete_tx(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 	rxd_tx_entry_free(ep, tx_entry);
 }
 
-static int rxd_comp_pkt_seq_no(struct dlist_entry *item, const void *arg)
+/*
+ * Packets received out of order are parked in a ring indexed by sequence
+ * number until the packets before them arrive, and reported to the sender
+ * in the SACK bitmap of our ACKs.  Returns 0 if the packet is a duplicate
+ * or beyond the window, in which case the caller still owns it.
+ */
+static int rxd_buf_pkt(struct rxd_peer *peer, struct rxd_pkt_entry *pkt_entry)
+{
+	uint64_t seq = rxd_get_base_hdr(pkt_entry)->seq_no;
+	struct rxd_pkt_entry **slot;
+
+	if (!ofi_before(peer->rx_seq_no, seq) ||
+	    seq - peer->rx_seq_no >= RXD_SACK_WINDOW)
+		return 0;
+
+	slot = &peer->buf_pkts[seq % RXD_SACK_WINDOW];
+	if (*slot) {
+		if (rxd_get_base_hdr(*slot)->seq_no == seq)
+			return 0;
+		/* left behind when rx_seq_no skipped past it */
+		ofi_buf_free(*slot);
+		peer->buf_pkts_cnt--;
+	}
+
+	*slot = pkt_entry;
+	peer->buf_pkts_cnt++;
+	return 1;
+}
+
+static struct rxd_pkt_entry *rxd_pop_buf_pkt(struct rxd_peer *peer)
 {
-	struct rxd_base_hdr *list_hdr;
-	struct rxd_base_hdr *new_hdr;
+	struct rxd_pkt_entry **slot;
+	struct rxd_pkt_entry *pkt_entry;
+
+	slot = &peer->buf_pkts[peer->rx_seq_no % RXD_SACK_WINDOW];
+	pkt_entry = *slot;
+	if (!pkt_entry)
+		return NULL;
+
+	*slot = NULL;
+	peer->buf_pkts_cnt--;
+	if (rxd_get_base_hdr(pkt_entry)->seq_no != peer->rx_seq_no) {
+		ofi_buf_free(pkt_entry);
+		return NULL;
+	}
+
+	return pkt_entry;
+}
 
-	list_hdr = rxd_get_base_hdr(container_of(item,
-				   struct rxd_pkt_entry, d_entry));
+/* Put back a popped packet that can't be consumed yet */
+static void rxd_keep_buf_pkt(struct rxd_peer *peer,
+			     struct rxd_pkt_entry *pkt_entry)
+{
+	peer->buf_pkts[peer->rx_seq_no % RXD_SACK_WINDOW] = pkt_entry;
+	peer->buf_pkts_cnt++;
+}
 
-	new_hdr = rxd_get_base_hdr(container_of((struct dlist_entry *) arg,
-				  struct rxd_pkt_entry, d_entry));
+static int rxd_buf_pkt_kept(struct rxd_peer *peer)
+{
+	struct rxd_pkt_entry *pkt_entry;
 
-	return new_hdr->seq_no > list_hdr->seq_no;
+	pkt_entry = peer->buf_pkts[peer->rx_seq_no % RXD_SACK_WINDOW];
+	return pkt_entry &&
+	       rxd_get_base_hdr(pkt_entry)->seq_no == peer->rx_seq_no;
 }
 
 void rxd_ep_recv_data(struct rxd_ep *ep, struct rxd_x_entry *x_entry,
@@ -882,6 +934,24 @@ static struct rxd_x_entry *rxd_get_data_x_entry(struct rxd_ep *ep,
 	return ofi_bufpool_get_ibuf(ep->tx_entry_pool.pool, data_pkt->ext_hdr.tx_id);
 }
 
+static void rxd_save_unexp_data(struct rxd_ep *ep,
+				struct rxd_pkt_entry *pkt_entry)
+{
+	struct rxd_data_pkt *pkt = (struct rxd_data_pkt *) (pkt_entry->pkt);
+	struct rxd_unexp_msg *unexp_msg;
+
+	unexp_msg = ep->peers[pkt->base_hdr.peer].curr_unexp;
+	dlist_insert_tail(&pkt_entry->d_entry, &unexp_msg->pkt_list);
+	if (pkt->ext_hdr.seg_no + 1 == unexp_msg->sar_hdr->num_segs - 1) {
+		ep->peers[pkt->base_hdr.peer].curr_unexp = NULL;
+		rxd_ep_send_ack(ep, pkt->base_hdr.peer);
+	}
+}
+
+/*
+ * A buffered packet that can't be consumed yet is kept in its slot and
+ * retried on the next pass, or when the sender resends it.
+ */
 static void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
 {
 	struct fi_cq_err_entry err_entry;
@@ -898,14 +968,19 @@ static void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
 	struct rxd_x_entry *rx_entry = NULL;
 	struct rxd_data_pkt *data_pkt;
 
-	while (!dlist_empty(&ep->peers[peer].buf_pkts)) {
-		pkt_entry = container_of((&ep->peers[peer].buf_pkts)->next,
-					struct rxd_pkt_entry, d_entry);
-		base_hdr = rxd_get_base_hdr(pkt_entry);
-		if (base_hdr->seq_no != ep->peers[peer].rx_seq_no)
+	while (ep->peers[peer].buf_pkts_cnt) {
+		pkt_entry = rxd_pop_buf_pkt(&ep->peers[peer]);
+		if (!pkt_entry)
 			return;
+		base_hdr = rxd_get_base_hdr(pkt_entry);
 
 		if (base_hdr->type == RXD_DATA || base_hdr->type == RXD_DATA_READ) {
+			if (base_hdr->type == RXD_DATA &&
+			    ep->peers[peer].curr_unexp) {
+				ep->peers[peer].rx_seq_no++;
+				rxd_save_unexp_data(ep, pkt_entry);
+				continue;
+			}
 			data_pkt = (struct rxd_data_pkt *) pkt_entry->pkt;
 			rx_entry = rxd_get_data_x_entry(ep, data_pkt);
 			rxd_ep_recv_data(ep, rx_entry, data_pkt, pkt_entry->pkt_size);
@@ -923,25 +998,33 @@ static void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
 					FI_WARN(&rxd_prov, FI_LOG_EP_CTRL,
 						"could not write error entry\n");
 				ep->peers[base_hdr->peer].rx_seq_no++;
-				rxd_remove_free_pkt_entry(pkt_entry);
+				ofi_buf_free(pkt_entry);
 				continue;
 			}
 			if (!rx_entry) {
-				if (base_hdr->type == RXD_MSG ||
-				    base_hdr->type == RXD_TAGGED) {
+				if ((base_hdr->type == RXD_MSG ||
+				     base_hdr->type == RXD_TAGGED) &&
+				    ep->peers[peer].curr_unexp) {
 					ep->peers[base_hdr->peer].rx_seq_no++;
+					if (!sar_hdr)
+						ep->peers[peer].curr_unexp = NULL;
 					continue;
 				}
-				break;
+				if (base_hdr->type != RXD_MSG &&
+				    base_hdr->type != RXD_TAGGED)
+					ep->peers[peer].rx_window = 0;
+				rxd_keep_buf_pkt(&ep->peers[peer], pkt_entry);
+				return;
 			}
 
+			ep->peers[peer].rx_window = rxd_env.max_unacked;
 			rxd_progress_op(ep, rx_entry, pkt_entry, base_hdr,
 					sar_hdr, tag_hdr, data_hdr, rma_hdr,
 					atom_hdr, &msg, msg_size);
 		}
 
 		ep->peers[base_hdr->peer].rx_seq_no++;
-		rxd_remove_free_pkt_entry(pkt_entry);
+		ofi_buf_free(pkt_entry);
 	}
 }
 
@@ -949,7 +1032,6 @@ static void rxd_handle_data(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 {
 	struct rxd_data_pkt *pkt = (struct rxd_data_pkt *) (pkt_entry->pkt);
 	struct rxd_x_entry *x_entry;
-	struct rxd_unexp_msg *unexp_msg;
 
 	if (pkt_entry->pkt_size < sizeof(*pkt) + ep->rx_prefix_size) {
 		FI_WARN(&rxd_prov, FI_LOG_CQ,
@@ -961,23 +1043,21 @@ static void rxd_handle_data(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 		ep->peers[pkt->base_hdr.peer].rx_seq_no++;
 		if (pkt->base_hdr.type == RXD_DATA &&
 		    ep->peers[pkt->base_hdr.peer].curr_unexp) {
-			unexp_msg = ep->peers[pkt->base_hdr.peer].curr_unexp;
-			dlist_insert_tail(&pkt_entry->d_entry, &unexp_msg->pkt_list);
-			if (pkt->ext_hdr.seg_no + 1 == unexp_msg->sar_hdr->num_segs - 1) {
-				ep->peers[pkt->base_hdr.peer].curr_unexp = NULL;
-				rxd_ep_send_ack(ep, pkt->base_hdr.peer);
-			}
+			rxd_save_unexp_data(ep, pkt_entry);
 			return;
 		}
 		x_entry = rxd_get_data_x_entry(ep, pkt);
 		rxd_ep_recv_data(ep, x_entry, pkt, pkt_entry->pkt_size);
-		if (!dlist_empty(&ep->peers[pkt->base_hdr.peer].buf_pkts))
+		if (ep->peers[pkt->base_hdr.peer].buf_pkts_cnt) {
 			rxd_progress_buf_pkts(ep, pkt->base_hdr.peer);
-	} else if (!rxd_env.retry) {
-		dlist_insert_order(&ep->peers[pkt->base_hdr.peer].buf_pkts,
-				   &rxd_comp_pkt_seq_no, &pkt_entry->d_entry);
+			rxd_ep_send_ack(ep, pkt->base_hdr.peer);
+		}
+	} else if (rxd_buf_pkt(&ep->peers[pkt->base_hdr.peer], pkt_entry)) {
+		if (rxd_env.retry)
+			rxd_ep_send_ack(ep, pkt->base_hdr.peer);
 		return;
-	} else if (ep->peers[pkt->base_hdr.peer].peer_addr != FI_ADDR_UNSPEC) {
+	} else if (rxd_env.retry &&
+		   ep->peers[pkt->base_hdr.peer].peer_addr != FI_ADDR_UNSPEC) {
 		rxd_ep_send_ack(ep, pkt->base_hdr.peer);
 	}
 free:
@@ -999,19 +1079,29 @@ static void rxd_handle_op(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 
 	if (base_hdr->seq_no != ep->peers[base_hdr->peer].rx_seq_no) {
 		if (!rxd_env.retry) {
-			dlist_insert_order(&ep->peers[base_hdr->peer].buf_pkts,
-					   &rxd_comp_pkt_seq_no, &pkt_entry->d_entry);
-			return;
+			if (rxd_buf_pkt(&ep->peers[base_hdr->peer], pkt_entry))
+				return;
+			goto release;
 		}
 
-		if (ep->peers[base_hdr->peer].peer_addr != FI_ADDR_UNSPEC)
+		if (ep->peers[base_hdr->peer].peer_addr == FI_ADDR_UNSPEC)
+			goto release;
+
+		if (!rxd_buf_pkt(&ep->peers[base_hdr->peer], pkt_entry))
 			goto ack;
-		goto release;
+
+		rxd_ep_send_ack(ep, base_hdr->peer);
+		return;
 	}
 
 	if (ep->peers[base_hdr->peer].peer_addr == FI_ADDR_UNSPEC)
 		goto release;
 
+	if (rxd_buf_pkt_kept(&ep->peers[base_hdr->peer])) {
+		rxd_progress_buf_pkts(ep, base_hdr->peer);
+		goto ack;
+	}
+
 	ret = rxd_unpack_init_rx(ep, &rx_entry, pkt_entry, base_hdr, &sar_hdr,
 				 &tag_hdr, &data_hdr, &rma_hdr, &atom_hdr,
 				 &msg, &msg_size);
@@ -1040,7 +1130,7 @@ static void rxd_handle_op(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 	rxd_progress_op(ep, rx_entry, pkt_entry, base_hdr, sar_hdr, tag_hdr,
 			data_hdr, rma_hdr, atom_hdr, &msg, msg_size);
 
-	if (!dlist_empty(&ep->peers[base_hdr->peer].buf_pkts))
+	if (ep->peers[base_hdr->peer].buf_pkts_cnt)
 		rxd_progress_buf_pkts(ep, base_hdr->peer);
 
 ack:
@@ -1062,6 +1152,59 @@ static void rxd_handle_cts(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 	rxd_update_peer(ep, cts->rts_addr, cts->cts_addr);
 }
 
+/*
+ * Selectively acked packets stay on the unacked list until the cumulative
+ * ACK passes them, which keeps the span of outstanding sequence numbers
+ * within the peer's SACK window, but they are no longer retried.  The
+ * flag follows each ACK, so a packet the peer dropped is retried again.
+ * RETX limits the fast resend of a hole to once until the peer reports
+ * it or the retry timer resends it.
+ */
+static void rxd_handle_sack(struct rxd_ep *ep, struct rxd_peer *peer,
+			    struct rxd_ack_pkt *ack)
+{
+	struct rxd_pkt_entry *pkt_entry;
+	uint64_t offset, last_sacked = 0;
+
+	if (!rxd_env.retry)
+		return;
+
+	dlist_foreach_container(&peer->unacked, struct rxd_pkt_entry,
+				pkt_entry, d_entry) {
+		offset = rxd_get_base_hdr(pkt_entry)->seq_no -
+			 ack->base_hdr.seq_no;
+		if (offset >= RXD_SACK_WINDOW)
+			continue;
+
+		if (ack->sack[offset / 64] & (1ULL << (offset % 64))) {
+			pkt_entry->flags |= RXD_PKT_SACKED;
+			pkt_entry->flags &= ~RXD_PKT_RETX;
+			last_sacked = MAX(last_sacked, offset);
+		} else {
+			pkt_entry->flags &= ~RXD_PKT_SACKED;
+		}
+	}
+
+	if (!last_sacked)
+		return;
+
+	/* Packets ahead of one the peer received were most likely lost,
+	 * resend them once instead of waiting for the retry timeout */
+	dlist_foreach_container(&peer->unacked, struct rxd_pkt_entry,
+				pkt_entry, d_entry) {
+		offset = rxd_get_base_hdr(pkt_entry)->seq_no -
+			 ack->base_hdr.seq_no;
+		if (offset >= last_sacked ||
+		    pkt_entry->flags & (RXD_PKT_IN_USE | RXD_PKT_ACKED |
+					RXD_PKT_SACKED | RXD_PKT_RETX))
+			continue;
+
+		if (rxd_ep_send_pkt(ep, pkt_entry))
+			break;
+		pkt_entry->flags |= RXD_PKT_RETX;
+	}
+}
+
 static void rxd_handle_ack(struct rxd_ep *ep, struct rxd_pkt_entry *ack_entry)
 {
 	struct rxd_ack_pkt *ack = (struct rxd_ack_pkt *) (ack_entry->pkt);
@@ -1071,8 +1214,10 @@ static void rxd_handle_ack(struct rxd_ep *ep, struct rxd_pkt_entry *ack_entry)
 
 	ep->peers[peer].tx_window = ack->ext_hdr.rx_id;
 
-	if (ep->peers[peer].last_rx_ack == ack->base_hdr.seq_no)
+	if (ep->peers[peer].last_rx_ack == ack->base_hdr.seq_no) {
+		rxd_handle_sack(ep, &ep->peers[peer], ack);
 		return;
+	}
 
 	ep->peers[peer].last_rx_ack = ack->base_hdr.seq_no;
 
@@ -1101,6 +1246,7 @@ static void rxd_handle_ack(struct rxd_ep *ep, struct rxd_pkt_entry *ack_entry)
 					struct rxd_pkt_entry, d_entry);
 	}
 
+	rxd_handle_sack(ep, &ep->peers[peer], ack);
 	rxd_progress_tx_list(ep, &ep->peers[ack->base_hdr.peer]);
 } 
 
@@ -552,6 +552,24 @@ size_t rxd_init_msg(void **ptr, const struct iovec *iov, size_t iov_count,
 	return done;
 }
 
+static void rxd_ep_init_sack(struct rxd_peer *peer, struct rxd_ack_pkt *ack)
+{
+	struct rxd_pkt_entry *pkt_entry;
+	uint64_t seq;
+	int i;
+
+	memset(ack->sack, 0, sizeof(ack->sack));
+	if (!peer->buf_pkts_cnt)
+		return;
+
+	for (i = 1; i < RXD_SACK_WINDOW; i++) {
+		seq = peer->rx_seq_no + i;
+		pkt_entry = peer->buf_pkts[seq % RXD_SACK_WINDOW];
+		if (pkt_entry && rxd_get_base_hdr(pkt_entry)->seq_no == seq)
+			ack->sack[i / 64] |= 1ULL << (i % 64);
+	}
+}
+
 void rxd_ep_send_ack(struct rxd_ep *rxd_ep, fi_addr_t peer)
 {
 	struct rxd_pkt_entry *pkt_entry;
@@ -572,6 +590,7 @@ void rxd_ep_send_ack(struct rxd_ep *rxd_ep, fi_addr_t peer)
 	ack->base_hdr.peer = rxd_ep->peers[peer].peer_addr;
 	ack->base_hdr.seq_no = rxd_ep->peers[peer].rx_seq_no;
 	ack->ext_hdr.rx_id = rxd_ep->peers[peer].rx_window;
+	rxd_ep_init_sack(&rxd_ep->peers[peer], ack);
 	rxd_ep->peers[peer].last_tx_ack = ack->base_hdr.seq_no;
 
 	dlist_insert_tail(&pkt_entry->d_entry, &rxd_ep->ctrl_pkts);
@@ -598,6 +617,7 @@ static void rxd_close_peer(struct rxd_ep *ep, struct rxd_peer *peer)
 {
 	struct rxd_pkt_entry *pkt_entry;
 	struct rxd_x_entry *x_entry;
+	int i;
 
 	while (!dlist_empty(&peer->unacked)) {
 		dlist_pop_front(&peer->unacked, struct rxd_pkt_entry,
@@ -624,6 +644,14 @@ static void rxd_close_peer(struct rxd_ep *ep, struct rxd_peer *peer)
 		rxd_tx_entry_free(ep, x_entry);
 	}
 
+	for (i = 0; peer->buf_pkts_cnt && i < RXD_SACK_WINDOW; i++) {
+		if (!peer->buf_pkts[i])
+			continue;
+		ofi_buf_free(peer->buf_pkts[i]);
+		peer->buf_pkts[i] = NULL;
+		peer->buf_pkts_cnt--;
+	}
+
 	dlist_remove(&peer->entry);
 	peer->active = 0;
 }
@@ -920,6 +948,9 @@ static void rxd_progress_pkt_list(struct rxd_ep *ep, struct rxd_peer *peer)
 
 	dlist_foreach_container(&peer->unacked, struct rxd_pkt_entry,
 				pkt_entry, d_entry) {
+		/* the peer already holds it, only resend the holes */
+		if (pkt_entry->flags & RXD_PKT_SACKED)
+			continue;
 		if (pkt_entry->flags & (RXD_PKT_IN_USE | RXD_PKT_ACKED) ||
 		    current < rxd_get_retry_time(pkt_entry->timestamp, peer->retry_cnt))
 			break;
@@ -927,6 +958,7 @@ static void rxd_progress_pkt_list(struct rxd_ep *ep, struct rxd_peer *peer)
 		ret = rxd_ep_send_pkt(ep, pkt_entry);
 		if (ret)
 			break;
+		pkt_entry->flags &= ~RXD_PKT_RETX;
 	}
 	if (retry)
 		peer->retry_cnt++;
@@ -1146,13 +1178,15 @@ static void rxd_init_peer(struct rxd_ep *ep, uint64_t rxd_addr)
 	ep->peers[rxd_addr].rx_window = rxd_env.max_unacked;
 	ep->peers[rxd_addr].tx_window = rxd_env.max_unacked;
 	ep->peers[rxd_addr].unacked_cnt = 0;
+	ep->peers[rxd_addr].buf_pkts_cnt = 0;
 	ep->peers[rxd_addr].retry_cnt = 0;
 	ep->peers[rxd_addr].active = 0;
 	dlist_init(&ep->peers[rxd_addr].unacked);
 	dlist_init(&ep->peers[rxd_addr].tx_list);
 	dlist_init(&ep->peers[rxd_addr].rx_list);
 	dlist_init(&ep->peers[rxd_addr].rma_rx_list);
-	dlist_init(&ep->peers[rxd_addr].buf_pkts);
+	memset(ep->peers[rxd_addr].buf_pkts, 0,
+	       sizeof(ep->peers[rxd_addr].buf_pkts));
 }
 
 int rxd_endpoint(struct fid_domain *domain, struct fi_info *info,
@@ -55,6 +55,13 @@ static void rxd_init_env(void)
 	fi_param_get_bool(&rxd_prov, "retry", &rxd_env.retry);
 	fi_param_get_int(&rxd_prov, "max_peers", &rxd_env.max_peers);
 	fi_param_get_int(&rxd_prov, "max_unacked", &rxd_env.max_unacked);
+
+	/* out of order packets are only buffered within the SACK window */
+	if (rxd_env.max_unacked > RXD_SACK_WINDOW) {
+		FI_WARN(&rxd_prov, FI_LOG_CORE,
+			"max_unacked limited to %d\n", RXD_SACK_WINDOW);
+		rxd_env.max_unacked = RXD_SACK_WINDOW;
+	}
 }
 
 void rxd_info_to_core_mr_modes(uint32_t version, const struct fi_info *hints,
@@ -146,7 +153,8 @@ RXD_INI
 	fi_param_define(&rxd_prov, "max_peers", FI_PARAM_INT,
 			"Maximum number of peers to track (default: 1024)");
 	fi_param_define(&rxd_prov, "max_unacked", FI_PARAM_INT,
-			"Maximum number of packets to send at once (default: 128)");
+			"Maximum number of packets to send at once (default: 128,"
+			" max: 256)");
 
 	rxd_init_env();
 
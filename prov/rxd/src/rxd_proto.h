@@ -120,11 +120,18 @@ struct rxd_cts_pkt {
 
 /*
  * ACK: to signal received packets and send tx/rx id info
+ * 	- base_hdr.seq_no: next sequence number expected in order
+ * 	- ext_hdr.rx_id: number of packets the peer may have outstanding
+ * 	- sack: selective ack of packets received out of order, bit i is set
+ * 		if packet base_hdr.seq_no + i was received (bit 0 is never set)
  */
+#define RXD_SACK_WINDOW		256
+#define RXD_SACK_WORDS		(RXD_SACK_WINDOW / 64)
+
 struct rxd_ack_pkt {
 	struct rxd_base_hdr	base_hdr;
 	struct rxd_ext_hdr	ext_hdr;
-	//TODO fill in more fields? Selective ack?
+	uint64_t		sack[RXD_SACK_WORDS];
 };
 
 /*
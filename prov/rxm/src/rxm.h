@@ -51,6 +51,7 @@
 #include <ofi_enosys.h>
 #include <ofi_util.h>
 #include <ofi_list.h>
+#include <ofi_match.h>
 #include <ofi_proto.h>
 #include <ofi_iov.h>
 
@@ -60,17 +61,31 @@
 
 #define RXM_CM_DATA_VERSION	1
 #define RXM_OP_VERSION		3
-#define RXM_CTRL_VERSION	4
+#define RXM_CTRL_VERSION	5
 
 #define RXM_BUF_SIZE	16384
 extern size_t rxm_eager_limit;
+extern size_t rxm_rndv_write_min;
+extern size_t rxm_rx_slab_size;
+
+/* FI_MULTI_RECV buffers posted per MSG endpoint or shared rx context */
+#define RXM_RX_SLAB_SIZE	(256 * 1024)
+#define RXM_RX_SLAB_CNT		4
+
+/* Eager sends up to this size use compact TX buffers */
+#define RXM_SMALL_BUF_SIZE	1024
 
 #define RXM_SAR_LIMIT	131072
+#define RXM_SAR_WINDOW	4
 #define RXM_SAR_TX_ERROR	UINT64_MAX
 #define RXM_SAR_RX_INIT		UINT64_MAX
 
 #define RXM_IOV_LIMIT 4
 
+/* Bounds of the number of MSG provider CQ entries read per fi_cq_read */
+#define RXM_MSG_CQ_BATCH_MIN	4
+#define RXM_MSG_CQ_BATCH_MAX	64
+
 #define RXM_MR_MODES	(OFI_MR_BASIC_MAP | FI_MR_LOCAL)
 
 #define RXM_PASSTHRU_TX_OP_FLAGS (FI_TRANSMIT_COMPLETE)
@@ -129,6 +144,7 @@ extern size_t rxm_msg_rx_size;
 extern size_t rxm_cm_progress_interval;
 extern size_t rxm_cq_eq_fairness;
 extern int force_auto_progress;
+extern int rxm_use_shm;
 extern enum fi_wait_obj def_wait_obj, def_tcp_wait_obj;
 
 struct rxm_ep;
@@ -183,7 +199,7 @@ struct rxm_cmap_handle {
 
 struct rxm_cmap_peer {
 	struct rxm_cmap_handle *handle;
-	struct dlist_entry entry;
+	UT_hash_handle hh;
 	uint8_t addr[];
 };
 
@@ -205,7 +221,8 @@ struct rxm_cmap {
 
 	struct ofi_key_idx	key_idx;
 
-	struct dlist_entry	peer_list;
+	/* Handles for peers not in the AV, hashed on address like util_av */
+	struct rxm_cmap_peer	*peers;
 	struct rxm_cmap_attr	attr;
 	pthread_t		cm_thread;
 	ofi_fastlock_acquire_t	acquire;
@@ -219,6 +236,9 @@ enum rxm_cmap_reject_reason {
 	RXM_CMAP_REJECT_SIMULT_CONN,
 };
 
+/* Set in connect/accept flags when the peer is reachable through shm */
+#define RXM_CM_FLAG_SHM		(1 << 0)
+
 union rxm_cm_data {
 	struct _connect {
 		uint8_t version;
@@ -226,7 +246,8 @@ union rxm_cm_data {
 		uint8_t ctrl_version;
 		uint8_t op_version;
 		uint16_t port;
-		uint8_t padding[2];
+		uint8_t flags;
+		uint8_t padding;
 		uint32_t eager_size;
 		uint32_t rx_size;
 		uint64_t client_conn_id;
@@ -235,6 +256,7 @@ union rxm_cm_data {
 	struct _accept {
 		uint64_t server_conn_id;
 		uint32_t rx_size;
+		uint8_t flags;
 	} accept;
 
 	struct _reject {
@@ -278,6 +300,11 @@ struct rxm_domain {
 	uint64_t mr_key;
 	uint8_t mr_local;
 	struct ofi_ops_flow_ctrl *flow_ctrl_ops;
+
+	/* Optional shm domain used to reach peers on the same node */
+	struct fi_info *shm_info;
+	struct fid_fabric *shm_fabric;
+	struct fid_domain *shm_domain;
 };
 
 int rxm_av_open(struct fid_domain *domain_fid, struct fi_av_attr *attr,
@@ -286,6 +313,7 @@ int rxm_av_open(struct fid_domain *domain_fid, struct fi_av_attr *attr,
 struct rxm_mr {
 	struct fid_mr mr_fid;
 	struct fid_mr *msg_mr;
+	struct fid_mr *shm_mr;
 	struct rxm_domain *domain;
 };
 
@@ -332,6 +360,7 @@ struct rxm_atomic_resp_hdr {
 	FUNC(RXM_INJECT_TX),		\
 	FUNC(RXM_RMA),			\
 	FUNC(RXM_RX),			\
+	FUNC(RXM_RX_SLAB),		\
 	FUNC(RXM_SAR_TX),		\
 	FUNC(RXM_CREDIT_TX),		\
 	FUNC(RXM_RNDV_TX),		\
@@ -340,6 +369,13 @@ struct rxm_atomic_resp_hdr {
 	FUNC(RXM_RNDV_ACK_SENT),	\
 	FUNC(RXM_RNDV_ACK_RECVD),	\
 	FUNC(RXM_RNDV_FINISH),		\
+	FUNC(RXM_RNDV_CTS_WAIT),	\
+	FUNC(RXM_RNDV_CTS_RECVD),	\
+	FUNC(RXM_RNDV_WRITE),		\
+	FUNC(RXM_RNDV_DONE_SENT),	\
+	FUNC(RXM_RNDV_CTS_SENT),	\
+	FUNC(RXM_RNDV_DONE_WAIT),	\
+	FUNC(RXM_RNDV_DONE_RECVD),	\
 	FUNC(RXM_ATOMIC_RESP_WAIT),	\
 	FUNC(RXM_ATOMIC_RESP_SENT)
 
@@ -356,7 +392,10 @@ enum {
 	rxm_ctrl_rndv_ack,
 	rxm_ctrl_atomic,
 	rxm_ctrl_atomic_resp,
-	rxm_ctrl_credit
+	rxm_ctrl_credit,
+	rxm_ctrl_rndv_wr,
+	rxm_ctrl_rndv_cts,
+	rxm_ctrl_rndv_done,
 };
 
 struct rxm_pkt {
@@ -396,6 +435,8 @@ struct rxm_recv_match_attr {
 };
 
 struct rxm_unexp_msg {
+	struct ofi_match_entry match;
+	/* Used for deferred SAR segments with FI_BUFFERED_RECV */
 	struct dlist_entry entry;
 	fi_addr_t addr;
 	uint64_t tag;
@@ -410,8 +451,10 @@ struct rxm_iov {
 enum rxm_buf_pool_type {
 	RXM_BUF_POOL_RX		= 0,
 	RXM_BUF_POOL_START	= RXM_BUF_POOL_RX,
+	RXM_BUF_POOL_RX_SLAB,
 	RXM_BUF_POOL_TX,
 	RXM_BUF_POOL_TX_START	= RXM_BUF_POOL_TX,
+	RXM_BUF_POOL_TX_SMALL,
 	RXM_BUF_POOL_TX_INJECT,
 	RXM_BUF_POOL_TX_ACK,
 	RXM_BUF_POOL_TX_RNDV,
@@ -458,6 +501,25 @@ struct rxm_rx_buf {
 	struct rxm_pkt pkt;
 };
 
+/*
+ * Posted with FI_MULTI_RECV when the MSG provider supports it, in place of
+ * rx_attr->size rx bufs.  Each packet that lands in the slab is copied out
+ * into an rx buf, so posted receive memory follows the bytes in flight
+ * rather than the number of messages.
+ */
+struct rxm_rx_slab {
+	/* Must stay at top */
+	struct rxm_buf hdr;
+
+	struct rxm_ep *ep;
+	struct fid_ep *msg_ep;
+	struct rxm_conn *conn;
+	struct dlist_entry repost_entry;
+
+	/* Must stay at bottom */
+	uint8_t data[];
+};
+
 struct rxm_tx_base_buf {
 	/* Must stay at top */
 	struct rxm_buf hdr;
@@ -484,6 +546,19 @@ struct rxm_tx_sar_buf {
 	void *app_context;
 	uint64_t flags;
 
+	/* Send state of the message, kept in its first segment which lives
+	 * until every segment completed, see rxm_ep_sar_tx_window */
+	struct {
+		struct rxm_conn *conn;
+		struct iovec iov[RXM_IOV_LIMIT];
+		uint8_t count;
+		size_t iov_offset;
+		size_t next_seg_no;
+		size_t segs_cnt;
+		size_t inflight;
+		bool failed;
+	} sar;
+
 	/* Must stay at bottom */
 	struct rxm_pkt pkt;
 };
@@ -495,8 +570,23 @@ struct rxm_tx_rndv_buf {
 	void *app_context;
 	uint64_t flags;
 	struct fid_mr *mr[RXM_IOV_LIMIT];
+	/* Registrations of mr with shm, for local peers */
+	struct fid_mr *shm_mr[RXM_IOV_LIMIT];
 	uint8_t count;
 
+	/* Used for the write-based protocol */
+	struct {
+		struct rxm_conn *conn;
+		struct rxm_iov iov;
+		/* Receive buffers advertised by the peer's CTS */
+		struct rxm_rndv_hdr remote;
+		uint64_t remote_id;
+		size_t rma_index;
+		/* First write that failed to post, reported once the
+		 * writes already posted drained */
+		int err;
+	} write;
+
 	/* Must stay at bottom */
 	struct rxm_pkt pkt;
 };
@@ -532,6 +622,9 @@ struct rxm_tx_atomic_buf {
 enum rxm_deferred_tx_entry_type {
 	RXM_DEFERRED_TX_RNDV_ACK,
 	RXM_DEFERRED_TX_RNDV_READ,
+	RXM_DEFERRED_TX_RNDV_CTS,
+	RXM_DEFERRED_TX_RNDV_WRITE,
+	RXM_DEFERRED_TX_RNDV_DONE,
 	RXM_DEFERRED_TX_SAR_SEG,
 	RXM_DEFERRED_TX_ATOMIC_RESP,
 	RXM_DEFERRED_TX_CREDIT_SEND,
@@ -553,22 +646,18 @@ struct rxm_deferred_tx_entry {
 			struct rxm_iov rxm_iov;
 		} rndv_read;
 		struct {
-			struct rxm_tx_sar_buf *cur_seg_tx_buf;
-			struct {
-				struct iovec iov[RXM_IOV_LIMIT];
-				uint8_t count;
-				size_t cur_iov_offset;
-				uint64_t data;
-				uint64_t tag;
-			} payload;
-			size_t next_seg_no;
-			size_t segs_cnt;
-			uint8_t op;
-			size_t total_len;
-			size_t remain_len;
-			uint64_t msg_id;
-			void *app_context;
-			uint64_t flags;
+			struct rxm_rx_buf *rx_buf;
+		} rndv_cts;
+		struct {
+			struct rxm_tx_rndv_buf *tx_buf;
+			struct fi_rma_iov rma_iov;
+			struct rxm_iov rxm_iov;
+		} rndv_write;
+		struct {
+			struct rxm_tx_rndv_buf *tx_buf;
+		} rndv_done;
+		struct {
+			struct rxm_tx_sar_buf *first_tx_buf;
 		} sar_seg;
 		struct {
 			struct rxm_tx_atomic_buf *tx_buf;
@@ -581,7 +670,7 @@ struct rxm_deferred_tx_entry {
 };
 
 struct rxm_recv_entry {
-	struct dlist_entry entry;
+	struct ofi_match_entry match;
 	struct rxm_iov rxm_iov;
 	fi_addr_t addr;
 	void *context;
@@ -601,7 +690,7 @@ struct rxm_recv_entry {
 	} sar;
 	/* Used for Rendezvous protocol */
 	struct {
-		/* This is used to send RNDV ACK */
+		/* This is used to send RNDV ACK or CTS */
 		struct rxm_tx_base_buf *tx_buf;
 	} rndv;
 };
@@ -617,12 +706,33 @@ struct rxm_recv_queue {
 	struct rxm_ep *rxm_ep;
 	enum rxm_recv_queue_type type;
 	struct rxm_recv_fs *fs;
-	struct dlist_entry recv_list;
-	struct dlist_entry unexp_msg_list;
-	dlist_func_t *match_recv;
-	dlist_func_t *match_unexp;
+	struct ofi_match_queue posted;
+	struct ofi_match_queue unexp;
+	bool directed;
 };
 
+/*
+ * Match keys.  Without FI_DIRECTED_RECV the source takes no part in
+ * matching, so every entry uses the same address and lookups by tag stay
+ * hashed.  Messages from peers that are not in the AV yet get a key that
+ * only FI_ADDR_UNSPEC receives match until the connection is resolved.
+ */
+#define RXM_MATCH_ADDR_UNKNOWN	(FI_ADDR_NOTAVAIL - 1)
+
+static inline fi_addr_t
+rxm_match_recv_addr(struct rxm_recv_queue *queue, fi_addr_t addr)
+{
+	return queue->directed ? addr : 0;
+}
+
+static inline fi_addr_t
+rxm_match_msg_addr(struct rxm_recv_queue *queue, fi_addr_t addr)
+{
+	if (!queue->directed)
+		return 0;
+	return addr == FI_ADDR_NOTAVAIL ? RXM_MATCH_ADDR_UNKNOWN : addr;
+}
+
 struct rxm_buf_pool {
 	enum rxm_buf_pool_type type;
 	struct ofi_bufpool *pool;
@@ -661,6 +771,8 @@ struct rxm_ep {
 	uint64_t		msg_cq_last_poll;
 	struct fid_ep 		*srx_ctx;
 	size_t 			comp_per_progress;
+	size_t			msg_cq_batch;
+	bool			msg_cq_dispatch;
 	ofi_atomic32_t		atomic_tx_credits;
 	int			cq_eq_fairness;
 
@@ -674,16 +786,27 @@ struct rxm_ep {
 	size_t			inject_limit;
 	size_t			eager_limit;
 	size_t			sar_limit;
+	size_t			sar_window;
+	size_t			rndv_write_min;
+	/* 0 when rx bufs are posted instead of slabs */
+	size_t			rx_slab_size;
 
 	struct rxm_buf_pool	*buf_pools;
 
 	struct dlist_entry	repost_ready_list;
+	struct dlist_entry	slab_repost_list;
 	struct dlist_entry	deferred_tx_conn_queue;
 
 	struct rxm_recv_queue	recv_queue;
 	struct rxm_recv_queue	trecv_queue;
 
 	struct rxm_eager_ops	*eager_ops;
+
+	/* Secondary shm endpoint for peers on the same node */
+	struct fid_ep		*shm_ep;
+	struct fid_av		*shm_av;
+	struct fid_cq		*shm_cq;
+	size_t			shm_cq_batch;
 };
 
 struct rxm_conn {
@@ -692,6 +815,12 @@ struct rxm_conn {
 
 	struct fid_ep *msg_ep;
 
+	/* Endpoint and address data is sent on: msg_ep, or shm_ep once
+	 * both sides agreed on shm while connecting */
+	struct fid_ep *tx_ep;
+	fi_addr_t tx_addr;
+	fi_addr_t shm_addr;
+
 	/* This is used only in non-FI_THREAD_SAFE case */
 	struct rxm_pkt *inject_pkt;
 	struct rxm_pkt *inject_data_pkt;
@@ -703,6 +832,10 @@ struct rxm_conn {
 	struct dlist_entry sar_rx_msg_list;
 	struct dlist_entry sar_deferred_rx_msg_list;
 
+	/* SAR messages with segments left to post, later transfers on the
+	 * conn wait for them so that they cannot overtake the segments */
+	size_t sar_tx_unposted;
+
 	uint32_t rndv_tx_credits;
 };
 
@@ -731,7 +864,7 @@ int rxm_conn_cmap_alloc(struct rxm_ep *rxm_ep);
 void rxm_cq_write_error(struct util_cq *cq, struct util_cntr *cntr,
 			void *op_context, int err);
 void rxm_cq_write_error_all(struct rxm_ep *rxm_ep, int err);
-void rxm_handle_comp_error(struct rxm_ep *rxm_ep);
+void rxm_handle_comp_error(struct rxm_ep *rxm_ep, struct fid_cq *msg_cq);
 ssize_t rxm_handle_comp(struct rxm_ep *rxm_ep, struct fi_cq_data_entry *comp);
 void rxm_ep_progress(struct util_ep *util_ep);
 void rxm_ep_progress_coll(struct util_ep *util_ep);
@@ -740,9 +873,30 @@ void rxm_ep_do_progress(struct util_ep *util_ep);
 ssize_t rxm_handle_eager(struct rxm_rx_buf *rx_buf);
 ssize_t rxm_handle_coll_eager(struct rxm_rx_buf *rx_buf);
 int rxm_finish_eager_send(struct rxm_ep *rxm_ep, struct rxm_tx_eager_buf *tx_eager_buf);
+int rxm_cq_write_tx_comp(struct rxm_ep *rxm_ep, uint64_t comp_flags,
+			 void *app_context, uint64_t flags);
 int rxm_finish_coll_eager_send(struct rxm_ep *rxm_ep, struct rxm_tx_eager_buf *tx_eager_buf);
+void rxm_rndv_hdr_init(struct rxm_ep *rxm_ep, void *buf,
+		       const struct iovec *iov, size_t count,
+		       struct fid_mr **mr);
 
 int rxm_msg_ep_prepost_recv(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep);
+int rxm_msg_ep_recv(struct rxm_rx_buf *rx_buf);
+
+int rxm_shm_domain_open(struct rxm_domain *rxm_domain, struct fi_info *info);
+void rxm_shm_domain_close(struct rxm_domain *rxm_domain);
+int rxm_shm_mr_reg(struct rxm_mr *rxm_mr, const struct fi_mr_attr *attr,
+		   uint64_t flags);
+int rxm_shm_mr_regv(struct rxm_ep *rxm_ep, const struct iovec *iov,
+		    size_t count, struct fid_mr **msg_mr,
+		    struct fid_mr **shm_mr);
+int rxm_ep_shm_open(struct rxm_ep *rxm_ep);
+void rxm_ep_shm_close(struct rxm_ep *rxm_ep);
+int rxm_ep_shm_prepost_recv(struct rxm_ep *rxm_ep);
+fi_addr_t rxm_shm_av_insert(struct rxm_ep *rxm_ep, const void *addr);
+bool rxm_shm_peer_lookup(struct rxm_ep *rxm_ep, fi_addr_t shm_addr,
+			 const void *addr);
+void rxm_conn_use_shm(struct rxm_conn *rxm_conn);
 
 int rxm_ep_query_atomic(struct fid_domain *domain, enum fi_datatype datatype,
 			enum fi_op op, struct fi_atomic_attr *attr,
@@ -770,10 +924,11 @@ rxm_atomic_send_respmsg(struct rxm_ep *rxm_ep, struct rxm_conn *conn,
 		.msg_iov = &iov,
 		.desc = &resp_buf->hdr.desc,
 		.iov_count = 1,
+		.addr = conn->tx_addr,
 		.context = resp_buf,
 		.data = 0,
 	};
-	return fi_sendmsg(conn->msg_ep, &msg, FI_COMPLETION);
+	return fi_sendmsg(conn->tx_ep, &msg, FI_COMPLETION);
 }
 
 static inline int rxm_needs_atomic_progress(const struct fi_info *info)
@@ -782,6 +937,12 @@ static inline int rxm_needs_atomic_progress(const struct fi_info *info)
 			info->domain_attr->data_progress == FI_PROGRESS_AUTO;
 }
 
+static inline bool rxm_conn_is_shm(struct rxm_ep *rxm_ep,
+				   struct rxm_conn *rxm_conn)
+{
+	return rxm_ep->shm_ep && rxm_conn->tx_ep == rxm_ep->shm_ep;
+}
+
 static inline struct rxm_conn *rxm_key2conn(struct rxm_ep *rxm_ep, uint64_t key)
 {
 	return (struct rxm_conn *)rxm_cmap_key2handle(rxm_ep->cmap, key);
@@ -789,10 +950,27 @@ static inline struct rxm_conn *rxm_key2conn(struct rxm_ep *rxm_ep, uint64_t key)
 
 void rxm_ep_progress_deferred_queue(struct rxm_ep *rxm_ep,
 				    struct rxm_conn *rxm_conn);
+struct rxm_tx_base_buf *rxm_rndv_cts_alloc(struct rxm_rx_buf *rx_buf);
+void rxm_rndv_write_abort(struct rxm_ep *rxm_ep,
+			  struct rxm_tx_rndv_buf *tx_buf,
+			  size_t write_cnt, int err);
 
 struct rxm_deferred_tx_entry *
 rxm_ep_alloc_deferred_tx_entry(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 			       enum rxm_deferred_tx_entry_type type);
+ssize_t rxm_ep_sar_tx_progress(struct rxm_ep *rxm_ep,
+			       struct rxm_tx_sar_buf *first_tx_buf);
+
+/* A failed SAR message posts no more segments, release its conn */
+static inline void rxm_ep_sar_tx_fail(struct rxm_tx_sar_buf *first_tx_buf)
+{
+	if (!first_tx_buf->sar.failed &&
+	    first_tx_buf->sar.next_seg_no < first_tx_buf->sar.segs_cnt) {
+		assert(first_tx_buf->sar.conn->sar_tx_unposted);
+		first_tx_buf->sar.conn->sar_tx_unposted--;
+	}
+	first_tx_buf->sar.failed = true;
+}
 
 static inline void
 rxm_ep_enqueue_deferred_tx_queue(struct rxm_deferred_tx_entry *tx_entry)
@@ -857,9 +1035,11 @@ rxm_ep_prepare_tx(struct rxm_ep *rxm_ep, fi_addr_t dest_addr,
 			return ret;
 	}
 
-	if (OFI_UNLIKELY(!dlist_empty(&(*rxm_conn)->deferred_tx_queue))) {
+	if (OFI_UNLIKELY(!dlist_empty(&(*rxm_conn)->deferred_tx_queue) ||
+			 (*rxm_conn)->sar_tx_unposted)) {
 		rxm_ep_do_progress(&rxm_ep->util_ep);
-		if (!dlist_empty(&(*rxm_conn)->deferred_tx_queue))
+		if (!dlist_empty(&(*rxm_conn)->deferred_tx_queue) ||
+		    (*rxm_conn)->sar_tx_unposted)
 			return -FI_EAGAIN;
 	}
 	return 0;
@@ -883,6 +1063,7 @@ static inline void *
 rxm_tx_buf_alloc(struct rxm_ep *rxm_ep, enum rxm_buf_pool_type type)
 {
 	assert((type == RXM_BUF_POOL_TX) ||
+	       (type == RXM_BUF_POOL_TX_SMALL) ||
 	       (type == RXM_BUF_POOL_TX_INJECT) ||
 	       (type == RXM_BUF_POOL_TX_ACK) ||
 	       (type == RXM_BUF_POOL_TX_RNDV) ||
@@ -904,7 +1085,11 @@ rxm_rx_buf_alloc(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep, uint8_t repost)
 		rx_buf->msg_ep = msg_ep;
 		rx_buf->repost = repost;
 
-		if (!rxm_ep->srx_ctx)
+		/* Packets received on the shared rx context or on the shm
+		 * endpoint are matched to their conn by the conn_id */
+		if (rxm_ep->srx_ctx || msg_ep == rxm_ep->shm_ep)
+			rx_buf->conn = NULL;
+		else
 			rx_buf->conn = container_of(msg_ep->fid.context,
 						    struct rxm_conn, handle);
 	}
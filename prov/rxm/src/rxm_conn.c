@@ -143,12 +143,15 @@ static void rxm_cmap_init_handle(struct rxm_cmap_handle *handle,
 	handle->peer = peer;
 }
 
-static int rxm_cmap_match_peer(struct dlist_entry *entry, const void *addr)
+static void rxm_cmap_add_peer(struct rxm_cmap *cmap, struct rxm_cmap_peer *peer)
 {
-	struct rxm_cmap_peer *peer;
+	HASH_ADD(hh, cmap->peers, addr, cmap->av->addrlen, peer);
+}
 
-	peer = container_of(entry, struct rxm_cmap_peer, entry);
-	return !memcmp(peer->addr, addr, peer->handle->cmap->av->addrlen);
+static void rxm_cmap_del_peer(struct rxm_cmap *cmap, struct rxm_cmap_peer *peer)
+{
+	HASH_DELETE(hh, cmap->peers, peer);
+	free(peer);
 }
 
 static int rxm_cmap_del_handle(struct rxm_cmap_handle *handle)
@@ -298,6 +301,7 @@ static void rxm_conn_close(struct rxm_cmap_handle *handle)
 		FI_WARN(&rxm_prov, FI_LOG_EP_CTRL, "unable to close msg_ep\n");
 
 	rxm_conn->msg_ep = NULL;
+	rxm_conn->tx_ep = NULL;
 }
 
 static void rxm_conn_free(struct rxm_cmap_handle *handle)
@@ -349,10 +353,10 @@ static int rxm_cmap_alloc_handle_peer(struct rxm_cmap *cmap, void *addr,
 			addr);
 	FI_DBG(cmap->av->prov, FI_LOG_EP_CTRL, "handle: %p\n", *handle);
 	rxm_cmap_init_handle(*handle, cmap, state, FI_ADDR_NOTAVAIL, peer);
-	FI_DBG(cmap->av->prov, FI_LOG_EP_CTRL, "Adding handle to peer list\n");
+	FI_DBG(cmap->av->prov, FI_LOG_EP_CTRL, "Adding handle to peer table\n");
 	peer->handle = *handle;
 	memcpy(peer->addr, addr, cmap->av->addrlen);
-	dlist_insert_tail(&peer->entry, &cmap->peer_list);
+	rxm_cmap_add_peer(cmap, peer);
 	return 0;
 }
 
@@ -360,15 +364,12 @@ static struct rxm_cmap_handle *
 rxm_cmap_get_handle_peer(struct rxm_cmap *cmap, const void *addr)
 {
 	struct rxm_cmap_peer *peer;
-	struct dlist_entry *entry;
 
-	entry = dlist_find_first_match(&cmap->peer_list, rxm_cmap_match_peer,
-				       addr);
-	if (!entry)
+	HASH_FIND(hh, cmap->peers, addr, cmap->av->addrlen, peer);
+	if (!peer)
 		return NULL;
 	ofi_straddr_dbg(cmap->av->prov, FI_LOG_AV,
-			"handle found in peer list for addr", addr);
-	peer = container_of(entry, struct rxm_cmap_peer, entry);
+			"handle found in peer table for addr", addr);
 	return peer->handle;
 }
 
@@ -387,7 +388,7 @@ int rxm_cmap_remove(struct rxm_cmap *cmap, int index)
 	if (!handle->peer) {
 		ret = -FI_ENOMEM;
 		FI_WARN(&rxm_prov, FI_LOG_EP_CTRL, "unable to allocate memory "
-			"for moving handle to peer list, deleting it instead\n");
+			"for moving handle to peer table, deleting it instead\n");
 		rxm_cmap_del_handle(handle);
 		return ret;
 	}
@@ -396,7 +397,7 @@ int rxm_cmap_remove(struct rxm_cmap *cmap, int index)
 	handle->peer->handle = handle;
 	memcpy(handle->peer->addr, ofi_av_get_addr(cmap->av, index),
 	       cmap->av->addrlen);
-	dlist_insert_tail(&handle->peer->entry, &cmap->peer_list);
+	rxm_cmap_add_peer(cmap, handle->peer);
 	return 0;
 }
 
@@ -405,8 +406,7 @@ static int rxm_cmap_move_handle(struct rxm_cmap_handle *handle,
 {
 	int ret;
 
-	dlist_remove(&handle->peer->entry);
-	free(handle->peer);
+	rxm_cmap_del_peer(handle->cmap, handle->peer);
 	handle->peer = NULL;
 	handle->fi_addr = fi_addr;
 	ret = rxm_cmap_check_and_realloc_handles_table(handle->cmap, fi_addr);
@@ -416,6 +416,15 @@ static int rxm_cmap_move_handle(struct rxm_cmap_handle *handle,
 	return 0;
 }
 
+static void rxm_conn_shm_insert(struct rxm_cmap_handle *handle,
+				const void *addr)
+{
+	struct rxm_conn *rxm_conn = container_of(handle, struct rxm_conn, handle);
+
+	if (rxm_conn->shm_addr == FI_ADDR_NOTAVAIL)
+		rxm_conn->shm_addr = rxm_shm_av_insert(handle->cmap->ep, addr);
+}
+
 int rxm_cmap_update(struct rxm_cmap *cmap, const void *addr, fi_addr_t fi_addr)
 {
 	struct rxm_cmap_handle *handle;
@@ -434,12 +443,16 @@ int rxm_cmap_update(struct rxm_cmap *cmap, const void *addr, fi_addr_t fi_addr)
 	if (!handle) {
 		ret = rxm_cmap_alloc_handle(cmap, fi_addr,
 					    RXM_CMAP_IDLE, &handle);
-		return ret;
+		if (ret)
+			return ret;
+		rxm_conn_shm_insert(handle, addr);
+		return 0;
 	}
 	ret = rxm_cmap_move_handle(handle, fi_addr);
 	if (ret)
 		return ret;
 
+	rxm_conn_shm_insert(handle, addr);
 	rxm_conn_av_updated_handler(handle);
 	return 0;
 }
@@ -472,6 +485,9 @@ void rxm_cmap_process_connect(struct rxm_cmap *cmap,
 		assert(handle->state == RXM_CMAP_CONNREQ_SENT);
 		handle->remote_key = cm_data->accept.server_conn_id;
 		rxm_conn->rndv_tx_credits = cm_data->accept.rx_size;
+		if ((cm_data->accept.flags & RXM_CM_FLAG_SHM) &&
+		    rxm_conn->shm_addr != FI_ADDR_NOTAVAIL)
+			rxm_conn_use_shm(rxm_conn);
 	} else {
 		assert(handle->state == RXM_CMAP_CONNREQ_RECV);
 	}
@@ -698,8 +714,7 @@ static int rxm_cmap_cm_thread_close(struct rxm_cmap *cmap)
 
 void rxm_cmap_free(struct rxm_cmap *cmap)
 {
-	struct rxm_cmap_peer *peer;
-	struct dlist_entry *entry;
+	struct rxm_cmap_peer *peer, *tmp;
 	size_t i;
 
 	FI_INFO(cmap->av->prov, FI_LOG_EP_CTRL, "Closing cmap\n");
@@ -713,13 +728,10 @@ void rxm_cmap_free(struct rxm_cmap *cmap)
 		}
 	}
 
-	while(!dlist_empty(&cmap->peer_list)) {
-		entry = cmap->peer_list.next;
-		peer = container_of(entry, struct rxm_cmap_peer, entry);
-		dlist_remove(&peer->entry);
+	HASH_ITER(hh, cmap->peers, peer, tmp) {
 		rxm_cmap_clear_key(peer->handle);
 		rxm_conn_free(peer->handle);
-		free(peer);
+		rxm_cmap_del_peer(cmap, peer);
 	}
 
 	free(cmap->handles_av);
@@ -771,7 +783,7 @@ int rxm_cmap_alloc(struct rxm_ep *rxm_ep, struct rxm_cmap_attr *attr)
 	memset(&cmap->handles_idx, 0, sizeof(cmap->handles_idx));
 	ofi_key_idx_init(&cmap->key_idx, RXM_CMAP_IDX_BITS);
 
-	dlist_init(&cmap->peer_list);
+	cmap->peers = NULL;
 
 	rxm_ep->cmap = cmap;
 
@@ -863,6 +875,8 @@ static int rxm_msg_ep_open(struct rxm_ep *rxm_ep, struct fi_info *msg_info,
 	}
 
 	rxm_conn->msg_ep = msg_ep;
+	rxm_conn->tx_ep = msg_ep;
+	rxm_conn->tx_addr = 0;
 
 	if (!rxm_ep->srx_ctx) {
 		ret = rxm_msg_ep_prepost_recv(rxm_ep, msg_ep);
@@ -878,32 +892,36 @@ err:
 static int rxm_conn_reprocess_directed_recvs(struct rxm_recv_queue *recv_queue)
 {
 	struct rxm_rx_buf *rx_buf;
-	struct dlist_entry *entry, *tmp_entry;
-	struct rxm_recv_match_attr match_attr;
+	struct dlist_entry *tmp_entry;
+	struct ofi_match_entry *match;
 	struct fi_cq_err_entry err_entry = {0};
 	int ret, count = 0;
 
-	dlist_foreach_container_safe(&recv_queue->unexp_msg_list,
+	dlist_foreach_container_safe(&recv_queue->unexp.list,
 				     struct rxm_rx_buf, rx_buf,
-				     unexp_msg.entry, tmp_entry) {
+				     unexp_msg.match.entry, tmp_entry) {
 		if (rx_buf->unexp_msg.addr == rx_buf->conn->handle.fi_addr)
 			continue;
 
 		assert(rx_buf->unexp_msg.addr == FI_ADDR_NOTAVAIL);
 
 		rx_buf->unexp_msg.addr = rx_buf->conn->handle.fi_addr;
-		match_attr.addr = rx_buf->unexp_msg.addr;
-		match_attr.tag = rx_buf->unexp_msg.tag;
-
-		entry = dlist_remove_first_match(&recv_queue->recv_list,
-						 recv_queue->match_recv,
-						 &match_attr);
-		if (!entry)
+		rx_buf->unexp_msg.match.addr =
+			rxm_match_msg_addr(recv_queue, rx_buf->unexp_msg.addr);
+
+		match = ofi_match_queue_remove_first(&recv_queue->posted,
+						     rx_buf->unexp_msg.match.addr,
+						     rx_buf->unexp_msg.tag, 0);
+		if (!match) {
+			ofi_match_queue_update(&recv_queue->unexp,
+					       &rx_buf->unexp_msg.match);
 			continue;
+		}
 
-		dlist_remove(&rx_buf->unexp_msg.entry);
-		rx_buf->recv_entry = container_of(entry, struct rxm_recv_entry,
-						  entry);
+		ofi_match_queue_remove(&recv_queue->unexp,
+				       &rx_buf->unexp_msg.match);
+		rx_buf->recv_entry = container_of(match, struct rxm_recv_entry,
+						  match);
 
 		ret = rxm_handle_rx_buf(rx_buf);
 		if (ret) {
@@ -956,6 +974,7 @@ static struct rxm_cmap_handle *rxm_conn_alloc(struct rxm_cmap *cmap)
 		free(rxm_conn);
 		return NULL;
 	}
+	rxm_conn->shm_addr = FI_ADDR_NOTAVAIL;
 
 	return &rxm_conn->handle;
 }
@@ -1073,6 +1092,14 @@ rxm_msg_process_connreq(struct rxm_ep *rxm_ep, struct fi_info *msg_info,
 	cm_data.accept.server_conn_id = rxm_conn->handle.key;
 	cm_data.accept.rx_size = rxm_conn_get_rx_size(rxm_ep, msg_info);
 
+	/* The peer reaches us through shm, make sure we can reach it back */
+	if (remote_cm_data->connect.flags & RXM_CM_FLAG_SHM) {
+		rxm_conn_shm_insert(handle, &remote_pep_addr);
+		if (rxm_shm_peer_lookup(rxm_ep, rxm_conn->shm_addr,
+					&remote_pep_addr))
+			cm_data.accept.flags = RXM_CM_FLAG_SHM;
+	}
+
 	ret = fi_accept(rxm_conn->msg_ep, &cm_data.accept.server_conn_id,
 			sizeof(cm_data.accept));
 	if (ret) {
@@ -1081,6 +1108,9 @@ rxm_msg_process_connreq(struct rxm_ep *rxm_ep, struct fi_info *msg_info,
 		goto err2;
 	}
 
+	if (cm_data.accept.flags & RXM_CM_FLAG_SHM)
+		rxm_conn_use_shm(rxm_conn);
+
 	return ret;
 err2:
 	rxm_cmap_del_handle(&rxm_conn->handle);
@@ -1107,7 +1137,7 @@ static void rxm_flush_msg_cq(struct rxm_ep *rxm_ep)
 				ret = 1;
 			}
 		} else if (ret == -FI_EAVAIL) {
-			rxm_handle_comp_error(rxm_ep);
+			rxm_handle_comp_error(rxm_ep, rxm_ep->msg_cq);
 			ret = 1;
 		} else if (ret < 0 && ret != -FI_EAGAIN) {
 			rxm_cq_write_error_all(rxm_ep, ret);
@@ -1140,8 +1170,7 @@ static int rxm_conn_handle_notify(struct fi_eq_entry *eq_entry)
 	rxm_flush_msg_cq(cmap->ep);
 
 	if (handle->peer) {
-		dlist_remove(&handle->peer->entry);
-		free(handle->peer);
+		rxm_cmap_del_peer(cmap, handle->peer);
 		handle->peer = NULL;
 	} else {
 		cmap->handles_av[handle->fi_addr] = 0;
@@ -1473,6 +1502,8 @@ rxm_conn_connect(struct rxm_ep *ep, struct rxm_cmap_handle *handle,
 		goto err;
 
 	cm_data.connect.rx_size = rxm_conn_get_rx_size(ep, ep->msg_info);
+	if (rxm_conn->shm_addr != FI_ADDR_NOTAVAIL)
+		cm_data.connect.flags = RXM_CM_FLAG_SHM;
 
 	ret = fi_connect(rxm_conn->msg_ep, ep->msg_info->dest_addr,
 			 &cm_data, sizeof(cm_data));
@@ -95,7 +95,8 @@ static int rxm_finish_buf_recv(struct rxm_rx_buf *rx_buf)
 	if (rx_buf->pkt.ctrl_hdr.type != rxm_ctrl_eager)
 		flags |= FI_MORE;
 
-	if (rx_buf->pkt.ctrl_hdr.type == rxm_ctrl_rndv)
+	if (rx_buf->pkt.ctrl_hdr.type == rxm_ctrl_rndv ||
+	    rx_buf->pkt.ctrl_hdr.type == rxm_ctrl_rndv_wr)
 		data = rxm_pkt_rndv_data(&rx_buf->pkt);
 	else
 		data = rx_buf->pkt.data;
@@ -171,8 +172,8 @@ static int rxm_finish_recv(struct rxm_rx_buf *rx_buf, size_t done_len)
 				recv_entry->rxm_iov.iov[0].iov_base + recv_size;
 		recv_entry->rxm_iov.iov[0].iov_len -= recv_size;
 
-		dlist_insert_head(&recv_entry->entry,
-				  &recv_entry->recv_queue->recv_list);
+		ofi_match_queue_insert_head(&recv_entry->recv_queue->posted,
+					    &recv_entry->match);
 		goto free_buf;
 	}
 
@@ -185,9 +186,8 @@ free_buf:
 	return ret;
 }
 
-static int
-rxm_cq_write_tx_comp(struct rxm_ep *rxm_ep, uint64_t comp_flags,
-		     void *app_context,  uint64_t flags)
+int rxm_cq_write_tx_comp(struct rxm_ep *rxm_ep, uint64_t comp_flags,
+			 void *app_context, uint64_t flags)
 {
 	int ret;
 
@@ -244,35 +244,53 @@ static int rxm_finish_sar_segment_send(struct rxm_ep *rxm_ep,
 				       struct rxm_tx_sar_buf *tx_buf, bool err)
 {
 	struct rxm_tx_sar_buf *first_tx_buf;
-	int ret = FI_SUCCESS;
+	ssize_t ret = FI_SUCCESS;
 
-	switch (rxm_sar_get_seg_type(&tx_buf->pkt.ctrl_hdr)) {
-	case RXM_SAR_SEG_FIRST:
-		break;
-	case RXM_SAR_SEG_MIDDLE:
+	first_tx_buf = ofi_bufpool_get_ibuf(rxm_ep->
+				buf_pools[RXM_BUF_POOL_TX_SAR].pool,
+				tx_buf->pkt.ctrl_hdr.msg_id);
+	if (tx_buf != first_tx_buf)
 		ofi_buf_free(tx_buf);
-		break;
-	case RXM_SAR_SEG_LAST:
-		if (!err) {
-			ret = rxm_cq_write_tx_comp(rxm_ep,
-					ofi_tx_cq_flags(tx_buf->pkt.hdr.op),
-					tx_buf->app_context, tx_buf->flags);
-
-			assert(ofi_tx_cq_flags(tx_buf->pkt.hdr.op) & FI_SEND);
-			ofi_ep_tx_cntr_inc(&rxm_ep->util_ep);
+
+	assert(first_tx_buf->sar.inflight);
+	first_tx_buf->sar.inflight--;
+
+	if (err) {
+		rxm_ep_sar_tx_fail(first_tx_buf);
+	} else if (!first_tx_buf->sar.failed) {
+		ret = rxm_ep_sar_tx_progress(rxm_ep, first_tx_buf);
+		if (ret) {
+			FI_WARN(&rxm_prov, FI_LOG_CQ,
+				"unable to send SAR segment: %zd\n", ret);
+			rxm_cq_write_error(rxm_ep->util_ep.tx_cq,
+					   rxm_ep->util_ep.tx_cntr,
+					   first_tx_buf->app_context, ret);
+			rxm_ep_sar_tx_fail(first_tx_buf);
+			ret = FI_SUCCESS;
 		}
-		first_tx_buf = ofi_bufpool_get_ibuf(rxm_ep->
-					buf_pools[RXM_BUF_POOL_TX_SAR].pool,
-					tx_buf->pkt.ctrl_hdr.msg_id);
-		ofi_buf_free(first_tx_buf);
-		ofi_buf_free(tx_buf);
-		break;
 	}
 
-	return ret;
+	/* Segments still in flight, or the message waits in the deferred
+	 * TX queue for buffers */
+	if (first_tx_buf->sar.inflight ||
+	    (!first_tx_buf->sar.failed &&
+	     first_tx_buf->sar.next_seg_no < first_tx_buf->sar.segs_cnt))
+		return (int) ret;
+
+	if (!first_tx_buf->sar.failed) {
+		ret = rxm_cq_write_tx_comp(rxm_ep,
+				ofi_tx_cq_flags(first_tx_buf->pkt.hdr.op),
+				first_tx_buf->app_context, first_tx_buf->flags);
+
+		assert(ofi_tx_cq_flags(first_tx_buf->pkt.hdr.op) & FI_SEND);
+		ofi_ep_tx_cntr_inc(&rxm_ep->util_ep);
+	}
+	ofi_buf_free(first_tx_buf);
+
+	return (int) ret;
 }
 
-static int rxm_finish_send_rndv_ack(struct rxm_rx_buf *rx_buf)
+static int rxm_rndv_rx_finish(struct rxm_rx_buf *rx_buf)
 {
 	RXM_UPDATE_STATE(FI_LOG_CQ, rx_buf, RXM_RNDV_FINISH);
 
@@ -295,8 +313,10 @@ static int rxm_rndv_tx_finish(struct rxm_ep *rxm_ep,
 
 	RXM_UPDATE_STATE(FI_LOG_CQ, tx_buf, RXM_RNDV_FINISH);
 
-	if (!rxm_ep->rdm_mr_local)
+	if (!rxm_ep->rdm_mr_local) {
+		rxm_msg_mr_closev(tx_buf->shm_mr, tx_buf->count);
 		rxm_msg_mr_closev(tx_buf->mr, tx_buf->count);
+	}
 
 	ret = rxm_cq_write_tx_comp(rxm_ep, ofi_tx_cq_flags(tx_buf->pkt.hdr.op),
 				   tx_buf->app_context, tx_buf->flags);
@@ -309,6 +329,38 @@ static int rxm_rndv_tx_finish(struct rxm_ep *rxm_ep,
 	return ret;
 }
 
+static void rxm_rndv_tx_fail(struct rxm_ep *rxm_ep,
+			     struct rxm_tx_rndv_buf *tx_buf)
+{
+	FI_WARN(&rxm_prov, FI_LOG_CQ, "unable to write rendezvous data: %d\n",
+		tx_buf->write.err);
+
+	if (!rxm_ep->rdm_mr_local) {
+		rxm_msg_mr_closev(tx_buf->shm_mr, tx_buf->count);
+		rxm_msg_mr_closev(tx_buf->mr, tx_buf->count);
+	}
+
+	rxm_cq_write_error(rxm_ep->util_ep.tx_cq, rxm_ep->util_ep.tx_cntr,
+			   tx_buf->app_context, tx_buf->write.err);
+	ofi_buf_free(tx_buf);
+}
+
+/*
+ * Stop the write protocol after a write failed to post.  Only write_cnt
+ * writes will complete against tx_buf, which is released once they have.
+ */
+void rxm_rndv_write_abort(struct rxm_ep *rxm_ep,
+			  struct rxm_tx_rndv_buf *tx_buf,
+			  size_t write_cnt, int err)
+{
+	if (!tx_buf->write.err)
+		tx_buf->write.err = err;
+	tx_buf->write.remote.count = (uint8_t) write_cnt;
+
+	if (tx_buf->write.rma_index >= write_cnt)
+		rxm_rndv_tx_fail(rxm_ep, tx_buf);
+}
+
 static int rxm_rndv_handle_ack(struct rxm_ep *rxm_ep, struct rxm_rx_buf *rx_buf)
 {
 	struct rxm_tx_rndv_buf *tx_buf;
@@ -334,6 +386,159 @@ static int rxm_rndv_handle_ack(struct rxm_ep *rxm_ep, struct rxm_rx_buf *rx_buf)
 	return ret;
 }
 
+static ssize_t rxm_rndv_send_done(struct rxm_ep *rxm_ep,
+				  struct rxm_tx_rndv_buf *tx_buf)
+{
+	struct rxm_deferred_tx_entry *def_tx_entry;
+	ssize_t ret;
+
+	/* The RTS has completed by now, so its packet carries the DONE */
+	tx_buf->pkt.ctrl_hdr.type = rxm_ctrl_rndv_done;
+	tx_buf->pkt.ctrl_hdr.msg_id = tx_buf->write.remote_id;
+
+	if (sizeof(tx_buf->pkt) <= rxm_ep->inject_limit) {
+		ret = fi_inject(tx_buf->write.conn->tx_ep, &tx_buf->pkt,
+				sizeof(tx_buf->pkt), tx_buf->write.conn->tx_addr);
+		if (!ret)
+			return rxm_rndv_tx_finish(rxm_ep, tx_buf);
+
+		if (ret != -FI_EAGAIN) {
+			FI_WARN(&rxm_prov, FI_LOG_CQ,
+				"send done via inject failed for MSG provider\n");
+			return ret;
+		}
+	}
+
+	RXM_UPDATE_STATE(FI_LOG_CQ, tx_buf, RXM_RNDV_DONE_SENT);
+	ret = fi_send(tx_buf->write.conn->tx_ep, &tx_buf->pkt,
+		      sizeof(tx_buf->pkt), tx_buf->hdr.desc,
+		      tx_buf->write.conn->tx_addr, tx_buf);
+	if (ret == -FI_EAGAIN) {
+		def_tx_entry = rxm_ep_alloc_deferred_tx_entry(rxm_ep,
+				tx_buf->write.conn, RXM_DEFERRED_TX_RNDV_DONE);
+		if (!def_tx_entry) {
+			FI_WARN(&rxm_prov, FI_LOG_CQ, "unable to "
+				"allocate TX entry for deferred DONE\n");
+			return -FI_EAGAIN;
+		}
+
+		def_tx_entry->rndv_done.tx_buf = tx_buf;
+		rxm_ep_enqueue_deferred_tx_queue(def_tx_entry);
+		return 0;
+	} else if (ret) {
+		FI_WARN(&rxm_prov, FI_LOG_CQ, "unable to send DONE: %zd\n", ret);
+	}
+	return ret;
+}
+
+static ssize_t rxm_rndv_write(struct rxm_ep *rxm_ep,
+			      struct rxm_tx_rndv_buf *tx_buf)
+{
+	struct rxm_deferred_tx_entry *def_tx_entry;
+	struct rxm_rndv_hdr *remote = &tx_buf->write.remote;
+	size_t i, index = 0, offset = 0, count;
+	struct iovec iov[RXM_IOV_LIMIT];
+	void *desc[RXM_IOV_LIMIT];
+	ssize_t ret = 0;
+
+	if (!remote->count)
+		return rxm_rndv_send_done(rxm_ep, tx_buf);
+
+	RXM_UPDATE_STATE(FI_LOG_CQ, tx_buf, RXM_RNDV_WRITE);
+
+	for (i = 0; i < remote->count; i++) {
+		ret = ofi_copy_iov_desc(&iov[0], &desc[0], &count,
+					&tx_buf->write.iov.iov[0],
+					&tx_buf->write.iov.desc[0],
+					tx_buf->write.iov.count,
+					&index, &offset, remote->iov[i].len);
+		if (ret)
+			goto err;
+
+		ret = fi_writev(tx_buf->write.conn->tx_ep, iov, desc, count,
+				tx_buf->write.conn->tx_addr,
+				remote->iov[i].addr, remote->iov[i].key, tx_buf);
+		if (ret == -FI_EAGAIN) {
+			def_tx_entry = rxm_ep_alloc_deferred_tx_entry(rxm_ep,
+					tx_buf->write.conn,
+					RXM_DEFERRED_TX_RNDV_WRITE);
+			if (!def_tx_entry) {
+				ret = -FI_ENOMEM;
+				goto err;
+			}
+
+			def_tx_entry->rndv_write.tx_buf = tx_buf;
+			def_tx_entry->rndv_write.rma_iov.addr = remote->iov[i].addr;
+			def_tx_entry->rndv_write.rma_iov.key = remote->iov[i].key;
+			memcpy(def_tx_entry->rndv_write.rxm_iov.iov, iov,
+			       sizeof(*iov) * count);
+			memcpy(def_tx_entry->rndv_write.rxm_iov.desc, desc,
+			       sizeof(*desc) * count);
+			def_tx_entry->rndv_write.rxm_iov.count = (uint8_t) count;
+			rxm_ep_enqueue_deferred_tx_queue(def_tx_entry);
+			ret = 0;
+		} else if (ret) {
+			goto err;
+		}
+	}
+	return 0;
+err:
+	/* Writes posted or deferred so far still complete against tx_buf */
+	rxm_rndv_write_abort(rxm_ep, tx_buf, i, (int) ret);
+	return 0;
+}
+
+static ssize_t rxm_rndv_handle_cts(struct rxm_ep *rxm_ep,
+				   struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_tx_rndv_buf *tx_buf;
+
+	tx_buf = ofi_bufpool_get_ibuf(rxm_ep->buf_pools[RXM_BUF_POOL_TX_RNDV].pool,
+				      rx_buf->pkt.ctrl_hdr.msg_id);
+
+	FI_DBG(&rxm_prov, FI_LOG_CQ, "Got CTS for msg_id: 0x%" PRIx64 "\n",
+	       rx_buf->pkt.ctrl_hdr.msg_id);
+
+	assert(tx_buf->pkt.ctrl_hdr.msg_id == rx_buf->pkt.ctrl_hdr.msg_id);
+	assert(tx_buf->pkt.ctrl_hdr.type == rxm_ctrl_rndv_wr);
+
+	memcpy(&tx_buf->write.remote, rx_buf->pkt.data,
+	       sizeof(tx_buf->write.remote));
+	tx_buf->write.remote_id = rx_buf->pkt.ctrl_hdr.ctrl_data;
+	assert(tx_buf->write.remote.count <= RXM_IOV_LIMIT);
+
+	rxm_rx_buf_free(rx_buf);
+
+	if (tx_buf->hdr.state == RXM_RNDV_CTS_WAIT)
+		return rxm_rndv_write(rxm_ep, tx_buf);
+
+	/* Writes are issued once the RTS send completes */
+	assert(tx_buf->hdr.state == RXM_RNDV_TX);
+	RXM_UPDATE_STATE(FI_LOG_CQ, tx_buf, RXM_RNDV_CTS_RECVD);
+	return 0;
+}
+
+static ssize_t rxm_rndv_handle_done(struct rxm_ep *rxm_ep,
+				    struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_rx_buf *rndv_rx_buf;
+
+	rndv_rx_buf = ofi_bufpool_get_ibuf(rxm_ep->buf_pools[RXM_BUF_POOL_RX].pool,
+					   rx_buf->pkt.ctrl_hdr.msg_id);
+
+	FI_DBG(&rxm_prov, FI_LOG_CQ, "Got DONE for msg_id: 0x%" PRIx64 "\n",
+	       rndv_rx_buf->pkt.ctrl_hdr.msg_id);
+
+	rxm_rx_buf_free(rx_buf);
+
+	if (rndv_rx_buf->hdr.state == RXM_RNDV_DONE_WAIT)
+		return rxm_rndv_rx_finish(rndv_rx_buf);
+
+	assert(rndv_rx_buf->hdr.state == RXM_RNDV_CTS_SENT);
+	RXM_UPDATE_STATE(FI_LOG_CQ, rndv_rx_buf, RXM_RNDV_DONE_RECVD);
+	return 0;
+}
+
 static int rxm_rx_buf_match_msg_id(struct dlist_entry *item, const void *arg)
 {
 	uint64_t msg_id = *((uint64_t *) arg);
@@ -343,29 +548,39 @@ static int rxm_rx_buf_match_msg_id(struct dlist_entry *item, const void *arg)
 	return (msg_id == rx_buf->pkt.ctrl_hdr.msg_id);
 }
 
+/*
+ * Segments are copied straight into the posted buffer at their offset in
+ * the message, so the order in which the sender's segments in flight are
+ * delivered does not matter.  Only the last segment may be shorter than
+ * the others.
+ */
 static ssize_t rxm_process_seg_data(struct rxm_rx_buf *rx_buf, int *done)
 {
-	uint64_t done_len;
+	struct rxm_recv_entry *recv_entry = rx_buf->recv_entry;
+	size_t offset, done_len;
 	ssize_t ret;
 
-	done_len = ofi_copy_to_iov(rx_buf->recv_entry->rxm_iov.iov,
-				   rx_buf->recv_entry->rxm_iov.count,
-				   rx_buf->recv_entry->sar.total_recv_len,
-				   rx_buf->pkt.data,
-				   rx_buf->pkt.ctrl_hdr.seg_size);
-	rx_buf->recv_entry->sar.total_recv_len += done_len;
+	if (rxm_sar_get_seg_type(&rx_buf->pkt.ctrl_hdr) == RXM_SAR_SEG_LAST)
+		offset = rx_buf->pkt.hdr.size - rx_buf->pkt.ctrl_hdr.seg_size;
+	else
+		offset = (size_t) rx_buf->pkt.ctrl_hdr.seg_no *
+			 rx_buf->pkt.ctrl_hdr.seg_size;
 
-	if ((rxm_sar_get_seg_type(&rx_buf->pkt.ctrl_hdr) == RXM_SAR_SEG_LAST) ||
-	    (done_len != rx_buf->pkt.ctrl_hdr.seg_size)) {
+	ofi_copy_to_iov(recv_entry->rxm_iov.iov, recv_entry->rxm_iov.count,
+			offset, rx_buf->pkt.data, rx_buf->pkt.ctrl_hdr.seg_size);
+	recv_entry->sar.total_recv_len += rx_buf->pkt.ctrl_hdr.seg_size;
 
-		dlist_remove(&rx_buf->recv_entry->sar.entry);
+	if (recv_entry->sar.total_recv_len >= rx_buf->pkt.hdr.size) {
+		if (recv_entry->sar.msg_id != RXM_SAR_RX_INIT)
+			dlist_remove(&recv_entry->sar.entry);
 
 		/* Mark rxm_recv_entry::msg_id as unknown for futher re-use */
-		rx_buf->recv_entry->sar.msg_id = RXM_SAR_RX_INIT;
-
-		done_len = rx_buf->recv_entry->sar.total_recv_len;
-		rx_buf->recv_entry->sar.total_recv_len = 0;
+		recv_entry->sar.msg_id = RXM_SAR_RX_INIT;
+		recv_entry->sar.total_recv_len = 0;
 
+		done_len = MIN(rx_buf->pkt.hdr.size,
+			       ofi_total_iov_len(recv_entry->rxm_iov.iov,
+						 recv_entry->rxm_iov.count));
 		*done = 1;
 		ret = rxm_finish_recv(rx_buf, done_len);
 	} else {
@@ -467,7 +682,8 @@ static ssize_t rxm_handle_rndv(struct rxm_rx_buf *rx_buf)
 		return ret;
 
 	if (!rx_buf->conn) {
-		assert(rx_buf->ep->srx_ctx);
+		assert(rx_buf->ep->srx_ctx ||
+		       rx_buf->msg_ep == rx_buf->ep->shm_ep);
 		rx_buf->conn = rxm_key2conn(rx_buf->ep,
 					    rx_buf->pkt.ctrl_hdr.conn_id);
 		if (!rx_buf->conn)
@@ -526,7 +742,8 @@ static ssize_t rxm_handle_rndv(struct rxm_rx_buf *rx_buf)
 							recv_entry->total_len);
 		}
 		total_recv_len -= copy_len;
-		ret = fi_readv(rx_buf->conn->msg_ep, iov, desc, count, 0,
+		ret = fi_readv(rx_buf->conn->tx_ep, iov, desc, count,
+			       rx_buf->conn->tx_addr,
 			       rx_buf->rndv_hdr->iov[i].addr,
 			       rx_buf->rndv_hdr->iov[i].key, rx_buf);
 		if (ret) {
@@ -552,6 +769,116 @@ readv_err:
 	return ret;
 }
 
+/*
+ * Allocate the CTS of a write rendezvous from the ACK pool and advertise the
+ * receive buffers registered for rx_buf in it.
+ */
+struct rxm_tx_base_buf *rxm_rndv_cts_alloc(struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_recv_entry *recv_entry = rx_buf->recv_entry;
+	struct rxm_tx_base_buf *tx_buf;
+	struct iovec iov[RXM_IOV_LIMIT];
+	struct fid_mr **mr;
+	size_t i, len;
+
+	tx_buf = rxm_tx_buf_alloc(rx_buf->ep, RXM_BUF_POOL_TX_ACK);
+	if (!tx_buf)
+		return NULL;
+
+	/* Only advertise as much of the buffer as the message can fill.
+	 * A shorter buffer is reported as truncated once DONE arrives. */
+	for (i = 0, len = MIN(recv_entry->total_len, rx_buf->pkt.hdr.size);
+	     i < recv_entry->rxm_iov.count && len; i++) {
+		iov[i].iov_base = recv_entry->rxm_iov.iov[i].iov_base;
+		iov[i].iov_len = MIN(recv_entry->rxm_iov.iov[i].iov_len, len);
+		len -= iov[i].iov_len;
+	}
+
+	/* desc is msg fid_mr * array if the app registered the buffers */
+	mr = rx_buf->ep->rdm_mr_local ?
+	     (struct fid_mr **) recv_entry->rxm_iov.desc : rx_buf->mr;
+
+	tx_buf->pkt.ctrl_hdr.type = rxm_ctrl_rndv_cts;
+	tx_buf->pkt.ctrl_hdr.conn_id = rx_buf->conn->handle.remote_key;
+	tx_buf->pkt.ctrl_hdr.msg_id = rx_buf->pkt.ctrl_hdr.msg_id;
+	tx_buf->pkt.ctrl_hdr.ctrl_data = ofi_buf_index(rx_buf);
+	rxm_rndv_hdr_init(rx_buf->ep, tx_buf->pkt.data, iov, i, mr);
+	return tx_buf;
+}
+
+static ssize_t rxm_handle_rndv_write(struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_deferred_tx_entry *def_tx_entry;
+	struct rxm_recv_entry *recv_entry = rx_buf->recv_entry;
+	struct rxm_tx_base_buf *tx_buf;
+	ssize_t ret;
+
+	ret = rxm_repost_new_rx(rx_buf);
+	if (ret)
+		return ret;
+
+	if (!rx_buf->conn) {
+		assert(rx_buf->ep->srx_ctx ||
+		       rx_buf->msg_ep == rx_buf->ep->shm_ep);
+		rx_buf->conn = rxm_key2conn(rx_buf->ep,
+					    rx_buf->pkt.ctrl_hdr.conn_id);
+		if (!rx_buf->conn)
+			return -FI_EOTHER;
+	}
+
+	FI_DBG(&rxm_prov, FI_LOG_CQ,
+	       "Got incoming write rendezvous with msg_id: 0x%" PRIx64 "\n",
+	       rx_buf->pkt.ctrl_hdr.msg_id);
+
+	if (!rx_buf->ep->rdm_mr_local) {
+		ret = rxm_msg_mr_regv(rx_buf->ep, recv_entry->rxm_iov.iov,
+				      recv_entry->rxm_iov.count,
+				      MIN(recv_entry->total_len,
+					  rx_buf->pkt.hdr.size),
+				      FI_REMOTE_WRITE, rx_buf->mr);
+		if (ret)
+			return ret;
+	}
+
+	RXM_UPDATE_STATE(FI_LOG_CQ, rx_buf, RXM_RNDV_CTS_SENT);
+	tx_buf = rxm_rndv_cts_alloc(rx_buf);
+	recv_entry->rndv.tx_buf = tx_buf;
+	if (tx_buf) {
+		ret = fi_send(rx_buf->conn->tx_ep, &tx_buf->pkt,
+			      sizeof(tx_buf->pkt) + sizeof(struct rxm_rndv_hdr),
+			      tx_buf->hdr.desc, rx_buf->conn->tx_addr, rx_buf);
+		if (!ret)
+			return 0;
+	} else {
+		/* The deferred queue allocates the CTS once ACK buffers
+		 * complete */
+		FI_DBG(&rxm_prov, FI_LOG_CQ,
+		       "ran out of buffers from ACK buffer pool\n");
+		ret = -FI_EAGAIN;
+	}
+
+	if (ret == -FI_EAGAIN) {
+		def_tx_entry = rxm_ep_alloc_deferred_tx_entry(rx_buf->ep,
+				rx_buf->conn, RXM_DEFERRED_TX_RNDV_CTS);
+		if (def_tx_entry) {
+			def_tx_entry->rndv_cts.rx_buf = rx_buf;
+			rxm_ep_enqueue_deferred_tx_queue(def_tx_entry);
+			return 0;
+		}
+		FI_WARN(&rxm_prov, FI_LOG_CQ, "unable to "
+			"allocate TX entry for deferred CTS\n");
+	} else {
+		FI_WARN(&rxm_prov, FI_LOG_CQ, "unable to send CTS: %zd\n", ret);
+	}
+	if (tx_buf) {
+		ofi_buf_free(tx_buf);
+		recv_entry->rndv.tx_buf = NULL;
+	}
+	if (!rx_buf->ep->rdm_mr_local)
+		rxm_msg_mr_closev(rx_buf->mr, recv_entry->rxm_iov.count);
+	return ret;
+}
+
 ssize_t rxm_handle_eager(struct rxm_rx_buf *rx_buf)
 {
 	uint64_t done_len;
@@ -590,6 +917,8 @@ ssize_t rxm_handle_rx_buf(struct rxm_rx_buf *rx_buf)
 		return rx_buf->ep->eager_ops->handle_rx(rx_buf);
 	case rxm_ctrl_rndv:
 		return rxm_handle_rndv(rx_buf);
+	case rxm_ctrl_rndv_wr:
+		return rxm_handle_rndv_write(rx_buf);
 	case rxm_ctrl_seg:
 		return rxm_handle_seg_data(rx_buf);
 	default:
@@ -604,12 +933,15 @@ rxm_match_rx_buf(struct rxm_rx_buf *rx_buf,
 		 struct rxm_recv_queue *recv_queue,
 		    struct rxm_recv_match_attr *match_attr)
 {
-	struct dlist_entry *entry;
-
-	entry = dlist_remove_first_match(&recv_queue->recv_list,
-					 recv_queue->match_recv, match_attr);
-	if (entry) {
-		rx_buf->recv_entry = container_of(entry, struct rxm_recv_entry, entry);
+	struct ofi_match_entry *match;
+	fi_addr_t addr;
+
+	addr = rxm_match_msg_addr(recv_queue, match_attr->addr);
+	match = ofi_match_queue_remove_first(&recv_queue->posted, addr,
+					     match_attr->tag, 0);
+	if (match) {
+		rx_buf->recv_entry = container_of(match, struct rxm_recv_entry,
+						  match);
 		return rxm_handle_rx_buf(rx_buf);
 	}
 
@@ -618,9 +950,10 @@ rxm_match_rx_buf(struct rxm_rx_buf *rx_buf,
 	FI_DBG(&rxm_prov, FI_LOG_CQ, "Enqueueing msg to unexpected msg queue\n");
 	rx_buf->unexp_msg.addr = match_attr->addr;
 	rx_buf->unexp_msg.tag = match_attr->tag;
-
-	dlist_insert_tail(&rx_buf->unexp_msg.entry,
-			  &recv_queue->unexp_msg_list);
+	rx_buf->unexp_msg.match.addr = addr;
+	rx_buf->unexp_msg.match.tag = match_attr->tag;
+	rx_buf->unexp_msg.match.ignore = 0;
+	ofi_match_queue_insert(&recv_queue->unexp, &rx_buf->unexp_msg.match);
 
 	// repost a new buffer now since we don't know when the unexpected
 	// buffer will be consumed
@@ -634,7 +967,7 @@ static ssize_t rxm_handle_recv_comp(struct rxm_rx_buf *rx_buf)
 	};
 
 	if (rx_buf->ep->rxm_info->caps & (FI_SOURCE | FI_DIRECTED_RECV)) {
-		if (rx_buf->ep->srx_ctx)
+		if (!rx_buf->conn)
 			rx_buf->conn = rxm_key2conn(rx_buf->ep, rx_buf->
 						    pkt.ctrl_hdr.conn_id);
 		if (!rx_buf->conn)
@@ -711,10 +1044,11 @@ static ssize_t rxm_rndv_send_ack_inject(struct rxm_rx_buf *rx_buf)
 	struct fi_msg msg = {
 		.msg_iov = &iov,
 		.iov_count = 1,
+		.addr = rx_buf->conn->tx_addr,
 		.context = rx_buf,
 	};
 
-	return fi_sendmsg(rx_buf->conn->msg_ep, &msg, FI_INJECT);
+	return fi_sendmsg(rx_buf->conn->tx_ep, &msg, FI_INJECT);
 }
 
 static ssize_t rxm_rndv_send_ack(struct rxm_rx_buf *rx_buf)
@@ -743,19 +1077,20 @@ static ssize_t rxm_rndv_send_ack(struct rxm_rx_buf *rx_buf)
 			"ran out of buffers from ACK buffer pool\n");
 		return -FI_EAGAIN;
 	}
-	assert(rx_buf->recv_entry->rndv.tx_buf->pkt.ctrl_hdr.type ==
-	       rxm_ctrl_rndv_ack);
-
 	assert(rx_buf->hdr.state == RXM_RNDV_READ);
 
+	/* ACK buffers also carry the CTS of the write protocol */
+	rx_buf->recv_entry->rndv.tx_buf->pkt.ctrl_hdr.type = rxm_ctrl_rndv_ack;
+
 	rx_buf->recv_entry->rndv.tx_buf->pkt.ctrl_hdr.conn_id = rx_buf->conn->
 								handle.remote_key;
 	rx_buf->recv_entry->rndv.tx_buf->pkt.ctrl_hdr.msg_id = rx_buf->pkt.
 							       ctrl_hdr.msg_id;
 
-	ret = fi_send(rx_buf->conn->msg_ep, &rx_buf->recv_entry->rndv.tx_buf->pkt,
+	ret = fi_send(rx_buf->conn->tx_ep, &rx_buf->recv_entry->rndv.tx_buf->pkt,
 		      sizeof(rx_buf->recv_entry->rndv.tx_buf->pkt),
-		      rx_buf->recv_entry->rndv.tx_buf->hdr.desc, 0, rx_buf);
+		      rx_buf->recv_entry->rndv.tx_buf->hdr.desc,
+		      rx_buf->conn->tx_addr, rx_buf);
 	if (ret) {
 		if (ret == -FI_EAGAIN) {
 			def_tx_entry = rxm_ep_alloc_deferred_tx_entry(rx_buf->ep,
@@ -845,8 +1180,8 @@ static ssize_t rxm_atomic_send_resp(struct rxm_ep *rxm_ep,
 	atomic_hdr->result_len = htonl(result_len);
 
 	if (resp_len < rxm_ep->inject_limit) {
-		ret = fi_inject(rx_buf->conn->msg_ep, &resp_buf->pkt,
-				resp_len, 0);
+		ret = fi_inject(rx_buf->conn->tx_ep, &resp_buf->pkt,
+				resp_len, rx_buf->conn->tx_addr);
 		if (!ret)
 			ofi_buf_free(resp_buf);
 	} else {
@@ -926,7 +1261,7 @@ static ssize_t rxm_handle_atomic_req(struct rxm_ep *rxm_ep,
 	       rx_buf->pkt.hdr.op == ofi_op_atomic_fetch ||
 	       rx_buf->pkt.hdr.op == ofi_op_atomic_compare);
 
-	if (rx_buf->ep->srx_ctx)
+	if (!rx_buf->conn)
 		rx_buf->conn = rxm_key2conn(rx_buf->ep,
 					    rx_buf->pkt.ctrl_hdr.conn_id);
 	if (!rx_buf->conn)
@@ -1075,6 +1410,98 @@ int rxm_finish_coll_eager_send(struct rxm_ep *rxm_ep,
 	return ret;
 };
 
+static ssize_t rxm_handle_rx_pkt(struct rxm_ep *rxm_ep,
+				 struct rxm_rx_buf *rx_buf)
+{
+	assert((rx_buf->pkt.hdr.version == OFI_OP_VERSION) &&
+	       (rx_buf->pkt.ctrl_hdr.version == RXM_CTRL_VERSION));
+
+	switch (rx_buf->pkt.ctrl_hdr.type) {
+	case rxm_ctrl_eager:
+	case rxm_ctrl_rndv:
+	case rxm_ctrl_rndv_wr:
+		return rxm_handle_recv_comp(rx_buf);
+	case rxm_ctrl_rndv_ack:
+		return rxm_rndv_handle_ack(rxm_ep, rx_buf);
+	case rxm_ctrl_rndv_cts:
+		return rxm_rndv_handle_cts(rxm_ep, rx_buf);
+	case rxm_ctrl_rndv_done:
+		return rxm_rndv_handle_done(rxm_ep, rx_buf);
+	case rxm_ctrl_seg:
+		return rxm_sar_handle_segment(rx_buf);
+	case rxm_ctrl_atomic:
+		return rxm_handle_atomic_req(rxm_ep, rx_buf);
+	case rxm_ctrl_atomic_resp:
+		return rxm_handle_atomic_resp(rxm_ep, rx_buf);
+	case rxm_ctrl_credit:
+		return rxm_handle_credit(rxm_ep, rx_buf);
+	default:
+		FI_WARN(&rxm_prov, FI_LOG_CQ, "Unknown message type\n");
+		assert(0);
+		return -FI_EINVAL;
+	}
+}
+
+static int rxm_msg_ep_recv_slab(struct rxm_rx_slab *rx_slab)
+{
+	struct iovec iov = {
+		.iov_base = rx_slab->data,
+		.iov_len = rx_slab->ep->rx_slab_size,
+	};
+	struct fi_msg msg = {
+		.msg_iov = &iov,
+		.desc = &rx_slab->hdr.desc,
+		.iov_count = 1,
+		.addr = FI_ADDR_UNSPEC,
+		.context = rx_slab,
+	};
+	int ret;
+
+	ret = (int) fi_recvmsg(rx_slab->msg_ep, &msg,
+			       FI_MULTI_RECV | FI_COMPLETION);
+	if (ret && ret != -FI_EAGAIN)
+		FI_WARN(&rxm_prov, FI_LOG_EP_CTRL,
+			"unable to post recv slab: %d\n", ret);
+	return ret;
+}
+
+static void rxm_repost_rx_slab(struct rxm_rx_slab *rx_slab)
+{
+	if (rxm_msg_ep_recv_slab(rx_slab))
+		dlist_insert_tail(&rx_slab->repost_entry,
+				  &rx_slab->ep->slab_repost_list);
+}
+
+/*
+ * Every packet is copied out of the slab into an rx buf, which is then
+ * handled as if the MSG provider had received into it.  The slab goes
+ * back to the MSG provider once it reports FI_MULTI_RECV.
+ */
+static ssize_t rxm_handle_rx_slab(struct rxm_ep *rxm_ep,
+				  struct fi_cq_data_entry *comp)
+{
+	struct rxm_rx_slab *rx_slab = comp->op_context;
+	struct rxm_rx_buf *rx_buf;
+	ssize_t ret = 0;
+
+	if (comp->len) {
+		assert(comp->len <= rxm_eager_limit + sizeof(struct rxm_pkt));
+		rx_buf = rxm_rx_buf_alloc(rxm_ep, rx_slab->msg_ep, 0);
+		if (rx_buf) {
+			if (rxm_ep->srx_ctx)
+				rx_buf->conn = NULL;
+			memcpy(&rx_buf->pkt, comp->buf, comp->len);
+			ret = rxm_handle_rx_pkt(rxm_ep, rx_buf);
+		} else {
+			ret = -FI_ENOMEM;
+		}
+	}
+
+	if (comp->flags & FI_MULTI_RECV)
+		rxm_repost_rx_slab(rx_slab);
+	return ret;
+}
+
 ssize_t rxm_handle_comp(struct rxm_ep *rxm_ep, struct fi_cq_data_entry *comp)
 {
 	struct rxm_rx_buf *rx_buf;
@@ -1111,30 +1538,11 @@ ssize_t rxm_handle_comp(struct rxm_ep *rxm_ep, struct fi_cq_data_entry *comp)
 		       (comp->flags & (FI_READ | FI_RMA)));
 		return rxm_finish_rma(rxm_ep, rma_buf, comp->flags);
 	case RXM_RX:
-		rx_buf = comp->op_context;
 		assert(!(comp->flags & FI_REMOTE_READ));
-		assert((rx_buf->pkt.hdr.version == OFI_OP_VERSION) &&
-		       (rx_buf->pkt.ctrl_hdr.version == RXM_CTRL_VERSION));
-
-		switch (rx_buf->pkt.ctrl_hdr.type) {
-		case rxm_ctrl_eager:
-		case rxm_ctrl_rndv:
-			return rxm_handle_recv_comp(rx_buf);
-		case rxm_ctrl_rndv_ack:
-			return rxm_rndv_handle_ack(rxm_ep, rx_buf);
-		case rxm_ctrl_seg:
-			return rxm_sar_handle_segment(rx_buf);
-		case rxm_ctrl_atomic:
-			return rxm_handle_atomic_req(rxm_ep, rx_buf);
-		case rxm_ctrl_atomic_resp:
-			return rxm_handle_atomic_resp(rxm_ep, rx_buf);
-		case rxm_ctrl_credit:
-			return rxm_handle_credit(rxm_ep, rx_buf);
-		default:
-			FI_WARN(&rxm_prov, FI_LOG_CQ, "Unknown message type\n");
-			assert(0);
-			return -FI_EINVAL;
-		}
+		return rxm_handle_rx_pkt(rxm_ep, comp->op_context);
+	case RXM_RX_SLAB:
+		assert(!(comp->flags & FI_REMOTE_READ));
+		return rxm_handle_rx_slab(rxm_ep, comp);
 	case RXM_SAR_TX:
 		tx_sar_buf = comp->op_context;
 		assert(comp->flags & FI_SEND);
@@ -1142,7 +1550,9 @@ ssize_t rxm_handle_comp(struct rxm_ep *rxm_ep, struct fi_cq_data_entry *comp)
 	case RXM_RNDV_TX:
 		tx_rndv_buf = comp->op_context;
 		assert(comp->flags & FI_SEND);
-		RXM_UPDATE_STATE(FI_LOG_CQ, tx_rndv_buf, RXM_RNDV_ACK_WAIT);
+		RXM_UPDATE_STATE(FI_LOG_CQ, tx_rndv_buf,
+				 tx_rndv_buf->pkt.ctrl_hdr.type == rxm_ctrl_rndv_wr ?
+				 RXM_RNDV_CTS_WAIT : RXM_RNDV_ACK_WAIT);
 		return 0;
 	case RXM_RNDV_ACK_WAIT:
 		assert(0);
@@ -1156,7 +1566,7 @@ ssize_t rxm_handle_comp(struct rxm_ep *rxm_ep, struct fi_cq_data_entry *comp)
 			return rxm_rndv_send_ack(rx_buf);
 	case RXM_RNDV_ACK_SENT:
 		assert(comp->flags & FI_SEND);
-		return rxm_finish_send_rndv_ack(comp->op_context);
+		return rxm_rndv_rx_finish(comp->op_context);
 	case RXM_RNDV_ACK_RECVD:
 		tx_rndv_buf = comp->op_context;
 		assert(comp->flags & FI_SEND);
@@ -1164,6 +1574,37 @@ ssize_t rxm_handle_comp(struct rxm_ep *rxm_ep, struct fi_cq_data_entry *comp)
 	case RXM_RNDV_FINISH:
 		assert(0);
 		return -FI_EOPBADSTATE;
+	case RXM_RNDV_CTS_WAIT:
+		assert(0);
+		return -FI_EOPBADSTATE;
+	case RXM_RNDV_CTS_RECVD:
+		assert(comp->flags & FI_SEND);
+		return rxm_rndv_write(rxm_ep, comp->op_context);
+	case RXM_RNDV_WRITE:
+		tx_rndv_buf = comp->op_context;
+		assert(comp->flags & FI_WRITE);
+		if (++tx_rndv_buf->write.rma_index <
+		    tx_rndv_buf->write.remote.count)
+			return 0;
+		if (tx_rndv_buf->write.err) {
+			rxm_rndv_tx_fail(rxm_ep, tx_rndv_buf);
+			return 0;
+		}
+		return rxm_rndv_send_done(rxm_ep, tx_rndv_buf);
+	case RXM_RNDV_DONE_SENT:
+		assert(comp->flags & FI_SEND);
+		return rxm_rndv_tx_finish(rxm_ep, comp->op_context);
+	case RXM_RNDV_CTS_SENT:
+		rx_buf = comp->op_context;
+		assert(comp->flags & FI_SEND);
+		RXM_UPDATE_STATE(FI_LOG_CQ, rx_buf, RXM_RNDV_DONE_WAIT);
+		return 0;
+	case RXM_RNDV_DONE_WAIT:
+		assert(0);
+		return -FI_EOPBADSTATE;
+	case RXM_RNDV_DONE_RECVD:
+		assert(comp->flags & FI_SEND);
+		return rxm_rndv_rx_finish(comp->op_context);
 	case RXM_ATOMIC_RESP_WAIT:
 		/* Optional atomic request completion; TX completion
 		 * processing is performed when atomic response is received */
@@ -1233,20 +1674,21 @@ void rxm_cq_write_error_all(struct rxm_ep *rxm_ep, int err)
 		rxm_cntr_incerr(rxm_ep->util_ep.rd_cntr);
 }
 
-void rxm_handle_comp_error(struct rxm_ep *rxm_ep)
+void rxm_handle_comp_error(struct rxm_ep *rxm_ep, struct fid_cq *msg_cq)
 {
 	struct rxm_tx_base_buf *base_buf;
 	struct rxm_tx_eager_buf *eager_buf;
 	struct rxm_tx_sar_buf *sar_buf;
 	struct rxm_tx_rndv_buf *rndv_buf;
 	struct rxm_rx_buf *rx_buf;
+	struct rxm_rx_slab *rx_slab;
 	struct rxm_rma_buf *rma_buf;
 	struct util_cq *cq;
 	struct util_cntr *cntr;
 	struct fi_cq_err_entry err_entry = {0};
 	ssize_t ret;
 
-	ret = fi_cq_readerr(rxm_ep->msg_cq, &err_entry, 0);
+	ret = fi_cq_readerr(msg_cq, &err_entry, 0);
 	if ((ret) < 0) {
 		FI_WARN(&rxm_prov, FI_LOG_CQ,
 			"unable to fi_cq_readerr on msg cq\n");
@@ -1256,11 +1698,19 @@ void rxm_handle_comp_error(struct rxm_ep *rxm_ep)
 
 	if (err_entry.err != FI_ECANCELED)
 		OFI_CQ_STRERROR(&rxm_prov, FI_LOG_WARN, FI_LOG_CQ,
-				rxm_ep->msg_cq, &err_entry);
+				msg_cq, &err_entry);
 
 	cq = rxm_ep->util_ep.tx_cq;
 	cntr = rxm_ep->util_ep.tx_cntr;
 
+	/* See rxm_handle_shm_comp */
+	if (msg_cq == rxm_ep->shm_cq && (err_entry.flags & FI_REMOTE_WRITE)) {
+		err_entry.op_context = NULL;
+		cq = rxm_ep->util_ep.rx_cq;
+		cntr = rxm_ep->util_ep.rem_wr_cntr;
+		goto write;
+	}
+
 	switch (RXM_GET_PROTO_STATE(err_entry.op_context)) {
 	case RXM_TX:
 		eager_buf = err_entry.op_context;
@@ -1293,11 +1743,30 @@ void rxm_handle_comp_error(struct rxm_ep *rxm_ep)
 		err_entry.flags = ofi_tx_cq_flags(base_buf->pkt.hdr.op);
 		break;
 	case RXM_RNDV_TX:
+	case RXM_RNDV_CTS_RECVD:
+	case RXM_RNDV_WRITE:
+	case RXM_RNDV_DONE_SENT:
 		rndv_buf = err_entry.op_context;
 		err_entry.op_context = rndv_buf->app_context;
 		err_entry.flags = ofi_tx_cq_flags(rndv_buf->pkt.hdr.op);
 		break;
 
+	case RXM_RX_SLAB:
+		rx_slab = err_entry.op_context;
+		/* Canceled along with its msg_ep, see RXM_RX below */
+		if (err_entry.err == FI_ECANCELED) {
+			ofi_buf_free(rx_slab);
+			return;
+		}
+		if (err_entry.flags & FI_MULTI_RECV)
+			rxm_repost_rx_slab(rx_slab);
+
+		FI_WARN(&rxm_prov, FI_LOG_CQ, "slab receive failed: %s\n",
+			fi_cq_strerror(msg_cq, err_entry.prov_errno,
+				       err_entry.err_data, NULL, 0));
+		rxm_cq_write_error_all(rxm_ep, -err_entry.err);
+		return;
+
 	/* Application receive related error */
 	case RXM_RX:
 		/* Silently drop any MSG CQ error entries for canceled receive
@@ -1313,6 +1782,8 @@ void rxm_handle_comp_error(struct rxm_ep *rxm_ep)
 	case RXM_RNDV_ACK_SENT:
 		/* fall through */
 	case RXM_RNDV_READ:
+	case RXM_RNDV_CTS_SENT:
+	case RXM_RNDV_DONE_RECVD:
 		rx_buf = (struct rxm_rx_buf *) err_entry.op_context;
 		assert(rx_buf->recv_entry);
 		err_entry.op_context = rx_buf->recv_entry->context;
@@ -1323,12 +1794,13 @@ void rxm_handle_comp_error(struct rxm_ep *rxm_ep)
 		break;
 	default:
 		FI_WARN(&rxm_prov, FI_LOG_CQ, "Invalid state!\nmsg cq error info: %s\n",
-			fi_cq_strerror(rxm_ep->msg_cq, err_entry.prov_errno,
+			fi_cq_strerror(msg_cq, err_entry.prov_errno,
 				       err_entry.err_data, NULL, 0));
 		rxm_cq_write_error_all(rxm_ep, -FI_EOPBADSTATE);
 		return;
 	}
 
+write:
 	if (cntr)
 		rxm_cntr_incerr(cntr);
 
@@ -1338,11 +1810,11 @@ void rxm_handle_comp_error(struct rxm_ep *rxm_ep)
 		FI_WARN(&rxm_prov, FI_LOG_CQ, "Unable to ofi_cq_write_error\n");
 }
 
-static int rxm_msg_ep_recv(struct rxm_rx_buf *rx_buf)
+int rxm_msg_ep_recv(struct rxm_rx_buf *rx_buf)
 {
 	int ret, level;
 
-	if (rx_buf->ep->srx_ctx)
+	if (rx_buf->ep->srx_ctx || rx_buf->msg_ep == rx_buf->ep->shm_ep)
 		rx_buf->conn = NULL;
 	rx_buf->hdr.state = RXM_RX;
 
@@ -1353,7 +1825,8 @@ static int rxm_msg_ep_recv(struct rxm_rx_buf *rx_buf)
 		return 0;
 
 	if (ret != -FI_EAGAIN) {
-		level = (rx_buf->conn->handle.state == RXM_CMAP_SHUTDOWN) ?
+		level = (rx_buf->conn &&
+			 rx_buf->conn->handle.state == RXM_CMAP_SHUTDOWN) ?
 			FI_LOG_DEBUG : FI_LOG_WARN;
 		FI_LOG(&rxm_prov, level, FI_LOG_EP_CTRL,
 		       "unable to post recv buf: %d\n", ret);
@@ -1361,12 +1834,46 @@ static int rxm_msg_ep_recv(struct rxm_rx_buf *rx_buf)
 	return ret;
 }
 
+static int rxm_msg_ep_prepost_slabs(struct rxm_ep *rxm_ep,
+				    struct fid_ep *msg_ep)
+{
+	struct ofi_bufpool *pool = rxm_ep->buf_pools[RXM_BUF_POOL_RX_SLAB].pool;
+	struct rxm_rx_slab *rx_slab;
+	int ret;
+	size_t i;
+
+	for (i = 0; i < RXM_RX_SLAB_CNT; i++) {
+		rx_slab = ofi_buf_alloc(pool);
+		if (!rx_slab)
+			return -FI_ENOMEM;
+
+		rx_slab->msg_ep = msg_ep;
+		rx_slab->conn = rxm_ep->srx_ctx ? NULL :
+				container_of(msg_ep->fid.context,
+					     struct rxm_conn, handle);
+
+		ret = rxm_msg_ep_recv_slab(rx_slab);
+		if (ret) {
+			ofi_buf_free(rx_slab);
+			return ret;
+		}
+	}
+	return 0;
+}
+
 int rxm_msg_ep_prepost_recv(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep)
 {
 	struct rxm_rx_buf *rx_buf;
+	size_t min_size = rxm_eager_limit + sizeof(struct rxm_pkt);
 	int ret;
 	size_t i;
 
+	/* The MSG provider retires a slab that can't fit a full packet */
+	if (rxm_ep->rx_slab_size &&
+	    !fi_setopt(&msg_ep->fid, FI_OPT_ENDPOINT, FI_OPT_MIN_MULTI_RECV,
+		       &min_size, sizeof(min_size)))
+		return rxm_msg_ep_prepost_slabs(rxm_ep, msg_ep);
+
 	for (i = 0; i < rxm_ep->msg_info->rx_attr->size; i++) {
 		rx_buf = rxm_rx_buf_alloc(rxm_ep, msg_ep, 1);
 		if (!rx_buf)
@@ -1381,23 +1888,84 @@ int rxm_msg_ep_prepost_recv(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep)
 	return 0;
 }
 
+/*
+ * Completions of the shm endpoint.  shm reports the target side of an RMA
+ * write with its own context, there is no rx buffer of ours behind it.
+ */
+static ssize_t rxm_handle_shm_comp(struct rxm_ep *rxm_ep,
+				   struct fi_cq_data_entry *comp)
+{
+	if (comp->flags & FI_REMOTE_WRITE)
+		comp->op_context = NULL;
+	return rxm_handle_comp(rxm_ep, comp);
+}
+
+/*
+ * Read a batch of completions from a MSG provider (or shm) CQ and handle
+ * them.  The batch doubles while reads fill it and halves while they come
+ * back less than half full, so a busy CQ is drained with few calls into
+ * the provider.  Returns the number of completions read, or an error.
+ */
+static ssize_t rxm_msg_cq_read(struct rxm_ep *rxm_ep, struct fid_cq *msg_cq,
+			       size_t *batch, size_t max,
+			       ssize_t (*handle_comp)(struct rxm_ep *,
+						      struct fi_cq_data_entry *))
+{
+	struct fi_cq_data_entry comp[RXM_MSG_CQ_BATCH_MAX];
+	size_t count = MIN(*batch, max);
+	ssize_t ret, rc, i;
+	int err = 0;
+
+	ret = fi_cq_read(msg_cq, comp, count);
+	if (ret == -FI_EAGAIN) {
+		*batch = RXM_MSG_CQ_BATCH_MIN;
+		return ret;
+	}
+	if (ret < 0)
+		return ret;
+
+	if ((size_t) ret == *batch)
+		*batch = MIN(*batch * 2, RXM_MSG_CQ_BATCH_MAX);
+	else if ((size_t) ret < *batch / 2)
+		*batch = MAX(*batch / 2, RXM_MSG_CQ_BATCH_MIN);
+
+	/* Progress called back from a handler must not reap completions
+	 * that belong after the rest of this batch. */
+	rxm_ep->msg_cq_dispatch = true;
+	for (i = 0; i < ret; i++) {
+		rc = handle_comp(rxm_ep, &comp[i]);
+		if (rc) {
+			// We don't have enough info to write a good
+			// error entry to the CQ at this point
+			rxm_cq_write_error_all(rxm_ep, (int) rc);
+			err = (int) rc;
+		}
+	}
+	rxm_ep->msg_cq_dispatch = false;
+	return err ? err : ret;
+}
+
 void rxm_ep_do_progress(struct util_ep *util_ep)
 {
 	struct rxm_ep *rxm_ep = container_of(util_ep, struct rxm_ep, util_ep);
-	struct fi_cq_data_entry comp;
 	struct dlist_entry *conn_entry_tmp;
 	struct rxm_conn *rxm_conn;
 	struct rxm_rx_buf *buf;
+	struct rxm_rx_slab *rx_slab;
 	ssize_t ret;
 	size_t comp_read = 0;
 	uint64_t timestamp;
 
+	if (rxm_ep->msg_cq_dispatch)
+		return;
+
 	while (!dlist_empty(&rxm_ep->repost_ready_list)) {
 		dlist_pop_front(&rxm_ep->repost_ready_list, struct rxm_rx_buf,
 				buf, repost_entry);
 
 		/* Discard rx buffer if its msg_ep was closed */
-		if (!rxm_ep->srx_ctx && !buf->conn->msg_ep) {
+		if (!rxm_ep->srx_ctx && buf->msg_ep != rxm_ep->shm_ep &&
+		    !buf->conn->msg_ep) {
 			ofi_buf_free(&buf->hdr);
 			continue;
 		}
@@ -1409,25 +1977,38 @@ void rxm_ep_do_progress(struct util_ep *util_ep)
 		}
 	}
 
+	while (!dlist_empty(&rxm_ep->slab_repost_list)) {
+		rx_slab = container_of(rxm_ep->slab_repost_list.next,
+				       struct rxm_rx_slab, repost_entry);
+
+		/* Discard the slab if its msg_ep was closed */
+		if (!rxm_ep->srx_ctx && !rx_slab->conn->msg_ep) {
+			dlist_remove(&rx_slab->repost_entry);
+			ofi_buf_free(rx_slab);
+			continue;
+		}
+
+		if (rxm_msg_ep_recv_slab(rx_slab))
+			break;
+		dlist_remove(&rx_slab->repost_entry);
+	}
+
 	do {
-		ret = fi_cq_read(rxm_ep->msg_cq, &comp, 1);
+		ret = rxm_msg_cq_read(rxm_ep, rxm_ep->msg_cq,
+				      &rxm_ep->msg_cq_batch,
+				      rxm_ep->comp_per_progress - comp_read,
+				      rxm_handle_comp);
 		if (ret > 0) {
-			ret = rxm_handle_comp(rxm_ep, &comp);
-			if (ret) {
-				// We don't have enough info to write a good
-				// error entry to the CQ at this point
-				rxm_cq_write_error_all(rxm_ep, ret);
-			} else {
-				ret = 1;
-			}
+			comp_read += ret;
+			rxm_ep->cq_eq_fairness -= (int) ret;
 		} else if (ret < 0 && (ret != -FI_EAGAIN)) {
 			if (ret == -FI_EAVAIL)
-				rxm_handle_comp_error(rxm_ep);
+				rxm_handle_comp_error(rxm_ep, rxm_ep->msg_cq);
 			else
-				rxm_cq_write_error_all(rxm_ep, ret);
+				rxm_cq_write_error_all(rxm_ep, (int) ret);
 		}
 
-		if (ret == -FI_EAGAIN || --rxm_ep->cq_eq_fairness <= 0) {
+		if (ret == -FI_EAGAIN || rxm_ep->cq_eq_fairness <= 0) {
 			rxm_ep->cq_eq_fairness = rxm_cq_eq_fairness;
 			timestamp = ofi_gettime_us();
 			if (timestamp - rxm_ep->msg_cq_last_poll >
@@ -1436,7 +2017,19 @@ void rxm_ep_do_progress(struct util_ep *util_ep)
 				rxm_msg_eq_progress(rxm_ep);
 			}
 		}
-	} while ((ret > 0) && (++comp_read < rxm_ep->comp_per_progress));
+	} while ((ret > 0) && (comp_read < rxm_ep->comp_per_progress));
+
+	/* shm has no progress thread, reading its CQ is what moves data */
+	if (rxm_ep->shm_cq) {
+		ret = rxm_msg_cq_read(rxm_ep, rxm_ep->shm_cq,
+				      &rxm_ep->shm_cq_batch,
+				      rxm_ep->comp_per_progress,
+				      rxm_handle_shm_comp);
+		if (ret == -FI_EAVAIL)
+			rxm_handle_comp_error(rxm_ep, rxm_ep->shm_cq);
+		else if (ret < 0 && ret != -FI_EAGAIN)
+			rxm_cq_write_error_all(rxm_ep, (int) ret);
+	}
 
 	if (!dlist_empty(&rxm_ep->deferred_tx_conn_queue)) {
 		dlist_foreach_container_safe(&rxm_ep->deferred_tx_conn_queue,
@@ -113,6 +113,7 @@ static int rxm_domain_close(fid_t fid)
 
 	rxm_domain = container_of(fid, struct rxm_domain, util_domain.domain_fid.fid);
 
+	rxm_shm_domain_close(rxm_domain);
 	ret = fi_close(&rxm_domain->msg_domain->fid);
 	if (ret)
 		return ret;
@@ -143,6 +144,9 @@ static int rxm_mr_close(fid_t fid)
 	if (rxm_mr->domain->util_domain.info_domain_caps & FI_ATOMIC)
 		rxm_mr_remove_map_entry(rxm_mr);
 
+	if (rxm_mr->shm_mr && fi_close(&rxm_mr->shm_mr->fid))
+		FI_WARN(&rxm_prov, FI_LOG_DOMAIN, "Unable to close shm MR\n");
+
 	ret = fi_close(&rxm_mr->msg_mr->fid);
 	if (ret)
 		FI_WARN(&rxm_prov, FI_LOG_DOMAIN, "Unable to close MSG MR\n");
@@ -224,6 +228,10 @@ rxm_mr_get_msg_access(struct rxm_domain *rxm_domain, uint64_t access)
 
 	if (rxm_domain->mr_local)
 		access |= FI_WRITE;
+
+	/* and for RMA write based rendezvous */
+	if (rxm_rndv_write_min)
+		access |= FI_WRITE | FI_REMOTE_WRITE;
 	return access;
 }
 
@@ -275,6 +283,10 @@ static int rxm_mr_regattr(struct fid *fid, const struct fi_mr_attr *attr,
 			goto map_err;
 	}
 
+	ret = rxm_shm_mr_reg(rxm_mr, &msg_attr, flags);
+	if (ret)
+		goto map_err;
+
 	return 0;
 
 map_err:
@@ -310,6 +322,7 @@ static int rxm_mr_regv(struct fid *fid, const struct iovec *iov, size_t count,
 		return -FI_ENOMEM;
 
 	access = rxm_mr_get_msg_access(rxm_domain, access);
+	msg_attr.access = access;
 
 	ret = fi_mr_regv(rxm_domain->msg_domain, iov, count, access, offset,
 			 requested_key, flags, &rxm_mr->msg_mr, context);
@@ -327,6 +340,10 @@ static int rxm_mr_regv(struct fid *fid, const struct iovec *iov, size_t count,
 			goto map_err;
 	}
 
+	ret = rxm_shm_mr_reg(rxm_mr, &msg_attr, flags);
+	if (ret)
+		goto map_err;
+
 	return 0;
 map_err:
 	fi_close(&rxm_mr->mr_fid.fid);
@@ -488,6 +505,10 @@ int rxm_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 		goto err3;
 	}
 
+	ret = rxm_shm_domain_open(rxm_domain, info);
+	if (ret)
+		goto err3;
+
 	fi_freeinfo(msg_info);
 	return 0;
 err3:
@@ -42,70 +42,13 @@
 
 #include "rxm.h"
 
-static int rxm_match_noop(struct dlist_entry *item, const void *arg)
-{
-	OFI_UNUSED(item);
-	OFI_UNUSED(arg);
-	return 1;
-}
-
-static int rxm_match_recv_entry(struct dlist_entry *item, const void *arg)
-{
-	struct rxm_recv_match_attr *attr = (struct rxm_recv_match_attr *) arg;
-	struct rxm_recv_entry *recv_entry =
-		container_of(item, struct rxm_recv_entry, entry);
-	return ofi_match_addr(recv_entry->addr, attr->addr);
-}
-
-static int rxm_match_recv_entry_tag(struct dlist_entry *item, const void *arg)
-{
-	struct rxm_recv_match_attr *attr = (struct rxm_recv_match_attr *) arg;
-	struct rxm_recv_entry *recv_entry =
-		container_of(item, struct rxm_recv_entry, entry);
-	return ofi_match_tag(recv_entry->tag, recv_entry->ignore, attr->tag);
-}
-
-static int rxm_match_recv_entry_tag_addr(struct dlist_entry *item, const void *arg)
-{
-	struct rxm_recv_match_attr *attr = (struct rxm_recv_match_attr *) arg;
-	struct rxm_recv_entry *recv_entry =
-		container_of(item, struct rxm_recv_entry, entry);
-	return ofi_match_addr(recv_entry->addr, attr->addr) &&
-		ofi_match_tag(recv_entry->tag, recv_entry->ignore, attr->tag);
-}
-
 static int rxm_match_recv_entry_context(struct dlist_entry *item, const void *context)
 {
 	struct rxm_recv_entry *recv_entry =
-		container_of(item, struct rxm_recv_entry, entry);
+		container_of(item, struct rxm_recv_entry, match.entry);
 	return recv_entry->context == context;
 }
 
-static int rxm_match_unexp_msg(struct dlist_entry *item, const void *arg)
-{
-	struct rxm_recv_match_attr *attr = (struct rxm_recv_match_attr *)arg;
-	struct rxm_unexp_msg *unexp_msg =
-		container_of(item, struct rxm_unexp_msg, entry);
-	return ofi_match_addr(attr->addr, unexp_msg->addr);
-}
-
-static int rxm_match_unexp_msg_tag(struct dlist_entry *item, const void *arg)
-{
-	struct rxm_recv_match_attr *attr = (struct rxm_recv_match_attr *) arg;
-	struct rxm_unexp_msg *unexp_msg =
-		container_of(item, struct rxm_unexp_msg, entry);
-	return ofi_match_tag(attr->tag, attr->ignore, unexp_msg->tag);
-}
-
-static int rxm_match_unexp_msg_tag_addr(struct dlist_entry *item, const void *arg)
-{
-	struct rxm_recv_match_attr *attr = (struct rxm_recv_match_attr *) arg;
-	struct rxm_unexp_msg *unexp_msg =
-		container_of(item, struct rxm_unexp_msg, entry);
-	return ofi_match_addr(attr->addr, unexp_msg->addr) &&
-		ofi_match_tag(attr->tag, attr->ignore, unexp_msg->tag);
-}
-
 static int rxm_buf_reg(struct ofi_bufpool_region *region)
 {
 	struct rxm_buf_pool *pool = region->pool->attr.context;
@@ -132,6 +75,7 @@ static void rxm_buf_init(struct ofi_bufpool_region *region, void *buf)
 	struct rxm_buf_pool *pool = region->pool->attr.context;
 	struct rxm_pkt *pkt;
 	struct rxm_rx_buf *rx_buf;
+	struct rxm_rx_slab *rx_slab;
 	struct rxm_tx_base_buf *tx_base_buf;
 	struct rxm_tx_eager_buf *tx_eager_buf;
 	struct rxm_tx_sar_buf *tx_sar_buf;
@@ -157,7 +101,17 @@ static void rxm_buf_init(struct ofi_bufpool_region *region, void *buf)
 		pkt = NULL;
 		type = rxm_ctrl_eager; /* This can be any value */
 		break;
+	case RXM_BUF_POOL_RX_SLAB:
+		rx_slab = buf;
+		rx_slab->ep = pool->rxm_ep;
+		rx_slab->hdr.state = RXM_RX_SLAB;
+
+		rx_slab->hdr.desc = mr_desc;
+		pkt = NULL;
+		type = rxm_ctrl_eager; /* This can be any value */
+		break;
 	case RXM_BUF_POOL_TX:
+	case RXM_BUF_POOL_TX_SMALL:
 		tx_eager_buf = buf;
 		tx_eager_buf->hdr.state = RXM_TX;
 
@@ -303,6 +257,8 @@ static void rxm_recv_entry_init(struct rxm_recv_entry *entry, void *arg)
 static int rxm_recv_queue_init(struct rxm_ep *rxm_ep,  struct rxm_recv_queue *recv_queue,
 			       size_t size, enum rxm_recv_queue_type type)
 {
+	int ret;
+
 	recv_queue->rxm_ep = rxm_ep;
 	recv_queue->type = type;
 	recv_queue->fs = rxm_recv_fs_create(size, rxm_recv_entry_init,
@@ -310,27 +266,23 @@ static int rxm_recv_queue_init(struct rxm_ep *rxm_ep,  struct rxm_recv_queue *re
 	if (!recv_queue->fs)
 		return -FI_ENOMEM;
 
-	dlist_init(&recv_queue->recv_list);
-	dlist_init(&recv_queue->unexp_msg_list);
-	if (type == RXM_RECV_QUEUE_MSG) {
-		if (rxm_ep->rxm_info->caps & FI_DIRECTED_RECV) {
-			recv_queue->match_recv = rxm_match_recv_entry;
-			recv_queue->match_unexp = rxm_match_unexp_msg;
-		} else {
-			recv_queue->match_recv = rxm_match_noop;
-			recv_queue->match_unexp = rxm_match_noop;
-		}
-	} else {
-		if (rxm_ep->rxm_info->caps & FI_DIRECTED_RECV) {
-			recv_queue->match_recv = rxm_match_recv_entry_tag_addr;
-			recv_queue->match_unexp = rxm_match_unexp_msg_tag_addr;
-		} else {
-			recv_queue->match_recv = rxm_match_recv_entry_tag;
-			recv_queue->match_unexp = rxm_match_unexp_msg_tag;
-		}
-	}
+	ret = ofi_match_queue_init(&recv_queue->posted, size);
+	if (ret)
+		goto err_posted;
 
+	ret = ofi_match_queue_init(&recv_queue->unexp, size);
+	if (ret)
+		goto err_unexp;
+
+	recv_queue->directed = !!(rxm_ep->rxm_info->caps & FI_DIRECTED_RECV);
 	return 0;
+
+err_unexp:
+	ofi_match_queue_close(&recv_queue->posted);
+err_posted:
+	rxm_recv_fs_free(recv_queue->fs);
+	recv_queue->fs = NULL;
+	return ret;
 }
 
 static void rxm_recv_queue_close(struct rxm_recv_queue *recv_queue)
@@ -338,8 +290,10 @@ static void rxm_recv_queue_close(struct rxm_recv_queue *recv_queue)
 	/* It indicates that the recv_queue were allocated */
 	if (recv_queue->fs) {
 		rxm_recv_fs_free(recv_queue->fs);
+		ofi_match_queue_close(&recv_queue->unexp);
+		ofi_match_queue_close(&recv_queue->posted);
 	}
-	// TODO cleanup recv_list and unexp msg list
+	// TODO cleanup posted and unexpected queues
 }
 
 static int rxm_ep_txrx_pool_create(struct rxm_ep *rxm_ep)
@@ -347,7 +301,9 @@ static int rxm_ep_txrx_pool_create(struct rxm_ep *rxm_ep)
 	int ret, i;
 	size_t queue_sizes[] = {
 		[RXM_BUF_POOL_RX] = rxm_ep->msg_info->rx_attr->size,
+		[RXM_BUF_POOL_RX_SLAB] = RXM_RX_SLAB_CNT,
 		[RXM_BUF_POOL_TX] = rxm_ep->msg_info->tx_attr->size,
+		[RXM_BUF_POOL_TX_SMALL] = rxm_ep->msg_info->tx_attr->size,
 		[RXM_BUF_POOL_TX_INJECT] = rxm_ep->msg_info->tx_attr->size,
 		[RXM_BUF_POOL_TX_ACK] = rxm_ep->msg_info->tx_attr->size,
 		[RXM_BUF_POOL_TX_RNDV] = rxm_ep->msg_info->tx_attr->size,
@@ -359,11 +315,16 @@ static int rxm_ep_txrx_pool_create(struct rxm_ep *rxm_ep)
 	size_t entry_sizes[] = {
 		[RXM_BUF_POOL_RX] = rxm_eager_limit +
 				    sizeof(struct rxm_rx_buf),
+		[RXM_BUF_POOL_RX_SLAB] = rxm_ep->rx_slab_size +
+					 sizeof(struct rxm_rx_slab),
 		[RXM_BUF_POOL_TX] = rxm_eager_limit +
 				    sizeof(struct rxm_tx_eager_buf),
+		[RXM_BUF_POOL_TX_SMALL] = RXM_SMALL_BUF_SIZE +
+					  sizeof(struct rxm_tx_eager_buf),
 		[RXM_BUF_POOL_TX_INJECT] = rxm_ep->inject_limit +
 					   sizeof(struct rxm_tx_base_buf),
-		[RXM_BUF_POOL_TX_ACK] = sizeof(struct rxm_tx_base_buf),
+		[RXM_BUF_POOL_TX_ACK] = sizeof(struct rxm_tx_base_buf) +
+					sizeof(struct rxm_rndv_hdr),
 		[RXM_BUF_POOL_TX_RNDV] = sizeof(struct rxm_rndv_hdr) +
 					 rxm_ep->buffered_min +
 					 sizeof(struct rxm_tx_rndv_buf),
@@ -376,7 +337,28 @@ static int rxm_ep_txrx_pool_create(struct rxm_ep *rxm_ep)
 				     sizeof(struct rxm_rma_buf),
 	};
 
+	size_t max_cnts[RXM_BUF_POOL_MAX];
+
+	for (i = RXM_BUF_POOL_START; i < RXM_BUF_POOL_MAX; i++)
+		max_cnts[i] = (i == RXM_BUF_POOL_RX ||
+			       i == RXM_BUF_POOL_RX_SLAB ||
+			       i == RXM_BUF_POOL_TX_ATOMIC) ? 0 :
+			      rxm_ep->rxm_info->tx_attr->size;
+
+	/* Eager sends draw from the small and the full sized pools, which
+	 * split the transmit depth between them.  Pools grow a chunk at a
+	 * time, so keep their chunks within the split as well. */
+	max_cnts[RXM_BUF_POOL_TX_SMALL] = MAX(max_cnts[RXM_BUF_POOL_TX] / 2, 1);
+	max_cnts[RXM_BUF_POOL_TX] = MAX(max_cnts[RXM_BUF_POOL_TX] -
+					max_cnts[RXM_BUF_POOL_TX_SMALL], 1);
+	queue_sizes[RXM_BUF_POOL_TX_SMALL] =
+		MIN(queue_sizes[RXM_BUF_POOL_TX_SMALL],
+		    max_cnts[RXM_BUF_POOL_TX_SMALL]);
+	queue_sizes[RXM_BUF_POOL_TX] = MIN(queue_sizes[RXM_BUF_POOL_TX],
+					   max_cnts[RXM_BUF_POOL_TX]);
+
 	dlist_init(&rxm_ep->repost_ready_list);
+	dlist_init(&rxm_ep->slab_repost_list);
 
 	rxm_ep->buf_pools = calloc(1, RXM_BUF_POOL_MAX *
 				      sizeof(*rxm_ep->buf_pools));
@@ -388,11 +370,11 @@ static int rxm_ep_txrx_pool_create(struct rxm_ep *rxm_ep)
 		    (rxm_ep->util_ep.domain->threading != FI_THREAD_SAFE))
 			continue;
 
+		if ((i == RXM_BUF_POOL_RX_SLAB) && !rxm_ep->rx_slab_size)
+			continue;
+
 		ret = rxm_buf_pool_create(rxm_ep, entry_sizes[i],
-					  (i == RXM_BUF_POOL_RX ||
-					   i == RXM_BUF_POOL_TX_ATOMIC) ? 0 :
-					  rxm_ep->rxm_info->tx_attr->size,
-					  queue_sizes[i],
+					  max_cnts[i], queue_sizes[i],
 					  &rxm_ep->buf_pools[i], i);
 		if (ret)
 			goto err;
@@ -515,11 +497,12 @@ static int rxm_ep_cancel_recv(struct rxm_ep *rxm_ep,
 	int ret;
 
 	ofi_ep_lock_acquire(&rxm_ep->util_ep);
-	entry = dlist_remove_first_match(&recv_queue->recv_list,
-					 rxm_match_recv_entry_context,
-					 context);
+	entry = dlist_find_first_match(&recv_queue->posted.list,
+				       rxm_match_recv_entry_context, context);
 	if (entry) {
-		recv_entry = container_of(entry, struct rxm_recv_entry, entry);
+		recv_entry = container_of(entry, struct rxm_recv_entry,
+					  match.entry);
+		ofi_match_queue_remove(&recv_queue->posted, &recv_entry->match);
 		memset(&err_entry, 0, sizeof(err_entry));
 		err_entry.op_context = recv_entry->context;
 		err_entry.flags |= recv_entry->comp_flags;
@@ -658,33 +641,40 @@ static struct rxm_rx_buf *
 rxm_get_unexp_msg(struct rxm_recv_queue *recv_queue, fi_addr_t addr,
 		  uint64_t tag, uint64_t ignore)
 {
-	struct rxm_recv_match_attr match_attr;
-	struct dlist_entry *entry;
+	struct ofi_match_entry *match;
 
-	if (dlist_empty(&recv_queue->unexp_msg_list))
+	if (ofi_match_queue_empty(&recv_queue->unexp))
 		return NULL;
 
-	match_attr.addr = addr;
-	match_attr.tag = tag;
-	match_attr.ignore = ignore;
-
-	entry = dlist_find_first_match(&recv_queue->unexp_msg_list,
-				       recv_queue->match_unexp, &match_attr);
-	if (!entry)
+	match = ofi_match_queue_find(&recv_queue->unexp,
+				     rxm_match_recv_addr(recv_queue, addr),
+				     tag, ignore);
+	if (!match)
 		return NULL;
 
 	RXM_DBG_ADDR_TAG(FI_LOG_EP_DATA, "Match for posted recv found in unexp"
-			 " msg list\n", match_attr.addr, match_attr.tag);
+			 " msg list\n", addr, tag);
 
-	return container_of(entry, struct rxm_rx_buf, unexp_msg.entry);
+	return container_of(match, struct rxm_rx_buf, unexp_msg.match);
+}
+
+static inline void
+rxm_recv_entry_post(struct rxm_recv_queue *recv_queue,
+		    struct rxm_recv_entry *recv_entry)
+{
+	recv_entry->match.addr = rxm_match_recv_addr(recv_queue,
+						     recv_entry->addr);
+	recv_entry->match.tag = recv_entry->tag;
+	recv_entry->match.ignore = recv_entry->ignore;
+	ofi_match_queue_insert(&recv_queue->posted, &recv_entry->match);
 }
 
 static int rxm_handle_unexp_sar(struct rxm_recv_queue *recv_queue,
 				struct rxm_recv_entry *recv_entry,
 				struct rxm_rx_buf *rx_buf)
 {
-	struct rxm_recv_match_attr match_attr;
 	struct dlist_entry *entry;
+	fi_addr_t addr;
 	bool last;
 	ssize_t ret;
 
@@ -693,15 +683,14 @@ static int rxm_handle_unexp_sar(struct rxm_recv_queue *recv_queue,
 	if (ret || last)
 		return ret;
 
-	match_attr.addr = recv_entry->addr;
-	match_attr.tag = recv_entry->tag;
-	match_attr.ignore = recv_entry->ignore;
+	addr = rxm_match_recv_addr(recv_queue, recv_entry->addr);
 
-	dlist_foreach_container_safe(&recv_queue->unexp_msg_list,
-					struct rxm_rx_buf, rx_buf,
-					unexp_msg.entry, entry) {
-		if (!recv_queue->match_unexp(&rx_buf->unexp_msg.entry,
-						&match_attr))
+	dlist_foreach_container_safe(&recv_queue->unexp.list,
+				     struct rxm_rx_buf, rx_buf,
+				     unexp_msg.match.entry, entry) {
+		if (!ofi_match_entry_matches(&rx_buf->unexp_msg.match, addr,
+					     recv_entry->tag,
+					     recv_entry->ignore))
 			continue;
 		/* Handle unordered completions from MSG provider */
 		if ((rx_buf->pkt.ctrl_hdr.msg_id != recv_entry->sar.msg_id) ||
@@ -715,7 +704,8 @@ static int rxm_handle_unexp_sar(struct rxm_recv_queue *recv_queue,
 		if (recv_entry->sar.conn != rx_buf->conn)
 			continue;
 		rx_buf->recv_entry = recv_entry;
-		dlist_remove(&rx_buf->unexp_msg.entry);
+		ofi_match_queue_remove(&recv_queue->unexp,
+				       &rx_buf->unexp_msg.match);
 		last = rxm_sar_get_seg_type(&rx_buf->pkt.ctrl_hdr) ==
 		       RXM_SAR_SEG_LAST;
 		ret = rxm_handle_rx_buf(rx_buf);
@@ -759,14 +749,16 @@ static int rxm_ep_peek_recv(struct rxm_ep *rxm_ep, fi_addr_t addr, uint64_t tag,
 	FI_DBG(&rxm_prov, FI_LOG_EP_DATA, "Message found\n");
 
 	if (flags & FI_DISCARD) {
-		dlist_remove(&rx_buf->unexp_msg.entry);
+		ofi_match_queue_remove(&recv_queue->unexp,
+				       &rx_buf->unexp_msg.match);
 		return rxm_ep_discard_recv(rxm_ep, rx_buf, context);
 	}
 
 	if (flags & FI_CLAIM) {
 		FI_DBG(&rxm_prov, FI_LOG_EP_DATA, "Marking message for Claim\n");
 		((struct fi_context *)context)->internal[0] = rx_buf;
-		dlist_remove(&rx_buf->unexp_msg.entry);
+		ofi_match_queue_remove(&recv_queue->unexp,
+				       &rx_buf->unexp_msg.match);
 	}
 
 	return ofi_cq_write(rxm_ep->util_ep.rx_cq, context, FI_TAGGED | FI_RECV,
@@ -835,12 +827,12 @@ rxm_ep_post_mrecv(struct rxm_ep *ep, const struct iovec *iov,
 
 		rx_buf = rxm_get_unexp_msg(&ep->recv_queue, recv_entry->addr, 0,  0);
 		if (!rx_buf) {
-			dlist_insert_tail(&recv_entry->entry,
-					  &ep->recv_queue.recv_list);
+			rxm_recv_entry_post(&ep->recv_queue, recv_entry);
 			return 0;
 		}
 
-		dlist_remove(&rx_buf->unexp_msg.entry);
+		ofi_match_queue_remove(&ep->recv_queue.unexp,
+				       &rx_buf->unexp_msg.match);
 		rx_buf->recv_entry = recv_entry;
 		recv_entry->flags &= ~FI_MULTI_RECV;
 		recv_entry->total_len = MIN(cur_iov.iov_len, rx_buf->pkt.hdr.size);
@@ -886,12 +878,11 @@ rxm_ep_post_recv(struct rxm_ep *rxm_ep, const struct iovec *iov,
 
 	rx_buf = rxm_get_unexp_msg(&rxm_ep->recv_queue, recv_entry->addr, 0,  0);
 	if (!rx_buf) {
-		dlist_insert_tail(&recv_entry->entry,
-				  &rxm_ep->recv_queue.recv_list);
+		rxm_recv_entry_post(&rxm_ep->recv_queue, recv_entry);
 		return FI_SUCCESS;
 	}
 
-	dlist_remove(&rx_buf->unexp_msg.entry);
+	ofi_match_queue_remove(&rxm_ep->recv_queue.unexp, &rx_buf->unexp_msg.match);
 	rx_buf->recv_entry = recv_entry;
 
 	if (rx_buf->pkt.ctrl_hdr.type != rxm_ctrl_seg)
@@ -998,9 +989,9 @@ static ssize_t rxm_ep_recvv(struct fid_ep *ep_fid, const struct iovec *iov,
 				  context, rxm_ep->util_ep.rx_op_flags);
 }
 
-static void rxm_rndv_hdr_init(struct rxm_ep *rxm_ep, void *buf,
-			      const struct iovec *iov, size_t count,
-			      struct fid_mr **mr)
+void rxm_rndv_hdr_init(struct rxm_ep *rxm_ep, void *buf,
+		       const struct iovec *iov, size_t count,
+		       struct fid_mr **mr)
 {
 	struct rxm_rndv_hdr *rndv_hdr = (struct rxm_rndv_hdr *)buf;
 	size_t i;
@@ -1025,7 +1016,8 @@ rxm_ep_msg_inject_send(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 	assert((tx_pkt->hdr.flags & FI_REMOTE_CQ_DATA) || !tx_pkt->hdr.flags);
 	assert(pkt_size <= rxm_ep->inject_limit);
 
-	ssize_t ret = fi_inject(rxm_conn->msg_ep, tx_pkt, pkt_size, 0);
+	ssize_t ret = fi_inject(rxm_conn->tx_ep, tx_pkt, pkt_size,
+				rxm_conn->tx_addr);
 	if (ret == -FI_EAGAIN)
 		rxm_ep_do_progress(&rxm_ep->util_ep);
 	return ret;
@@ -1040,7 +1032,8 @@ rxm_ep_msg_normal_send(struct rxm_conn *rxm_conn, struct rxm_pkt *tx_pkt,
 
 	assert((tx_pkt->hdr.flags & FI_REMOTE_CQ_DATA) || !tx_pkt->hdr.flags);
 
-	return fi_send(rxm_conn->msg_ep, tx_pkt, pkt_size, desc, 0, context);
+	return fi_send(rxm_conn->tx_ep, tx_pkt, pkt_size, desc,
+		       rxm_conn->tx_addr, context);
 }
 
 static ssize_t
@@ -1053,6 +1046,8 @@ rxm_ep_alloc_rndv_tx_res(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 	struct fid_mr **mr_iov;
 	ssize_t ret;
 	struct rxm_tx_rndv_buf *tx_buf;
+	bool write;
+	uint8_t i;
 
 	tx_buf = rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX_RNDV);
 	if (!tx_buf) {
@@ -1061,8 +1056,13 @@ rxm_ep_alloc_rndv_tx_res(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 		return -FI_EAGAIN;
 	}
 
+	/* a local peer reads from the send buffer with a single copy */
+	write = rxm_ep->rndv_write_min && data_len >= rxm_ep->rndv_write_min &&
+		!rxm_conn_is_shm(rxm_ep, rxm_conn);
+
 	rxm_ep_format_tx_buf_pkt(rxm_conn, data_len, op, data, tag,
 				 flags, &(tx_buf)->pkt);
+	tx_buf->pkt.ctrl_hdr.type = write ? rxm_ctrl_rndv_wr : rxm_ctrl_rndv;
 	tx_buf->pkt.ctrl_hdr.msg_id = ofi_buf_index(tx_buf);
 	tx_buf->app_context = context;
 	tx_buf->flags = flags;
@@ -1070,15 +1070,37 @@ rxm_ep_alloc_rndv_tx_res(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 
 	if (!rxm_ep->rdm_mr_local) {
 		ret = rxm_msg_mr_regv(rxm_ep, iov, tx_buf->count, data_len,
-				      FI_REMOTE_READ, tx_buf->mr);
+				      write ? FI_WRITE : FI_REMOTE_READ,
+				      tx_buf->mr);
 		if (ret)
 			goto err;
 		mr_iov = tx_buf->mr;
+
+		memset(tx_buf->shm_mr, 0, sizeof(tx_buf->shm_mr));
+		if (rxm_conn_is_shm(rxm_ep, rxm_conn)) {
+			ret = rxm_shm_mr_regv(rxm_ep, iov, tx_buf->count,
+					      tx_buf->mr, tx_buf->shm_mr);
+			if (ret) {
+				rxm_msg_mr_closev(tx_buf->mr, tx_buf->count);
+				goto err;
+			}
+		}
 	} else {
 		/* desc is msg fid_mr * array */
 		mr_iov = (struct fid_mr **)desc;
 	}
 
+	if (write) {
+		tx_buf->write.conn = rxm_conn;
+		tx_buf->write.rma_index = 0;
+		tx_buf->write.err = 0;
+		for (i = 0; i < count; i++) {
+			tx_buf->write.iov.iov[i] = iov[i];
+			tx_buf->write.iov.desc[i] = fi_mr_desc(mr_iov[i]);
+		}
+		tx_buf->write.iov.count = count;
+	}
+
 	rxm_rndv_hdr_init(rxm_ep, &tx_buf->pkt.data, iov, tx_buf->count,
 			  mr_iov);
 
@@ -1106,7 +1128,9 @@ rxm_ep_rndv_tx_send(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 
 	RXM_UPDATE_STATE(FI_LOG_EP_DATA, tx_buf, RXM_RNDV_TX);
 	if (pkt_size <= rxm_ep->inject_limit) {
-		RXM_UPDATE_STATE(FI_LOG_EP_DATA, tx_buf, RXM_RNDV_ACK_WAIT);
+		RXM_UPDATE_STATE(FI_LOG_EP_DATA, tx_buf,
+				 tx_buf->pkt.ctrl_hdr.type == rxm_ctrl_rndv_wr ?
+				 RXM_RNDV_CTS_WAIT : RXM_RNDV_ACK_WAIT);
 		ret = rxm_ep_msg_inject_send(rxm_ep, rxm_conn, &tx_buf->pkt,
 					     pkt_size, ofi_cntr_inc_noop);
 	} else {
@@ -1121,8 +1145,10 @@ rxm_ep_rndv_tx_send(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 err:
 	FI_DBG(&rxm_prov, FI_LOG_EP_DATA,
 	       "Transmit for MSG provider failed\n");
-	if (!rxm_ep->rdm_mr_local)
+	if (!rxm_ep->rdm_mr_local) {
+		rxm_msg_mr_closev(tx_buf->shm_mr, tx_buf->count);
 		rxm_msg_mr_closev(tx_buf->mr, tx_buf->count);
+	}
 	ofi_buf_free(tx_buf);
 	return ret;
 }
@@ -1134,11 +1160,10 @@ rxm_ep_sar_calc_segs_cnt(struct rxm_ep *rxm_ep, size_t data_len)
 }
 
 static struct rxm_tx_sar_buf *
-rxm_ep_sar_tx_prepare_segment(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
-			      void *app_context, size_t total_len,
-			      size_t seg_len, size_t seg_no, uint64_t data,
-			      uint64_t flags, uint64_t tag, uint8_t op,
-			      enum rxm_sar_seg_type seg_type, uint64_t *msg_id)
+rxm_ep_sar_tx_prepare_first(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
+			    void *app_context, size_t total_len,
+			    uint64_t data, uint64_t flags, uint64_t tag,
+			    uint8_t op)
 {
 	struct rxm_tx_sar_buf *tx_buf;
 
@@ -1151,66 +1176,95 @@ rxm_ep_sar_tx_prepare_segment(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 
 	rxm_ep_format_tx_buf_pkt(rxm_conn, total_len, op, data, tag, flags,
 				 &tx_buf->pkt);
-	if (seg_type == RXM_SAR_SEG_FIRST) {
-		*msg_id = tx_buf->pkt.ctrl_hdr.msg_id = ofi_buf_index(tx_buf);
-	} else {
-		tx_buf->pkt.ctrl_hdr.msg_id = *msg_id;
-	}
-	tx_buf->pkt.ctrl_hdr.seg_size = seg_len;
-	tx_buf->pkt.ctrl_hdr.seg_no = seg_no;
+	tx_buf->pkt.ctrl_hdr.msg_id = ofi_buf_index(tx_buf);
+	tx_buf->pkt.ctrl_hdr.seg_size = rxm_eager_limit;
+	tx_buf->pkt.ctrl_hdr.seg_no = 0;
 	tx_buf->app_context = app_context;
 	tx_buf->flags = flags;
-	rxm_sar_set_seg_type(&tx_buf->pkt.ctrl_hdr, seg_type);
+	rxm_sar_set_seg_type(&tx_buf->pkt.ctrl_hdr, RXM_SAR_SEG_FIRST);
 
 	return tx_buf;
 }
 
-static void
-rxm_ep_sar_tx_cleanup(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
-		      struct rxm_tx_sar_buf *tx_buf)
-{
-	struct rxm_tx_sar_buf *first_tx_buf;
-
-	first_tx_buf = ofi_bufpool_get_ibuf(rxm_ep->
-					    buf_pools[RXM_BUF_POOL_TX_SAR].pool,
-					    tx_buf->pkt.ctrl_hdr.msg_id);
-	ofi_buf_free(first_tx_buf);
-	ofi_buf_free(tx_buf);
-}
-
-static ssize_t
-rxm_ep_sar_tx_prepare_and_send_segment(struct rxm_ep *rxm_ep,
-		struct rxm_conn *rxm_conn, void *app_context, size_t data_len,
-		size_t remain_len, uint64_t msg_id, size_t seg_len,
-		size_t seg_no, size_t segs_cnt, uint64_t data, uint64_t flags,
-		uint64_t tag, uint8_t op, const struct iovec *iov,
-		uint8_t count, size_t *iov_offset,
-		struct rxm_tx_sar_buf **out_tx_buf)
+/*
+ * Send the next segments of a message while fewer than sar_window of them
+ * are in flight.  Past the first window, each segment is copied out of the
+ * send buffer when an earlier one completes, so the copy overlaps with the
+ * transmit of the segments ahead of it.
+ */
+static ssize_t rxm_ep_sar_tx_window(struct rxm_ep *rxm_ep,
+				    struct rxm_tx_sar_buf *first_tx_buf)
 {
 	struct rxm_tx_sar_buf *tx_buf;
-	enum rxm_sar_seg_type seg_type = RXM_SAR_SEG_MIDDLE;
+	size_t seg_len;
+	ssize_t ret;
 
-	if (seg_no == (segs_cnt - 1)) {
-		seg_type = RXM_SAR_SEG_LAST;
-		assert(remain_len <= seg_len);
-		seg_len = remain_len;
-	}
+	while (first_tx_buf->sar.next_seg_no < first_tx_buf->sar.segs_cnt &&
+	       first_tx_buf->sar.inflight < rxm_ep->sar_window) {
+		tx_buf = rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX_SAR);
+		if (!tx_buf)
+			return -FI_EAGAIN;
+
+		seg_len = MIN(rxm_eager_limit, first_tx_buf->pkt.hdr.size -
+					       first_tx_buf->sar.iov_offset);
+		memcpy(&tx_buf->pkt, &first_tx_buf->pkt, sizeof(tx_buf->pkt));
+		tx_buf->pkt.ctrl_hdr.seg_size = seg_len;
+		tx_buf->pkt.ctrl_hdr.seg_no = first_tx_buf->sar.next_seg_no;
+		rxm_sar_set_seg_type(&tx_buf->pkt.ctrl_hdr,
+				     (first_tx_buf->sar.next_seg_no ==
+				      first_tx_buf->sar.segs_cnt - 1) ?
+				     RXM_SAR_SEG_LAST : RXM_SAR_SEG_MIDDLE);
+		tx_buf->app_context = first_tx_buf->app_context;
+		tx_buf->flags = first_tx_buf->flags;
+
+		ofi_copy_from_iov(tx_buf->pkt.data, seg_len,
+				  first_tx_buf->sar.iov,
+				  first_tx_buf->sar.count,
+				  first_tx_buf->sar.iov_offset);
+
+		ret = fi_send(first_tx_buf->sar.conn->tx_ep, &tx_buf->pkt,
+			      sizeof(struct rxm_pkt) + seg_len, tx_buf->hdr.desc,
+			      first_tx_buf->sar.conn->tx_addr, tx_buf);
+		if (ret) {
+			ofi_buf_free(tx_buf);
+			return ret;
+		}
 
-	tx_buf = rxm_ep_sar_tx_prepare_segment(rxm_ep, rxm_conn, app_context,
-					       data_len, seg_len, seg_no, data,
-					       flags, tag, op, seg_type, &msg_id);
-	if (!tx_buf) {
-		*out_tx_buf = NULL;
-		return -FI_EAGAIN;
+		first_tx_buf->sar.iov_offset += seg_len;
+		first_tx_buf->sar.inflight++;
+		if (++first_tx_buf->sar.next_seg_no ==
+		    first_tx_buf->sar.segs_cnt)
+			first_tx_buf->sar.conn->sar_tx_unposted--;
 	}
+	return 0;
+}
+
+/*
+ * Keep a SAR message going after its first segment was sent or one of its
+ * segments completed.  A message that runs out of buffers with none of its
+ * segments in flight, so no completion to pick it up again, is handed to
+ * the deferred tx queue.
+ */
+ssize_t rxm_ep_sar_tx_progress(struct rxm_ep *rxm_ep,
+			       struct rxm_tx_sar_buf *first_tx_buf)
+{
+	struct rxm_deferred_tx_entry *def_tx;
+	ssize_t ret;
 
-	ofi_copy_from_iov(tx_buf->pkt.data, seg_len, iov, count, *iov_offset);
-	*iov_offset += seg_len;
+	ret = rxm_ep_sar_tx_window(rxm_ep, first_tx_buf);
+	if (ret != -FI_EAGAIN)
+		return ret;
+	if (first_tx_buf->sar.inflight)
+		return 0;
 
-	*out_tx_buf = tx_buf;
+	def_tx = rxm_ep_alloc_deferred_tx_entry(rxm_ep, first_tx_buf->sar.conn,
+						RXM_DEFERRED_TX_SAR_SEG);
+	if (!def_tx)
+		return -FI_ENOMEM;
 
-	return fi_send(rxm_conn->msg_ep, &tx_buf->pkt, sizeof(struct rxm_pkt) +
-		       tx_buf->pkt.ctrl_hdr.seg_size, tx_buf->hdr.desc, 0, tx_buf);
+	def_tx->sar_seg.first_tx_buf = first_tx_buf;
+	rxm_ep_enqueue_deferred_tx_queue(def_tx);
+	return 0;
 }
 
 static ssize_t
@@ -1219,28 +1273,32 @@ rxm_ep_sar_tx_send(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 		   size_t data_len, size_t segs_cnt, uint64_t data,
 		   uint64_t flags, uint64_t tag, uint8_t op)
 {
-	struct rxm_tx_sar_buf *tx_buf, *first_tx_buf;
-	size_t i, iov_offset = 0, remain_len = data_len;
+	struct rxm_tx_sar_buf *first_tx_buf;
 	ssize_t ret;
-	struct rxm_deferred_tx_entry *def_tx;
-	uint64_t msg_id = 0;
 
 	assert(segs_cnt >= 2);
 
-	first_tx_buf = rxm_ep_sar_tx_prepare_segment(rxm_ep, rxm_conn, context,
-						     data_len, rxm_eager_limit,
-						     0, data, flags, tag, op,
-						     RXM_SAR_SEG_FIRST, &msg_id);
+	first_tx_buf = rxm_ep_sar_tx_prepare_first(rxm_ep, rxm_conn, context,
+						   data_len, data, flags,
+						   tag, op);
 	if (!first_tx_buf)
 		return -FI_EAGAIN;
 
 	ofi_copy_from_iov(first_tx_buf->pkt.data, rxm_eager_limit,
-			  iov, count, iov_offset);
-	iov_offset += rxm_eager_limit;
-
-	ret = fi_send(rxm_conn->msg_ep, &first_tx_buf->pkt,
+			  iov, count, 0);
+
+	first_tx_buf->sar.conn = rxm_conn;
+	memcpy(first_tx_buf->sar.iov, iov, sizeof(*iov) * count);
+	first_tx_buf->sar.count = count;
+	first_tx_buf->sar.iov_offset = rxm_eager_limit;
+	first_tx_buf->sar.next_seg_no = 1;
+	first_tx_buf->sar.segs_cnt = segs_cnt;
+	first_tx_buf->sar.inflight = 1;
+	first_tx_buf->sar.failed = false;
+
+	ret = fi_send(rxm_conn->tx_ep, &first_tx_buf->pkt,
 		      sizeof(struct rxm_pkt) + first_tx_buf->pkt.ctrl_hdr.seg_size,
-		      first_tx_buf->hdr.desc, 0, first_tx_buf);
+		      first_tx_buf->hdr.desc, rxm_conn->tx_addr, first_tx_buf);
 	if (ret) {
 		if (ret == -FI_EAGAIN)
 			rxm_ep_do_progress(&rxm_ep->util_ep);
@@ -1248,52 +1306,27 @@ rxm_ep_sar_tx_send(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 		return ret;
 	}
 
-	remain_len -= rxm_eager_limit;
-
-	for (i = 1; i < segs_cnt; i++) {
-		ret = rxm_ep_sar_tx_prepare_and_send_segment(rxm_ep, rxm_conn,
-				context, data_len, remain_len,
-				msg_id, rxm_eager_limit, i, segs_cnt,
-				data, flags, tag, op, iov, count,
-				&iov_offset, &tx_buf);
-		if (ret) {
-			if (ret == -FI_EAGAIN)
-				goto defer;
-			goto free;
-		}
-		remain_len -= rxm_eager_limit;
-	}
+	/* Until its last segment is posted, rxm_ep_prepare_tx holds back
+	 * later transfers on the conn.  On error, the completion of the
+	 * segments already sent releases the message without reporting it */
+	rxm_conn->sar_tx_unposted++;
+	ret = rxm_ep_sar_tx_progress(rxm_ep, first_tx_buf);
+	if (ret)
+		rxm_ep_sar_tx_fail(first_tx_buf);
+	return ret;
+}
 
-	return 0;
+/* Eager sends that fit use the small buffers first, then the full sized ones */
+static struct rxm_tx_eager_buf *
+rxm_tx_eager_buf_alloc(struct rxm_ep *rxm_ep, size_t len)
+{
+	struct rxm_tx_eager_buf *tx_buf = NULL;
 
-free:
-	ofi_buf_free(first_tx_buf);
-	return ret;
-defer:
-	def_tx = rxm_ep_alloc_deferred_tx_entry(rxm_ep,
-			rxm_conn, RXM_DEFERRED_TX_SAR_SEG);
-	if (!def_tx) {
-		if (tx_buf)
-			ofi_buf_free(tx_buf);
-		return -FI_ENOMEM;
-	}
-	memcpy(def_tx->sar_seg.payload.iov,
-		iov, sizeof(*iov) * count);
-	def_tx->sar_seg.payload.count = count;
-	def_tx->sar_seg.payload.cur_iov_offset = iov_offset;
-	def_tx->sar_seg.payload.tag = tag;
-	def_tx->sar_seg.payload.data = data;
-	def_tx->sar_seg.cur_seg_tx_buf = tx_buf;
-	def_tx->sar_seg.app_context = context;
-	def_tx->sar_seg.flags = flags;
-	def_tx->sar_seg.op = op;
-	def_tx->sar_seg.next_seg_no = i;
-	def_tx->sar_seg.segs_cnt = segs_cnt;
-	def_tx->sar_seg.total_len = data_len;
-	def_tx->sar_seg.remain_len = remain_len;
-	def_tx->sar_seg.msg_id = msg_id;
-	rxm_ep_enqueue_deferred_tx_queue(def_tx);
-	return 0;
+	if (len <= RXM_SMALL_BUF_SIZE)
+		tx_buf = rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX_SMALL);
+	if (!tx_buf)
+		tx_buf = rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX);
+	return tx_buf;
 }
 
 static ssize_t
@@ -1305,7 +1338,7 @@ rxm_ep_emulate_inject(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 	struct rxm_tx_eager_buf *tx_buf;
 	ssize_t ret;
 
-	tx_buf = rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX);
+	tx_buf = rxm_tx_eager_buf_alloc(rxm_ep, len);
 	if (!tx_buf) {
 		FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
 			"Ran out of buffers from Eager buffer pool\n");
@@ -1391,6 +1424,53 @@ unlock:
 
 }
 
+/*
+ * Small sends go straight to fi_inject on the MSG endpoint, reusing the
+ * connection's prebuilt packet header when there is one, and complete
+ * locally once the MSG provider owns the data, as fi_inject itself does.
+ * The caller routes sends that ask for transmit or delivery completion
+ * through the eager path instead.
+ */
+static ssize_t
+rxm_ep_inject_eager(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
+		    const struct iovec *iov, size_t count, size_t data_len,
+		    void *context, uint64_t data, uint64_t flags, uint64_t tag,
+		    uint8_t op, struct rxm_pkt *inject_pkt)
+{
+	struct rxm_tx_base_buf *tx_buf = NULL;
+	struct rxm_pkt *pkt;
+	ssize_t ret;
+
+	if (inject_pkt) {
+		pkt = inject_pkt;
+		pkt->hdr.size = data_len;
+		pkt->hdr.tag = tag;
+		pkt->hdr.data = data;
+	} else {
+		tx_buf = rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX_INJECT);
+		if (!tx_buf) {
+			FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
+				"Ran out of eager inject buffers\n");
+			return -FI_EAGAIN;
+		}
+		rxm_ep_format_tx_buf_pkt(rxm_conn, data_len, op, data, tag,
+					 flags, &tx_buf->pkt);
+		pkt = &tx_buf->pkt;
+	}
+	ofi_copy_from_iov(pkt->data, data_len, iov, count, 0);
+
+	ret = rxm_ep_msg_inject_send(rxm_ep, rxm_conn, pkt,
+				     sizeof(struct rxm_pkt) + data_len,
+				     ofi_cntr_inc_noop);
+	if (tx_buf)
+		ofi_buf_free(tx_buf);
+	if (ret)
+		return ret;
+
+	ofi_ep_tx_cntr_inc(&rxm_ep->util_ep);
+	return rxm_cq_write_tx_comp(rxm_ep, ofi_tx_cq_flags(op), context, flags);
+}
+
 static ssize_t
 rxm_ep_send_common(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 		   const struct iovec *iov, void **desc, size_t count,
@@ -1407,8 +1487,14 @@ rxm_ep_send_common(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 		(data_len > rxm_ep->rxm_info->tx_attr->inject_size)) ||
 	       (data_len <= rxm_ep->rxm_info->tx_attr->inject_size));
 
-	if (data_len <= rxm_eager_limit) {
-		tx_buf = rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX);
+	if (total_len <= rxm_ep->inject_limit &&
+	    !(flags & (FI_TRANSMIT_COMPLETE | FI_DELIVERY_COMPLETE)) &&
+	    rxm_ep->eager_ops == &def_eager_ops) {
+		ret = rxm_ep_inject_eager(rxm_ep, rxm_conn, iov, count,
+					  data_len, context, data, flags, tag,
+					  op, inject_pkt);
+	} else if (data_len <= rxm_eager_limit) {
+		tx_buf = rxm_tx_eager_buf_alloc(rxm_ep, data_len);
 		if (!tx_buf) {
 			FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
 				"Ran out of buffers from Eager buffer pool\n");
@@ -1431,6 +1517,9 @@ rxm_ep_send_common(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 			ofi_buf_free(tx_buf);
 		}
 	} else if (data_len <= rxm_ep->sar_limit &&
+		   /* shm reads large messages with a single copy, which beats
+		    * copying segments in and out of its buffers */
+		   !rxm_conn_is_shm(rxm_ep, rxm_conn) &&
 		   /* SAR uses eager_limit as segment size */
 		   (rxm_eager_limit <
 		    (1ULL << (8 * sizeof_field(struct ofi_ctrl_hdr, seg_size))))) {
@@ -1470,82 +1559,32 @@ rxm_ep_alloc_deferred_tx_entry(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 	return def_tx_entry;
 }
 
-static void
-rxm_ep_sar_handle_segment_failure(struct rxm_deferred_tx_entry *def_tx_entry,
-				ssize_t ret)
-{
-	rxm_ep_sar_tx_cleanup(def_tx_entry->rxm_ep, def_tx_entry->rxm_conn,
-			      def_tx_entry->sar_seg.cur_seg_tx_buf);
-	rxm_cq_write_error(def_tx_entry->rxm_ep->util_ep.tx_cq,
-			   def_tx_entry->rxm_ep->util_ep.tx_cntr,
-			   def_tx_entry->sar_seg.app_context, ret);
-}
-
-/* Returns FI_SUCCESS if the SAR deferred TX queue is empty,
+/* Returns FI_SUCCESS once the message has left the deferred TX queue,
  * otherwise, it returns -FI_EAGAIN or error from MSG provider */
 static ssize_t
 rxm_ep_progress_sar_deferred_segments(struct rxm_deferred_tx_entry *def_tx_entry)
 {
-	ssize_t ret = 0;
-	struct rxm_tx_sar_buf *tx_buf = def_tx_entry->sar_seg.cur_seg_tx_buf;
-
-	if (tx_buf) {
-		ret = fi_send(def_tx_entry->rxm_conn->msg_ep, &tx_buf->pkt,
-			      sizeof(tx_buf->pkt) + tx_buf->pkt.ctrl_hdr.seg_size,
-			      tx_buf->hdr.desc, 0, tx_buf);
-		if (ret) {
-			if (ret != -FI_EAGAIN) {
-				rxm_ep_sar_handle_segment_failure(def_tx_entry, ret);
-				goto sar_finish;
-			}
-			return ret;
-		}
-
-		def_tx_entry->sar_seg.next_seg_no++;
-		def_tx_entry->sar_seg.remain_len -= rxm_eager_limit;
-
-		if (def_tx_entry->sar_seg.next_seg_no ==
-		    def_tx_entry->sar_seg.segs_cnt) {
-			assert(rxm_sar_get_seg_type(&tx_buf->pkt.ctrl_hdr) ==
-			       RXM_SAR_SEG_LAST);
-			goto sar_finish;
-		}
-	}
+	struct rxm_tx_sar_buf *first_tx_buf = def_tx_entry->sar_seg.first_tx_buf;
+	struct rxm_ep *rxm_ep = def_tx_entry->rxm_ep;
+	ssize_t ret;
 
-	while (def_tx_entry->sar_seg.next_seg_no !=
-	       def_tx_entry->sar_seg.segs_cnt) {
-		ret = rxm_ep_sar_tx_prepare_and_send_segment(
-				def_tx_entry->rxm_ep, def_tx_entry->rxm_conn,
-				def_tx_entry->sar_seg.app_context,
-				def_tx_entry->sar_seg.total_len,
-				def_tx_entry->sar_seg.remain_len,
-				def_tx_entry->sar_seg.msg_id, rxm_eager_limit,
-				def_tx_entry->sar_seg.next_seg_no,
-				def_tx_entry->sar_seg.segs_cnt,
-				def_tx_entry->sar_seg.payload.data,
-				def_tx_entry->sar_seg.flags,
-				def_tx_entry->sar_seg.payload.tag,
-				def_tx_entry->sar_seg.op,
-				def_tx_entry->sar_seg.payload.iov,
-				def_tx_entry->sar_seg.payload.count,
-				&def_tx_entry->sar_seg.payload.cur_iov_offset,
-				&def_tx_entry->sar_seg.cur_seg_tx_buf);
-		if (ret) {
-			if (ret != -FI_EAGAIN) {
-				rxm_ep_sar_handle_segment_failure(def_tx_entry, ret);
-				goto sar_finish;
-			}
+	ret = rxm_ep_sar_tx_window(rxm_ep, first_tx_buf);
+	if (ret == -FI_EAGAIN && !first_tx_buf->sar.inflight)
+		return ret;
 
-			return ret;
-		}
-		def_tx_entry->sar_seg.next_seg_no++;
-		def_tx_entry->sar_seg.remain_len -= rxm_eager_limit;
+	if (ret && ret != -FI_EAGAIN) {
+		rxm_cq_write_error(rxm_ep->util_ep.tx_cq,
+				   rxm_ep->util_ep.tx_cntr,
+				   first_tx_buf->app_context, ret);
+		rxm_ep_sar_tx_fail(first_tx_buf);
+		if (!first_tx_buf->sar.inflight)
+			ofi_buf_free(first_tx_buf);
+	} else {
+		ret = 0;
 	}
 
-sar_finish:
 	rxm_ep_dequeue_deferred_tx_queue(def_tx_entry);
 	free(def_tx_entry);
-
 	return ret;
 }
 
@@ -1553,6 +1592,7 @@ void rxm_ep_progress_deferred_queue(struct rxm_ep *rxm_ep,
 				    struct rxm_conn *rxm_conn)
 {
 	struct rxm_deferred_tx_entry *def_tx_entry;
+	struct rxm_recv_entry *recv_entry;
 	struct iovec iov;
 	struct fi_msg msg;
 	ssize_t ret = 0;
@@ -1565,14 +1605,15 @@ void rxm_ep_progress_deferred_queue(struct rxm_ep *rxm_ep,
 					    struct rxm_deferred_tx_entry, entry);
 		switch (def_tx_entry->type) {
 		case RXM_DEFERRED_TX_RNDV_ACK:
-			ret = fi_send(def_tx_entry->rxm_conn->msg_ep,
+			ret = fi_send(def_tx_entry->rxm_conn->tx_ep,
 				      &def_tx_entry->rndv_ack.rx_buf->
 					recv_entry->rndv.tx_buf->pkt,
 				      sizeof(def_tx_entry->rndv_ack.rx_buf->
 					recv_entry->rndv.tx_buf->pkt),
 				      def_tx_entry->rndv_ack.rx_buf->recv_entry->
 					rndv.tx_buf->hdr.desc,
-				      0, def_tx_entry->rndv_ack.rx_buf);
+				      def_tx_entry->rxm_conn->tx_addr,
+				      def_tx_entry->rndv_ack.rx_buf);
 			if (ret) {
 				if (ret == -FI_EAGAIN)
 					break;
@@ -1588,10 +1629,11 @@ void rxm_ep_progress_deferred_queue(struct rxm_ep *rxm_ep,
 			free(def_tx_entry);
 			break;
 		case RXM_DEFERRED_TX_RNDV_READ:
-			ret = fi_readv(def_tx_entry->rxm_conn->msg_ep,
+			ret = fi_readv(def_tx_entry->rxm_conn->tx_ep,
 				       def_tx_entry->rndv_read.rxm_iov.iov,
 				       def_tx_entry->rndv_read.rxm_iov.desc,
-				       def_tx_entry->rndv_read.rxm_iov.count, 0,
+				       def_tx_entry->rndv_read.rxm_iov.count,
+				       def_tx_entry->rxm_conn->tx_addr,
 				       def_tx_entry->rndv_read.rma_iov.addr,
 				       def_tx_entry->rndv_read.rma_iov.key,
 				       def_tx_entry->rndv_read.rx_buf);
@@ -1607,6 +1649,75 @@ void rxm_ep_progress_deferred_queue(struct rxm_ep *rxm_ep,
 			rxm_ep_dequeue_deferred_tx_queue(def_tx_entry);
 			free(def_tx_entry);
 			break;
+		case RXM_DEFERRED_TX_RNDV_CTS:
+			/* The CTS waits for an ACK buffer */
+			recv_entry = def_tx_entry->rndv_cts.rx_buf->recv_entry;
+			if (!recv_entry->rndv.tx_buf) {
+				recv_entry->rndv.tx_buf = rxm_rndv_cts_alloc(
+						def_tx_entry->rndv_cts.rx_buf);
+				if (!recv_entry->rndv.tx_buf) {
+					ret = -FI_EAGAIN;
+					break;
+				}
+			}
+			ret = fi_send(def_tx_entry->rxm_conn->tx_ep,
+				      &def_tx_entry->rndv_cts.rx_buf->
+					recv_entry->rndv.tx_buf->pkt,
+				      sizeof(struct rxm_pkt) +
+					sizeof(struct rxm_rndv_hdr),
+				      def_tx_entry->rndv_cts.rx_buf->recv_entry->
+					rndv.tx_buf->hdr.desc,
+				      def_tx_entry->rxm_conn->tx_addr,
+				      def_tx_entry->rndv_cts.rx_buf);
+			if (ret) {
+				if (ret == -FI_EAGAIN)
+					break;
+				rxm_cq_write_error(def_tx_entry->rxm_ep->util_ep.rx_cq,
+						   def_tx_entry->rxm_ep->util_ep.rx_cntr,
+						   def_tx_entry->rndv_cts.rx_buf->
+							recv_entry->context, ret);
+			}
+			rxm_ep_dequeue_deferred_tx_queue(def_tx_entry);
+			free(def_tx_entry);
+			break;
+		case RXM_DEFERRED_TX_RNDV_WRITE:
+			ret = fi_writev(def_tx_entry->rxm_conn->tx_ep,
+					def_tx_entry->rndv_write.rxm_iov.iov,
+					def_tx_entry->rndv_write.rxm_iov.desc,
+					def_tx_entry->rndv_write.rxm_iov.count,
+					def_tx_entry->rxm_conn->tx_addr,
+					def_tx_entry->rndv_write.rma_iov.addr,
+					def_tx_entry->rndv_write.rma_iov.key,
+					def_tx_entry->rndv_write.tx_buf);
+			if (ret == -FI_EAGAIN)
+				break;
+			rxm_ep_dequeue_deferred_tx_queue(def_tx_entry);
+			if (ret)
+				rxm_rndv_write_abort(rxm_ep,
+					def_tx_entry->rndv_write.tx_buf,
+					def_tx_entry->rndv_write.tx_buf->
+						write.remote.count - 1,
+					(int) ret);
+			free(def_tx_entry);
+			break;
+		case RXM_DEFERRED_TX_RNDV_DONE:
+			ret = fi_send(def_tx_entry->rxm_conn->tx_ep,
+				      &def_tx_entry->rndv_done.tx_buf->pkt,
+				      sizeof(def_tx_entry->rndv_done.tx_buf->pkt),
+				      def_tx_entry->rndv_done.tx_buf->hdr.desc,
+				      def_tx_entry->rxm_conn->tx_addr,
+				      def_tx_entry->rndv_done.tx_buf);
+			if (ret) {
+				if (ret == -FI_EAGAIN)
+					break;
+				rxm_cq_write_error(def_tx_entry->rxm_ep->util_ep.tx_cq,
+						   def_tx_entry->rxm_ep->util_ep.tx_cntr,
+						   def_tx_entry->rndv_done.tx_buf->
+							app_context, ret);
+			}
+			rxm_ep_dequeue_deferred_tx_queue(def_tx_entry);
+			free(def_tx_entry);
+			break;
 		case RXM_DEFERRED_TX_SAR_SEG:
 			ret = rxm_ep_progress_sar_deferred_segments(def_tx_entry);
 			break;
@@ -1869,12 +1980,11 @@ rxm_ep_post_trecv(struct rxm_ep *rxm_ep, const struct iovec *iov,
 	rx_buf = rxm_get_unexp_msg(&rxm_ep->trecv_queue, recv_entry->addr,
 				   recv_entry->tag, recv_entry->ignore);
 	if (!rx_buf) {
-		dlist_insert_tail(&recv_entry->entry,
-				  &rxm_ep->trecv_queue.recv_list);
+		rxm_recv_entry_post(&rxm_ep->trecv_queue, recv_entry);
 		return FI_SUCCESS;
 	}
 
-	dlist_remove(&rx_buf->unexp_msg.entry);
+	ofi_match_queue_remove(&rxm_ep->trecv_queue.unexp, &rx_buf->unexp_msg.match);
 	rx_buf->recv_entry = recv_entry;
 
 	if (rx_buf->pkt.ctrl_hdr.type != rxm_ctrl_seg)
@@ -2285,6 +2395,7 @@ static int rxm_ep_close(struct fid *fid)
 	if (ret)
 		retv = ret;
 
+	rxm_ep_shm_close(rxm_ep);
 	rxm_ep_txrx_res_close(rxm_ep);
 	ret = rxm_ep_msg_res_close(rxm_ep);
 	if (ret)
@@ -2373,6 +2484,34 @@ static enum fi_wait_obj rxm_get_wait_obj(struct rxm_ep *ep)
 	return def_wait_obj;
 }
 
+/*
+ * shm is progressed by reading its CQ, which has no wait object, so local
+ * peers can only go through shm when the app drives progress by polling.
+ * Packets the MSG provider could inject have to be injectable through shm
+ * as well.
+ */
+static bool rxm_ep_shm_usable(struct rxm_ep *rxm_ep)
+{
+	struct rxm_domain *rxm_domain;
+
+	rxm_domain = container_of(rxm_ep->util_ep.domain, struct rxm_domain,
+				  util_domain);
+
+	if (!rxm_domain->shm_domain)
+		return false;
+
+	if (rxm_msg_cq_fd_needed(rxm_ep) ||
+	    rxm_ep->util_ep.domain->data_progress == FI_PROGRESS_AUTO ||
+	    force_auto_progress ||
+	    rxm_domain->shm_info->tx_attr->inject_size < rxm_ep->inject_limit) {
+		FI_INFO(&rxm_prov, FI_LOG_EP_CTRL, "shm doesn't support the "
+			"endpoint's wait objects, progress or inject size, "
+			"local peers go through the MSG provider\n");
+		return false;
+	}
+	return true;
+}
+
 static int rxm_ep_msg_cq_open(struct rxm_ep *rxm_ep)
 {
 	struct rxm_domain *rxm_domain;
@@ -2458,6 +2597,10 @@ static void rxm_ep_sar_init(struct rxm_ep *rxm_ep)
 		rxm_ep->sar_limit = (sar_limit > RXM_SAR_LIMIT) ?
 				    RXM_SAR_LIMIT : sar_limit;
 	}
+
+	if (fi_param_get_size_t(&rxm_prov, "sar_window", &param) || !param)
+		param = RXM_SAR_WINDOW;
+	rxm_ep->sar_window = param;
 }
 
 static void rxm_ep_settings_init(struct rxm_ep *rxm_ep)
@@ -2470,6 +2613,9 @@ static void rxm_ep_settings_init(struct rxm_ep *rxm_ep)
 			   rxm_ep->msg_info->rx_attr->size) / 2;
 	rxm_ep->comp_per_progress = (rxm_ep->comp_per_progress > max_prog_val) ?
 				    max_prog_val : rxm_ep->comp_per_progress;
+	if (!rxm_ep->comp_per_progress)
+		rxm_ep->comp_per_progress = 1;
+	rxm_ep->msg_cq_batch = RXM_MSG_CQ_BATCH_MIN;
 	ofi_atomic_initialize32(&rxm_ep->atomic_tx_credits,
 				rxm_ep->rxm_info->tx_attr->size);
 
@@ -2494,6 +2640,14 @@ static void rxm_ep_settings_init(struct rxm_ep *rxm_ep)
 	assert(!rxm_ep->buffered_limit);
 	rxm_ep->buffered_limit = rxm_eager_limit;
 
+	rxm_ep->rndv_write_min = rxm_rndv_write_min;
+
+	/* A slab must hold at least two full size packets */
+	if (rxm_rx_slab_size && (rxm_ep->msg_info->caps & FI_MULTI_RECV))
+		rxm_ep->rx_slab_size = MAX(rxm_rx_slab_size, 2 *
+					   (rxm_eager_limit +
+					    sizeof(struct rxm_pkt)));
+
 	rxm_ep_sar_init(rxm_ep);
 
  	FI_INFO(&rxm_prov, FI_LOG_CORE,
@@ -2505,12 +2659,15 @@ static void rxm_ep_settings_init(struct rxm_ep *rxm_ep)
 	        "\t\t FI_EP_MSG provider inject size: %zu\n"
 	        "\t\t rxm inject size: %zu\n"
 		"\t\t Protocol limits: Eager: %zu, "
-				      "SAR: %zu\n",
+				      "SAR: %zu, RNDV write: %zu\n"
+		"\t\t SAR window: %zu\n"
+		"\t\t MSG rx slab size: %zu\n",
 		rxm_ep->msg_mr_local, rxm_ep->rdm_mr_local,
 		rxm_ep->comp_per_progress, rxm_ep->buffered_min,
 		rxm_ep->min_multi_recv_size, rxm_ep->inject_limit,
 		rxm_ep->rxm_info->tx_attr->inject_size,
-		rxm_eager_limit, rxm_ep->sar_limit);
+		rxm_eager_limit, rxm_ep->sar_limit, rxm_ep->rndv_write_min,
+		rxm_ep->sar_window, rxm_ep->rx_slab_size);
 }
 
 static int rxm_ep_txrx_res_open(struct rxm_ep *rxm_ep)
@@ -2595,6 +2752,12 @@ static int rxm_ep_ctrl(struct fid *fid, int command, void *arg)
 			return ret;
 		}
 
+		/* The shm endpoint is named after the listening address and
+		 * has to exist before cmap alloc inserts the AV peers.  Local
+		 * peers fall back to the MSG provider if it can't be opened */
+		if (rxm_ep_shm_usable(rxm_ep))
+			(void) rxm_ep_shm_open(rxm_ep);
+
 		ret = rxm_conn_cmap_alloc(rxm_ep);
 		if (ret)
 			return ret;
@@ -2616,12 +2779,23 @@ static int rxm_ep_ctrl(struct fid *fid, int command, void *arg)
 				goto err;
 			}
 		}
+
+		if (rxm_ep->shm_ep) {
+			ret = rxm_ep_shm_prepost_recv(rxm_ep);
+			if (ret) {
+				rxm_cmap_free(rxm_ep->cmap);
+				FI_WARN(&rxm_prov, FI_LOG_EP_CTRL,
+					"unable to prepost shm recv bufs\n");
+				goto err;
+			}
+		}
 		break;
 	default:
 		return -FI_ENOSYS;
 	}
 	return 0;
 err:
+	rxm_ep_shm_close(rxm_ep);
 	rxm_ep_txrx_res_close(rxm_ep);
 	return ret;
 }
@@ -2738,7 +2912,7 @@ int rxm_endpoint(struct fid_domain *domain, struct fi_info *info,
 
 	if (fi_param_get_int(&rxm_prov, "comp_per_progress",
 			     (int *)&rxm_ep->comp_per_progress))
-		rxm_ep->comp_per_progress = 1;
+		rxm_ep->comp_per_progress = RXM_MSG_CQ_BATCH_MAX;
 
 	if (rxm_ep->rxm_info->caps & FI_COLLECTIVE) {
 		ret = ofi_endpoint_init(domain, &rxm_util_prov, info,
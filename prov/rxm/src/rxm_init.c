@@ -52,7 +52,10 @@
 size_t rxm_msg_tx_size		= 128;
 size_t rxm_msg_rx_size		= 128;
 size_t rxm_eager_limit		= RXM_BUF_SIZE - sizeof(struct rxm_pkt);
+size_t rxm_rndv_write_min	= 0;
+size_t rxm_rx_slab_size		= RXM_RX_SLAB_SIZE;
 int force_auto_progress		= 0;
+int rxm_use_shm			= 0;
 enum fi_wait_obj def_wait_obj = FI_WAIT_FD, def_tcp_wait_obj = FI_WAIT_UNSPEC;
 
 char *rxm_proto_state_str[] = {
@@ -104,8 +107,11 @@ int rxm_info_to_core(uint32_t version, const struct fi_info *hints,
 			core_info->caps |= FI_MSG | FI_SEND | FI_RECV;
 
 		/* FI_RMA cap is needed for large message transfer protocol */
-		if (core_info->caps & FI_MSG)
+		if (core_info->caps & FI_MSG) {
 			core_info->caps |= FI_RMA | FI_READ | FI_REMOTE_READ;
+			if (rxm_rndv_write_min)
+				core_info->caps |= FI_WRITE | FI_REMOTE_WRITE;
+		}
 
 		if (hints->domain_attr) {
 			core_info->domain_attr->caps |= hints->domain_attr->caps;
@@ -419,7 +425,7 @@ RXM_INI
 
 	fi_param_define(&rxm_prov, "comp_per_progress", FI_PARAM_INT,
 			"Defines the maximum number of MSG provider CQ entries "
-			"(default: 1) that would be read per progress "
+			"(default: 64) that would be read per progress "
 			"(RxM CQ read).");
 
 	fi_param_define(&rxm_prov, "sar_limit", FI_PARAM_SIZE_T,
@@ -431,6 +437,26 @@ RXM_INI
 			"of size greater than this would be transmitted via "
 			"rendezvous protocol.", sizeof(struct rxm_pkt));
 
+	fi_param_define(&rxm_prov, "sar_window", FI_PARAM_SIZE_T,
+			"Maximum number of segments of a SAR message that are "
+			"in flight at once (default: %d). The sender copies the "
+			"next segment as soon as one completes, overlapping "
+			"the copy with the transmit of the others.",
+			RXM_SAR_WINDOW);
+
+	fi_param_define(&rxm_prov, "rndv_write_min", FI_PARAM_SIZE_T,
+			"Rendezvous messages of at least this size are "
+			"transferred by the sender writing into the receive "
+			"buffer advertised by the receiver, instead of the "
+			"receiver reading from the send buffer (default: 0, "
+			"always use reads).");
+
+	fi_param_define(&rxm_prov, "rx_slab_size", FI_PARAM_SIZE_T,
+			"Size of the FI_MULTI_RECV buffers that RxM posts to "
+			"MSG providers supporting them, instead of one buffer "
+			"per message (default: 256 KB). Setting this to 0 "
+			"always posts one buffer per message.");
+
 	fi_param_define(&rxm_prov, "use_srx", FI_PARAM_BOOL,
 			"Set this environment variable to control the RxM "
 			"receive path. If this variable set to 1 (default: 0), "
@@ -471,9 +497,19 @@ RXM_INI
 			"Force auto-progress for data transfers even if app "
 			"requested manual progress (default: false/no).");
 
+	fi_param_define(&rxm_prov, "use_shm", FI_PARAM_BOOL,
+			"Send to peers on the same node through the shm "
+			"provider instead of the MSG provider. Connections are "
+			"still set up by the MSG provider, and both peers must "
+			"enable this for shm to be used between them. Only "
+			"used with manual progress and no wait objects "
+			"(default: false/no).");
+
 	rxm_init_infos();
 	fi_param_get_size_t(&rxm_prov, "msg_tx_size", &rxm_msg_tx_size);
 	fi_param_get_size_t(&rxm_prov, "msg_rx_size", &rxm_msg_rx_size);
+	fi_param_get_size_t(&rxm_prov, "rndv_write_min", &rxm_rndv_write_min);
+	fi_param_get_size_t(&rxm_prov, "rx_slab_size", &rxm_rx_slab_size);
 	if (fi_param_get_int(&rxm_prov, "cm_progress_interval",
 				(int *) &rxm_cm_progress_interval))
 		rxm_cm_progress_interval = 10000;
@@ -481,6 +517,7 @@ RXM_INI
 				(int *) &rxm_cq_eq_fairness))
 		rxm_cq_eq_fairness = 128;
 	fi_param_get_bool(&rxm_prov, "data_auto_progress", &force_auto_progress);
+	fi_param_get_bool(&rxm_prov, "use_shm", &rxm_use_shm);
 	rxm_get_def_wait();
 
 	if (force_auto_progress)
@@ -95,9 +95,10 @@ rxm_ep_rma_common(struct rxm_ep *rxm_ep, const struct fi_msg_rma *msg,
 		goto release;
 
 	msg_rma.desc = mr_desc;
+	msg_rma.addr = rxm_conn->tx_addr;
 	msg_rma.context = rma_buf;
 
-	ret = rma_msg(rxm_conn->msg_ep, &msg_rma, flags);
+	ret = rma_msg(rxm_conn->tx_ep, &msg_rma, flags);
 	if (OFI_LIKELY(!ret))
 		goto unlock;
 
@@ -219,8 +220,9 @@ rxm_ep_rma_emulate_inject_msg(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 	rxm_ep_format_rma_msg(rma_buf, msg, &rxm_msg_iov, &rxm_rma_msg);
 
 	flags = (flags & ~FI_INJECT) | FI_COMPLETION;
+	rxm_rma_msg.addr = rxm_conn->tx_addr;
 
-	ret = fi_writemsg(rxm_conn->msg_ep, &rxm_rma_msg, flags);
+	ret = fi_writemsg(rxm_conn->tx_ep, &rxm_rma_msg, flags);
 	if (OFI_UNLIKELY(ret)) {
 		if (ret == -FI_EAGAIN)
 			rxm_ep_do_progress(&rxm_ep->util_ep);
@@ -284,15 +286,15 @@ rxm_ep_rma_inject_common(struct rxm_ep *rxm_ep, const struct fi_msg_rma *msg,
 	}
 
 	if (flags & FI_REMOTE_CQ_DATA) {
-		ret = fi_inject_writedata(rxm_conn->msg_ep,
+		ret = fi_inject_writedata(rxm_conn->tx_ep,
 					  msg->msg_iov->iov_base,
 					  msg->msg_iov->iov_len, msg->data,
-					  msg->addr, msg->rma_iov->addr,
+					  rxm_conn->tx_addr, msg->rma_iov->addr,
 					  msg->rma_iov->key);
 	} else {
-		ret = fi_inject_write(rxm_conn->msg_ep,
+		ret = fi_inject_write(rxm_conn->tx_ep,
 				      msg->msg_iov->iov_base,
-				      msg->msg_iov->iov_len, msg->addr,
+				      msg->msg_iov->iov_len, rxm_conn->tx_addr,
 				      msg->rma_iov->addr,
 				      msg->rma_iov->key);
 	}
@@ -440,7 +442,8 @@ static ssize_t rxm_ep_inject_write(struct fid_ep *ep_fid, const void *buf,
 		goto unlock;
 	}
 
-	ret = fi_inject_write(rxm_conn->msg_ep, buf, len, dest_addr, addr, key);
+	ret = fi_inject_write(rxm_conn->tx_ep, buf, len, rxm_conn->tx_addr,
+			      addr, key);
 	if (ret == -FI_EAGAIN)
 		rxm_ep_do_progress(&rxm_ep->util_ep);
 	else if (ret)
@@ -475,8 +478,8 @@ static ssize_t rxm_ep_inject_writedata(struct fid_ep *ep_fid, const void *buf,
 		goto unlock;
 	}
 
-	ret = fi_inject_writedata(rxm_conn->msg_ep, buf, len,
-				  data, dest_addr, addr, key);
+	ret = fi_inject_writedata(rxm_conn->tx_ep, buf, len,
+				  data, rxm_conn->tx_addr, addr, key);
 	if (ret == -FI_EAGAIN)
 		rxm_ep_do_progress(&rxm_ep->util_ep);
 	else if (ret)
@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2020 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <arpa/inet.h>
+
+#include "rxm.h"
+
+/*
+ * Intra-node fast path
+ *
+ * Each RxM endpoint may open a secondary shm endpoint named after its
+ * listening address.  Peers whose address resolves to this node are
+ * inserted into the shm AV when they are inserted into the cmap, and the
+ * MSG connection request carries a flag telling the other side whether
+ * we can reach it through shm.  Once both sides agree, the connection's
+ * data path (eager, SAR, RMA and atomic packets) moves to the shm
+ * endpoint, while the MSG connection is kept for connection management.
+ * Packets arriving on the shm endpoint carry the same conn_id as on the
+ * MSG endpoint, so they are matched to their connection as with a shared
+ * receive context.
+ */
+
+#define RXM_SHM_PREFIX		"fi_rxm_"
+#define RXM_SHM_NAME_MAX	64
+
+static int rxm_shm_name(const void *addr, char *name, size_t len)
+{
+	const struct sockaddr *sa = addr;
+	char ip[INET6_ADDRSTRLEN];
+	int ret;
+
+	if (!ofi_get_ipaddr(sa) ||
+	    !inet_ntop(sa->sa_family, ofi_get_ipaddr(sa), ip, sizeof(ip)))
+		return -FI_EINVAL;
+
+	ret = snprintf(name, len, RXM_SHM_PREFIX "%s_%" PRIu16, ip,
+		       ofi_addr_get_port(sa));
+	return (ret < 0 || (size_t) ret >= len) ? -FI_ETOOSMALL : 0;
+}
+
+int rxm_shm_domain_open(struct rxm_domain *rxm_domain, struct fi_info *info)
+{
+	struct fi_info *hints;
+	int ret;
+
+	if (!rxm_use_shm)
+		return 0;
+
+	/* shm can't report these on behalf of the MSG provider */
+	if (info->caps & (FI_RMA_EVENT | FI_HMEM))
+		return 0;
+
+	hints = fi_allocinfo();
+	if (!hints)
+		return -FI_ENOMEM;
+
+	hints->fabric_attr->prov_name = strdup("shm");
+	if (!hints->fabric_attr->prov_name) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	/* Rendezvous reads large messages with shm RMA */
+	hints->caps = FI_MSG | FI_RMA;
+	hints->addr_format = FI_ADDR_STR;
+	hints->ep_attr->type = FI_EP_RDM;
+	hints->tx_attr->msg_order = FI_ORDER_SAS;
+	hints->rx_attr->msg_order = FI_ORDER_SAS;
+	hints->domain_attr->av_type = FI_AV_TABLE;
+	hints->domain_attr->threading = FI_THREAD_SAFE;
+	/* RMA addresses and keys are the ones of the MSG provider MRs */
+	hints->domain_attr->mr_mode = RXM_MR_VIRT_ADDR(info) ?
+				      FI_MR_VIRT_ADDR : 0;
+
+	ret = fi_getinfo(fi_version(), NULL, NULL, 0, hints,
+			 &rxm_domain->shm_info);
+	if (ret) {
+		FI_INFO(&rxm_prov, FI_LOG_DOMAIN,
+			"shm not available, local peers go through the MSG "
+			"provider: %d\n", ret);
+		ret = 0;
+		goto out;
+	}
+
+	ret = fi_fabric(rxm_domain->shm_info->fabric_attr,
+			&rxm_domain->shm_fabric, NULL);
+	if (ret)
+		goto err;
+
+	ret = fi_domain(rxm_domain->shm_fabric, rxm_domain->shm_info,
+			&rxm_domain->shm_domain, NULL);
+	if (ret)
+		goto err;
+
+	FI_INFO(&rxm_prov, FI_LOG_DOMAIN, "using shm for local peers\n");
+	goto out;
+err:
+	FI_WARN(&rxm_prov, FI_LOG_DOMAIN, "unable to open shm domain: %d\n",
+		ret);
+	rxm_shm_domain_close(rxm_domain);
+	ret = 0;
+out:
+	fi_freeinfo(hints);
+	return ret;
+}
+
+void rxm_shm_domain_close(struct rxm_domain *rxm_domain)
+{
+	if (rxm_domain->shm_domain) {
+		fi_close(&rxm_domain->shm_domain->fid);
+		rxm_domain->shm_domain = NULL;
+	}
+	if (rxm_domain->shm_fabric) {
+		fi_close(&rxm_domain->shm_fabric->fid);
+		rxm_domain->shm_fabric = NULL;
+	}
+	fi_freeinfo(rxm_domain->shm_info);
+	rxm_domain->shm_info = NULL;
+}
+
+/*
+ * Remote memory is registered with shm under the MSG provider key, so the
+ * key an application exchanges is valid whichever way the peer reaches us.
+ */
+int rxm_shm_mr_reg(struct rxm_mr *rxm_mr, const struct fi_mr_attr *attr,
+		   uint64_t flags)
+{
+	struct fi_mr_attr shm_attr = *attr;
+	int ret;
+
+	if (!rxm_mr->domain->shm_domain ||
+	    !(attr->access & (FI_REMOTE_READ | FI_REMOTE_WRITE)))
+		return 0;
+
+	shm_attr.requested_key = rxm_mr->mr_fid.key;
+	ret = fi_mr_regattr(rxm_mr->domain->shm_domain, &shm_attr, flags,
+			    &rxm_mr->shm_mr);
+	if (ret)
+		FI_WARN(&rxm_prov, FI_LOG_DOMAIN,
+			"unable to register MR with shm: %d\n", ret);
+	return ret;
+}
+
+/*
+ * Buffers of a rendezvous send registered by rxm are registered with shm
+ * as well, under the keys of their MSG provider MRs, so that a local peer
+ * reads them with a single copy.
+ */
+int rxm_shm_mr_regv(struct rxm_ep *rxm_ep, const struct iovec *iov,
+		    size_t count, struct fid_mr **msg_mr,
+		    struct fid_mr **shm_mr)
+{
+	struct rxm_domain *rxm_domain;
+	struct fi_mr_attr attr = {
+		.iov_count = 1,
+		.access = FI_REMOTE_READ,
+	};
+	size_t i;
+	int ret;
+
+	rxm_domain = container_of(rxm_ep->util_ep.domain, struct rxm_domain,
+				  util_domain);
+
+	for (i = 0; i < count; i++) {
+		attr.mr_iov = &iov[i];
+		attr.requested_key = fi_mr_key(msg_mr[i]);
+		ret = fi_mr_regattr(rxm_domain->shm_domain, &attr, 0,
+				    &shm_mr[i]);
+		if (ret) {
+			FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
+				"unable to register MR with shm: %d\n", ret);
+			rxm_msg_mr_closev(shm_mr, i);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int rxm_ep_shm_open(struct rxm_ep *rxm_ep)
+{
+	struct rxm_domain *rxm_domain;
+	struct fi_av_attr av_attr = {
+		.type = FI_AV_TABLE,
+	};
+	struct fi_cq_attr cq_attr = {
+		.format = FI_CQ_FORMAT_DATA,
+		.wait_obj = FI_WAIT_NONE,
+	};
+	struct sockaddr_storage addr;
+	size_t len = sizeof(addr);
+	char name[RXM_SHM_NAME_MAX];
+	int ret;
+
+	rxm_domain = container_of(rxm_ep->util_ep.domain, struct rxm_domain,
+				  util_domain);
+
+	ret = fi_getname(&rxm_ep->msg_pep->fid, &addr, &len);
+	if (ret)
+		return ret;
+
+	ret = rxm_shm_name(&addr, name, sizeof(name));
+	if (ret)
+		return ret;
+
+	av_attr.count = rxm_ep->util_ep.av->count;
+	ret = fi_av_open(rxm_domain->shm_domain, &av_attr, &rxm_ep->shm_av,
+			 NULL);
+	if (ret)
+		goto err;
+
+	cq_attr.size = rxm_domain->shm_info->tx_attr->size +
+		       rxm_domain->shm_info->rx_attr->size;
+	ret = fi_cq_open(rxm_domain->shm_domain, &cq_attr, &rxm_ep->shm_cq,
+			 NULL);
+	if (ret)
+		goto err;
+
+	ret = fi_endpoint(rxm_domain->shm_domain, rxm_domain->shm_info,
+			  &rxm_ep->shm_ep, rxm_ep);
+	if (ret)
+		goto err;
+
+	ret = fi_setname(&rxm_ep->shm_ep->fid, name, strlen(name) + 1);
+	if (ret)
+		goto err;
+
+	ret = fi_ep_bind(rxm_ep->shm_ep, &rxm_ep->shm_av->fid, 0);
+	if (ret)
+		goto err;
+
+	ret = fi_ep_bind(rxm_ep->shm_ep, &rxm_ep->shm_cq->fid,
+			 FI_TRANSMIT | FI_RECV);
+	if (ret)
+		goto err;
+
+	ret = fi_enable(rxm_ep->shm_ep);
+	if (ret)
+		goto err;
+
+	rxm_ep->shm_cq_batch = RXM_MSG_CQ_BATCH_MIN;
+	FI_INFO(&rxm_prov, FI_LOG_EP_CTRL, "opened shm endpoint %s\n", name);
+	return 0;
+err:
+	FI_WARN(&rxm_prov, FI_LOG_EP_CTRL,
+		"unable to open shm endpoint: %d\n", ret);
+	rxm_ep_shm_close(rxm_ep);
+	return ret;
+}
+
+void rxm_ep_shm_close(struct rxm_ep *rxm_ep)
+{
+	if (rxm_ep->shm_ep) {
+		fi_close(&rxm_ep->shm_ep->fid);
+		rxm_ep->shm_ep = NULL;
+	}
+	if (rxm_ep->shm_cq) {
+		fi_close(&rxm_ep->shm_cq->fid);
+		rxm_ep->shm_cq = NULL;
+	}
+	if (rxm_ep->shm_av) {
+		fi_close(&rxm_ep->shm_av->fid);
+		rxm_ep->shm_av = NULL;
+	}
+}
+
+int rxm_ep_shm_prepost_recv(struct rxm_ep *rxm_ep)
+{
+	struct rxm_domain *rxm_domain;
+	struct rxm_rx_buf *rx_buf;
+	size_t i, count;
+	int ret;
+
+	rxm_domain = container_of(rxm_ep->util_ep.domain, struct rxm_domain,
+				  util_domain);
+	count = MIN(rxm_domain->shm_info->rx_attr->size,
+		    rxm_ep->rxm_info->rx_attr->size);
+
+	for (i = 0; i < count; i++) {
+		rx_buf = rxm_rx_buf_alloc(rxm_ep, rxm_ep->shm_ep, 1);
+		if (!rx_buf)
+			return -FI_ENOMEM;
+
+		ret = rxm_msg_ep_recv(rx_buf);
+		if (ret) {
+			ofi_buf_free(&rx_buf->hdr);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static bool rxm_shm_is_local(struct rxm_ep *rxm_ep, const void *addr)
+{
+	const struct sockaddr *sa = addr;
+
+	switch (sa->sa_family) {
+	case AF_INET:
+		if ((ntohl(ofi_sin_addr(sa).s_addr) >> 24) == IN_LOOPBACKNET)
+			return true;
+		break;
+	case AF_INET6:
+		if (IN6_IS_ADDR_LOOPBACK(&ofi_sin6_addr(sa)))
+			return true;
+		break;
+	default:
+		return false;
+	}
+	return ofi_equals_ipaddr(sa, rxm_ep->cmap->attr.name);
+}
+
+/*
+ * Returns the shm address of a peer on this node, or FI_ADDR_NOTAVAIL if
+ * the peer has to be reached through the MSG provider.
+ */
+fi_addr_t rxm_shm_av_insert(struct rxm_ep *rxm_ep, const void *addr)
+{
+	char name[RXM_SHM_NAME_MAX];
+	fi_addr_t shm_addr;
+
+	if (!rxm_ep->shm_ep || !rxm_shm_is_local(rxm_ep, addr) ||
+	    rxm_shm_name(addr, name, sizeof(name)))
+		return FI_ADDR_NOTAVAIL;
+
+	if (fi_av_insert(rxm_ep->shm_av, name, 1, &shm_addr, 0, NULL) != 1) {
+		FI_WARN(&rxm_prov, FI_LOG_AV,
+			"unable to insert %s into shm AV\n", name);
+		return FI_ADDR_NOTAVAIL;
+	}
+	return shm_addr;
+}
+
+/*
+ * Checks that a peer asking for shm, which opened its shm endpoint before
+ * connecting, is in our shm AV under the name of that endpoint.
+ */
+bool rxm_shm_peer_lookup(struct rxm_ep *rxm_ep, fi_addr_t shm_addr,
+			 const void *addr)
+{
+	char name[RXM_SHM_NAME_MAX], av_name[RXM_SHM_NAME_MAX];
+	size_t len = sizeof(av_name);
+
+	if (!rxm_ep->shm_ep || shm_addr == FI_ADDR_NOTAVAIL ||
+	    rxm_shm_name(addr, name, sizeof(name)))
+		return false;
+
+	if (fi_av_lookup(rxm_ep->shm_av, shm_addr, av_name, &len))
+		return false;
+
+	return !strncmp(name, av_name, sizeof(name));
+}
+
+void rxm_conn_use_shm(struct rxm_conn *rxm_conn)
+{
+	FI_DBG(&rxm_prov, FI_LOG_EP_CTRL,
+	       "sending to conn %p through shm\n", rxm_conn);
+	rxm_conn->tx_ep = rxm_conn->handle.cmap->ep->shm_ep;
+	rxm_conn->tx_addr = rxm_conn->shm_addr;
+}
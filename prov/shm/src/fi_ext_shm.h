@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2021 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _FI_EXT_SHM_H_
+#define _FI_EXT_SHM_H_
+
+/*
+ * See the fi_shm.7 man page for information about the shm provider
+ * extensions provided in this header.
+ */
+
+#include <stddef.h>
+#include <rdma/fabric.h>
+
+/* FI_OPT_ENDPOINT option names */
+enum {
+	FI_OPT_SHM_MAP_STATS = (1U | FI_PROV_SPECIFIC),	/* struct fi_shm_map_stats */
+};
+
+/*
+ * Peer region mapping counters of the AV an endpoint is bound to, read
+ * with fi_getopt.
+ */
+struct fi_shm_map_stats {
+	size_t		mapped;		/* peer regions mapped */
+	size_t		unmapped;	/* peer regions unmapped */
+	size_t		over_limit;	/* maps made past FI_SHM_MAX_MAPPED_PEERS */
+};
+
+#endif /* _FI_EXT_SHM_H_ */
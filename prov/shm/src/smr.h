@@ -60,15 +60,50 @@
 #include <ofi_signal.h>
 #include <ofi_util.h>
 #include <ofi_atomic.h>
+#include <ofi_match.h>
+
+#include "fi_ext_shm.h"
 
 #ifndef _SMR_H_
 #define _SMR_H_
 
 struct smr_env {
+	size_t inject_threshold;
+	size_t remote_inject_threshold;
 	size_t sar_threshold;
+	size_t remote_sar_threshold;
+	size_t max_mapped_peers;
+	size_t sar_seg_count;
 };
 
 extern struct smr_env smr_env;
+
+void smr_tune_init(const char *path, int calibrate);
+
+/*
+ * Sizes above the inject threshold use CMA when it is available.  Peers on
+ * another NUMA node use their own threshold, since the inject buffer they
+ * copy into lives in remote memory.  Without CMA the inject buffer is still
+ * used up to its full size, since the alternative is the much slower SAR
+ * protocol.
+ */
+static inline int smr_use_inject(struct smr_region *smr,
+				 struct smr_region *peer_smr, size_t len)
+{
+	if (len <= (smr_remote_node(smr, peer_smr) ?
+		    smr_env.remote_inject_threshold : smr_env.inject_threshold))
+		return 1;
+
+	return len <= SMR_INJECT_SIZE && smr->cma_cap != SMR_CMA_CAP_ON;
+}
+
+/* Without CMA, sizes above the SAR threshold go through an mmapped file */
+static inline int smr_use_sar(struct smr_region *smr,
+			      struct smr_region *peer_smr, size_t len)
+{
+	return len <= (smr_remote_node(smr, peer_smr) ?
+		       smr_env.remote_sar_threshold : smr_env.sar_threshold);
+}
 extern struct fi_provider smr_prov;
 extern struct fi_info smr_info;
 extern struct util_prov smr_util_prov;
@@ -97,11 +132,8 @@ int smr_query_atomic(struct fid_domain *domain, enum fi_datatype datatype,
 #define SMR_IOV_LIMIT		4
 
 struct smr_rx_entry {
-	struct dlist_entry	entry;
+	struct ofi_match_entry	match;
 	void			*context;
-	fi_addr_t		addr;
-	uint64_t		tag;
-	uint64_t		ignore;
 	struct iovec		iov[SMR_IOV_LIMIT];
 	uint32_t		iov_count;
 	uint16_t		flags;
@@ -118,6 +150,7 @@ struct smr_tx_entry {
 	int		next;
 	void		*map_ptr;
 	struct smr_ep_name *map_name;
+	int64_t		cmd_pos;
 };
 
 struct smr_sar_entry {
@@ -138,25 +171,8 @@ typedef int (*smr_tx_comp_func)(struct smr_ep *ep, void *context, uint32_t op,
 		uint16_t flags, uint64_t err);
 
 
-struct smr_match_attr {
-	fi_addr_t	addr;
-	uint64_t	tag;
-	uint64_t	ignore;
-};
-
-static inline int smr_match_addr(fi_addr_t addr, fi_addr_t match_addr)
-{
-	return (addr == FI_ADDR_UNSPEC) || (match_addr == FI_ADDR_UNSPEC) ||
-		(addr == match_addr);
-}
-
-static inline int smr_match_tag(uint64_t tag, uint64_t ignore, uint64_t match_tag)
-{
-	return ((tag | ignore) == (match_tag | ignore));
-}
-
 struct smr_unexp_msg {
-	struct dlist_entry entry;
+	struct ofi_match_entry match;
 	struct smr_cmd cmd;
 };
 
@@ -165,11 +181,6 @@ DECLARE_FREESTACK(struct smr_unexp_msg, smr_unexp_fs);
 DECLARE_FREESTACK(struct smr_tx_entry, smr_pend_fs);
 DECLARE_FREESTACK(struct smr_sar_entry, smr_sar_fs);
 
-struct smr_queue {
-	struct dlist_entry list;
-	dlist_func_t *match_func;
-};
-
 struct smr_fabric {
 	struct util_fabric	util_fabric;
 	int			dom_idx;
@@ -219,16 +230,45 @@ struct smr_ep {
 	uint64_t		msg_id;
 	struct smr_region	*region;
 	struct smr_recv_fs	*recv_fs; /* protected by rx_cq lock */
-	struct smr_queue	recv_queue;
-	struct smr_queue	trecv_queue;
+	struct ofi_match_queue	recv_queue;
+	struct ofi_match_queue	trecv_queue;
 	struct smr_unexp_fs	*unexp_fs;
 	struct smr_pend_fs	*pend_fs;
 	struct smr_sar_fs	*sar_fs;
-	struct smr_queue	unexp_msg_queue;
-	struct smr_queue	unexp_tagged_queue;
+	struct ofi_match_queue	unexp_msg_queue;
+	struct ofi_match_queue	unexp_tagged_queue;
 	struct dlist_entry	sar_list;
+
+	/*
+	 * Progress batching.  Command credits are handed back to senders and
+	 * CQ wait objects are signaled once per batch instead of once per
+	 * command.  The rx fields are protected by the rx cq lock, the tx
+	 * fields by the tx cq lock.
+	 */
+	int			cmd_credits;
+	bool			rx_batch;
+	bool			rx_signal;
+	bool			tx_batch;
+	bool			tx_signal;
 };
 
+/* Max commands or responses handled per lock hold in a progress call */
+#define SMR_PROGRESS_BATCH	64
+
+/* Called with the rx cq lock held */
+static inline void smr_return_cmd(struct smr_ep *ep)
+{
+	ep->cmd_credits++;
+}
+
+static inline void smr_flush_cmd_credits(struct smr_ep *ep)
+{
+	if (ep->cmd_credits) {
+		ofi_atomic_add64(&ep->region->cmd_cnt, ep->cmd_credits);
+		ep->cmd_credits = 0;
+	}
+}
+
 #define smr_ep_rx_flags(smr_ep) ((smr_ep)->util_ep.rx_op_flags)
 #define smr_ep_tx_flags(smr_ep) ((smr_ep)->util_ep.tx_op_flags)
 
@@ -249,10 +289,10 @@ int smr_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
 
 int smr_verify_peer(struct smr_ep *ep, int peer_id);
 
-void smr_format_pend_resp(struct smr_tx_entry *pend, struct smr_cmd *cmd,
-			  void *context, const struct iovec *iov,
-			  uint32_t iov_count, fi_addr_t id,
-			  struct smr_resp *resp);
+void smr_format_pend_resp(struct smr_ep *ep, struct smr_tx_entry *pend,
+			  struct smr_cmd *cmd, void *context,
+			  const struct iovec *iov, uint32_t iov_count,
+			  fi_addr_t id, struct smr_resp *resp);
 void smr_generic_format(struct smr_cmd *cmd, fi_addr_t peer_id, uint32_t op,
 			uint64_t tag, uint64_t data, uint64_t op_flags);
 void smr_format_inline(struct smr_cmd *cmd, const struct iovec *iov,
@@ -304,6 +344,6 @@ uint64_t smr_rx_cq_flags(uint32_t op, uint16_t op_flags);
 void smr_ep_progress(struct util_ep *util_ep);
 
 int smr_progress_unexp_queue(struct smr_ep *ep, struct smr_rx_entry *entry,
-			     struct smr_queue *unexp_queue);
+			     struct ofi_match_queue *unexp_queue);
 
 #endif
@@ -128,9 +128,10 @@ static ssize_t smr_generic_atomic(struct smr_ep *ep,
 {
 	struct smr_region *peer_smr;
 	struct smr_inject_buf *tx_buf;
-	struct smr_tx_entry *pend;
+	struct smr_tx_entry *pend = NULL;
+	int64_t pos;
 	struct smr_resp *resp = NULL;
-	struct smr_cmd *cmd;
+	struct smr_cmd cmd[2];
 	struct iovec iov[SMR_IOV_LIMIT];
 	struct iovec compare_iov[SMR_IOV_LIMIT];
 	struct iovec result_iov[SMR_IOV_LIMIT];
@@ -145,26 +146,25 @@ static ssize_t smr_generic_atomic(struct smr_ep *ep,
 	assert(rma_count <= SMR_IOV_LIMIT);
 
 	id = (int) addr;
-	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 
 	ret = smr_verify_peer(ep, id);
 	if (ret)
 		return ret;
 
+	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 	peer_smr = smr_peer_region(ep->region, id);
-	fastlock_acquire(&peer_smr->lock);
-	if (peer_smr->cmd_cnt < 2 || smr_peer_data(ep->region)[id].sar_status) {
+	if (smr_cmd_queue_reserve(peer_smr, 2)) {
 		ret = -FI_EAGAIN;
-		goto unlock_region;
+		goto out;
 	}
 
 	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq) ||
+	    smr_peer_data(ep->region)[id].sar_status) {
 		ret = -FI_EAGAIN;
 		goto unlock_cq;
 	}
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
 	total_len = ofi_datatype_size(datatype) * ofi_total_ioc_cnt(ioc, count);
 	
 	switch (op) {
@@ -192,29 +192,29 @@ static ssize_t smr_generic_atomic(struct smr_ep *ep,
 		break;
 	}
 
-	smr_generic_format(cmd, peer_id, op, 0, 0, op_flags);
-	smr_generic_atomic_format(cmd, datatype, atomic_op);
+	smr_generic_format(&cmd[0], peer_id, op, 0, 0, op_flags);
+	smr_generic_atomic_format(&cmd[0], datatype, atomic_op);
 
 	if (total_len <= SMR_MSG_DATA_LEN && !(flags & SMR_RMA_REQ) &&
 	    !(op_flags & FI_DELIVERY_COMPLETE)) {
-		smr_format_inline_atomic(cmd, iov, count, compare_iov,
+		smr_format_inline_atomic(&cmd[0], iov, count, compare_iov,
 					 compare_count);
 	} else if (total_len <= SMR_INJECT_SIZE) {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
-		smr_format_inject_atomic(cmd, iov, count, result_iov,
+		if ((flags & SMR_RMA_REQ || op_flags & FI_DELIVERY_COMPLETE) &&
+		    ofi_cirque_isfull(smr_resp_queue(ep->region))) {
+			ret = -FI_EAGAIN;
+			goto unlock_cq;
+		}
+		tx_buf = smr_inject_buf_get(peer_smr);
+		smr_format_inject_atomic(&cmd[0], iov, count, result_iov,
 					 result_count, compare_iov, compare_count,
 					 peer_smr, tx_buf);
 		if (flags & SMR_RMA_REQ || op_flags & FI_DELIVERY_COMPLETE) {
-			if (ofi_cirque_isfull(smr_resp_queue(ep->region))) {
-				smr_freestack_push(smr_inject_pool(peer_smr), tx_buf);
-				ret = -FI_EAGAIN;
-				goto unlock_cq;
-			}
 			resp = ofi_cirque_tail(smr_resp_queue(ep->region));
 			pend = freestack_pop(ep->pend_fs);
-			smr_format_pend_resp(pend, cmd, context, result_iov,
+			smr_format_pend_resp(ep, pend, &cmd[0], context, result_iov,
 					     result_count, id, resp);
-			cmd->msg.hdr.data = smr_get_offset(ep->region, resp);
+			cmd[0].msg.hdr.data = smr_get_offset(ep->region, resp);
 			ofi_cirque_commit(smr_resp_queue(ep->region));
 		}
 	} else {
@@ -223,28 +223,28 @@ static ssize_t smr_generic_atomic(struct smr_ep *ep,
 		ret = -FI_EINVAL;
 		goto unlock_cq;
 	}
-	cmd->msg.hdr.op_flags |= flags;
-
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
+	cmd[0].msg.hdr.op_flags |= flags;
+	smr_format_rma_ioc(&cmd[1], rma_ioc, rma_count);
+	pos = smr_cmd_queue_post(smr_cmd_queue(peer_smr), cmd, 2);
+	if (pend)
+		pend->cmd_pos = pos;
 
 	if (!resp) {
-		ret = smr_complete_tx(ep, context, op, cmd->msg.hdr.op_flags,
+		ret = smr_complete_tx(ep, context, op, cmd[0].msg.hdr.op_flags,
 				      err);
 		if (ret) {
 			FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
 				"unable to process tx completion\n");
 		}
 	}
+	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	goto out;
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_format_rma_ioc(cmd, rma_ioc, rma_count);
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
 unlock_cq:
 	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
-unlock_region:
-	fastlock_release(&peer_smr->lock);
+	smr_cmd_queue_release(peer_smr, 2);
+out:
+	smr_peer_release(ep->region, id);
 	return ret;
 }
 
@@ -311,7 +311,7 @@ static ssize_t smr_atomic_inject(struct fid_ep *ep_fid, const void *buf,
 	struct smr_ep *ep;
 	struct smr_region *peer_smr;
 	struct smr_inject_buf *tx_buf;
-	struct smr_cmd *cmd;
+	struct smr_cmd cmd[2];
 	struct iovec iov;
 	struct fi_rma_ioc rma_ioc;
 	int id, peer_id;
@@ -323,20 +323,20 @@ static ssize_t smr_atomic_inject(struct fid_ep *ep_fid, const void *buf,
 	ep = container_of(ep_fid, struct smr_ep, util_ep.ep_fid.fid);
 
 	id = (int) dest_addr;
-	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 
 	ret = smr_verify_peer(ep, id);
 	if (ret)
 		return ret;
 
+	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 	peer_smr = smr_peer_region(ep->region, id);
-	fastlock_acquire(&peer_smr->lock);
-	if (peer_smr->cmd_cnt < 2 || smr_peer_data(ep->region)[id].sar_status) {
+	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
+	if (smr_peer_data(ep->region)[id].sar_status ||
+	    smr_cmd_queue_reserve(peer_smr, 2)) {
 		ret = -FI_EAGAIN;
-		goto unlock_region;
+		goto unlock_cq;
 	}
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
 	total_len = count * ofi_datatype_size(datatype);
 	
 	iov.iov_base = (void *) buf;
@@ -346,27 +346,24 @@ static ssize_t smr_atomic_inject(struct fid_ep *ep_fid, const void *buf,
 	rma_ioc.count = count;
 	rma_ioc.key = key;
 
-	smr_generic_format(cmd, peer_id, ofi_op_atomic, 0, 0, 0);
-	smr_generic_atomic_format(cmd, datatype, op);
+	smr_generic_format(&cmd[0], peer_id, ofi_op_atomic, 0, 0, 0);
+	smr_generic_atomic_format(&cmd[0], datatype, op);
 
 	if (total_len <= SMR_MSG_DATA_LEN) {
-		smr_format_inline_atomic(cmd, &iov, 1, NULL, 0);
+		smr_format_inline_atomic(&cmd[0], &iov, 1, NULL, 0);
 	} else if (total_len <= SMR_INJECT_SIZE) {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
-		smr_format_inject_atomic(cmd, &iov, 1, NULL, 0, NULL, 0,
+		tx_buf = smr_inject_buf_get(peer_smr);
+		smr_format_inject_atomic(&cmd[0], &iov, 1, NULL, 0, NULL, 0,
 					 peer_smr, tx_buf);
 	}
 
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_format_rma_ioc(cmd, &rma_ioc, 1);
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
+	smr_format_rma_ioc(&cmd[1], &rma_ioc, 1);
+	smr_cmd_queue_post(smr_cmd_queue(peer_smr), cmd, 2);
 
 	ofi_ep_tx_cntr_inc_func(&ep->util_ep, ofi_op_atomic);
-unlock_region:
-	fastlock_release(&peer_smr->lock);
+unlock_cq:
+	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	smr_peer_release(ep->region, id);
 	return ret;
 }
 
@@ -71,7 +71,7 @@ static int smr_av_insert(struct fid_av *av_fid, const void *addr, size_t count,
 	smr_av = container_of(util_av, struct smr_av, util_av);
 
 	for (i = 0; i < count; i++, addr = (char *) addr + strlen(addr) + 1) {
-		if (smr_av->used < SMR_MAX_PEERS) {
+		if (smr_av->used < util_av->count) {
 			ep_name = smr_no_prefix(addr);
 			ret = ofi_av_insert_addr(util_av, ep_name, &index);
 		} else {
@@ -98,6 +98,9 @@ static int smr_av_insert(struct fid_av *av_fid, const void *addr, size_t count,
 		if (fi_addr)
 			fi_addr[i] = (ret == 0) ? index : FI_ADDR_NOTAVAIL;
 
+		if (ret)
+			continue;
+
 		dlist_foreach(&util_av->ep_list, av_entry) {
 			util_ep = container_of(av_entry, struct util_ep, av_entry);
 			smr_ep = container_of(util_ep, struct smr_ep, util_ep);
@@ -152,19 +155,19 @@ static int smr_av_lookup(struct fid_av *av, fi_addr_t fi_addr, void *addr,
 {
 	struct util_av *util_av;
 	struct smr_av *smr_av;
-	struct smr_region *peer_smr;
+	struct smr_peer *peer;
 	int peer_id = (int)fi_addr;
 
 	util_av = container_of(av, struct util_av, av_fid);
 	smr_av = container_of(util_av, struct smr_av, util_av);
-	peer_smr = smr_map_get(smr_av->smr_map, peer_id);
+	peer = smr_map_peer(smr_av->smr_map, peer_id);
 
-	if (!peer_smr)
+	if (!peer)
 		return -FI_ADDR_NOTAVAIL;
 
-	strncpy((char *)addr, smr_name(peer_smr), *addrlen);
-	((char *) addr)[MIN(*addrlen - 1, strlen(smr_name(peer_smr)))] = '\0';
-	*addrlen = strlen(smr_name(peer_smr) + 1);
+	strncpy((char *)addr, peer->peer.name, *addrlen);
+	((char *) addr)[MIN(*addrlen - 1, strlen(peer->peer.name))] = '\0';
+	*addrlen = strlen(peer->peer.name + 1);
 	return 0;
 }
 
@@ -222,11 +225,6 @@ int smr_av_open(struct fid_domain *domain, struct fi_av_attr *attr,
 
 	util_attr.addrlen = NAME_MAX;
 	util_attr.flags = 0;
-	if (attr->count > SMR_MAX_PEERS) {
-		ret = -FI_ENOSYS;
-		goto out;
-	}
-
 	ret = ofi_av_init(util_domain, attr, &util_attr, &smr_av->util_av, context);
 	if (ret)
 		goto out;
@@ -236,7 +234,8 @@ int smr_av_open(struct fid_domain *domain, struct fi_av_attr *attr,
 	(*av)->fid.ops = &smr_av_fi_ops;
 	(*av)->ops = &smr_av_ops;
 
-	ret = smr_map_create(&smr_prov, SMR_MAX_PEERS, &smr_av->smr_map);
+	ret = smr_map_create(&smr_prov, smr_env.max_mapped_peers,
+			     &smr_av->smr_map);
 	if (ret)
 		goto close;
 
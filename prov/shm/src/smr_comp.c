@@ -84,7 +84,10 @@ int smr_tx_comp_signal(struct smr_ep *ep, void *context, uint32_t op,
 	ret = smr_tx_comp(ep, context, op, flags, err);
 	if (ret)
 		return ret;
-	ep->util_ep.tx_cq->wait->signal(ep->util_ep.tx_cq->wait);
+	if (ep->tx_batch)
+		ep->tx_signal = true;
+	else
+		ep->util_ep.tx_cq->wait->signal(ep->util_ep.tx_cq->wait);
 	return 0;
 }
 
@@ -155,7 +158,10 @@ int smr_rx_comp_signal(struct smr_ep *ep, void *context, uint32_t op,
 	ret = smr_rx_comp(ep, context, op, flags, len, buf, addr, tag, data, err);
 	if (ret)
 		return ret;
-	ep->util_ep.rx_cq->wait->signal(ep->util_ep.rx_cq->wait);
+	if (ep->rx_batch)
+		ep->rx_signal = true;
+	else
+		ep->util_ep.rx_cq->wait->signal(ep->util_ep.rx_cq->wait);
 	return 0;
 }
 
@@ -169,7 +175,10 @@ int smr_rx_src_comp_signal(struct smr_ep *ep, void *context, uint32_t op,
 			      tag, data, err);
 	if (ret)
 		return ret;
-	ep->util_ep.rx_cq->wait->signal(ep->util_ep.rx_cq->wait);
+	if (ep->rx_batch)
+		ep->rx_signal = true;
+	else
+		ep->util_ep.rx_cq->wait->signal(ep->util_ep.rx_cq->wait);
 	return 0;
 
 }
@@ -96,12 +96,36 @@ int smr_getopt(fid_t fid, int level, int optname,
 {
 	struct smr_ep *smr_ep =
 		container_of(fid, struct smr_ep, util_ep.ep_fid);
+	struct fi_shm_map_stats *stats;
+	struct smr_map *map;
 
-	if ((level != FI_OPT_ENDPOINT) || (optname != FI_OPT_MIN_MULTI_RECV))
+	if (level != FI_OPT_ENDPOINT)
 		return -FI_ENOPROTOOPT;
 
-	*(size_t *)optval = smr_ep->min_multi_recv_size;
-	*optlen = sizeof(size_t);
+	switch (optname) {
+	case FI_OPT_MIN_MULTI_RECV:
+		*(size_t *)optval = smr_ep->min_multi_recv_size;
+		*optlen = sizeof(size_t);
+		break;
+	case FI_OPT_SHM_MAP_STATS:
+		if (*optlen < sizeof(*stats))
+			return -FI_ETOOSMALL;
+		if (!smr_ep->util_ep.av)
+			return -FI_EOPBADSTATE;
+
+		map = container_of(smr_ep->util_ep.av, struct smr_av,
+				   util_av)->smr_map;
+		stats = optval;
+		fastlock_acquire(&map->lock);
+		stats->mapped = map->map_cnt;
+		stats->unmapped = map->unmap_cnt;
+		stats->over_limit = map->over_limit_cnt;
+		fastlock_release(&map->lock);
+		*optlen = sizeof(*stats);
+		break;
+	default:
+		return -FI_ENOPROTOOPT;
+	}
 
 	return FI_SUCCESS;
 }
@@ -124,11 +148,11 @@ static int smr_match_recv_ctx(struct dlist_entry *item, const void *args)
 {
 	struct smr_rx_entry *pending_recv;
 
-	pending_recv = container_of(item, struct smr_rx_entry, entry);
+	pending_recv = container_of(item, struct smr_rx_entry, match.entry);
 	return pending_recv->context == args;
 }
 
-static int smr_ep_cancel_recv(struct smr_ep *ep, struct smr_queue *queue,
+static int smr_ep_cancel_recv(struct smr_ep *ep, struct ofi_match_queue *queue,
 			      void *context)
 {
 	struct smr_rx_entry *recv_entry;
@@ -136,14 +160,16 @@ static int smr_ep_cancel_recv(struct smr_ep *ep, struct smr_queue *queue,
 	int ret = 0;
 
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
-	entry = dlist_remove_first_match(&queue->list, smr_match_recv_ctx,
-					 context);
+	entry = dlist_find_first_match(&queue->list, smr_match_recv_ctx,
+				       context);
 	if (entry) {
-		recv_entry = container_of(entry, struct smr_rx_entry, entry);
+		recv_entry = container_of(entry, struct smr_rx_entry,
+					  match.entry);
+		ofi_match_queue_remove(queue, &recv_entry->match);
 		ret = smr_complete_rx(ep, (void *) recv_entry->context, ofi_op_msg,
 				  recv_entry->flags, 0,
-				  NULL, recv_entry->addr,
-				  recv_entry->tag, 0, FI_ECANCELED);
+				  NULL, recv_entry->match.addr,
+				  recv_entry->match.tag, 0, FI_ECANCELED);
 		freestack_push(ep->recv_fs, recv_entry);
 		ret = ret ? ret : 1;
 	}
@@ -178,78 +204,84 @@ static struct fi_ops_ep smr_ep_ops = {
 	.tx_size_left = fi_no_tx_size_left,
 };
 
+/*
+ * Maps the peer region if needed and completes the address exchange with the
+ * peer.  On success the caller holds a reference on the peer region and must
+ * drop it with smr_peer_release().
+ */
 int smr_verify_peer(struct smr_ep *ep, int peer_id)
 {
+	struct smr_region *peer_smr;
 	int ret;
 
-	if (ep->region->map->peers[peer_id].peer.addr != FI_ADDR_UNSPEC)
-		return 0;
-
-	ret = smr_map_to_region(&smr_prov, &ep->region->map->peers[peer_id]);
-
-	return (ret == -ENOENT) ? -FI_EAGAIN : ret;
-}
-
-static int smr_match_msg(struct dlist_entry *item, const void *args)
-{
-	struct smr_match_attr *attr = (struct smr_match_attr *)args;
-	struct smr_rx_entry *recv_entry;
-
-	recv_entry = container_of(item, struct smr_rx_entry, entry);
-	return smr_match_addr(recv_entry->addr, attr->addr);
-}
-
-static int smr_match_tagged(struct dlist_entry *item, const void *args)
-{
-	struct smr_match_attr *attr = (struct smr_match_attr *)args;
-	struct smr_rx_entry *recv_entry;
-
-	recv_entry = container_of(item, struct smr_rx_entry, entry);
-	return smr_match_addr(recv_entry->addr, attr->addr) &&
-	       smr_match_tag(recv_entry->tag, recv_entry->ignore, attr->tag); 
-} 
+	if (!smr_map_peer(ep->region->map, peer_id) ||
+	    peer_id >= ep->region->max_peers)
+		return -FI_EINVAL;
 
-static int smr_match_unexp_msg(struct dlist_entry *item, const void *args)
-{
-	struct smr_match_attr *attr = (struct smr_match_attr *)args;
-	struct smr_unexp_msg *unexp_msg;
+	ret = smr_peer_acquire(ep->region, peer_id, &peer_smr);
+	if (ret)
+		return (ret == -ENOENT) ? -FI_EAGAIN : ret;
+
+	if (smr_peer_data(ep->region)[peer_id].addr.addr == FI_ADDR_UNSPEC) {
+		smr_map_to_endpoint(ep->region, peer_id);
+		if (smr_peer_data(ep->region)[peer_id].addr.addr ==
+		    FI_ADDR_UNSPEC) {
+			/* peer has not inserted our address yet */
+			smr_peer_release(ep->region, peer_id);
+			return -FI_EAGAIN;
+		}
+	}
 
-	unexp_msg = container_of(item, struct smr_unexp_msg, entry);
-	assert(unexp_msg->cmd.msg.hdr.op == ofi_op_msg);
-	return smr_match_addr(unexp_msg->cmd.msg.hdr.addr, attr->addr);
+	return 0;
 }
 
-static int smr_match_unexp_tagged(struct dlist_entry *item, const void *args)
+static int smr_init_queues(struct smr_ep *ep, size_t size)
 {
-	struct smr_match_attr *attr = (struct smr_match_attr *)args;
-	struct smr_unexp_msg *unexp_msg;
+	int ret;
 
-	unexp_msg = container_of(item, struct smr_unexp_msg, entry);
-	if (unexp_msg->cmd.msg.hdr.op == ofi_op_msg)
-		return smr_match_addr(unexp_msg->cmd.msg.hdr.addr, attr->addr);
+	ret = ofi_match_queue_init(&ep->recv_queue, size);
+	if (ret)
+		return ret;
+	ret = ofi_match_queue_init(&ep->trecv_queue, size);
+	if (ret)
+		goto err1;
+	ret = ofi_match_queue_init(&ep->unexp_msg_queue, size);
+	if (ret)
+		goto err2;
+	ret = ofi_match_queue_init(&ep->unexp_tagged_queue, size);
+	if (ret)
+		goto err3;
+	return 0;
 
-	assert(unexp_msg->cmd.msg.hdr.op == ofi_op_tagged);
-	return smr_match_addr(unexp_msg->cmd.msg.hdr.addr, attr->addr) &&
-	       smr_match_tag(unexp_msg->cmd.msg.hdr.tag, attr->ignore,
-			     attr->tag);
+err3:
+	ofi_match_queue_close(&ep->unexp_msg_queue);
+err2:
+	ofi_match_queue_close(&ep->trecv_queue);
+err1:
+	ofi_match_queue_close(&ep->recv_queue);
+	return ret;
 }
 
-static void smr_init_queue(struct smr_queue *queue,
-			   dlist_func_t *match_func)
+static void smr_close_queues(struct smr_ep *ep)
 {
-	dlist_init(&queue->list);
-	queue->match_func = match_func;
+	ofi_match_queue_close(&ep->recv_queue);
+	ofi_match_queue_close(&ep->trecv_queue);
+	ofi_match_queue_close(&ep->unexp_msg_queue);
+	ofi_match_queue_close(&ep->unexp_tagged_queue);
 }
 
-void smr_format_pend_resp(struct smr_tx_entry *pend, struct smr_cmd *cmd,
-			  void *context, const struct iovec *iov,
-			  uint32_t iov_count, fi_addr_t id, struct smr_resp *resp)
+void smr_format_pend_resp(struct smr_ep *ep, struct smr_tx_entry *pend,
+			  struct smr_cmd *cmd, void *context,
+			  const struct iovec *iov, uint32_t iov_count,
+			  fi_addr_t id, struct smr_resp *resp)
 {
 	pend->cmd = *cmd;
 	pend->context = context;
 	memcpy(pend->iov, iov, sizeof(*iov) * iov_count);
 	pend->iov_count = iov_count;
 	pend->addr = id;
+	/* released when the response is processed */
+	smr_peer_tryacquire(smr_map_peer(ep->region->map, id));
 	if (cmd->msg.hdr.op_src != smr_src_sar)
 		pend->bytes_done = 0;
 
@@ -380,30 +412,31 @@ remove_entry:
 	return ret;
 }
 
+/*
+ * The copy routines fill or drain as many consecutive segments as are
+ * available, starting at *next, and leave *next at the first segment
+ * they could not use.
+ */
 size_t smr_copy_to_sar(struct smr_sar_msg *sar_msg, struct smr_resp *resp,
 		       struct smr_cmd *cmd, const struct iovec *iov, size_t count,
 		       size_t *bytes_done, int *next)
 {
+	struct smr_sar_buf *seg;
 	size_t start = *bytes_done;
 
-	if (sar_msg->sar[0].status == SMR_SAR_FREE && !*next) {
-		*bytes_done += ofi_copy_from_iov(sar_msg->sar[0].buf, SMR_SAR_SIZE,
-						 iov, count, *bytes_done);
-		sar_msg->sar[0].status = SMR_SAR_READY;
-		if (cmd->msg.hdr.op == ofi_op_read_req)
-			resp->status = FI_SUCCESS;
-		*next = 1;
-	}
+	while (*bytes_done < cmd->msg.hdr.size) {
+		seg = smr_sar_seg(sar_msg, *next);
+		if (seg->status != SMR_SAR_FREE)
+			break;
 
-	if (*bytes_done < cmd->msg.hdr.size &&
-	    sar_msg->sar[1].status == SMR_SAR_FREE && *next) {
-		*bytes_done += ofi_copy_from_iov(sar_msg->sar[1].buf, SMR_SAR_SIZE,
+		*bytes_done += ofi_copy_from_iov(seg->buf, SMR_SAR_SIZE,
 						 iov, count, *bytes_done);
-		sar_msg->sar[1].status = SMR_SAR_READY;
-		if (cmd->msg.hdr.op == ofi_op_read_req)
-			resp->status = FI_SUCCESS;
-		*next = 0;
+		seg->status = SMR_SAR_READY;
+		*next = (*next + 1) % sar_msg->seg_cnt;
 	}
+
+	if (*bytes_done != start && cmd->msg.hdr.op == ofi_op_read_req)
+		resp->status = FI_SUCCESS;
 	return *bytes_done - start;
 }
 
@@ -411,26 +444,22 @@ size_t smr_copy_from_sar(struct smr_sar_msg *sar_msg, struct smr_resp *resp,
 			 struct smr_cmd *cmd, const struct iovec *iov, size_t count,
 			 size_t *bytes_done, int *next)
 {
+	struct smr_sar_buf *seg;
 	size_t start = *bytes_done;
 
-	if (sar_msg->sar[0].status == SMR_SAR_READY && !*next) {
-		*bytes_done += ofi_copy_to_iov(iov, count, *bytes_done,
-					       sar_msg->sar[0].buf, SMR_SAR_SIZE);
-		sar_msg->sar[0].status = SMR_SAR_FREE;
-		if (cmd->msg.hdr.op != ofi_op_read_req)
-			resp->status = FI_SUCCESS;
-		*next = 1;
-	}
+	while (*bytes_done < cmd->msg.hdr.size) {
+		seg = smr_sar_seg(sar_msg, *next);
+		if (seg->status != SMR_SAR_READY)
+			break;
 
-	if (*bytes_done < cmd->msg.hdr.size &&
-	    sar_msg->sar[1].status == SMR_SAR_READY && *next) {
 		*bytes_done += ofi_copy_to_iov(iov, count, *bytes_done,
-					       sar_msg->sar[1].buf, SMR_SAR_SIZE);
-		sar_msg->sar[1].status = SMR_SAR_FREE;
-		if (cmd->msg.hdr.op != ofi_op_read_req)
-			resp->status = FI_SUCCESS;
-		*next = 0;
+					       seg->buf, SMR_SAR_SIZE);
+		seg->status = SMR_SAR_FREE;
+		*next = (*next + 1) % sar_msg->seg_cnt;
 	}
+
+	if (*bytes_done != start && cmd->msg.hdr.op != ofi_op_read_req)
+		resp->status = FI_SUCCESS;
 	return *bytes_done - start;
 }
 
@@ -439,6 +468,8 @@ void smr_format_sar(struct smr_cmd *cmd, const struct iovec *iov, size_t count,
 		    struct smr_region *peer_smr, struct smr_sar_msg *sar_msg,
 		    struct smr_tx_entry *pending, struct smr_resp *resp)
 {
+	int i;
+
 	cmd->msg.hdr.op_src = smr_src_sar;
 	cmd->msg.hdr.src_data = smr_get_offset(smr, resp);
 	cmd->msg.data.sar = smr_get_offset(peer_smr, sar_msg);
@@ -446,8 +477,8 @@ void smr_format_sar(struct smr_cmd *cmd, const struct iovec *iov, size_t count,
 
 	pending->bytes_done = 0;
 	pending->next = 0;
-	sar_msg->sar[0].status = SMR_SAR_FREE;
-	sar_msg->sar[1].status = SMR_SAR_FREE;
+	for (i = 0; i < sar_msg->seg_cnt; i++)
+		smr_sar_seg(sar_msg, i)->status = SMR_SAR_FREE;
 	if (cmd->msg.hdr.op != ofi_op_read_req)
 		smr_copy_to_sar(sar_msg, NULL, cmd, iov, count,
 				&pending->bytes_done, &pending->next);
@@ -464,6 +495,7 @@ static int smr_ep_close(struct fid *fid)
 	if (ep->region)
 		smr_free(ep->region);
 
+	smr_close_queues(ep);
 	smr_recv_fs_free(ep->recv_fs);
 	smr_unexp_fs_free(ep->unexp_fs);
 	smr_pend_fs_free(ep->pend_fs);
@@ -595,6 +627,8 @@ static int smr_ep_ctrl(struct fid *fid, int command, void *arg)
 		attr.name = ep->name;
 		attr.rx_count = ep->rx_size;
 		attr.tx_count = ep->tx_size;
+		attr.peer_count = av->util_av.count;
+		attr.sar_seg_count = smr_env.sar_seg_count;
 		ret = smr_create(&smr_prov, av->smr_map, &attr, &ep->region);
 		if (ret)
 			return ret;
@@ -669,10 +703,9 @@ int smr_endpoint(struct fid_domain *domain, struct fi_info *info,
 	ep->unexp_fs = smr_unexp_fs_create(info->rx_attr->size, NULL, NULL);
 	ep->pend_fs = smr_pend_fs_create(info->tx_attr->size, NULL, NULL);
 	ep->sar_fs = smr_sar_fs_create(info->rx_attr->size, NULL, NULL);
-	smr_init_queue(&ep->recv_queue, smr_match_msg);
-	smr_init_queue(&ep->trecv_queue, smr_match_tagged);
-	smr_init_queue(&ep->unexp_msg_queue, smr_match_unexp_msg);
-	smr_init_queue(&ep->unexp_tagged_queue, smr_match_unexp_tagged);
+	ret = smr_init_queues(ep, info->rx_attr->size);
+	if (ret)
+		goto err0;
 	dlist_init(&ep->sar_list);
 
 	ep->min_multi_recv_size = SMR_INJECT_SIZE;
@@ -688,6 +721,12 @@ int smr_endpoint(struct fid_domain *domain, struct fi_info *info,
 	*ep_fid = &ep->util_ep.ep_fid;
 	return 0;
 
+err0:
+	smr_recv_fs_free(ep->recv_fs);
+	smr_unexp_fs_free(ep->unexp_fs);
+	smr_pend_fs_free(ep->pend_fs);
+	smr_sar_fs_free(ep->sar_fs);
+	ofi_endpoint_close(&ep->util_ep);
 err1:
 	free((void *)ep->name);
 err2:
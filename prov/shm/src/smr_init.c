@@ -38,14 +38,51 @@
 
 extern struct sigaction *old_action;
 struct smr_env smr_env = {
+	.inject_threshold = SMR_INJECT_SIZE,
+	.remote_inject_threshold = SMR_INJECT_SIZE,
 	.sar_threshold = SIZE_MAX,
+	.remote_sar_threshold = SIZE_MAX,
+	.sar_seg_count = 4,
 };
 
 static void smr_init_env(void)
 {
-	fi_param_get_size_t(&smr_prov, "sar_threshold", &smr_env.sar_threshold);
+	long num_of_core;
+	size_t sar_buf_size;
+	char *tune_file = NULL;
+	int calibrate = 0;
+
+	fi_param_get_str(&smr_prov, "tune_file", &tune_file);
+	fi_param_get_bool(&smr_prov, "calibrate", &calibrate);
+	smr_tune_init(tune_file, calibrate);
+
+	if (!fi_param_get_size_t(&smr_prov, "inject_threshold",
+				 &smr_env.inject_threshold)) {
+		smr_env.inject_threshold = MIN(smr_env.inject_threshold,
+					       SMR_INJECT_SIZE);
+		smr_env.remote_inject_threshold = smr_env.inject_threshold;
+	}
+	if (!fi_param_get_size_t(&smr_prov, "remote_inject_threshold",
+				 &smr_env.remote_inject_threshold))
+		smr_env.remote_inject_threshold =
+			MIN(smr_env.remote_inject_threshold, SMR_INJECT_SIZE);
+	if (!fi_param_get_size_t(&smr_prov, "sar_threshold",
+				 &smr_env.sar_threshold))
+		smr_env.remote_sar_threshold = smr_env.sar_threshold;
+	fi_param_get_size_t(&smr_prov, "remote_sar_threshold",
+			    &smr_env.remote_sar_threshold);
 	fi_param_get_size_t(&smr_prov, "tx_size", &smr_info.tx_attr->size);
 	fi_param_get_size_t(&smr_prov, "rx_size", &smr_info.rx_attr->size);
+
+	if (fi_param_get_size_t(&smr_prov, "max_mapped_peers",
+				&smr_env.max_mapped_peers)) {
+		num_of_core = ofi_sysconf(_SC_NPROCESSORS_ONLN);
+		smr_env.max_mapped_peers = num_of_core > 0 ? num_of_core : 0;
+	}
+
+	if (!fi_param_get_size_t(&smr_prov, "sar_buf_size", &sar_buf_size))
+		smr_env.sar_seg_count = MAX(SMR_SAR_MIN_SEGS,
+			ofi_div_ceil(sar_buf_size, SMR_SAR_SIZE));
 }
 
 static void smr_resolve_addr(const char *node, const char *service,
@@ -77,9 +114,10 @@ static void smr_resolve_addr(const char *node, const char *service,
 /*
  * The smr_shm_space_check is to check if there's enough shm space we
  * need under /dev/shm.
- * Here we use #core instead of SMR_MAX_PEERS, as it is the most likely
- * value and has less possibility of failing fi_getinfo calls that are
- * currently passing, and breaking currently working app
+ * Here we use #core for both the number of endpoints and the number of
+ * peers each endpoint is sized for, as it is the most likely value and has
+ * less possibility of failing fi_getinfo calls that are currently passing,
+ * and breaking currently working app
  */
 static int smr_shm_space_check(size_t tx_count, size_t rx_count)
 {
@@ -97,8 +135,9 @@ static int smr_shm_space_check(size_t tx_count, size_t rx_count)
 	}
 	shm_size_needed = num_of_core *
 			  smr_calculate_size_offsets(tx_count, rx_count,
-						     NULL, NULL, NULL,
-						     NULL, NULL, NULL);
+						     num_of_core,
+						     smr_env.sar_seg_count, NULL, NULL,
+						     NULL, NULL, NULL, NULL);
 	err = statvfs(shm_fs, &stat);
 	if (err) {
 		FI_WARN(&smr_prov, FI_LOG_CORE,
@@ -187,16 +226,48 @@ struct util_prov smr_util_prov = {
 
 SHM_INI
 {
+	fi_param_define(&smr_prov, "inject_threshold", FI_PARAM_SIZE_T,
+			"Max size to send through an inject buffer before \
+			 switching to the CMA protocol, capped at 4096 \
+			 Default: 4096");
+	fi_param_define(&smr_prov, "remote_inject_threshold", FI_PARAM_SIZE_T,
+			"inject_threshold for peers whose region is on \
+			 another NUMA node.  Default: inject_threshold");
 	fi_param_define(&smr_prov, "sar_threshold", FI_PARAM_SIZE_T,
 			"Max size to use for alternate SAR protocol if CMA \
 			 is not available before switching to mmap protocol \
 			 Default: SIZE_MAX (18446744073709551615)");
+	fi_param_define(&smr_prov, "remote_sar_threshold", FI_PARAM_SIZE_T,
+			"sar_threshold for peers whose region is on another \
+			 NUMA node.  Default: sar_threshold");
+	fi_param_define(&smr_prov, "calibrate", FI_PARAM_BOOL,
+			"Time the shm protocols on this machine at startup, \
+			 with the peer's memory on the local and on another \
+			 NUMA node, and pick the local and remote inject and \
+			 sar thresholds from the results.  Explicitly set \
+			 thresholds take precedence.  Default: false");
+	fi_param_define(&smr_prov, "tune_file", FI_PARAM_STRING,
+			"File holding calibrated thresholds.  If it exists \
+			 and was written for the same NUMA topology the \
+			 thresholds are loaded from it, otherwise it is \
+			 written after calibration.  Default: none");
 	fi_param_define(&smr_prov, "tx_size", FI_PARAM_SIZE_T,
 			"Max number of outstanding tx operations \
 			 Default: 1024");
 	fi_param_define(&smr_prov, "rx_size", FI_PARAM_SIZE_T,
 			"Max number of outstanding rx operations \
 			 Default: 1024");
+	fi_param_define(&smr_prov, "max_mapped_peers", FI_PARAM_SIZE_T,
+			"Max number of peer regions kept mapped.  Regions \
+			 are mapped on first use and the least recently \
+			 used idle ones are unmapped above this limit, 0 \
+			 disables the limit.  Default: number of cores");
+	fi_param_define(&smr_prov, "sar_buf_size", FI_PARAM_SIZE_T,
+			"Size of the staging buffer used by each peer for "
+			"the SAR protocol, rounded up to a multiple of the "
+			"16KB segment size (minimum 2 segments).  Larger "
+			"buffers let more segments be copied in and out "
+			"concurrently.  Default: 65536");
 
 	smr_init_env();
 
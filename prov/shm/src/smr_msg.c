@@ -70,9 +70,10 @@ static struct smr_rx_entry *smr_get_recv_entry(struct smr_ep *ep,
 	entry->context = context;
 	entry->err = 0;
 	entry->flags = smr_convert_rx_flags(flags);
-	entry->addr = ep->util_ep.caps & FI_DIRECTED_RECV ? addr : FI_ADDR_UNSPEC;
-	entry->tag = tag;
-	entry->ignore = ignore;
+	entry->match.addr = ep->util_ep.caps & FI_DIRECTED_RECV ?
+			    addr : FI_ADDR_UNSPEC;
+	entry->match.tag = tag;
+	entry->match.ignore = ignore;
 
 	return entry;
 }
@@ -80,8 +81,8 @@ static struct smr_rx_entry *smr_get_recv_entry(struct smr_ep *ep,
 ssize_t smr_generic_recv(struct smr_ep *ep, const struct iovec *iov,
 			 size_t iov_count, fi_addr_t addr, void *context,
 			 uint64_t tag, uint64_t ignore, uint64_t flags,
-			 struct smr_queue *recv_queue,
-			 struct smr_queue *unexp_queue)
+			 struct ofi_match_queue *recv_queue,
+			 struct ofi_match_queue *unexp_queue)
 {
 	struct smr_rx_entry *entry;
 	ssize_t ret = -FI_EAGAIN;
@@ -89,7 +90,6 @@ ssize_t smr_generic_recv(struct smr_ep *ep, const struct iovec *iov,
 	assert(iov_count <= SMR_IOV_LIMIT);
 	assert(!(flags & FI_MULTI_RECV) || iov_count == 1);
 
-	fastlock_acquire(&ep->region->lock);
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
 
 	entry = smr_get_recv_entry(ep, iov, iov_count, addr, context, tag,
@@ -97,11 +97,11 @@ ssize_t smr_generic_recv(struct smr_ep *ep, const struct iovec *iov,
 	if (!entry)
 		goto out;
 
-	dlist_insert_tail(&entry->entry, &recv_queue->list);
+	ofi_match_queue_insert(recv_queue, &entry->match);
 	ret = smr_progress_unexp_queue(ep, entry, unexp_queue);
+	smr_flush_cmd_credits(ep);
 out:
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
-	fastlock_release(&ep->region->lock);
 	return ret;
 }
 
@@ -155,8 +155,9 @@ static ssize_t smr_generic_sendmsg(struct smr_ep *ep, const struct iovec *iov,
 	struct smr_inject_buf *tx_buf;
 	struct smr_sar_msg *sar;
 	struct smr_resp *resp;
-	struct smr_cmd *cmd;
-	struct smr_tx_entry *pend;
+	struct smr_cmd cmd;
+	struct smr_tx_entry *pend = NULL;
+	int64_t pos;
 	int id, peer_id;
 	ssize_t ret = 0;
 	size_t total_len;
@@ -164,36 +165,35 @@ static ssize_t smr_generic_sendmsg(struct smr_ep *ep, const struct iovec *iov,
 	assert(iov_count <= SMR_IOV_LIMIT);
 
 	id = (int) addr;
-	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 
 	ret = smr_verify_peer(ep, id);
 	if (ret)
 		return ret;
 
+	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 	peer_smr = smr_peer_region(ep->region, id);
-	fastlock_acquire(&peer_smr->lock);
-	if (!peer_smr->cmd_cnt || smr_peer_data(ep->region)[id].sar_status) {
+	if (smr_cmd_queue_reserve(peer_smr, 1)) {
 		ret = -FI_EAGAIN;
-		goto unlock_region;
+		goto out;
 	}
 
 	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq) ||
+	    smr_peer_data(ep->region)[id].sar_status) {
 		ret = -FI_EAGAIN;
 		goto unlock_cq;
 	}
 
 	total_len = ofi_total_iov_len(iov, iov_count);
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_generic_format(cmd, peer_id, op, tag, data, op_flags);
+	smr_generic_format(&cmd, peer_id, op, tag, data, op_flags);
 
 	if (total_len <= SMR_MSG_DATA_LEN && !(op_flags & FI_DELIVERY_COMPLETE)) {
-		smr_format_inline(cmd, iov, iov_count);
-	} else if (total_len <= SMR_INJECT_SIZE &&
+		smr_format_inline(&cmd, iov, iov_count);
+	} else if (smr_use_inject(ep->region, peer_smr, total_len) &&
 		   !(op_flags & FI_DELIVERY_COMPLETE)) {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
-		smr_format_inject(cmd, iov, iov_count, peer_smr, tx_buf);
+		tx_buf = smr_inject_buf_get(peer_smr);
+		smr_format_inject(&cmd, iov, iov_count, peer_smr, tx_buf);
 	} else {
 		if (ofi_cirque_isfull(smr_resp_queue(ep->region))) {
 			ret = -FI_EAGAIN;
@@ -202,21 +202,20 @@ static ssize_t smr_generic_sendmsg(struct smr_ep *ep, const struct iovec *iov,
 		resp = ofi_cirque_tail(smr_resp_queue(ep->region));
 		pend = freestack_pop(ep->pend_fs);
 		if (ep->region->cma_cap == SMR_CMA_CAP_ON) {
-			smr_format_iov(cmd, iov, iov_count, total_len, ep->region, resp);
+			smr_format_iov(&cmd, iov, iov_count, total_len, ep->region, resp);
 		} else {
-			if (total_len <= smr_env.sar_threshold) {
-				if (!peer_smr->sar_cnt) {
+			if (smr_use_sar(ep->region, peer_smr, total_len)) {
+				sar = smr_sar_buf_get(peer_smr);
+				if (!sar) {
 					ret = -FI_EAGAIN;
 				} else {
-					sar = smr_freestack_pop(smr_sar_pool(peer_smr));
-					smr_format_sar(cmd, iov, iov_count, total_len,
+					smr_format_sar(&cmd, iov, iov_count, total_len,
 						       ep->region, peer_smr, sar,
 						       pend, resp);
-					peer_smr->sar_cnt--;
 					smr_peer_data(ep->region)[id].sar_status = 1;
 				}
 			} else {
-				ret = smr_format_mmap(ep, cmd, iov, iov_count,
+				ret = smr_format_mmap(ep, &cmd, iov, iov_count,
 						      total_len, pend, resp);
 			}
 			if (ret) {
@@ -225,24 +224,33 @@ static ssize_t smr_generic_sendmsg(struct smr_ep *ep, const struct iovec *iov,
 				goto unlock_cq;
 			}
 		}
-		smr_format_pend_resp(pend, cmd, context, iov, iov_count, id, resp);
+		smr_format_pend_resp(ep, pend, &cmd, context, iov, iov_count,
+				     id, resp);
 		ofi_cirque_commit(smr_resp_queue(ep->region));
 		goto commit;
 	}
-	ret = smr_complete_tx(ep, context, op, cmd->msg.hdr.op_flags, 0);
+	ret = smr_complete_tx(ep, context, op, cmd.msg.hdr.op_flags, 0);
 	if (ret) {
 		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
 			"unable to process tx completion\n");
+		if (cmd.msg.hdr.op_src == smr_src_inject)
+			smr_inject_buf_put(peer_smr, smr_get_ptr(peer_smr,
+					   cmd.msg.hdr.src_data));
 		goto unlock_cq;
 	}
 
 commit:
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
+	pos = smr_cmd_queue_post(smr_cmd_queue(peer_smr), &cmd, 1);
+	if (pend)
+		pend->cmd_pos = pos;
+	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	goto out;
+
 unlock_cq:
 	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
-unlock_region:
-	fastlock_release(&peer_smr->lock);
+	smr_cmd_queue_release(peer_smr, 1);
+out:
+	smr_peer_release(ep->region, id);
 	return ret;
 }
 
@@ -292,7 +300,7 @@ static ssize_t smr_generic_inject(struct fid_ep *ep_fid, const void *buf,
 	struct smr_ep *ep;
 	struct smr_region *peer_smr;
 	struct smr_inject_buf *tx_buf;
-	struct smr_cmd *cmd;
+	struct smr_cmd cmd;
 	int id, peer_id;
 	ssize_t ret = 0;
 	struct iovec msg_iov;
@@ -304,34 +312,33 @@ static ssize_t smr_generic_inject(struct fid_ep *ep_fid, const void *buf,
 
 	ep = container_of(ep_fid, struct smr_ep, util_ep.ep_fid.fid);
 	id = (int) dest_addr;
-	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 
 	ret = smr_verify_peer(ep, id);
 	if (ret)
 		return ret;
 
+	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 	peer_smr = smr_peer_region(ep->region, id);
-	fastlock_acquire(&peer_smr->lock);
-	if (!peer_smr->cmd_cnt || smr_peer_data(ep->region)[id].sar_status) {
+	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
+	if (smr_peer_data(ep->region)[id].sar_status ||
+	    smr_cmd_queue_reserve(peer_smr, 1)) {
 		ret = -FI_EAGAIN;
-		goto unlock;
+		goto unlock_cq;
 	}
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_generic_format(cmd, peer_id, op, tag, data, op_flags);
+	smr_generic_format(&cmd, peer_id, op, tag, data, op_flags);
 
 	if (len <= SMR_MSG_DATA_LEN) {
-		smr_format_inline(cmd, &msg_iov, 1);
+		smr_format_inline(&cmd, &msg_iov, 1);
 	} else {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
-		smr_format_inject(cmd, &msg_iov, 1, peer_smr, tx_buf);
+		tx_buf = smr_inject_buf_get(peer_smr);
+		smr_format_inject(&cmd, &msg_iov, 1, peer_smr, tx_buf);
 	}
 	ofi_ep_tx_cntr_inc_func(&ep->util_ep, op);
-	peer_smr->cmd_cnt--;
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-unlock:
-	fastlock_release(&peer_smr->lock);
-
+	smr_cmd_queue_post(smr_cmd_queue(peer_smr), &cmd, 1);
+unlock_cq:
+	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	smr_peer_release(ep->region, id);
 	return ret;
 }
 
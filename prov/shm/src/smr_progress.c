@@ -69,14 +69,18 @@ static int smr_progress_resp_entry(struct smr_ep *ep, struct smr_resp *resp,
 
 	peer_smr = smr_peer_region(ep->region, pending->addr);
 
+	/* the peer may answer before discarding the command, and the credit
+	 * returned below must not come back before the command slot does */
+	if (!smr_cmd_queue_consumed(smr_cmd_queue(peer_smr), pending->cmd_pos))
+		return -FI_EAGAIN;
+
 	switch (pending->cmd.msg.hdr.op_src) {
 	case smr_src_iov:
 		break;
 	case smr_src_sar:
 		sar_msg = smr_get_ptr(peer_smr, pending->cmd.msg.data.sar);
 		if (pending->bytes_done == pending->cmd.msg.hdr.size &&
-		    sar_msg->sar[0].status == SMR_SAR_FREE &&
-		    sar_msg->sar[1].status == SMR_SAR_FREE)
+		    smr_sar_idle(sar_msg))
 			break;
 
 		if (pending->cmd.msg.hdr.op == ofi_op_read_req)
@@ -90,8 +94,7 @@ static int smr_progress_resp_entry(struct smr_ep *ep, struct smr_resp *resp,
 					pending->iov_count, &pending->bytes_done,
 					&pending->next);
 		if (pending->bytes_done != pending->cmd.msg.hdr.size ||
-		    sar_msg->sar[0].status != SMR_SAR_FREE ||
-		    sar_msg->sar[1].status != SMR_SAR_FREE)
+		    !smr_sar_idle(sar_msg))
 			return -FI_EAGAIN;
 		break;
 	case smr_src_mmap:
@@ -138,24 +141,14 @@ static int smr_progress_resp_entry(struct smr_ep *ep, struct smr_resp *resp,
 			"unidentified operation type\n");
 	}
 
-	//Skip locking on transfers from self since we already have
-	//the ep->region->lock
-	if (peer_smr != ep->region) {
-		if (fastlock_tryacquire(&peer_smr->lock))
-			return -FI_EAGAIN;
-	}
-
-	peer_smr->cmd_cnt++;
 	if (tx_buf) {
-		smr_freestack_push(smr_inject_pool(peer_smr), tx_buf);
+		smr_inject_buf_put(peer_smr, tx_buf);
 	} else if (sar_msg) {
-		smr_freestack_push(smr_sar_pool(peer_smr), sar_msg);
-		peer_smr->sar_cnt++;
+		smr_sar_buf_put(peer_smr, sar_msg);
 		smr_peer_data(ep->region)[pending->addr].sar_status = 0;
 	}
-
-	if (peer_smr != ep->region)
-		fastlock_release(&peer_smr->lock);
+	ofi_atomic_inc64(&peer_smr->cmd_cnt);
+	smr_peer_release(ep->region, pending->addr);
 
 	return 0;
 }
@@ -164,12 +157,17 @@ static void smr_progress_resp(struct smr_ep *ep)
 {
 	struct smr_resp *resp;
 	struct smr_tx_entry *pending;
-	int ret;
+	int ret, cnt;
+
+	/* Only this endpoint posts responses, so a stale read just defers */
+	if (ofi_cirque_isempty(smr_resp_queue(ep->region)))
+		return;
 
-	fastlock_acquire(&ep->region->lock);
 	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	while (!ofi_cirque_isempty(smr_resp_queue(ep->region)) &&
-	       !ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+	ep->tx_batch = true;
+	for (cnt = 0; cnt < SMR_PROGRESS_BATCH &&
+	     !ofi_cirque_isempty(smr_resp_queue(ep->region)) &&
+	     !ofi_cirque_isfull(ep->util_ep.tx_cq->cirq); cnt++) {
 		resp = ofi_cirque_head(smr_resp_queue(ep->region));
 		if (resp->status == FI_EBUSY)
 			break;
@@ -189,8 +187,12 @@ static void smr_progress_resp(struct smr_ep *ep)
 		freestack_push(ep->pend_fs, pending);
 		ofi_cirque_discard(smr_resp_queue(ep->region));
 	}
+	ep->tx_batch = false;
+	if (ep->tx_signal) {
+		ep->tx_signal = false;
+		ep->util_ep.tx_cq->wait->signal(ep->util_ep.tx_cq->wait);
+	}
 	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
-	fastlock_release(&ep->region->lock);
 }
 
 static int smr_progress_inline(struct smr_cmd *cmd, struct iovec *iov,
@@ -217,7 +219,7 @@ static int smr_progress_inject(struct smr_cmd *cmd, struct iovec *iov,
 	tx_buf = smr_get_ptr(ep->region, inj_offset);
 
 	if (err) {
-		smr_freestack_push(smr_inject_pool(ep->region), tx_buf);
+		smr_inject_buf_put(ep->region, tx_buf);
 		return err;
 	}
 
@@ -227,7 +229,7 @@ static int smr_progress_inject(struct smr_cmd *cmd, struct iovec *iov,
 	} else {
 		*total_len = ofi_copy_to_iov(iov, iov_count, 0, tx_buf->data,
 					     cmd->msg.hdr.size);
-		smr_freestack_push(smr_inject_pool(ep->region), tx_buf);
+		smr_inject_buf_put(ep->region, tx_buf);
 	}
 
 	if (*total_len != cmd->msg.hdr.size) {
@@ -247,8 +249,14 @@ static int smr_progress_iov(struct smr_cmd *cmd, struct iovec *iov,
 	struct smr_resp *resp;
 	int peer_id, ret;
 
+	/*
+	 * smr_progress_cmd already holds the region, so this only fails when
+	 * the sender's region is gone and there is no response to write.
+	 */
 	peer_id = (int) cmd->msg.hdr.addr;
-	peer_smr = smr_peer_region(ep->region, peer_id);
+	ret = smr_peer_acquire(ep->region, peer_id, &peer_smr);
+	if (ret)
+		return ret;
 	resp = smr_get_ptr(peer_smr, cmd->msg.hdr.src_data);
 
 	if (err) {
@@ -284,6 +292,7 @@ static int smr_progress_iov(struct smr_cmd *cmd, struct iovec *iov,
 out:
 	//Status must be set last (signals peer: op done, valid resp entry)
 	resp->status = ret;
+	smr_peer_release(ep->region, peer_id);
 
 	return -ret;
 }
@@ -299,7 +308,8 @@ static int smr_mmap_peer_copy(struct smr_ep *ep, struct smr_cmd *cmd,
 
 	peer_id = (int) cmd->msg.hdr.addr;
 
-	num = smr_mmap_name(shm_name, ep->region->map->peers[peer_id].peer.name,
+	num = smr_mmap_name(shm_name,
+			    smr_map_peer(ep->region->map, peer_id)->peer.name,
 			    cmd->msg.hdr.msg_id);
 	if (num < 0) {
 		FI_WARN(&smr_prov, FI_LOG_AV, "generating shm file name failed\n");
@@ -356,31 +366,45 @@ static int smr_progress_mmap(struct smr_cmd *cmd, struct iovec *iov,
 	struct smr_resp *resp;
 	int peer_id, ret;
 
+	/* see smr_progress_iov */
 	peer_id = (int) cmd->msg.hdr.addr;
-	peer_smr = smr_peer_region(ep->region, peer_id);
+	ret = smr_peer_acquire(ep->region, peer_id, &peer_smr);
+	if (ret)
+		return ret;
 	resp = smr_get_ptr(peer_smr, cmd->msg.hdr.src_data);
 
 	ret = smr_mmap_peer_copy(ep, cmd, iov, iov_count, total_len);
 
 	//Status must be set last (signals peer: op done, valid resp entry)
 	resp->status = ret;
+	smr_peer_release(ep->region, peer_id);
 
 	return ret;
 }
 
-static struct smr_sar_entry *smr_progress_sar(struct smr_cmd *cmd,
+/*
+ * Returns the sar entry tracking the rest of the transfer in *sar_entry, or
+ * NULL if the transfer is complete.  The sar entry keeps the reference on
+ * the peer region until the transfer completes.
+ */
+static int smr_progress_sar(struct smr_cmd *cmd,
 			struct smr_rx_entry *rx_entry, struct iovec *iov,
-			size_t iov_count, size_t *total_len, struct smr_ep *ep)
+			size_t iov_count, size_t *total_len, struct smr_ep *ep,
+			struct smr_sar_entry **sar_entry)
 {
 	struct smr_region *peer_smr;
-	struct smr_sar_entry *sar_entry;
 	struct smr_sar_msg *sar_msg;
 	struct smr_resp *resp;
 	struct iovec sar_iov[SMR_IOV_LIMIT];
 	int next = 0;
+	int ret;
+
+	*sar_entry = NULL;
+	ret = smr_peer_acquire(ep->region, cmd->msg.hdr.addr, &peer_smr);
+	if (ret)
+		return ret;
 
 	sar_msg = smr_get_ptr(ep->region, cmd->msg.data.sar);
-	peer_smr = smr_peer_region(ep->region, cmd->msg.hdr.addr);
 	resp = smr_get_ptr(peer_smr, cmd->msg.hdr.src_data);
 
 	memcpy(sar_iov, iov, sizeof(*iov) * iov_count);
@@ -393,27 +417,29 @@ static struct smr_sar_entry *smr_progress_sar(struct smr_cmd *cmd,
 		smr_try_progress_from_sar(sar_msg, resp, cmd, sar_iov, iov_count,
 					  total_len, &next);
 
-	if (*total_len == cmd->msg.hdr.size)
-		return NULL;
+	if (*total_len == cmd->msg.hdr.size) {
+		smr_peer_release(ep->region, cmd->msg.hdr.addr);
+		return 0;
+	}
 
-	sar_entry = freestack_pop(ep->sar_fs);
+	*sar_entry = freestack_pop(ep->sar_fs);
 
-	sar_entry->cmd = *cmd;
-	sar_entry->bytes_done = *total_len;
-	sar_entry->next = next;
-	memcpy(sar_entry->iov, sar_iov, sizeof(*sar_iov) * iov_count);
-	sar_entry->iov_count = iov_count;
+	(*sar_entry)->cmd = *cmd;
+	(*sar_entry)->bytes_done = *total_len;
+	(*sar_entry)->next = next;
+	memcpy((*sar_entry)->iov, sar_iov, sizeof(*sar_iov) * iov_count);
+	(*sar_entry)->iov_count = iov_count;
 	if (rx_entry) {
-		sar_entry->rx_entry = *rx_entry;
-		sar_entry->rx_entry.flags |= cmd->msg.hdr.op_flags;
-		sar_entry->rx_entry.flags &= ~SMR_MULTI_RECV;
+		(*sar_entry)->rx_entry = *rx_entry;
+		(*sar_entry)->rx_entry.flags |= cmd->msg.hdr.op_flags;
+		(*sar_entry)->rx_entry.flags &= ~SMR_MULTI_RECV;
 	} else {
-		sar_entry->rx_entry.flags = cmd->msg.hdr.op_flags;
+		(*sar_entry)->rx_entry.flags = cmd->msg.hdr.op_flags;
 	}
 
-	dlist_insert_tail(&sar_entry->entry, &ep->sar_list);
+	dlist_insert_tail(&(*sar_entry)->entry, &ep->sar_list);
 	*total_len = cmd->msg.hdr.size;
-	return sar_entry;
+	return 0;
 }
 
 static bool smr_progress_multi_recv(struct smr_ep *ep,
@@ -525,7 +551,7 @@ static int smr_progress_inject_atomic(struct smr_cmd *cmd, struct fi_ioc *ioc,
 
 out:
 	if (!(cmd->msg.hdr.op_flags & SMR_RMA_REQ))
-		smr_freestack_push(smr_inject_pool(ep->region), tx_buf);
+		smr_inject_buf_put(ep->region, tx_buf);
 
 	return err;
 }
@@ -544,12 +570,12 @@ static int smr_progress_msg_common(struct smr_ep *ep, struct smr_cmd *cmd,
 	case smr_src_inline:
 		entry->err = smr_progress_inline(cmd, entry->iov, entry->iov_count,
 						 &total_len);
-		ep->region->cmd_cnt++;
+		smr_return_cmd(ep);
 		break;
 	case smr_src_inject:
 		entry->err = smr_progress_inject(cmd, entry->iov, entry->iov_count,
 						 &total_len, ep, 0);
-		ep->region->cmd_cnt++;
+		smr_return_cmd(ep);
 		break;
 	case smr_src_iov:
 		entry->err = smr_progress_iov(cmd, entry->iov, entry->iov_count,
@@ -560,8 +586,9 @@ static int smr_progress_msg_common(struct smr_ep *ep, struct smr_cmd *cmd,
 					       &total_len, ep);
 		break;
 	case smr_src_sar:
-		sar = smr_progress_sar(cmd, entry, entry->iov, entry->iov_count,
-				       &total_len, ep);
+		entry->err = smr_progress_sar(cmd, entry, entry->iov,
+					      entry->iov_count, &total_len,
+					      ep, &sar);
 		break;
 	default:
 		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
@@ -592,7 +619,9 @@ static int smr_progress_msg_common(struct smr_ep *ep, struct smr_cmd *cmd,
 	}
 
 	if (free_entry) {
-		dlist_remove(&entry->entry);
+		ofi_match_queue_remove(cmd->msg.hdr.op == ofi_op_tagged ?
+				       &ep->trecv_queue : &ep->recv_queue,
+				       &entry->match);
 		freestack_push(ep->recv_fs, entry);
 		return 1;
 	}
@@ -601,9 +630,8 @@ static int smr_progress_msg_common(struct smr_ep *ep, struct smr_cmd *cmd,
 
 static int smr_progress_cmd_msg(struct smr_ep *ep, struct smr_cmd *cmd)
 {
-	struct smr_queue *recv_queue;
-	struct smr_match_attr match_attr;
-	struct dlist_entry *dlist_entry;
+	struct ofi_match_queue *recv_queue;
+	struct ofi_match_entry *match;
 	struct smr_unexp_msg *unexp;
 	int ret;
 
@@ -616,35 +644,37 @@ static int smr_progress_cmd_msg(struct smr_ep *ep, struct smr_cmd *cmd)
 	recv_queue = (cmd->msg.hdr.op == ofi_op_tagged) ?
 		      &ep->trecv_queue : &ep->recv_queue;
 
-	match_attr.addr = cmd->msg.hdr.addr;
-	match_attr.tag = cmd->msg.hdr.tag;
-
-	dlist_entry = dlist_find_first_match(&recv_queue->list,
-					     recv_queue->match_func,
-					     &match_attr);
-	if (!dlist_entry) {
+	match = ofi_match_queue_find(recv_queue, cmd->msg.hdr.addr,
+				     cmd->msg.hdr.tag, 0);
+	if (!match) {
 		if (freestack_isempty(ep->unexp_fs))
 			return -FI_EAGAIN;
 		unexp = freestack_pop(ep->unexp_fs);
 		memcpy(&unexp->cmd, cmd, sizeof(*cmd));
-		ofi_cirque_discard(smr_cmd_queue(ep->region));
+		smr_cmd_queue_discard(smr_cmd_queue(ep->region));
+		unexp->match.addr = unexp->cmd.msg.hdr.addr;
+		unexp->match.tag = unexp->cmd.msg.hdr.tag;
+		unexp->match.ignore = 0;
 		if (cmd->msg.hdr.op == ofi_op_msg) {
-			dlist_insert_tail(&unexp->entry, &ep->unexp_msg_queue.list);
+			ofi_match_queue_insert(&ep->unexp_msg_queue,
+					       &unexp->match);
 		} else {
 			assert(cmd->msg.hdr.op == ofi_op_tagged);
-			dlist_insert_tail(&unexp->entry, &ep->unexp_tagged_queue.list);
+			ofi_match_queue_insert(&ep->unexp_tagged_queue,
+					       &unexp->match);
 		}
 		return 0;
 	}
 	ret = smr_progress_msg_common(ep, cmd,
-			container_of(dlist_entry, struct smr_rx_entry, entry));
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
+			container_of(match, struct smr_rx_entry, match));
+	smr_cmd_queue_discard(smr_cmd_queue(ep->region));
 	return ret < 0 ? ret : 0;
 }
 
 static int smr_progress_cmd_rma(struct smr_ep *ep, struct smr_cmd *cmd)
 {
 	struct smr_region *peer_smr;
+	struct smr_sar_entry *sar_entry;
 	struct smr_domain *domain;
 	struct smr_cmd *rma_cmd;
 	struct smr_resp *resp;
@@ -663,9 +693,8 @@ static int smr_progress_cmd_rma(struct smr_ep *ep, struct smr_cmd *cmd)
 		return -FI_ENOSPC;
 	}
 
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
-	ep->region->cmd_cnt++;
-	rma_cmd = ofi_cirque_head(smr_cmd_queue(ep->region));
+	rma_cmd = smr_cmd_queue_next(smr_cmd_queue(ep->region));
+	smr_return_cmd(ep);
 
 	for (iov_count = 0; iov_count < rma_cmd->rma.rma_count; iov_count++) {
 		ret = ofi_mr_verify(&domain->util_domain.mr_map,
@@ -679,25 +708,30 @@ static int smr_progress_cmd_rma(struct smr_ep *ep, struct smr_cmd *cmd)
 		iov[iov_count].iov_base = (void *) rma_cmd->rma.rma_iov[iov_count].addr;
 		iov[iov_count].iov_len = rma_cmd->rma.rma_iov[iov_count].len;
 	}
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
 	if (ret) {
-		ep->region->cmd_cnt++;
-		return ret;
+		smr_return_cmd(ep);
+		goto discard;
 	}
 
 	switch (cmd->msg.hdr.op_src) {
 	case smr_src_inline:
 		err = smr_progress_inline(cmd, iov, iov_count, &total_len);
-		ep->region->cmd_cnt++;
+		smr_return_cmd(ep);
 		break;
 	case smr_src_inject:
 		err = smr_progress_inject(cmd, iov, iov_count, &total_len, ep, ret);
 		if (cmd->msg.hdr.op == ofi_op_read_req && cmd->msg.hdr.data) {
-			peer_smr = smr_peer_region(ep->region, cmd->msg.hdr.addr);
+			ret = smr_peer_acquire(ep->region, cmd->msg.hdr.addr,
+					       &peer_smr);
+			if (ret) {
+				err = err ? err : ret;
+				break;
+			}
 			resp = smr_get_ptr(peer_smr, cmd->msg.hdr.data);
 			resp->status = -err;
+			smr_peer_release(ep->region, cmd->msg.hdr.addr);
 		} else {
-			ep->region->cmd_cnt++;
+			smr_return_cmd(ep);
 		}
 		break;
 	case smr_src_iov:
@@ -707,8 +741,10 @@ static int smr_progress_cmd_rma(struct smr_ep *ep, struct smr_cmd *cmd)
 		err = smr_progress_mmap(cmd, iov, iov_count, &total_len, ep);
 		break;
 	case smr_src_sar:
-		if (smr_progress_sar(cmd, NULL, iov, iov_count, &total_len, ep))
-			return ret;
+		err = smr_progress_sar(cmd, NULL, iov, iov_count, &total_len,
+				       ep, &sar_entry);
+		if (sar_entry)
+			goto discard;
 		break;
 	default:
 		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
@@ -725,6 +761,9 @@ static int smr_progress_cmd_rma(struct smr_ep *ep, struct smr_cmd *cmd)
 		"unable to process rx completion\n");
 	}
 
+discard:
+	smr_cmd_queue_discard(smr_cmd_queue(ep->region));
+	smr_cmd_queue_discard(smr_cmd_queue(ep->region));
 	return ret;
 }
 
@@ -742,9 +781,8 @@ static int smr_progress_cmd_atomic(struct smr_ep *ep, struct smr_cmd *cmd)
 	domain = container_of(ep->util_ep.domain, struct smr_domain,
 			      util_domain);
 
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
-	ep->region->cmd_cnt++;
-	rma_cmd = ofi_cirque_head(smr_cmd_queue(ep->region));
+	rma_cmd = smr_cmd_queue_next(smr_cmd_queue(ep->region));
+	smr_return_cmd(ep);
 
 	for (ioc_count = 0; ioc_count < rma_cmd->rma.rma_count; ioc_count++) {
 		ret = ofi_mr_verify(&domain->util_domain.mr_map,
@@ -760,10 +798,9 @@ static int smr_progress_cmd_atomic(struct smr_ep *ep, struct smr_cmd *cmd)
 		ioc[ioc_count].addr = (void *) rma_cmd->rma.rma_ioc[ioc_count].addr;
 		ioc[ioc_count].count = rma_cmd->rma.rma_ioc[ioc_count].count;
 	}
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
 	if (ret) {
-		ep->region->cmd_cnt++;
-		return ret;
+		smr_return_cmd(ep);
+		goto discard;
 	}
 
 	switch (cmd->msg.hdr.op_src) {
@@ -779,11 +816,17 @@ static int smr_progress_cmd_atomic(struct smr_ep *ep, struct smr_cmd *cmd)
 		err = -FI_EINVAL;
 	}
 	if (cmd->msg.hdr.data) {
-		peer_smr = smr_peer_region(ep->region, cmd->msg.hdr.addr);
-		resp = smr_get_ptr(peer_smr, cmd->msg.hdr.data);
-		resp->status = -err;
+		ret = smr_peer_acquire(ep->region, cmd->msg.hdr.addr,
+				       &peer_smr);
+		if (!ret) {
+			resp = smr_get_ptr(peer_smr, cmd->msg.hdr.data);
+			resp->status = -err;
+			smr_peer_release(ep->region, cmd->msg.hdr.addr);
+		} else if (!err) {
+			err = ret;
+		}
 	} else {
-		ep->region->cmd_cnt++;
+		smr_return_cmd(ep);
 	}
 
 	if (err)
@@ -793,22 +836,69 @@ static int smr_progress_cmd_atomic(struct smr_ep *ep, struct smr_cmd *cmd)
 	ret = smr_complete_rx(ep, NULL, cmd->msg.hdr.op, cmd->msg.hdr.op_flags,
 			      total_len, ioc_count ? ioc[0].addr : NULL,
 			      cmd->msg.hdr.addr, 0, cmd->msg.hdr.data, err);
-	if (ret)
-		return ret;
+	if (!ret)
+		ret = err;
+
+discard:
+	smr_cmd_queue_discard(smr_cmd_queue(ep->region));
+	smr_cmd_queue_discard(smr_cmd_queue(ep->region));
+	return ret;
+}
+
+/*
+ * Commands that need a response from us have it in the sender's region,
+ * which may not be mapped yet.  Such a command is only consumed once the
+ * region is held, otherwise there would be nowhere to report its status.
+ */
+static bool smr_cmd_needs_resp(struct smr_cmd *cmd)
+{
+	switch (cmd->msg.hdr.op_src) {
+	case smr_src_iov:
+	case smr_src_mmap:
+	case smr_src_sar:
+		return true;
+	default:
+		break;
+	}
 
-	return err; 
+	switch (cmd->msg.hdr.op) {
+	case ofi_op_read_req:
+	case ofi_op_atomic:
+	case ofi_op_atomic_fetch:
+	case ofi_op_atomic_compare:
+		return cmd->msg.hdr.data != 0;
+	default:
+		return false;
+	}
 }
 
 static void smr_progress_cmd(struct smr_ep *ep)
 {
+	struct smr_region *peer_smr;
 	struct smr_cmd *cmd;
-	int ret = 0;
+	int ret = 0, cnt, peer_id;
+
+	if (!smr_cmd_queue_head(smr_cmd_queue(ep->region)))
+		return;
 
-	fastlock_acquire(&ep->region->lock);
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
+	ep->rx_batch = true;
 
-	while (!ofi_cirque_isempty(smr_cmd_queue(ep->region))) {
-		cmd = ofi_cirque_head(smr_cmd_queue(ep->region));
+	for (cnt = 0; cnt < SMR_PROGRESS_BATCH; cnt++) {
+		cmd = smr_cmd_queue_head(smr_cmd_queue(ep->region));
+		if (!cmd)
+			break;
+
+		peer_id = -1;
+		if (smr_cmd_needs_resp(cmd)) {
+			ret = smr_peer_acquire(ep->region, cmd->msg.hdr.addr,
+					       &peer_smr);
+			if (ret == -FI_EAGAIN || ret == -FI_ENOMEM)
+				break;
+			/* any other error means the sender's region is gone */
+			if (!ret)
+				peer_id = (int) cmd->msg.hdr.addr;
+		}
 
 		switch (cmd->msg.hdr.op) {
 		case ofi_op_msg:
@@ -822,8 +912,8 @@ static void smr_progress_cmd(struct smr_ep *ep)
 		case ofi_op_write_async:
 		case ofi_op_read_async:
 			ofi_ep_rx_cntr_inc_func(&ep->util_ep, cmd->msg.hdr.op);
-			ofi_cirque_discard(smr_cmd_queue(ep->region));
-			ep->region->cmd_cnt++;
+			smr_cmd_queue_discard(smr_cmd_queue(ep->region));
+			smr_return_cmd(ep);
 			break;
 		case ofi_op_atomic:
 		case ofi_op_atomic_fetch:
@@ -835,6 +925,8 @@ static void smr_progress_cmd(struct smr_ep *ep)
 				"unidentified operation type\n");
 			ret = -FI_EINVAL;
 		}
+		if (peer_id >= 0)
+			smr_peer_release(ep->region, peer_id);
 
 		if (ret) {
 			if (ret != -FI_EAGAIN) {
@@ -844,8 +936,13 @@ static void smr_progress_cmd(struct smr_ep *ep)
 			break;
 		}
 	}
+	smr_flush_cmd_credits(ep);
+	ep->rx_batch = false;
+	if (ep->rx_signal) {
+		ep->rx_signal = false;
+		ep->util_ep.rx_cq->wait->signal(ep->util_ep.rx_cq->wait);
+	}
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
-	fastlock_release(&ep->region->lock);
 }
 
 static void smr_progress_sar_list(struct smr_ep *ep)
@@ -857,7 +954,6 @@ static void smr_progress_sar_list(struct smr_ep *ep)
 	struct dlist_entry *tmp;
 	int ret;
  
-	fastlock_acquire(&ep->region->lock);
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
 
 	dlist_foreach_container_safe(&ep->sar_list, struct smr_sar_entry,
@@ -887,12 +983,13 @@ static void smr_progress_sar_list(struct smr_ep *ep)
 				FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
 					"unable to process rx completion\n");
 			}
+			smr_peer_release(ep->region,
+					 sar_entry->cmd.msg.hdr.addr);
 			dlist_remove(&sar_entry->entry);
 			freestack_push(ep->sar_fs, sar_entry);
 		}
 	}
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
-	fastlock_release(&ep->region->lock);
 }
 
 void smr_ep_progress(struct util_ep *util_ep)
@@ -909,35 +1006,31 @@ void smr_ep_progress(struct util_ep *util_ep)
 }
 
 int smr_progress_unexp_queue(struct smr_ep *ep, struct smr_rx_entry *entry,
-			     struct smr_queue *unexp_queue)
+			     struct ofi_match_queue *unexp_queue)
 {
-	struct smr_match_attr match_attr;
 	struct smr_unexp_msg *unexp_msg;
-	struct dlist_entry *dlist_entry;
+	struct ofi_match_entry *match;
 	int multi_recv;
 	int ret;
 
-	match_attr.addr = entry->addr;
-	match_attr.ignore = entry->ignore;
-	match_attr.tag = entry->tag;
-
-	dlist_entry = dlist_remove_first_match(&unexp_queue->list,
-					       unexp_queue->match_func,
-					       &match_attr);
-	if (!dlist_entry)
+	match = ofi_match_queue_remove_first(unexp_queue, entry->match.addr,
+					     entry->match.tag,
+					     entry->match.ignore);
+	if (!match)
 		return 0;
 
 	multi_recv = entry->flags & SMR_MULTI_RECV;
-	while (dlist_entry) {
-		unexp_msg = container_of(dlist_entry, struct smr_unexp_msg, entry);
+	while (match) {
+		unexp_msg = container_of(match, struct smr_unexp_msg, match);
 		ret = smr_progress_msg_common(ep, &unexp_msg->cmd, entry);
 		freestack_push(ep->unexp_fs, unexp_msg);
 		if (!multi_recv || ret)
 			break;
 
-		dlist_entry = dlist_remove_first_match(&unexp_queue->list,
-						       unexp_queue->match_func,
-						       &match_attr);
+		match = ofi_match_queue_remove_first(unexp_queue,
+						     entry->match.addr,
+						     entry->match.tag,
+						     entry->match.ignore);
 	}
 
 	return ret < 0 ? ret : 0;
@@ -108,8 +108,9 @@ ssize_t smr_generic_rma(struct smr_ep *ep, const struct iovec *iov,
 	struct smr_inject_buf *tx_buf;
 	struct smr_sar_msg *sar;
 	struct smr_resp *resp;
-	struct smr_cmd *cmd;
-	struct smr_tx_entry *pend;
+	struct smr_cmd cmd[2];
+	struct smr_tx_entry *pend = NULL;
+	int64_t pos;
 	int id, peer_id, cmds, err = 0, comp = 1;
 	uint16_t comp_flags;
 	ssize_t ret = 0;
@@ -121,63 +122,64 @@ ssize_t smr_generic_rma(struct smr_ep *ep, const struct iovec *iov,
 	domain = container_of(ep->util_ep.domain, struct smr_domain, util_domain);
 
 	id = (int) addr;
-	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 
 	ret = smr_verify_peer(ep, id);
 	if (ret)
 		return ret;
 
+	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 	cmds = 1 + !(domain->fast_rma && !(op_flags &
 		    (FI_REMOTE_CQ_DATA | FI_DELIVERY_COMPLETE)) &&
 		     rma_count == 1 &&
 		     ep->region->cma_cap == SMR_CMA_CAP_ON);
 
 	peer_smr = smr_peer_region(ep->region, id);
-	fastlock_acquire(&peer_smr->lock);
-	if (peer_smr->cmd_cnt < cmds ||
-	    smr_peer_data(ep->region)[id].sar_status) {
+	if (smr_cmd_queue_reserve(peer_smr, cmds)) {
 		ret = -FI_EAGAIN;
-		goto unlock_region;
+		goto out;
 	}
 
 	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq) ||
+	    smr_peer_data(ep->region)[id].sar_status) {
 		ret = -FI_EAGAIN;
 		goto unlock_cq;
 	}
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-
 	if (cmds == 1) {
-		err = smr_rma_fast(peer_smr, cmd, iov, iov_count, rma_iov,
+		err = smr_rma_fast(peer_smr, &cmd[0], iov, iov_count, rma_iov,
 				   rma_count, desc, peer_id,  context, op,
 				   op_flags);
-		comp_flags = cmd->msg.hdr.op_flags;
+		comp_flags = cmd[0].msg.hdr.op_flags;
+		if (err) {
+			smr_cmd_queue_release(peer_smr, cmds);
+			cmds = 0;
+		}
 		goto commit_comp;
 	}
 
 	total_len = ofi_total_iov_len(iov, iov_count);
 
-	smr_generic_format(cmd, peer_id, op, 0, data, op_flags);
+	smr_generic_format(&cmd[0], peer_id, op, 0, data, op_flags);
 	if (total_len <= SMR_MSG_DATA_LEN && op == ofi_op_write &&
 	    !(op_flags & FI_DELIVERY_COMPLETE)) {
-		smr_format_inline(cmd, iov, iov_count);
-	} else if (total_len <= SMR_INJECT_SIZE &&
+		smr_format_inline(&cmd[0], iov, iov_count);
+	} else if (smr_use_inject(ep->region, peer_smr, total_len) &&
 		   !(op_flags & FI_DELIVERY_COMPLETE)) {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
-		smr_format_inject(cmd, iov, iov_count, peer_smr, tx_buf);
+		if (op == ofi_op_read_req &&
+		    ofi_cirque_isfull(smr_resp_queue(ep->region))) {
+			ret = -FI_EAGAIN;
+			goto unlock_cq;
+		}
+		tx_buf = smr_inject_buf_get(peer_smr);
+		smr_format_inject(&cmd[0], iov, iov_count, peer_smr, tx_buf);
 		if (op == ofi_op_read_req) {
-			if (ofi_cirque_isfull(smr_resp_queue(ep->region))) {
-				smr_freestack_push(smr_inject_pool(peer_smr), tx_buf);
-				ret = -FI_EAGAIN;
-				goto unlock_cq;
-			}
-			cmd->msg.hdr.op_flags |= SMR_RMA_REQ;
+			cmd[0].msg.hdr.op_flags |= SMR_RMA_REQ;
 			resp = ofi_cirque_tail(smr_resp_queue(ep->region));
 			pend = freestack_pop(ep->pend_fs);
-			smr_format_pend_resp(pend, cmd, context, iov,
+			smr_format_pend_resp(ep, pend, &cmd[0], context, iov,
 					     iov_count, id, resp);
-			cmd->msg.hdr.data = smr_get_offset(ep->region, resp);
+			cmd[0].msg.hdr.data = smr_get_offset(ep->region, resp);
 			ofi_cirque_commit(smr_resp_queue(ep->region));
 			comp = 0;
 		}
@@ -189,21 +191,21 @@ ssize_t smr_generic_rma(struct smr_ep *ep, const struct iovec *iov,
 		resp = ofi_cirque_tail(smr_resp_queue(ep->region));
 		pend = freestack_pop(ep->pend_fs);
 		if (ep->region->cma_cap == SMR_CMA_CAP_ON) {
-			smr_format_iov(cmd, iov, iov_count, total_len, ep->region, resp);
+			smr_format_iov(&cmd[0], iov, iov_count, total_len,
+				       ep->region, resp);
 		} else {
-			if (total_len <= smr_env.sar_threshold) {
-				if (!peer_smr->sar_cnt) {
+			if (smr_use_sar(ep->region, peer_smr, total_len)) {
+				sar = smr_sar_buf_get(peer_smr);
+				if (!sar) {
 					ret = -FI_EAGAIN;
 				} else {
-					sar = smr_freestack_pop(smr_sar_pool(peer_smr));
-					smr_format_sar(cmd, iov, iov_count, total_len,
-						       ep->region, peer_smr, sar,
-						       pend, resp);
-					peer_smr->sar_cnt--;
+					smr_format_sar(&cmd[0], iov, iov_count,
+						       total_len, ep->region,
+						       peer_smr, sar, pend, resp);
 					smr_peer_data(ep->region)[id].sar_status = 1;
 				}
 			} else {
-				ret = smr_format_mmap(ep, cmd, iov, iov_count,
+				ret = smr_format_mmap(ep, &cmd[0], iov, iov_count,
 						      total_len, pend, resp);
 			}
 			if (ret) {
@@ -212,34 +214,37 @@ ssize_t smr_generic_rma(struct smr_ep *ep, const struct iovec *iov,
 				goto unlock_cq;
 			}
 		}
-		smr_format_pend_resp(pend, cmd, context, iov, iov_count, id, resp);
+		smr_format_pend_resp(ep, pend, &cmd[0], context, iov, iov_count,
+				     id, resp);
 		ofi_cirque_commit(smr_resp_queue(ep->region));
 		comp = 0;
 	}
 
-	comp_flags = cmd->msg.hdr.op_flags;
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_format_rma_iov(cmd, rma_iov, rma_count);
+	comp_flags = cmd[0].msg.hdr.op_flags;
+	smr_format_rma_iov(&cmd[1], rma_iov, rma_count);
 
 commit_comp:
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
-
-	if (!comp)
-		goto unlock_cq;
+	if (cmds) {
+		pos = smr_cmd_queue_post(smr_cmd_queue(peer_smr), cmd, cmds);
+		if (pend)
+			pend->cmd_pos = pos;
+	}
 
-	ret = smr_complete_tx(ep, context, op, comp_flags, err);
-	if (ret) {
-		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
-			"unable to process tx completion\n");
+	if (comp) {
+		ret = smr_complete_tx(ep, context, op, comp_flags, err);
+		if (ret) {
+			FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
+				"unable to process tx completion\n");
+		}
 	}
+	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	goto out;
 
 unlock_cq:
 	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
-unlock_region:
-	fastlock_release(&peer_smr->lock);
+	smr_cmd_queue_release(peer_smr, cmds);
+out:
+	smr_peer_release(ep->region, id);
 	return ret;
 }
 
@@ -356,7 +361,7 @@ ssize_t smr_generic_rma_inject(struct fid_ep *ep_fid, const void *buf,
 	struct smr_domain *domain;
 	struct smr_region *peer_smr;
 	struct smr_inject_buf *tx_buf;
-	struct smr_cmd *cmd;
+	struct smr_cmd cmd[2];
 	struct iovec iov;
 	struct fi_rma_iov rma_iov;
 	int id, peer_id, cmds;
@@ -367,21 +372,21 @@ ssize_t smr_generic_rma_inject(struct fid_ep *ep_fid, const void *buf,
 	domain = container_of(ep->util_ep.domain, struct smr_domain, util_domain);
 
 	id = (int) dest_addr;
-	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 
 	ret = smr_verify_peer(ep, id);
 	if (ret)
 		return ret;
 
+	peer_id = smr_peer_data(ep->region)[id].addr.addr;
 	cmds = 1 + !(domain->fast_rma && !(flags & FI_REMOTE_CQ_DATA) &&
 		     ep->region->cma_cap == SMR_CMA_CAP_ON);
 
 	peer_smr = smr_peer_region(ep->region, id);
-	fastlock_acquire(&peer_smr->lock);
-	if (peer_smr->cmd_cnt < cmds ||
-	    smr_peer_data(ep->region)[id].sar_status) {
+	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
+	if (smr_peer_data(ep->region)[id].sar_status ||
+	    smr_cmd_queue_reserve(peer_smr, cmds)) {
 		ret = -FI_EAGAIN;
-		goto unlock_region;
+		goto unlock_cq;
 	}
 
 	iov.iov_base = (void *) buf;
@@ -390,35 +395,32 @@ ssize_t smr_generic_rma_inject(struct fid_ep *ep_fid, const void *buf,
 	rma_iov.len = len;
 	rma_iov.key = key;
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-
 	if (cmds == 1) {
-		ret = smr_rma_fast(peer_smr, cmd, &iov, 1, &rma_iov, 1, NULL,
+		ret = smr_rma_fast(peer_smr, &cmd[0], &iov, 1, &rma_iov, 1, NULL,
 				   peer_id, NULL, ofi_op_write, flags);
-		if (ret)
-			goto unlock_region;
+		if (ret) {
+			smr_cmd_queue_release(peer_smr, cmds);
+			goto unlock_cq;
+		}
 		goto commit;
 	}
 
-	smr_generic_format(cmd, peer_id, ofi_op_write, 0, data, flags);
+	smr_generic_format(&cmd[0], peer_id, ofi_op_write, 0, data, flags);
 	if (len <= SMR_MSG_DATA_LEN) {
-		smr_format_inline(cmd, &iov, 1);
+		smr_format_inline(&cmd[0], &iov, 1);
 	} else {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
-		smr_format_inject(cmd, &iov, 1, peer_smr, tx_buf);
+		tx_buf = smr_inject_buf_get(peer_smr);
+		smr_format_inject(&cmd[0], &iov, 1, peer_smr, tx_buf);
 	}
 
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_format_rma_iov(cmd, &rma_iov, 1);
+	smr_format_rma_iov(&cmd[1], &rma_iov, 1);
 
 commit:
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
+	smr_cmd_queue_post(smr_cmd_queue(peer_smr), cmd, cmds);
 	ofi_ep_tx_cntr_inc_func(&ep->util_ep, ofi_op_write);
-unlock_region:
-	fastlock_release(&peer_smr->lock);
+unlock_cq:
+	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	smr_peer_release(ep->region, id);
 	return ret;
 }
 
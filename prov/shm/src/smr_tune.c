@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2020 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Protocol threshold calibration.
+ *
+ * Each protocol is modeled by the copies and system calls it performs for
+ * one message, which can all be timed inside a single process:
+ *
+ *   inject - copy into an inject buffer and copy back out
+ *   iov    - one process_vm_readv (CMA)
+ *   sar    - copy in and out through SMR_SAR_SIZE staging segments
+ *   mmap   - create, size and map a shm file, copy in, map it again,
+ *            copy out, unmap and unlink
+ *
+ * A size sweep finds the largest size for which inject beats iov and sar
+ * beats mmap.  The sweep runs twice: once with all buffers on the local
+ * NUMA node, and once with the sender's buffer and the mmapped file on
+ * another node, which is what the receiver reads from when the peer is
+ * across sockets.  The staging buffers live in the receiver's region and
+ * stay local.  The second sweep sets the remote thresholds, which are used
+ * for peers whose region is on another node.
+ *
+ * The result can be saved to a file so later runs on the same machine load
+ * it instead of measuring again.  The file is keyed on a hash of the NUMA
+ * nodes and their CPUs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "smr.h"
+
+#define SMR_TUNE_NAME		"fi_shm_tune_"
+#define SMR_TUNE_VERSION	2
+#define SMR_TUNE_ITERS		16
+#define SMR_TUNE_MIN_INJECT	256
+#define SMR_TUNE_MIN_SAR	(SMR_SAR_SIZE * 4)
+#define SMR_TUNE_MAX_SAR	(1 << 24)
+/* nodes ofi_numa_prefer() can bind to */
+#define SMR_TUNE_MAX_NODES	64
+
+static uint64_t smr_tune_inject(char *dst, char *src, char *tmp, size_t size)
+{
+	uint64_t start;
+	int i;
+
+	start = ofi_gettime_ns();
+	for (i = 0; i < SMR_TUNE_ITERS; i++) {
+		memcpy(tmp, src, size);
+		memcpy(dst, tmp, size);
+	}
+	return ofi_gettime_ns() - start;
+}
+
+static uint64_t smr_tune_iov(char *dst, char *src, size_t size)
+{
+	struct iovec local, remote;
+	uint64_t start;
+	int i;
+
+	local.iov_base = dst;
+	local.iov_len = size;
+	remote.iov_base = src;
+	remote.iov_len = size;
+
+	start = ofi_gettime_ns();
+	for (i = 0; i < SMR_TUNE_ITERS; i++) {
+		if (ofi_process_vm_readv(getpid(), &local, 1,
+					 &remote, 1, 0) != (ssize_t) size)
+			return UINT64_MAX;
+	}
+	return ofi_gettime_ns() - start;
+}
+
+static uint64_t smr_tune_sar(char *dst, char *src, char *tmp, size_t size)
+{
+	uint64_t start;
+	size_t done, len;
+	int i;
+
+	start = ofi_gettime_ns();
+	for (i = 0; i < SMR_TUNE_ITERS; i++) {
+		for (done = 0; done < size; done += len) {
+			len = MIN(SMR_SAR_SIZE, size - done);
+			memcpy(tmp, src + done, len);
+			memcpy(dst + done, tmp, len);
+		}
+	}
+	return ofi_gettime_ns() - start;
+}
+
+static uint64_t smr_tune_mmap(const char *name, char *dst, char *src,
+			      size_t size, int node)
+{
+	uint64_t start;
+	void *ptr;
+	int i, fd;
+
+	start = ofi_gettime_ns();
+	for (i = 0; i < SMR_TUNE_ITERS; i++) {
+		fd = shm_open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+		if (fd < 0)
+			return UINT64_MAX;
+
+		if (ftruncate(fd, size))
+			goto err;
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+		if (ptr == MAP_FAILED)
+			goto err;
+		if (node >= 0)
+			(void) ofi_numa_prefer(ptr, size, node);
+		memcpy(ptr, src, size);
+		munmap(ptr, size);
+
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+		if (ptr == MAP_FAILED)
+			goto err;
+		memcpy(dst, ptr, size);
+		munmap(ptr, size);
+
+		close(fd);
+		shm_unlink(name);
+	}
+	return ofi_gettime_ns() - start;
+err:
+	close(fd);
+	shm_unlink(name);
+	return UINT64_MAX;
+}
+
+/*
+ * Hash of the NUMA nodes and the CPUs on each, which identifies the
+ * topology the thresholds were measured on.  Also returns a node with CPUs
+ * other than local in *remote, or -1 if there is none.
+ */
+static size_t smr_tune_topology(int local, int *remote)
+{
+	char path[64], cpus[4096];
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i, len, cnt;
+	FILE *file;
+	int node;
+
+	*remote = -1;
+	for (node = 0; node < SMR_TUNE_MAX_NODES; node++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", node);
+		file = fopen(path, "r");
+		if (!file)
+			continue;
+
+		len = snprintf(cpus, sizeof(cpus), "%d:", node);
+		cnt = fread(cpus + len, 1, sizeof(cpus) - len, file);
+		fclose(file);
+		len += cnt;
+
+		/* memory-only nodes have an empty cpulist */
+		if (*remote < 0 && node != local && cnt > 1)
+			*remote = node;
+
+		for (i = 0; i < len; i++) {
+			hash ^= (uint8_t) cpus[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	return (size_t) hash;
+}
+
+static char *smr_tune_alloc(size_t size, int node)
+{
+	void *buf;
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		return NULL;
+
+	/* before the pages are first touched */
+	if (node >= 0)
+		(void) ofi_numa_prefer(buf, size, node);
+	memset(buf, 0xa5, size);
+	return buf;
+}
+
+/* node is where src and the mmapped file are placed, or -1 for local */
+static void smr_tune_sweep(char *dst, char *src, char *tmp, int node,
+			   size_t *inject_threshold, size_t *sar_threshold)
+{
+	char name[NAME_MAX];
+	size_t size;
+
+	*inject_threshold = SMR_MSG_DATA_LEN;
+	for (size = SMR_TUNE_MIN_INJECT; size <= SMR_INJECT_SIZE; size <<= 1) {
+		if (smr_tune_iov(dst, src, size) <
+		    smr_tune_inject(dst, src, tmp, size))
+			break;
+		*inject_threshold = size;
+	}
+
+	snprintf(name, sizeof(name), "%s%d", SMR_TUNE_NAME, getpid());
+	for (size = SMR_TUNE_MIN_SAR; size <= SMR_TUNE_MAX_SAR; size <<= 1) {
+		if (smr_tune_mmap(name, dst, src, size, node) <
+		    smr_tune_sar(dst, src, tmp, size))
+			break;
+	}
+	*sar_threshold = size > SMR_TUNE_MAX_SAR ? SIZE_MAX : size >> 1;
+}
+
+static void smr_tune_calibrate(void)
+{
+	char *src, *dst, *tmp;
+	int local, remote;
+
+	local = ofi_numa_node();
+	(void) smr_tune_topology(local, &remote);
+
+	src = smr_tune_alloc(SMR_TUNE_MAX_SAR, local);
+	dst = smr_tune_alloc(SMR_TUNE_MAX_SAR, local);
+	tmp = malloc(MAX(SMR_INJECT_SIZE, SMR_SAR_SIZE));
+	if (!src || !dst || !tmp) {
+		FI_WARN(&smr_prov, FI_LOG_CORE,
+			"unable to allocate calibration buffers\n");
+		goto out;
+	}
+
+	smr_tune_sweep(dst, src, tmp, -1, &smr_env.inject_threshold,
+		       &smr_env.sar_threshold);
+	smr_env.remote_inject_threshold = smr_env.inject_threshold;
+	smr_env.remote_sar_threshold = smr_env.sar_threshold;
+
+	if (remote >= 0) {
+		munmap(src, SMR_TUNE_MAX_SAR);
+		src = smr_tune_alloc(SMR_TUNE_MAX_SAR, remote);
+		if (!src) {
+			FI_WARN(&smr_prov, FI_LOG_CORE,
+				"unable to allocate calibration buffers\n");
+			goto out;
+		}
+		smr_tune_sweep(dst, src, tmp, remote,
+			       &smr_env.remote_inject_threshold,
+			       &smr_env.remote_sar_threshold);
+	}
+
+	FI_INFO(&smr_prov, FI_LOG_CORE,
+		"calibrated inject_threshold %zu sar_threshold %zu, "
+		"remote (node %d) inject_threshold %zu sar_threshold %zu\n",
+		smr_env.inject_threshold, smr_env.sar_threshold, remote,
+		smr_env.remote_inject_threshold, smr_env.remote_sar_threshold);
+out:
+	free(tmp);
+	if (dst)
+		munmap(dst, SMR_TUNE_MAX_SAR);
+	if (src)
+		munmap(src, SMR_TUNE_MAX_SAR);
+}
+
+static int smr_tune_load(const char *path)
+{
+	size_t inject_threshold = smr_env.inject_threshold;
+	size_t sar_threshold = smr_env.sar_threshold;
+	size_t remote_inject_threshold = smr_env.remote_inject_threshold;
+	size_t remote_sar_threshold = smr_env.remote_sar_threshold;
+	char key[32];
+	size_t num, topology = 0;
+	int version = 0, remote;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -errno;
+
+	while (fscanf(file, "%31s %zu", key, &num) == 2) {
+		if (!strcmp(key, "version"))
+			version = (int) num;
+		else if (!strcmp(key, "topology"))
+			topology = num;
+		else if (!strcmp(key, "inject_threshold"))
+			inject_threshold = num;
+		else if (!strcmp(key, "sar_threshold"))
+			sar_threshold = num;
+		else if (!strcmp(key, "remote_inject_threshold"))
+			remote_inject_threshold = num;
+		else if (!strcmp(key, "remote_sar_threshold"))
+			remote_sar_threshold = num;
+	}
+	fclose(file);
+
+	if (version != SMR_TUNE_VERSION ||
+	    topology != smr_tune_topology(ofi_numa_node(), &remote)) {
+		FI_INFO(&smr_prov, FI_LOG_CORE,
+			"ignoring stale calibration file %s\n", path);
+		return -FI_EINVAL;
+	}
+
+	smr_env.inject_threshold = MIN(inject_threshold, SMR_INJECT_SIZE);
+	smr_env.sar_threshold = sar_threshold;
+	smr_env.remote_inject_threshold = MIN(remote_inject_threshold,
+					      SMR_INJECT_SIZE);
+	smr_env.remote_sar_threshold = remote_sar_threshold;
+	return 0;
+}
+
+/*
+ * Several processes on the node may calibrate at the same time, so the file
+ * is written under a temporary name in the same directory and renamed into
+ * place.  Readers see either no file or a complete one.
+ */
+static void smr_tune_save(const char *path)
+{
+	FILE *file;
+	char *tmp;
+	int fd, ret, remote;
+
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+		return;
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto err;
+
+	file = fdopen(fd, "w");
+	if (!file) {
+		close(fd);
+		unlink(tmp);
+		goto err;
+	}
+
+	fprintf(file, "version %d\n", SMR_TUNE_VERSION);
+	fprintf(file, "topology %zu\n", smr_tune_topology(-1, &remote));
+	fprintf(file, "inject_threshold %zu\n", smr_env.inject_threshold);
+	fprintf(file, "sar_threshold %zu\n", smr_env.sar_threshold);
+	fprintf(file, "remote_inject_threshold %zu\n",
+		smr_env.remote_inject_threshold);
+	fprintf(file, "remote_sar_threshold %zu\n",
+		smr_env.remote_sar_threshold);
+	ret = ferror(file);
+	if (fclose(file) || ret || rename(tmp, path)) {
+		unlink(tmp);
+		goto err;
+	}
+	free(tmp);
+	return;
+
+err:
+	FI_WARN(&smr_prov, FI_LOG_CORE,
+		"unable to write calibration file %s\n", path);
+	free(tmp);
+}
+
+void smr_tune_init(const char *path, int calibrate)
+{
+	if (path && !smr_tune_load(path))
+		return;
+
+	if (!calibrate)
+		return;
+
+	smr_tune_calibrate();
+	if (path)
+		smr_tune_save(path);
+}
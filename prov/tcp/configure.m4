@@ -11,5 +11,45 @@ AC_DEFUN([FI_TCP_CONFIGURE],[
        # Determine if we can support the tcp provider
        tcp_h_happy=0
        AS_IF([test x"$enable_tcp" != x"no"], [tcp_h_happy=1])
+
+       # MSG_ZEROCOPY transmit needs both the flag and the errqueue format
+       tcp_zerocopy=0
+       AS_IF([test $tcp_h_happy -eq 1],
+	     [AC_MSG_CHECKING([for MSG_ZEROCOPY support])
+	      AC_COMPILE_IFELSE([AC_LANG_PROGRAM(
+				[[#include <sys/socket.h>
+				  #include <linux/errqueue.h>]],
+				[[int flags = MSG_ZEROCOPY;
+				  int opt = SO_ZEROCOPY;
+				  int origin = SO_EE_ORIGIN_ZEROCOPY;
+				  (void) flags; (void) opt; (void) origin;]])],
+				[tcp_zerocopy=1
+				 AC_MSG_RESULT([yes])],
+				[AC_MSG_RESULT([no])])])
+       AC_DEFINE_UNQUOTED([HAVE_TCP_ZEROCOPY], [$tcp_zerocopy],
+			  [Define to 1 if tcp can transmit with MSG_ZEROCOPY])
+
+       # The io_uring engine uses the raw system calls, not liburing
+       tcp_uring=0
+       AS_IF([test $tcp_h_happy -eq 1],
+	     [AC_MSG_CHECKING([for io_uring support])
+	      AC_COMPILE_IFELSE([AC_LANG_PROGRAM(
+				[[#include <sys/syscall.h>
+				  #include <linux/io_uring.h>]],
+				[[int ops[] = { IORING_OP_RECV,
+						IORING_OP_SENDMSG,
+						IORING_OP_POLL_ADD,
+						IORING_OP_ASYNC_CANCEL };
+				  unsigned feat = IORING_FEAT_NODROP;
+				  unsigned setup = IORING_SETUP_CQSIZE;
+				  long nr = __NR_io_uring_setup +
+					    __NR_io_uring_enter;
+				  (void) ops; (void) feat; (void) setup;
+				  (void) nr;]])],
+				[tcp_uring=1
+				 AC_MSG_RESULT([yes])],
+				[AC_MSG_RESULT([no])])])
+       AC_DEFINE_UNQUOTED([HAVE_TCP_URING], [$tcp_uring],
+			  [Define to 1 if tcp can use io_uring])
        AS_IF([test $tcp_h_happy -eq 1], [$1], [$2])
 ])
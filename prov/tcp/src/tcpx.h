@@ -58,6 +58,7 @@
 #include <ofi_signal.h>
 #include <ofi_util.h>
 #include <ofi_proto.h>
+#include <ofi_match.h>
 
 #ifndef _TCP_H_
 #define _TCP_H_
@@ -67,7 +68,7 @@
 
 #define TCPX_MAX_CM_DATA_SIZE	(1 << 8)
 #define TCPX_IOV_LIMIT		(4)
-#define TCPX_MAX_INJECT_SZ	(64)
+#define TCPX_MAX_INJECT_SZ	(128)
 
 #define MAX_POLL_EVENTS		100
 
@@ -75,10 +76,45 @@
 
 #define TCPX_PORT_MAX_RANGE	(USHRT_MAX)
 
+/* Limits for coalescing queued sends into one sendmsg, well below IOV_MAX */
+#define TCPX_TX_GATHER_IOV	64
+#define TCPX_TX_GATHER_SIZE	(64 * 1024)
+
+/* Default bytes of unexpected messages an FI_EP_RDM endpoint buffers */
+#define TCPX_RDM_BUFFERED_RECV	(16 * 1024 * 1024)
+
+/* Sleep bound of the progress thread while it has cqs it cannot wait on */
+#define TCPX_PROGRESS_POLL_MS	1
+
+/* io_uring submission and completion queue sizes, see tcpx_uring.c */
+#define TCPX_URING_SQ_SIZE	1024
+#define TCPX_URING_CQ_SIZE	(8 * TCPX_URING_SQ_SIZE)
+#define TCPX_URING_SQ_IDLE_MS	100
+
+/* Parallel sockets of a connection, see tcpx_stream.c */
+#define TCPX_MAX_STREAMS	16
+#define TCPX_MIN_STRIPE_SIZE	(64 * 1024)
+#define TCPX_STREAM_TIMEOUT_MS	10000
+
+/* tcpx_base_hdr::flags, the payload is split across the streams */
+#define TCPX_STRIPED		(1 << 8)
+
 extern struct fi_provider	tcpx_prov;
 extern struct util_prov		tcpx_util_prov;
 extern struct fi_info		tcpx_info;
+extern struct fi_info		tcpx_rdm_info;
 extern struct tcpx_port_range	port_range;
+extern size_t			tcpx_zerocopy_size;
+extern size_t			tcpx_staging_size;
+extern size_t			tcpx_direct_recv_size;
+extern int			tcpx_progress_thread;
+extern int			tcpx_progress_spin;
+extern char			*tcpx_progress_affinity;
+extern char			*tcpx_io_engine;
+extern int			tcpx_uring_sqpoll;
+extern int			tcpx_streams;
+extern size_t			tcpx_stripe_size;
+extern int			tcpx_rdm_enabled;
 struct tcpx_xfer_entry;
 struct tcpx_ep;
 
@@ -91,6 +127,7 @@ enum tcpx_xfer_op_codes {
 	TCPX_OP_READ_REQ,
 	TCPX_OP_READ_RSP,
 	TCPX_OP_REMOTE_READ,
+	TCPX_OP_TAGGED_SEND,
 	TCPX_OP_CODE_MAX,
 };
 
@@ -100,6 +137,7 @@ enum tcpx_cm_event_type {
 	SERVER_RECV_CONNREQ,
 	SERVER_SEND_CM_ACCEPT,
 	CLIENT_RECV_CONNRESP,
+	SERVER_STREAM_CONNECT,
 };
 
 struct tcpx_cm_context {
@@ -107,6 +145,9 @@ struct tcpx_cm_context {
 	enum tcpx_cm_event_type	type;
 	size_t			cm_data_sz;
 	char			cm_data[TCPX_MAX_CM_DATA_SIZE];
+	/* streams asked for (connreq) or granted (connresp) */
+	uint32_t		streams;
+	uint16_t		stream_port;
 };
 
 struct tcpx_port_range {
@@ -119,6 +160,8 @@ struct tcpx_conn_handle {
 	struct tcpx_pep		*pep;
 	SOCKET			sock;
 	bool			endian_match;
+	uint32_t		streams;
+	uint16_t		stream_port;
 };
 
 struct tcpx_pep {
@@ -152,7 +195,15 @@ struct tcpx_cq_data_hdr {
 	uint64_t		cq_data;
 };
 
+/* Tagged messages carry the tag in the last 8 bytes before the payload */
+static inline uint64_t *tcpx_hdr_tag(struct tcpx_base_hdr *hdr)
+{
+	return (uint64_t *) ((uint8_t *) hdr + hdr->payload_off -
+			     sizeof(uint64_t));
+}
+
 #define TCPX_MAX_HDR_SZ (sizeof(struct tcpx_base_hdr) + 	\
+			 sizeof(uint64_t) +			\
 			 sizeof(uint64_t) +			\
 			 sizeof(struct ofi_rma_iov) *		\
 			 TCPX_IOV_LIMIT +			\
@@ -172,6 +223,7 @@ struct tcpx_rx_ctx {
 	struct slist		rx_queue;
 	struct ofi_bufpool	*buf_pool;
 	uint64_t		op_flags;
+	size_t			min_multi_recv_size;
 	fastlock_t		lock;
 };
 
@@ -181,12 +233,67 @@ enum {
 	STAGE_BUF_SIZE = 512
 };
 
+/*
+ * Receive staging buffer.  Headers and payloads smaller than
+ * tcpx_direct_recv_size are read through it, so one recv can pick up
+ * many small messages.  read_len starts at STAGE_BUF_SIZE and doubles,
+ * up to tcpx_staging_size, each time a recv fills it.  Larger payloads
+ * are read straight into the user buffer, and read_len drops back so
+ * the next large payload is not pulled into the buffer and copied.
+ */
 struct stage_buf {
-	uint8_t			buf[STAGE_BUF_SIZE];
+	uint8_t			*buf;
+	size_t			size;
+	size_t			read_len;
 	size_t			bytes_avail;
 	size_t			cur_pos;
 };
 
+/*
+ * Links an endpoint on a cq's ready list while its stage_buf holds bytes
+ * that could not be processed yet.  epoll cannot report those, so the cq
+ * revisits the endpoint on its next progress call.  queued is protected
+ * by the cq's ready_lock.
+ */
+struct tcpx_ready_entry {
+	struct dlist_entry	entry;
+	struct tcpx_ep		*ep;
+	bool			queued;
+};
+
+struct tcpx_conn;
+struct tcpx_uring;
+
+/*
+ * io_uring state of an endpoint.  ops has a bit set for each request
+ * in flight, which owns the staging buffer (rx) or the gathered iov (tx)
+ * until it completes.  Protected by the ep lock.
+ */
+struct tcpx_uring_ep {
+	struct tcpx_uring	*ring;
+	uint8_t			ops;
+	bool			closing;
+	struct msghdr		msg;
+	struct iovec		iov[TCPX_TX_GATHER_IOV];
+};
+
+/*
+ * Extra socket of a striped connection.  tx_iov and rx_iov hold this
+ * stream's slice of the striped transfer in progress, if any.
+ */
+struct tcpx_stream {
+	SOCKET			sock;
+	/* set while the server's connect is in progress */
+	struct tcpx_cm_context	*cm_ctx;
+	bool			pollout_set;
+	struct iovec		tx_iov[TCPX_IOV_LIMIT + 1];
+	size_t			tx_iov_cnt;
+	size_t			tx_len;
+	struct iovec		rx_iov[TCPX_IOV_LIMIT + 1];
+	size_t			rx_iov_cnt;
+	size_t			rx_len;
+};
+
 struct tcpx_ep {
 	struct util_ep		util_ep;
 	SOCKET			sock;
@@ -207,12 +314,45 @@ struct tcpx_ep {
 	struct stage_buf	stage_buf;
 	size_t			min_multi_recv_size;
 	bool			pollout_set;
+	/* FI_MORE sends queued without being sent */
+	bool			tx_held;
+	size_t			tx_held_iov;
+	size_t			tx_held_len;
+	/* MSG_ZEROCOPY state, see tcpx_comm.c */
+	bool			zerocopy;
+	uint32_t		zc_next;
+	uint32_t		zc_acked;
+	struct slist		tx_zc_queue;
+	/* ready list links for the rx cq and, if different, the tx cq */
+	struct tcpx_ready_entry	ready[2];
+	/* set when the ep carries a connection of an FI_EP_RDM endpoint */
+	struct tcpx_conn	*conn;
+	/* set when the ep's transfers go through io_uring */
+	struct tcpx_uring_ep	*uring;
+	/* streams next to sock, and the striped transfers using them */
+	struct tcpx_stream	*streams;
+	size_t			stream_cnt;
+	struct tcpx_xfer_entry	*tx_stripe;
+	bool			rx_stripe;
+	/* connection setup: listener of the client, request of the peer */
+	SOCKET			stream_listen;
+	uint32_t		stream_req;
+	uint16_t		stream_port;
+	/* server: accept response held back until the streams connect */
+	struct tcpx_cm_context	*stream_cm_ctx;
+	size_t			stream_pending;
 };
 
 struct tcpx_fabric {
 	struct util_fabric	util_fabric;
 };
 
+/*
+ * tcpx_xfer_entry::flags, the receive is carved out of the posted
+ * FI_MULTI_RECV buffer at mrecv and completes with mrecv_msg_start as buf
+ */
+#define TCPX_MULTI_RECV_PART	(1ULL << 60)
+
 struct tcpx_xfer_entry {
 	struct slist_entry	entry;
 	union {
@@ -227,10 +367,36 @@ struct tcpx_xfer_entry {
 	void			*context;
 	uint64_t		rem_len;
 	void			*mrecv_msg_start;
+	/* ids of the MSG_ZEROCOPY sends that carry this entry */
+	uint32_t		zc_first;
+	uint32_t		zc_sent;
+	uint32_t		zc_pending;
+	/* FI_EP_RDM receives, see tcpx_rdm.c */
+	struct ofi_match_entry	match;
+	struct tcpx_xfer_entry	*claim;
+	/* FI_MULTI_RECV buffers, see tcpx_shared_ctx.c */
+	struct tcpx_xfer_entry	*mrecv;
+	size_t			mrecv_cnt;
 };
 
+/*
+ * With FI_PROGRESS_AUTO data progress a domain may run a progress thread
+ * over all of its cqs.  The thread busy polls for tcpx_progress_spin usecs
+ * after the last event, then sleeps on progress_epoll, which holds the
+ * epoll fd of each cq's wait set.
+ */
 struct tcpx_domain {
 	struct util_domain	util_domain;
+	pthread_t		progress_thread;
+	volatile bool		progress_running;
+	ofi_epoll_t		progress_epoll;
+	struct fd_signal	progress_signal;
+	/* protects cq_list, held by the thread over each pass */
+	fastlock_t		progress_lock;
+	struct dlist_entry	cq_list;
+	int			polled_cqs;
+	/* set when transfers go through io_uring, see tcpx_uring.c */
+	struct tcpx_uring	*uring;
 };
 
 struct tcpx_buf_pool {
@@ -242,6 +408,54 @@ struct tcpx_cq {
 	struct util_cq		util_cq;
 	/* buf_pools protected by util.cq_lock */
 	struct tcpx_buf_pool	buf_pools[TCPX_OP_CODE_MAX];
+	/* leaf lock, taken with the ep lock held */
+	fastlock_t		ready_lock;
+	struct dlist_entry	ready_list;
+	struct dlist_entry	progress_entry;
+	/* util cq ops with sread retrying io_uring interrupts */
+	struct fi_ops_cq	uring_ops;
+};
+
+/*
+ * FI_EP_RDM endpoint.  Each peer is reached over a tcpx_ep connection
+ * opened on the first send to it.  Connections carry data one way only:
+ * an rdm sends over the connections it opened and receives over those it
+ * accepted, so two peers connecting to each other at the same time never
+ * race.  All connections complete to the rdm's cqs and receive through
+ * its matching queues.
+ */
+struct tcpx_conn {
+	struct dlist_entry	entry;
+	struct tcpx_rdm		*rdm;
+	struct tcpx_ep		*ep;
+	fi_addr_t		fi_addr;
+	/* listening address of the peer, sent as connection data */
+	union ofi_sock_ip	peer_name;
+	bool			connected;
+};
+
+struct tcpx_rdm {
+	struct util_ep		util_ep;
+	struct fi_info		*msg_info;
+	struct fid_pep		*pep;
+	struct fid_eq		*eq;
+	int			eq_fd;
+	/* cq progress calls handling connection events, see tcpx_rdm_close */
+	ofi_atomic32_t		cm_ref;
+	union ofi_sock_ip	name;
+	/* protects the connections, taken before any connection's ep lock */
+	fastlock_t		lock;
+	struct index_map	conn_idm;
+	struct dlist_entry	conn_list;
+	/* protects the queues, taken with a connection's ep lock held */
+	fastlock_t		rx_lock;
+	/* indexed by ofi_op_msg == 0 or tagged == 1 */
+	struct ofi_match_queue	recv_queue[2];
+	struct ofi_match_queue	unexp_queue[2];
+	/* payload bytes held for unexpected messages, at most unexp_max
+	 * unless a single message is larger */
+	size_t			unexp_bytes;
+	size_t			unexp_max;
 };
 
 struct tcpx_eq {
@@ -264,10 +478,33 @@ int tcpx_set_port_range(void);
 
 int tcpx_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 		     struct fid_domain **domain, void *context);
+int tcpx_progress_add_cq(struct tcpx_cq *cq);
+void tcpx_progress_del_cq(struct tcpx_cq *cq);
+
+static inline struct tcpx_domain *tcpx_cq_domain(struct tcpx_cq *cq)
+{
+	return container_of(cq->util_cq.domain, struct tcpx_domain,
+			    util_domain);
+}
 
 
 int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 		  struct fid_ep **ep_fid, void *context);
+int tcpx_rdm_endpoint(struct fid_domain *domain, struct fi_info *info,
+		      struct fid_ep **ep_fid, void *context);
+void tcpx_rdm_progress_cm(struct tcpx_rdm *rdm);
+int tcpx_rdm_start_recv(struct tcpx_ep *ep);
+void tcpx_rdm_unexp_done(struct tcpx_rdm *rdm, struct tcpx_xfer_entry *unexp,
+			 int err);
+
+/* Accepted connections learn the peer's fi_addr once it is in the AV */
+static inline fi_addr_t tcpx_conn_addr(struct tcpx_conn *conn)
+{
+	if (conn->fi_addr == FI_ADDR_NOTAVAIL)
+		conn->fi_addr = ofi_av_lookup_fi_addr(conn->rdm->util_ep.av,
+						      &conn->peer_name);
+	return conn->fi_addr;
+}
 
 
 int tcpx_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
@@ -279,11 +516,15 @@ void tcpx_cq_report_error(struct util_cq *cq,
 			  int err);
 
 
-int tcpx_recv_hdr(SOCKET sock, struct stage_buf *stage_buf,
-		  struct tcpx_cur_rx_msg *cur_rx_msg);
+int tcpx_recv_hdr(struct tcpx_ep *ep);
 int tcpx_recv_msg_data(struct tcpx_xfer_entry *recv_entry);
 int tcpx_send_msg(struct tcpx_xfer_entry *tx_entry);
-int tcpx_read_to_buffer(SOCKET sock, struct stage_buf *stage_buf);
+ssize_t tcpx_send_iov(SOCKET sock, struct iovec *iov, size_t iov_cnt);
+int tcpx_read_to_buffer(struct tcpx_ep *ep);
+void tcpx_stage_buf_fill(struct stage_buf *stage_buf, size_t len);
+int tcpx_stage_buf_init(struct stage_buf *stage_buf);
+void tcpx_zerocopy_enable(struct tcpx_ep *ep);
+void tcpx_progress_zerocopy(struct tcpx_ep *ep);
 
 struct tcpx_xfer_entry *tcpx_xfer_entry_alloc(struct tcpx_cq *cq,
 					      enum tcpx_xfer_op_codes type);
@@ -291,6 +532,10 @@ struct tcpx_xfer_entry *tcpx_xfer_entry_alloc(struct tcpx_cq *cq,
 void tcpx_ep_wait_fd_del(struct tcpx_ep *ep);
 void tcpx_xfer_entry_release(struct tcpx_cq *tcpx_cq,
 			     struct tcpx_xfer_entry *xfer_entry);
+bool tcpx_mrecv_carve(struct tcpx_xfer_entry *mrecv,
+		      struct tcpx_xfer_entry *rx_entry,
+		      size_t msg_len, size_t min_size);
+bool tcpx_mrecv_put(struct tcpx_xfer_entry *rx_entry);
 void tcpx_srx_xfer_release(struct tcpx_rx_ctx *srx_ctx,
 			   struct tcpx_xfer_entry *xfer_entry);
 
@@ -299,13 +544,67 @@ struct tcpx_xfer_entry *
 tcpx_srx_next_xfer_entry(struct tcpx_rx_ctx *srx_ctx,
 			struct tcpx_ep *ep, size_t entry_size);
 
+static inline bool tcpx_tx_zerocopy(struct tcpx_xfer_entry *tx_entry)
+{
+	/* An entry started with zero copy stays with it for its tail */
+	return tx_entry->ep->zerocopy && tx_entry->ep->tx_stripe != tx_entry &&
+	       (tx_entry->zc_sent || tx_entry->rem_len >= tcpx_zerocopy_size);
+}
+
 void tcpx_progress_tx(struct tcpx_ep *ep);
 void tcpx_progress_rx(struct tcpx_ep *ep);
+int tcpx_tx_gather(struct tcpx_ep *ep, struct iovec *iov, size_t *iov_cnt,
+		   size_t *len);
+void tcpx_tx_sent(struct tcpx_ep *ep, ssize_t ret);
+int tcpx_wait_pollout(struct tcpx_ep *ep, SOCKET sock, bool pollout);
+int tcpx_update_pollout(struct tcpx_ep *ep);
 int tcpx_try_func(void *util_ep);
+void tcpx_ep_queue_ready(struct tcpx_ep *ep);
+void tcpx_ep_remove_ready(struct tcpx_ep *ep);
+int tcpx_cq_progress_events(struct util_cq *cq);
+
+int tcpx_uring_open(struct tcpx_uring **ring);
+void tcpx_uring_close(struct tcpx_uring *ring);
+int tcpx_uring_progress(struct tcpx_uring *ring);
+void tcpx_uring_flush(struct tcpx_uring *ring);
+int tcpx_uring_wait_add(struct tcpx_uring *ring, struct util_wait *wait);
+void tcpx_uring_wait_del(struct tcpx_uring *ring, struct util_wait *wait);
+int tcpx_uring_ep_enable(struct tcpx_ep *ep, struct tcpx_uring *ring);
+void tcpx_uring_ep_close(struct tcpx_ep *ep);
+int tcpx_uring_recv(struct tcpx_ep *ep);
+int tcpx_uring_send(struct tcpx_ep *ep);
 
 void tcpx_hdr_none(struct tcpx_base_hdr *hdr);
 void tcpx_hdr_bswap(struct tcpx_base_hdr *hdr);
 
+/* Queued tx headers are already in wire byte order */
+static inline bool tcpx_tx_striped(struct tcpx_xfer_entry *tx_entry)
+{
+	uint16_t flags = tx_entry->hdr.base_hdr.flags;
+
+	if (tx_entry->ep->hdr_bswap == tcpx_hdr_bswap)
+		flags = ntohs(flags);
+	return flags & TCPX_STRIPED;
+}
+
+void tcpx_stream_listen(struct tcpx_ep *ep, struct tcpx_cm_context *cm_ctx);
+int tcpx_stream_connect(struct tcpx_ep *ep, struct util_wait *wait,
+			struct tcpx_cm_context *cm_ctx);
+int tcpx_stream_connected(struct tcpx_ep *ep, struct util_wait *wait,
+			  struct tcpx_cm_context *stream_ctx);
+void tcpx_stream_cm_del(struct tcpx_ep *ep, struct util_wait *wait);
+int tcpx_stream_accept(struct tcpx_ep *ep, uint32_t streams);
+int tcpx_stream_wait_add(struct tcpx_ep *ep, struct util_wait *wait);
+void tcpx_stream_wait_del(struct tcpx_ep *ep, struct util_wait *wait);
+void tcpx_stream_update_pollout(struct tcpx_ep *ep);
+void tcpx_stream_shutdown(struct tcpx_ep *ep);
+void tcpx_stream_close(struct tcpx_ep *ep);
+void tcpx_stream_mark(struct tcpx_ep *ep, struct tcpx_xfer_entry *tx_entry);
+int tcpx_stream_send(struct tcpx_xfer_entry *tx_entry);
+int tcpx_stream_recv(struct tcpx_xfer_entry *rx_entry);
+int tcpx_send_entry(struct tcpx_xfer_entry *tx_entry);
+int tcpx_recv_entry_data(struct tcpx_xfer_entry *rx_entry);
+
 int tcpx_ep_shutdown_report(struct tcpx_ep *ep, fid_t fid);
 void tcpx_tx_queue_insert(struct tcpx_ep *tcpx_ep,
 			  struct tcpx_xfer_entry *tx_entry);
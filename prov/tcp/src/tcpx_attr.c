@@ -36,10 +36,15 @@
 #define TCPX_DOMAIN_CAPS (FI_LOCAL_COMM | FI_REMOTE_COMM)
 #define TCPX_EP_CAPS	 (FI_MSG | FI_RMA | FI_RMA_PMEM)
 #define TCPX_TX_CAPS	 (FI_SEND | FI_WRITE | FI_READ)
-#define TCPX_RX_CAPS	 (FI_RECV | FI_REMOTE_READ | 			\
+#define TCPX_RX_CAPS	 (FI_RECV | FI_REMOTE_READ | FI_MULTI_RECV |	\
 			  FI_REMOTE_WRITE)
 
 
+#define TCPX_RDM_EP_CAPS (FI_MSG | FI_TAGGED)
+#define TCPX_RDM_TX_CAPS (FI_SEND)
+#define TCPX_RDM_RX_CAPS (FI_RECV | FI_SOURCE | FI_DIRECTED_RECV)
+
+
 #define TCPX_MSG_ORDER (OFI_ORDER_RAR_SET | OFI_ORDER_RAW_SET | FI_ORDER_RAS | \
 			OFI_ORDER_WAW_SET | FI_ORDER_WAS | \
 			FI_ORDER_SAW | FI_ORDER_SAS)
@@ -48,14 +53,14 @@
 	(FI_INJECT | FI_INJECT_COMPLETE | FI_TRANSMIT_COMPLETE | \
 	 FI_DELIVERY_COMPLETE | FI_COMMIT_COMPLETE | FI_COMPLETION)
 
-#define TCPX_RX_OP_FLAGS (FI_COMPLETION)
+#define TCPX_RX_OP_FLAGS (FI_COMPLETION | FI_MULTI_RECV)
 
 static struct fi_tx_attr tcpx_tx_attr = {
 	.caps = TCPX_EP_CAPS | TCPX_TX_CAPS,
 	.op_flags = TCPX_TX_OP_FLAGS,
 	.comp_order = FI_ORDER_STRICT,
 	.msg_order = TCPX_MSG_ORDER,
-	.inject_size = 64,
+	.inject_size = TCPX_MAX_INJECT_SZ,
 	.size = 1024,
 	.iov_limit = TCPX_IOV_LIMIT,
 	.rma_iov_limit = TCPX_IOV_LIMIT,
@@ -82,6 +87,36 @@ static struct fi_ep_attr tcpx_ep_attr = {
 	.max_order_waw_size = SIZE_MAX,
 };
 
+static struct fi_tx_attr tcpx_rdm_tx_attr = {
+	.caps = TCPX_RDM_EP_CAPS | TCPX_RDM_TX_CAPS,
+	.op_flags = TCPX_TX_OP_FLAGS & ~FI_COMMIT_COMPLETE,
+	.comp_order = FI_ORDER_NONE,
+	.msg_order = FI_ORDER_SAS,
+	.inject_size = TCPX_MAX_INJECT_SZ,
+	.size = 1024,
+	.iov_limit = TCPX_IOV_LIMIT,
+};
+
+static struct fi_rx_attr tcpx_rdm_rx_attr = {
+	.caps = TCPX_RDM_EP_CAPS | TCPX_RDM_RX_CAPS,
+	.op_flags = TCPX_RX_OP_FLAGS,
+	.comp_order = FI_ORDER_NONE,
+	.msg_order = FI_ORDER_SAS,
+	.total_buffered_recv = TCPX_RDM_BUFFERED_RECV,
+	.size = 1024,
+	.iov_limit = TCPX_IOV_LIMIT
+};
+
+static struct fi_ep_attr tcpx_rdm_ep_attr = {
+	.type = FI_EP_RDM,
+	.protocol = FI_PROTO_SOCK_TCP,
+	.protocol_version = 0,
+	.max_msg_size = SIZE_MAX,
+	.mem_tag_format = FI_TAG_GENERIC,
+	.tx_ctx_cnt = 1,
+	.rx_ctx_cnt = 1,
+};
+
 static struct fi_domain_attr tcpx_domain_attr = {
 	.name = "tcp",
 	.caps = TCPX_DOMAIN_CAPS,
@@ -107,6 +142,18 @@ static struct fi_fabric_attr tcpx_fabric_attr = {
 	.prov_version = OFI_VERSION_DEF_PROV,
 };
 
+struct fi_info tcpx_rdm_info = {
+	.caps = TCPX_DOMAIN_CAPS | TCPX_RDM_EP_CAPS | TCPX_RDM_TX_CAPS |
+		TCPX_RDM_RX_CAPS,
+	.addr_format = FI_SOCKADDR,
+	.tx_attr = &tcpx_rdm_tx_attr,
+	.rx_attr = &tcpx_rdm_rx_attr,
+	.ep_attr = &tcpx_rdm_ep_attr,
+	.domain_attr = &tcpx_domain_attr,
+	.fabric_attr = &tcpx_fabric_attr
+};
+
+/* tcpx_rdm_info is linked after tcpx_info when FI_TCP_RDM is set */
 struct fi_info tcpx_info = {
 	.caps = TCPX_DOMAIN_CAPS | TCPX_EP_CAPS | TCPX_TX_CAPS | TCPX_RX_CAPS,
 	.addr_format = FI_SOCKADDR,
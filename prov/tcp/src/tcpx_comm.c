@@ -37,18 +37,191 @@
 #include <ofi_iov.h>
 #include "tcpx.h"
 
-int tcpx_send_msg(struct tcpx_xfer_entry *tx_entry)
+#if HAVE_TCP_ZEROCOPY
+#include <linux/errqueue.h>
+#else
+#define MSG_ZEROCOPY 0
+#endif
+
+/*
+ * MSG_ZEROCOPY transmit
+ *
+ * Sends of at least tcpx_zerocopy_size bytes pin the user pages instead of
+ * copying them.  The kernel numbers every zero-copy sendmsg call on a socket
+ * and reports ranges of those ids on the socket error queue once it no
+ * longer references the pages.  An entry records the ids of the calls that
+ * carried it, and once fully sent it waits on tx_zc_queue until all of
+ * them have been reported before its completion is written.
+ */
+void tcpx_zerocopy_enable(struct tcpx_ep *ep)
+{
+#if HAVE_TCP_ZEROCOPY
+	int optval = 1;
+
+	if (tcpx_zerocopy_size == SIZE_MAX)
+		return;
+
+	if (setsockopt(ep->sock, SOL_SOCKET, SO_ZEROCOPY, (char *) &optval,
+		       sizeof(optval))) {
+		FI_INFO(&tcpx_prov, FI_LOG_EP_CTRL,
+			"MSG_ZEROCOPY unavailable, sends will be copied\n");
+		return;
+	}
+	ep->zerocopy = true;
+#endif
+}
+
+static void tcpx_zc_sent(struct tcpx_xfer_entry *tx_entry)
+{
+	struct tcpx_ep *ep = tx_entry->ep;
+
+	if (!tx_entry->zc_sent)
+		tx_entry->zc_first = ep->zc_next;
+	tx_entry->zc_sent++;
+	tx_entry->zc_pending++;
+	ep->zc_next++;
+}
+
+#if HAVE_TCP_ZEROCOPY
+/* Account for the ids lo..hi (which may wrap) that fall in this entry */
+static void tcpx_zc_ack_entry(struct tcpx_xfer_entry *entry,
+			      uint32_t lo, uint32_t hi)
+{
+	uint32_t range = hi - lo, cnt;
+
+	if (!entry->zc_sent)
+		return;
+
+	if (entry->zc_first - lo <= range)
+		cnt = MIN(entry->zc_sent, range - (entry->zc_first - lo) + 1);
+	else if (lo - entry->zc_first < entry->zc_sent)
+		cnt = MIN(entry->zc_sent - (lo - entry->zc_first), range + 1);
+	else
+		return;
+
+	assert(cnt <= entry->zc_pending);
+	entry->zc_pending -= cnt;
+}
+
+static void tcpx_zc_ack(struct tcpx_ep *ep, uint32_t lo, uint32_t hi)
+{
+	struct tcpx_xfer_entry *entry;
+	struct slist_entry *item, *prev;
+
+	ep->zc_acked += hi - lo + 1;
+
+	/* Only the head of the tx queue can be partially sent */
+	if (!slist_empty(&ep->tx_queue)) {
+		entry = container_of(ep->tx_queue.head,
+				     struct tcpx_xfer_entry, entry);
+		tcpx_zc_ack_entry(entry, lo, hi);
+	}
+
+	(void) prev; /* Makes compiler happy */
+	slist_foreach(&ep->tx_zc_queue, item, prev) {
+		entry = container_of(item, struct tcpx_xfer_entry, entry);
+		tcpx_zc_ack_entry(entry, lo, hi);
+	}
+
+	/* delivery-complete entries still waiting for the peer's response */
+	slist_foreach(&ep->tx_rsp_pend_queue, item, prev) {
+		entry = container_of(item, struct tcpx_xfer_entry, entry);
+		tcpx_zc_ack_entry(entry, lo, hi);
+	}
+}
+
+static int tcpx_zc_read_errqueue(struct tcpx_ep *ep)
+{
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+				sizeof(struct sockaddr_in6))];
+	struct sock_extended_err *serr;
+	struct msghdr msg = {0};
+	struct cmsghdr *cmsg;
+
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(ep->sock, &msg, MSG_ERRQUEUE) < 0)
+		return -ofi_sockerr();
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (!(cmsg->cmsg_level == SOL_IP &&
+		      cmsg->cmsg_type == IP_RECVERR) &&
+		    !(cmsg->cmsg_level == SOL_IPV6 &&
+		      cmsg->cmsg_type == IPV6_RECVERR))
+			continue;
+
+		serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+		if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno)
+			continue;
+
+		/* The kernel had to copy anyway, so pinning only costs us */
+		if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) &&
+		    ep->zerocopy) {
+			FI_INFO(&tcpx_prov, FI_LOG_EP_DATA,
+				"MSG_ZEROCOPY sends are being copied, "
+				"disabling zero copy on ep %p\n", ep);
+			ep->zerocopy = false;
+		}
+		tcpx_zc_ack(ep, serr->ee_info, serr->ee_data);
+	}
+	return 0;
+}
+#endif
+
+/* Must hold ep lock */
+void tcpx_progress_zerocopy(struct tcpx_ep *ep)
+{
+#if HAVE_TCP_ZEROCOPY
+	struct tcpx_xfer_entry *entry;
+	struct tcpx_cq *tcpx_cq;
+
+	if (ep->zc_acked == ep->zc_next)
+		return;
+
+	while (!tcpx_zc_read_errqueue(ep) && ep->zc_acked != ep->zc_next)
+		;
+
+	tcpx_cq = container_of(ep->util_ep.tx_cq, struct tcpx_cq, util_cq);
+	while (!slist_empty(&ep->tx_zc_queue)) {
+		entry = container_of(ep->tx_zc_queue.head,
+				     struct tcpx_xfer_entry, entry);
+		if (entry->zc_pending)
+			break;
+
+		slist_remove_head(&ep->tx_zc_queue);
+		tcpx_cq_report_success(ep->util_ep.tx_cq, entry);
+		tcpx_xfer_entry_release(tcpx_cq, entry);
+	}
+#endif
+}
+
+/* Send what is left of the entry's iov on the ep socket */
+int tcpx_send_entry(struct tcpx_xfer_entry *tx_entry)
 {
 	ssize_t bytes_sent;
 	struct msghdr msg = {0};
+	int flags = MSG_NOSIGNAL;
 
 	msg.msg_iov = tx_entry->iov;
 	msg.msg_iovlen = tx_entry->iov_cnt;
 
-	bytes_sent = ofi_sendmsg_tcp(tx_entry->ep->sock, &msg, MSG_NOSIGNAL);
+	if (tcpx_tx_zerocopy(tx_entry))
+		flags |= MSG_ZEROCOPY;
+
+	bytes_sent = ofi_sendmsg_tcp(tx_entry->ep->sock, &msg, flags);
+	if (bytes_sent < 0 && (flags & MSG_ZEROCOPY) &&
+	    ofi_sockerr() == ENOBUFS) {
+		/* Out of socket memory to track pinned pages, copy instead */
+		flags &= ~MSG_ZEROCOPY;
+		bytes_sent = ofi_sendmsg_tcp(tx_entry->ep->sock, &msg, flags);
+	}
 	if (bytes_sent < 0)
 		return ofi_sockerr() == EPIPE ? -FI_ENOTCONN : -ofi_sockerr();
 
+	if (flags & MSG_ZEROCOPY)
+		tcpx_zc_sent(tx_entry);
+
 	tx_entry->rem_len -= bytes_sent;
 	if (tx_entry->rem_len) {
 		ofi_consume_iov(tx_entry->iov, &tx_entry->iov_cnt, bytes_sent);
@@ -57,6 +230,28 @@ int tcpx_send_msg(struct tcpx_xfer_entry *tx_entry)
 	return FI_SUCCESS;
 }
 
+int tcpx_send_msg(struct tcpx_xfer_entry *tx_entry)
+{
+	if (tcpx_tx_striped(tx_entry))
+		return tcpx_stream_send(tx_entry);
+
+	return tcpx_send_entry(tx_entry);
+}
+
+ssize_t tcpx_send_iov(SOCKET sock, struct iovec *iov, size_t iov_cnt)
+{
+	struct msghdr msg = {0};
+	ssize_t bytes_sent;
+
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov_cnt;
+
+	bytes_sent = ofi_sendmsg_tcp(sock, &msg, MSG_NOSIGNAL);
+	if (bytes_sent < 0)
+		return ofi_sockerr() == EPIPE ? -FI_ENOTCONN : -ofi_sockerr();
+	return bytes_sent;
+}
+
 static ssize_t tcpx_read_from_buffer(struct stage_buf *stage_buf,
 				     uint8_t *buf, size_t len)
 {
@@ -71,24 +266,24 @@ static ssize_t tcpx_read_from_buffer(struct stage_buf *stage_buf,
 	return ret;
 }
 
-int tcpx_recv_hdr(SOCKET sock, struct stage_buf *stage_buf,
-		  struct tcpx_cur_rx_msg *cur_rx_msg)
+int tcpx_recv_hdr(struct tcpx_ep *ep)
 {
+	struct tcpx_cur_rx_msg *cur_rx_msg = &ep->cur_rx_msg;
+	struct stage_buf *stage_buf = &ep->stage_buf;
 	void *rem_buf;
 	size_t rem_len;
-	ssize_t bytes_recvd;
+	int ret;
 
 	rem_buf = (uint8_t *) &cur_rx_msg->hdr + cur_rx_msg->done_len;
 	rem_len = cur_rx_msg->hdr_len - cur_rx_msg->done_len;
 
-	if (stage_buf->cur_pos < stage_buf->bytes_avail)
-		bytes_recvd = tcpx_read_from_buffer(stage_buf, rem_buf, rem_len);
-	else
-		bytes_recvd = ofi_recv_socket(sock, rem_buf, rem_len, 0);
-	if (bytes_recvd <= 0)
-		return bytes_recvd ? -ofi_sockerr(): -FI_ENOTCONN;
+	if (stage_buf->cur_pos == stage_buf->bytes_avail) {
+		ret = tcpx_read_to_buffer(ep);
+		if (ret)
+			return ret;
+	}
 
-	return bytes_recvd;
+	return (int) tcpx_read_from_buffer(stage_buf, rem_buf, rem_len);
 }
 
 static ssize_t tcpx_readv_from_buffer(struct stage_buf *stage_buf,
@@ -114,39 +309,103 @@ static ssize_t tcpx_readv_from_buffer(struct stage_buf *stage_buf,
 	return ret;
 }
 
-int tcpx_recv_msg_data(struct tcpx_xfer_entry *rx_entry)
+/* Receive the rest of the entry's iov from the ep socket */
+int tcpx_recv_entry_data(struct tcpx_xfer_entry *rx_entry)
 {
+	struct stage_buf *stage_buf = &rx_entry->ep->stage_buf;
 	ssize_t bytes_recvd;
+	int ret;
 
 	if (!rx_entry->iov_cnt || !rx_entry->iov[0].iov_len)
 		return FI_SUCCESS;
 
-	if (rx_entry->ep->stage_buf.cur_pos < rx_entry->ep->stage_buf.bytes_avail)
-		bytes_recvd = tcpx_readv_from_buffer(&rx_entry->ep->stage_buf,
-						     rx_entry->iov,
-						     rx_entry->iov_cnt);
-	else
-		bytes_recvd = ofi_readv_socket(rx_entry->ep->sock,
-					       rx_entry->iov,
-					       rx_entry->iov_cnt);
-	if (bytes_recvd <= 0)
-		return (bytes_recvd) ? -ofi_sockerr(): -FI_ENOTCONN;
+	if (stage_buf->cur_pos == stage_buf->bytes_avail) {
+		/* io_uring receives always land in the staging buffer */
+		if (!rx_entry->ep->uring &&
+		    ofi_total_iov_len(rx_entry->iov, rx_entry->iov_cnt) >=
+		    tcpx_direct_recv_size) {
+			bytes_recvd = ofi_readv_socket(rx_entry->ep->sock,
+						       rx_entry->iov,
+						       rx_entry->iov_cnt);
+			if (bytes_recvd <= 0)
+				return (bytes_recvd) ? -ofi_sockerr() :
+						       -FI_ENOTCONN;
+
+			stage_buf->read_len = STAGE_BUF_SIZE;
+			goto consume;
+		}
 
+		ret = tcpx_read_to_buffer(rx_entry->ep);
+		if (ret)
+			return ret;
+	}
+
+	bytes_recvd = tcpx_readv_from_buffer(stage_buf, rx_entry->iov,
+					     (int) rx_entry->iov_cnt);
+consume:
 	ofi_consume_iov(rx_entry->iov, &rx_entry->iov_cnt, bytes_recvd);
 	return (rx_entry->iov_cnt && rx_entry->iov[0].iov_len) ?
 		-FI_EAGAIN: FI_SUCCESS;
 }
 
-int tcpx_read_to_buffer(SOCKET sock, struct stage_buf *stage_buf)
+int tcpx_recv_msg_data(struct tcpx_xfer_entry *rx_entry)
+{
+	if (rx_entry->hdr.base_hdr.flags & TCPX_STRIPED)
+		return tcpx_stream_recv(rx_entry);
+
+	return tcpx_recv_entry_data(rx_entry);
+}
+
+/* Account for len bytes just received into the staging buffer */
+void tcpx_stage_buf_fill(struct stage_buf *stage_buf, size_t len)
+{
+	size_t new_len;
+	void *buf;
+
+	stage_buf->bytes_avail = len;
+	stage_buf->cur_pos = 0;
+
+	/* A full read means more is likely queued, take more next time */
+	if (len == stage_buf->read_len &&
+	    stage_buf->read_len < tcpx_staging_size) {
+		new_len = MIN(stage_buf->read_len * 2, tcpx_staging_size);
+		if (new_len > stage_buf->size) {
+			buf = realloc(stage_buf->buf, new_len);
+			if (!buf)
+				return;
+			stage_buf->buf = buf;
+			stage_buf->size = new_len;
+		}
+		stage_buf->read_len = new_len;
+	}
+}
+
+int tcpx_read_to_buffer(struct tcpx_ep *ep)
 {
-	int bytes_recvd;
+	ssize_t bytes_recvd;
 
-	bytes_recvd = ofi_recv_socket(sock, stage_buf->buf,
-				      sizeof(stage_buf->buf), 0);
+	/* The data arrives with the recv completion */
+	if (ep->uring)
+		return tcpx_uring_recv(ep);
+
+	bytes_recvd = ofi_recv_socket(ep->sock, ep->stage_buf.buf,
+				      ep->stage_buf.read_len, 0);
 	if (bytes_recvd <= 0)
 		return (bytes_recvd) ? -ofi_sockerr(): -FI_ENOTCONN;
 
-	stage_buf->bytes_avail = bytes_recvd;
+	tcpx_stage_buf_fill(&ep->stage_buf, bytes_recvd);
+	return FI_SUCCESS;
+}
+
+int tcpx_stage_buf_init(struct stage_buf *stage_buf)
+{
+	stage_buf->buf = malloc(STAGE_BUF_SIZE);
+	if (!stage_buf->buf)
+		return -FI_ENOMEM;
+
+	stage_buf->size = STAGE_BUF_SIZE;
+	stage_buf->read_len = STAGE_BUF_SIZE;
+	stage_buf->bytes_avail = 0;
 	stage_buf->cur_pos = 0;
 	return FI_SUCCESS;
 }
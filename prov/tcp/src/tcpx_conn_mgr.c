@@ -67,6 +67,10 @@ static int rx_cm_data(SOCKET fd, struct ofi_ctrl_hdr *hdr,
 		goto out;
 	}
 
+	/* Zero unless the peer uses streams, see tcpx_stream.c */
+	cm_ctx->streams = ntohl(hdr->seg_no);
+	cm_ctx->stream_port = (uint16_t) ntohll(hdr->conn_id);
+
 	data_size = MIN(ntohs(hdr->seg_size), TCPX_MAX_CM_DATA_SIZE);
 	if (data_size) {
 		ret = ofi_recv_socket(fd, cm_ctx->cm_data, data_size,
@@ -102,6 +106,8 @@ static int tx_cm_data(SOCKET fd, uint8_t type, struct tcpx_cm_context *cm_ctx)
 	hdr.type = type;
 	hdr.seg_size = htons((uint16_t) cm_ctx->cm_data_sz);
 	hdr.conn_data = 1; /* For testing endianess mismatch at peer */
+	hdr.seg_no = htonl(cm_ctx->streams);
+	hdr.conn_id = htonll(cm_ctx->stream_port);
 
 	ret = ofi_send_socket(fd, &hdr, sizeof(hdr), MSG_NOSIGNAL);
 	if (ret != sizeof(hdr))
@@ -121,6 +127,7 @@ err:
 
 static int tcpx_ep_enable_xfers(struct tcpx_ep *ep)
 {
+	struct tcpx_domain *domain;
 	int ret;
 
 	fastlock_acquire(&ep->lock);
@@ -137,6 +144,21 @@ static int tcpx_ep_enable_xfers(struct tcpx_ep *ep)
 			"failed to set socket to nonblocking\n");
 		goto unlock;
 	}
+	domain = container_of(ep->util_ep.domain, struct tcpx_domain,
+			      util_domain);
+	if (domain->uring) {
+		ret = tcpx_uring_ep_enable(ep, domain->uring);
+		if (ret)
+			goto unlock;
+
+		/* The socket is driven by its io_uring requests */
+		ep->cm_state = TCPX_EP_CONNECTED;
+		(void) tcpx_uring_recv(ep);
+		tcpx_uring_flush(domain->uring);
+		goto unlock;
+	}
+
+	tcpx_zerocopy_enable(ep);
 	ep->cm_state = TCPX_EP_CONNECTED;
 	fastlock_release(&ep->lock);
 
@@ -145,6 +167,8 @@ static int tcpx_ep_enable_xfers(struct tcpx_ep *ep)
 				      ep->sock, POLLIN, tcpx_try_func,
 				      (void *) &ep->util_ep,
 				      &ep->util_ep.ep_fid.fid);
+		if (!ret)
+			ret = tcpx_stream_wait_add(ep, ep->util_ep.rx_cq->wait);
 		if (ret) {
 			FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
 				"Failed to add fd to rx_cq\n");
@@ -157,6 +181,8 @@ static int tcpx_ep_enable_xfers(struct tcpx_ep *ep)
 				      ep->sock, POLLIN, tcpx_try_func,
 				      (void *) &ep->util_ep,
 				      &ep->util_ep.ep_fid.fid);
+		if (!ret)
+			ret = tcpx_stream_wait_add(ep, ep->util_ep.tx_cq->wait);
 		if (ret) {
 			FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
 				"Failed to add fd to tx_cq\n");
@@ -195,6 +221,10 @@ static int proc_conn_resp(struct tcpx_cm_context *cm_ctx,
 	ep->hdr_bswap = (conn_resp.conn_data == 1) ?
 			tcpx_hdr_none : tcpx_hdr_bswap;
 
+	ret = tcpx_stream_accept(ep, cm_ctx->streams);
+	if (ret)
+		goto err;
+
 	ret = tcpx_ep_enable_xfers(ep);
 	if (ret)
 		goto err;
@@ -263,18 +293,49 @@ err:
 		free(err_entry.err_data);
 }
 
+static void server_report_accept_err(struct tcpx_ep *ep,
+				     struct tcpx_cm_context *cm_ctx, int ret)
+{
+	struct fi_eq_err_entry err_entry;
+
+	memset(&err_entry, 0, sizeof err_entry);
+	err_entry.fid = cm_ctx->fid;
+	err_entry.context = cm_ctx->fid->context;
+	err_entry.err = -ret;
+
+	free(cm_ctx);
+
+	FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL, "Sending shutdown, err: %d (%s)\n",
+		err_entry.err, fi_strerror(err_entry.err));
+
+	fi_eq_write(&ep->util_ep.eq->eq_fid, FI_SHUTDOWN,
+		    &err_entry, sizeof(err_entry), UTIL_FLAG_ERROR);
+}
+
 static void server_send_cm_accept(struct util_wait *wait,
 				  struct tcpx_cm_context *cm_ctx)
 {
 	struct fi_eq_cm_entry cm_entry = {0};
-	struct fi_eq_err_entry err_entry;
 	struct tcpx_ep *ep;
 	int ret, del_ret;
 
 	assert(cm_ctx->fid->fclass == FI_CLASS_EP);
 	ep = container_of(cm_ctx->fid, struct tcpx_ep, util_ep.ep_fid.fid);
 
+	/* The response waits for the streams, see server_stream_connect */
+	ret = tcpx_stream_connect(ep, wait, cm_ctx);
+	if (ret == -FI_EINPROGRESS) {
+		ret = ofi_wait_del_fd(wait, ep->sock);
+		if (ret)
+			FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+				"Could not remove fd from wait: %s\n",
+				fi_strerror(-ret));
+		return;
+	}
+
 	FI_DBG(&tcpx_prov, FI_LOG_EP_CTRL, "Send connect (accept) response\n");
+	cm_ctx->streams = (uint32_t) ep->stream_cnt + 1;
+	cm_ctx->stream_port = 0;
 	ret = tx_cm_data(ep->sock, ofi_ctrl_connresp, cm_ctx);
 	if (ret) {
 		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
@@ -311,18 +372,28 @@ err_del:
 			fi_strerror(-del_ret));
 
 err_report:
-	memset(&err_entry, 0, sizeof err_entry);
-	err_entry.fid = cm_ctx->fid;
-	err_entry.context = cm_ctx->fid->context;
-	err_entry.err = -ret;
+	server_report_accept_err(ep, cm_ctx, ret);
+}
 
-	free(cm_ctx);
+static void server_stream_connect(struct util_wait *wait,
+				  struct tcpx_cm_context *cm_ctx)
+{
+	struct tcpx_ep *ep;
+	int ret;
 
-	FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL, "Sending shutdown, err: %d (%s)\n",
-		err_entry.err, fi_strerror(err_entry.err));
+	assert(cm_ctx->fid->fclass == FI_CLASS_EP);
+	ep = container_of(cm_ctx->fid, struct tcpx_ep, util_ep.ep_fid.fid);
 
-	fi_eq_write(&ep->util_ep.eq->eq_fid, FI_SHUTDOWN,
-		    &err_entry, sizeof(err_entry), UTIL_FLAG_ERROR);
+	if (tcpx_stream_connected(ep, wait, cm_ctx))
+		return;
+
+	/* Resume the accept response held back by server_send_cm_accept */
+	cm_ctx = ep->stream_cm_ctx;
+	ep->stream_cm_ctx = NULL;
+	ret = ofi_wait_add_fd(wait, ep->sock, POLLOUT,
+			      tcpx_eq_wait_try_func, NULL, cm_ctx);
+	if (ret)
+		server_report_accept_err(ep, cm_ctx, ret);
 }
 
 static void server_recv_connreq(struct util_wait *wait,
@@ -361,6 +432,8 @@ static void server_recv_connreq(struct util_wait *wait,
 		goto err3;
 
 	handle->endian_match = (conn_req.conn_data == 1);
+	handle->streams = cm_ctx->streams;
+	handle->stream_port = cm_ctx->stream_port;
 	cm_entry->info->handle = &handle->handle;
 	memcpy(cm_entry->data, cm_ctx->cm_data, cm_ctx->cm_data_sz);
 
@@ -526,6 +599,9 @@ static void process_cm_ctx(struct util_wait *wait,
 	case CLIENT_RECV_CONNRESP:
 		client_recv_connresp(wait, cm_ctx);
 		break;
+	case SERVER_STREAM_CONNECT:
+		server_stream_connect(wait, cm_ctx);
+		break;
 	default:
 		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
 			"should never end up here\n");
@@ -38,29 +38,107 @@
 #define TCPX_DEF_CQ_SIZE (1024)
 
 
-void tcpx_cq_progress(struct util_cq *cq)
+static struct tcpx_ready_entry *
+tcpx_ep_ready_entry(struct tcpx_ep *ep, struct util_cq *cq)
+{
+	return &ep->ready[cq == ep->util_ep.rx_cq ? 0 : 1];
+}
+
+static void tcpx_cq_queue_ready(struct util_cq *cq, struct tcpx_ep *ep)
+{
+	struct tcpx_cq *tcpx_cq = container_of(cq, struct tcpx_cq, util_cq);
+	struct tcpx_ready_entry *ready = tcpx_ep_ready_entry(ep, cq);
+
+	fastlock_acquire(&tcpx_cq->ready_lock);
+	if (!ready->queued) {
+		ready->queued = true;
+		dlist_insert_tail(&ready->entry, &tcpx_cq->ready_list);
+	}
+	fastlock_release(&tcpx_cq->ready_lock);
+}
+
+/* Must hold ep lock */
+void tcpx_ep_queue_ready(struct tcpx_ep *ep)
+{
+	tcpx_cq_queue_ready(ep->util_ep.rx_cq, ep);
+	if (ep->util_ep.tx_cq != ep->util_ep.rx_cq)
+		tcpx_cq_queue_ready(ep->util_ep.tx_cq, ep);
+}
+
+static void tcpx_cq_remove_ready(struct util_cq *cq, struct tcpx_ep *ep)
+{
+	struct tcpx_cq *tcpx_cq = container_of(cq, struct tcpx_cq, util_cq);
+	struct tcpx_ready_entry *ready = tcpx_ep_ready_entry(ep, cq);
+
+	/* excludes a progress call that may be walking the entry */
+	cq->cq_fastlock_acquire(&cq->ep_list_lock);
+	fastlock_acquire(&tcpx_cq->ready_lock);
+	if (ready->queued) {
+		ready->queued = false;
+		dlist_remove(&ready->entry);
+	}
+	fastlock_release(&tcpx_cq->ready_lock);
+	cq->cq_fastlock_release(&cq->ep_list_lock);
+}
+
+void tcpx_ep_remove_ready(struct tcpx_ep *ep)
+{
+	if (ep->util_ep.rx_cq)
+		tcpx_cq_remove_ready(ep->util_ep.rx_cq, ep);
+	if (ep->util_ep.tx_cq && ep->util_ep.tx_cq != ep->util_ep.rx_cq)
+		tcpx_cq_remove_ready(ep->util_ep.tx_cq, ep);
+}
+
+/*
+ * Only endpoints with work to do are visited: those epoll reports as
+ * readable, or as writable while they have queued sends, and those left
+ * on the ready list with buffered bytes.  Idle endpoints cost nothing.
+ * With the io_uring engine, endpoints are visited through the completions
+ * of their requests instead.  Returns the number of endpoints, rdm
+ * endpoints and completions visited.
+ */
+int tcpx_cq_progress_events(struct util_cq *cq)
 {
 	void *wait_contexts[MAX_POLL_EVENTS];
-	struct fid_list_entry *fid_entry;
+	struct tcpx_rdm *rdms[MAX_POLL_EVENTS];
+	struct tcpx_ready_entry *ready;
+	struct tcpx_uring *uring;
 	struct util_wait_fd *wait_fd;
-	struct dlist_entry *item;
+	struct dlist_entry ready_list;
+	struct tcpx_cq *tcpx_cq;
 	struct tcpx_ep *ep;
 	struct fid *fid;
-	int nfds, i;
+	int nfds, nrdms = 0, events = 0, i;
 
+	tcpx_cq = container_of(cq, struct tcpx_cq, util_cq);
 	wait_fd = container_of(cq->wait, struct util_wait_fd, util_wait);
+	uring = tcpx_cq_domain(tcpx_cq)->uring;
+	if (uring)
+		events += tcpx_uring_progress(uring);
 
 	cq->cq_fastlock_acquire(&cq->ep_list_lock);
-	dlist_foreach(&cq->ep_list, item) {
-		fid_entry = container_of(item, struct fid_list_entry, entry);
-		ep = container_of(fid_entry->fid, struct tcpx_ep,
-				  util_ep.ep_fid.fid);
-		tcpx_try_func(&ep->util_ep);
+
+	/* Entries stay queued while on the local list, so no other thread
+	 * touches them until they are popped below. */
+	dlist_init(&ready_list);
+	fastlock_acquire(&tcpx_cq->ready_lock);
+	dlist_splice_tail(&ready_list, &tcpx_cq->ready_list);
+	fastlock_release(&tcpx_cq->ready_lock);
+
+	while (!dlist_empty(&ready_list)) {
+		dlist_pop_front(&ready_list, struct tcpx_ready_entry,
+				ready, entry);
+		ep = ready->ep;
 		fastlock_acquire(&ep->lock);
-		tcpx_progress_tx(ep);
-		if (ep->stage_buf.cur_pos < ep->stage_buf.bytes_avail)
-			tcpx_progress_rx(ep);
+		fastlock_acquire(&tcpx_cq->ready_lock);
+		ready->queued = false;
+		fastlock_release(&tcpx_cq->ready_lock);
+		/* io_uring requests that found the queue full are retried */
+		if (ep->uring)
+			tcpx_progress_tx(ep);
+		tcpx_progress_rx(ep);
 		fastlock_release(&ep->lock);
+		events++;
 	}
 
 	nfds = (wait_fd->util_wait.wait_obj == FI_WAIT_FD) ?
@@ -73,18 +151,49 @@ void tcpx_cq_progress(struct util_cq *cq)
 
 	for (i = 0; i < nfds; i++) {
 		fid = wait_contexts[i];
+		if (fid->fclass == FI_CLASS_EQ) {
+			/* held until the events are handled, see
+			 * tcpx_rdm_cq_del_eq */
+			rdms[nrdms] = fid->context;
+			ofi_atomic_inc32(&rdms[nrdms++]->cm_ref);
+			continue;
+		}
+		/* io_uring completions, reaped above */
+		if (fid->fclass == FI_CLASS_UNSPEC)
+			continue;
 		if (fid->fclass != FI_CLASS_EP) {
-			fd_signal_reset(&wait_fd->signal);
+			/* A blocked fi_cq_sread may not have seen the signal
+			 * yet, leave it to the reader with a progress thread */
+			if (!tcpx_cq_domain(tcpx_cq)->progress_running)
+				fd_signal_reset(&wait_fd->signal);
 			continue;
 		}
 
 		ep = container_of(fid, struct tcpx_ep, util_ep.ep_fid.fid);
 		fastlock_acquire(&ep->lock);
+		tcpx_progress_tx(ep);
 		tcpx_progress_rx(ep);
+		tcpx_update_pollout(ep);
 		fastlock_release(&ep->lock);
+		events++;
 	}
 unlock:
 	cq->cq_fastlock_release(&cq->ep_list_lock);
+	if (uring)
+		tcpx_uring_flush(uring);
+
+	/* Connection setup binds new endpoints to this cq */
+	for (i = 0; i < nrdms; i++) {
+		tcpx_rdm_progress_cm(rdms[i]);
+		ofi_atomic_dec32(&rdms[i]->cm_ref);
+	}
+
+	return events + nrdms;
+}
+
+void tcpx_cq_progress(struct util_cq *cq)
+{
+	tcpx_cq_progress_events(cq);
 }
 
 static void tcpx_buf_pools_destroy(struct tcpx_buf_pool *buf_pools)
@@ -101,11 +210,16 @@ static int tcpx_cq_close(struct fid *fid)
 	struct tcpx_cq *tcpx_cq;
 
 	tcpx_cq = container_of(fid, struct tcpx_cq, util_cq.cq_fid.fid);
+	tcpx_progress_del_cq(tcpx_cq);
+	if (tcpx_cq_domain(tcpx_cq)->uring)
+		tcpx_uring_wait_del(tcpx_cq_domain(tcpx_cq)->uring,
+				    tcpx_cq->util_cq.wait);
 	tcpx_buf_pools_destroy(tcpx_cq->buf_pools);
 	ret = ofi_cq_cleanup(&tcpx_cq->util_cq);
 	if (ret)
 		return ret;
 
+	fastlock_destroy(&tcpx_cq->ready_lock);
 	free(tcpx_cq);
 	return 0;
 }
@@ -128,7 +242,8 @@ struct tcpx_xfer_entry *tcpx_xfer_entry_alloc(struct tcpx_cq *tcpx_cq,
 void tcpx_xfer_entry_release(struct tcpx_cq *tcpx_cq,
 			     struct tcpx_xfer_entry *xfer_entry)
 {
-	if (xfer_entry->ep->cur_rx_entry == xfer_entry)
+	/* FI_EP_RDM receives may complete outside of any connection */
+	if (xfer_entry->ep && xfer_entry->ep->cur_rx_entry == xfer_entry)
 		xfer_entry->ep->cur_rx_entry = NULL;
 
 	xfer_entry->hdr.base_hdr.flags = 0;
@@ -136,6 +251,8 @@ void tcpx_xfer_entry_release(struct tcpx_cq *tcpx_cq,
 	xfer_entry->flags = 0;
 	xfer_entry->context = 0;
 	xfer_entry->rem_len = 0;
+	xfer_entry->zc_sent = 0;
+	xfer_entry->zc_pending = 0;
 
 	tcpx_cq->util_cq.cq_fastlock_acquire(&tcpx_cq->util_cq.cq_lock);
 	ofi_buf_free(xfer_entry);
@@ -147,12 +264,20 @@ void tcpx_cq_report_success(struct util_cq *cq,
 {
 	uint64_t data = 0;
 	uint64_t flags = 0;
+	uint64_t tag = 0;
 	void *buf = NULL;
 	size_t len = 0;
 
 	flags = xfer_entry->flags;
 
-	if (!(flags & FI_COMPLETION))
+	if (flags & TCPX_MULTI_RECV_PART) {
+		if (tcpx_mrecv_put(xfer_entry))
+			flags |= FI_MULTI_RECV;
+		flags &= ~TCPX_MULTI_RECV_PART;
+		buf = xfer_entry->mrecv_msg_start;
+	}
+
+	if (!(flags & (FI_COMPLETION | FI_MULTI_RECV)))
 		return;
 
 	len = xfer_entry->hdr.base_hdr.size -
@@ -163,9 +288,23 @@ void tcpx_cq_report_success(struct util_cq *cq,
 		data = xfer_entry->hdr.cq_data_hdr.cq_data;
 	}
 
-	ofi_cq_write(cq, xfer_entry->context,
-		     flags, len, buf, data, 0);
-	if (cq->wait)
+	if ((flags & (FI_TAGGED | FI_RECV)) == (FI_TAGGED | FI_RECV))
+		tag = *tcpx_hdr_tag(&xfer_entry->hdr.base_hdr);
+
+	if (cq->src)
+		ofi_cq_write_src(cq, xfer_entry->context, flags, len, buf,
+				 data, tag, xfer_entry->match.addr);
+	else
+		ofi_cq_write(cq, xfer_entry->context,
+			     flags, len, buf, data, tag);
+	if (!cq->wait)
+		return;
+
+	/* An FI_EP_RDM reader blocked in sread is woken without aborting the
+	 * read, which fi_cq_signal would do */
+	if (!xfer_entry->ep || xfer_entry->ep->conn)
+		util_cq_signal(cq);
+	else
 		ofi_cq_signal(&cq->cq_fid);
 }
 
@@ -181,6 +320,12 @@ void tcpx_cq_report_error(struct util_cq *cq,
 		data = xfer_entry->hdr.cq_data_hdr.cq_data;
 	}
 
+	if (xfer_entry->flags & TCPX_MULTI_RECV_PART) {
+		xfer_entry->flags &= ~TCPX_MULTI_RECV_PART;
+		if (tcpx_mrecv_put(xfer_entry))
+			xfer_entry->flags |= FI_MULTI_RECV;
+	}
+
 	err_entry.op_context = xfer_entry->context;
 	err_entry.flags = xfer_entry->flags;
 	err_entry.len = 0;
@@ -226,6 +371,33 @@ static struct fi_ops tcpx_cq_fi_ops = {
 	.ops_open = fi_no_ops_open,
 };
 
+/* io_uring task work can interrupt the epoll_wait of a blocked reader,
+ * which the util wait set reports as -FI_EINTR.  Keep waiting instead.
+ */
+static ssize_t tcpx_cq_sreadfrom(struct fid_cq *cq_fid, void *buf,
+				 size_t count, fi_addr_t *src_addr,
+				 const void *cond, int timeout)
+{
+	uint64_t endtime;
+	ssize_t ret;
+
+	endtime = ofi_timeout_time(timeout);
+	do {
+		ret = ofi_cq_sreadfrom(cq_fid, buf, count, src_addr,
+				       cond, timeout);
+		if (ret != -FI_EINTR)
+			return ret;
+	} while (!ofi_adjust_timeout(endtime, &timeout));
+
+	return -FI_EAGAIN;
+}
+
+static ssize_t tcpx_cq_sread(struct fid_cq *cq_fid, void *buf, size_t count,
+			     const void *cond, int timeout)
+{
+	return tcpx_cq_sreadfrom(cq_fid, buf, count, NULL, cond, timeout);
+}
+
 static void tcpx_buf_pool_init(struct ofi_bufpool_region *region, void *buf)
 {
 	struct tcpx_buf_pool *pool = region->pool->attr.context;
@@ -233,6 +405,7 @@ static void tcpx_buf_pool_init(struct ofi_bufpool_region *region, void *buf)
 
 	xfer_entry->hdr.base_hdr.version = TCPX_HDR_VERSION;
 	xfer_entry->hdr.base_hdr.op_data = pool->op_type;
+	xfer_entry->match.addr = FI_ADDR_NOTAVAIL;
 
 	switch (pool->op_type) {
 	case TCPX_OP_MSG_RECV:
@@ -252,6 +425,9 @@ static void tcpx_buf_pool_init(struct ofi_bufpool_region *region, void *buf)
 		break;
 	case TCPX_OP_REMOTE_READ:
 		break;
+	case TCPX_OP_TAGGED_SEND:
+		xfer_entry->hdr.base_hdr.op = ofi_op_tagged;
+		break;
 	default:
 		assert(0);
 		break;
@@ -292,10 +468,13 @@ err:
 int tcpx_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		 struct fid_cq **cq_fid, void *context)
 {
+	struct tcpx_domain *tcpx_domain;
 	struct tcpx_cq *tcpx_cq;
 	struct fi_cq_attr cq_attr;
 	int ret;
 
+	tcpx_domain = container_of(domain, struct tcpx_domain,
+				   util_domain.domain_fid);
 	tcpx_cq = calloc(1, sizeof(*tcpx_cq));
 	if (!tcpx_cq)
 		return -FI_ENOMEM;
@@ -307,23 +486,51 @@ int tcpx_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 	if (ret)
 		goto free_cq;
 
+	/* A progress thread sleeps on the epoll fd of the wait set */
 	if (attr->wait_obj == FI_WAIT_NONE ||
 	    attr->wait_obj == FI_WAIT_UNSPEC) {
 		cq_attr = *attr;
-		cq_attr.wait_obj = FI_WAIT_POLLFD;
+		cq_attr.wait_obj = tcpx_domain->progress_running ?
+				   FI_WAIT_FD : FI_WAIT_POLLFD;
 		attr = &cq_attr;
 	}
 
+	fastlock_init(&tcpx_cq->ready_lock);
+	dlist_init(&tcpx_cq->ready_list);
+
 	ret = ofi_cq_init(&tcpx_prov, domain, attr, &tcpx_cq->util_cq,
 			  &tcpx_cq_progress, context);
 	if (ret)
-		goto destroy_pool;
+		goto destroy_lock;
+
+	if (tcpx_domain->uring) {
+		ret = tcpx_uring_wait_add(tcpx_domain->uring,
+					  tcpx_cq->util_cq.wait);
+		if (ret)
+			goto cleanup;
+	}
+
+	ret = tcpx_progress_add_cq(tcpx_cq);
+	if (ret)
+		goto del_uring;
 
 	*cq_fid = &tcpx_cq->util_cq.cq_fid;
 	(*cq_fid)->fid.ops = &tcpx_cq_fi_ops;
+	if (tcpx_domain->uring) {
+		tcpx_cq->uring_ops = *(*cq_fid)->ops;
+		tcpx_cq->uring_ops.sread = tcpx_cq_sread;
+		tcpx_cq->uring_ops.sreadfrom = tcpx_cq_sreadfrom;
+		(*cq_fid)->ops = &tcpx_cq->uring_ops;
+	}
 	return 0;
 
-destroy_pool:
+del_uring:
+	if (tcpx_domain->uring)
+		tcpx_uring_wait_del(tcpx_domain->uring, tcpx_cq->util_cq.wait);
+cleanup:
+	ofi_cq_cleanup(&tcpx_cq->util_cq);
+destroy_lock:
+	fastlock_destroy(&tcpx_cq->ready_lock);
 	tcpx_buf_pools_destroy(tcpx_cq->buf_pools);
 free_cq:
 	free(tcpx_cq);
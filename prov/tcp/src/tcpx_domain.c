@@ -65,6 +65,52 @@ static struct fi_ops fi_ops_srx_ctx = {
 	.ops_open = fi_no_ops_open,
 };
 
+static int tcpx_srx_getopt(fid_t fid, int level, int optname,
+			   void *optval, size_t *optlen)
+{
+	struct tcpx_rx_ctx *srx_ctx;
+
+	if (level != FI_OPT_ENDPOINT || optname != FI_OPT_MIN_MULTI_RECV)
+		return -FI_ENOPROTOOPT;
+
+	if (*optlen < sizeof(size_t)) {
+		*optlen = sizeof(size_t);
+		return -FI_ETOOSMALL;
+	}
+
+	srx_ctx = container_of(fid, struct tcpx_rx_ctx, rx_fid.fid);
+	*((size_t *) optval) = srx_ctx->min_multi_recv_size;
+	*optlen = sizeof(size_t);
+	return FI_SUCCESS;
+}
+
+static int tcpx_srx_setopt(fid_t fid, int level, int optname,
+			   const void *optval, size_t optlen)
+{
+	struct tcpx_rx_ctx *srx_ctx;
+
+	if (level != FI_OPT_ENDPOINT || optname != FI_OPT_MIN_MULTI_RECV)
+		return -FI_ENOPROTOOPT;
+
+	if (optlen != sizeof(size_t))
+		return -FI_EINVAL;
+
+	srx_ctx = container_of(fid, struct tcpx_rx_ctx, rx_fid.fid);
+	srx_ctx->min_multi_recv_size = *(size_t *) optval;
+	return FI_SUCCESS;
+}
+
+static struct fi_ops_ep tcpx_srx_ep_ops = {
+	.size = sizeof(struct fi_ops_ep),
+	.cancel = fi_no_cancel,
+	.getopt = tcpx_srx_getopt,
+	.setopt = tcpx_srx_setopt,
+	.tx_ctx = fi_no_tx_ctx,
+	.rx_ctx = fi_no_rx_ctx,
+	.rx_size_left = fi_no_rx_size_left,
+	.tx_size_left = fi_no_tx_size_left,
+};
+
 static int tcpx_srx_ctx(struct fid_domain *domain, struct fi_rx_attr *attr,
 		 struct fid_ep **rx_ep, void *context)
 {
@@ -78,6 +124,8 @@ static int tcpx_srx_ctx(struct fid_domain *domain, struct fi_rx_attr *attr,
 	srx_ctx->rx_fid.fid.fclass = FI_CLASS_SRX_CTX;
 	srx_ctx->rx_fid.fid.context = context;
 	srx_ctx->rx_fid.fid.ops = &fi_ops_srx_ctx;
+	srx_ctx->rx_fid.ops = &tcpx_srx_ep_ops;
+	srx_ctx->min_multi_recv_size = TCPX_MIN_MULTI_RECV;
 
 	srx_ctx->rx_fid.msg = &tcpx_srx_msg_ops;
 	slist_init(&srx_ctx->rx_queue);
@@ -118,6 +166,167 @@ static struct fi_ops_domain tcpx_domain_ops = {
 	.query_collective = fi_no_query_collective,
 };
 
+#ifdef HAVE_EPOLL
+#define TCPX_EPOLL_ET	EPOLLET
+#else
+#define TCPX_EPOLL_ET	0
+#endif
+
+/* Returns the fd the progress thread can sleep on for the cq, or -1 */
+static int tcpx_progress_cq_fd(struct tcpx_cq *cq)
+{
+#ifdef HAVE_EPOLL
+	if (cq->util_cq.wait->wait_obj == FI_WAIT_FD)
+		return container_of(cq->util_cq.wait, struct util_wait_fd,
+				    util_wait)->epoll_fd;
+#endif
+	return -1;
+}
+
+int tcpx_progress_add_cq(struct tcpx_cq *cq)
+{
+	struct tcpx_domain *domain = tcpx_cq_domain(cq);
+	int fd, ret = 0;
+
+	if (!domain->progress_running)
+		return 0;
+
+	fastlock_acquire(&domain->progress_lock);
+	fd = tcpx_progress_cq_fd(cq);
+	if (fd >= 0) {
+		/* Edge triggered, a cq signal nobody reset must not keep
+		 * the thread awake */
+		ret = ofi_epoll_add(domain->progress_epoll, fd,
+				    OFI_EPOLL_IN | TCPX_EPOLL_ET, cq);
+		if (ret)
+			goto unlock;
+	} else {
+		domain->polled_cqs++;
+	}
+	dlist_insert_tail(&cq->progress_entry, &domain->cq_list);
+unlock:
+	fastlock_release(&domain->progress_lock);
+	return ret;
+}
+
+void tcpx_progress_del_cq(struct tcpx_cq *cq)
+{
+	struct tcpx_domain *domain = tcpx_cq_domain(cq);
+	int fd;
+
+	if (!domain->progress_running)
+		return;
+
+	fastlock_acquire(&domain->progress_lock);
+	fd = tcpx_progress_cq_fd(cq);
+	if (fd >= 0)
+		ofi_epoll_del(domain->progress_epoll, fd);
+	else
+		domain->polled_cqs--;
+	dlist_remove(&cq->progress_entry);
+	fastlock_release(&domain->progress_lock);
+}
+
+static void tcpx_progress_wait(struct tcpx_domain *domain)
+{
+	void *context;
+	int ret;
+
+	ret = ofi_epoll_wait(domain->progress_epoll, &context, 1,
+			     domain->polled_cqs ? TCPX_PROGRESS_POLL_MS : -1);
+	if (ret < 0 && ret != -FI_EINTR)
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN, "poll failed: %s\n",
+			strerror(-ret));
+	else if (ret && context == &domain->progress_signal)
+		fd_signal_reset(&domain->progress_signal);
+}
+
+static void *tcpx_progress_func(void *arg)
+{
+	struct tcpx_domain *domain = arg;
+	struct tcpx_cq *cq;
+	uint64_t last, now;
+	int events;
+
+	if (tcpx_progress_affinity &&
+	    ofi_set_thread_affinity(tcpx_progress_affinity))
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"unable to set progress thread affinity to %s\n",
+			tcpx_progress_affinity);
+
+	last = ofi_gettime_us();
+	while (domain->progress_running) {
+		events = 0;
+		fastlock_acquire(&domain->progress_lock);
+		dlist_foreach_container(&domain->cq_list, struct tcpx_cq,
+					cq, progress_entry)
+			events += tcpx_cq_progress_events(&cq->util_cq);
+		fastlock_release(&domain->progress_lock);
+
+		now = ofi_gettime_us();
+		if (events)
+			last = now;
+		else if (now - last >= (uint64_t) tcpx_progress_spin) {
+			tcpx_progress_wait(domain);
+			last = ofi_gettime_us();
+		}
+	}
+	return NULL;
+}
+
+static int tcpx_progress_start(struct tcpx_domain *domain)
+{
+	int ret;
+
+	fastlock_init(&domain->progress_lock);
+	dlist_init(&domain->cq_list);
+
+	ret = ofi_epoll_create(&domain->progress_epoll);
+	if (ret)
+		goto err1;
+
+	ret = fd_signal_init(&domain->progress_signal);
+	if (ret)
+		goto err2;
+
+	ret = ofi_epoll_add(domain->progress_epoll,
+			    domain->progress_signal.fd[FI_READ_FD],
+			    OFI_EPOLL_IN, &domain->progress_signal);
+	if (ret)
+		goto err3;
+
+	domain->progress_running = true;
+	ret = pthread_create(&domain->progress_thread, NULL,
+			     tcpx_progress_func, domain);
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"unable to start progress thread: %s\n",
+			strerror(ret));
+		domain->progress_running = false;
+		ret = -ret;
+		goto err3;
+	}
+	return 0;
+err3:
+	fd_signal_free(&domain->progress_signal);
+err2:
+	ofi_epoll_close(domain->progress_epoll);
+err1:
+	fastlock_destroy(&domain->progress_lock);
+	return ret;
+}
+
+static void tcpx_progress_stop(struct tcpx_domain *domain)
+{
+	domain->progress_running = false;
+	fd_signal_set(&domain->progress_signal);
+	pthread_join(domain->progress_thread, NULL);
+
+	fd_signal_free(&domain->progress_signal);
+	ofi_epoll_close(domain->progress_epoll);
+	fastlock_destroy(&domain->progress_lock);
+}
+
 static int tcpx_domain_close(fid_t fid)
 {
 	struct tcpx_domain *tcpx_domain;
@@ -126,10 +335,20 @@ static int tcpx_domain_close(fid_t fid)
 	tcpx_domain = container_of(fid, struct tcpx_domain,
 				   util_domain.domain_fid.fid);
 
+	if (ofi_atomic_get32(&tcpx_domain->util_domain.ref))
+		return -FI_EBUSY;
+
+	/* the thread must not run while the domain is torn down */
+	if (tcpx_domain->progress_running)
+		tcpx_progress_stop(tcpx_domain);
+
 	ret = ofi_domain_close(&tcpx_domain->util_domain);
 	if (ret)
 		return ret;
 
+	if (tcpx_domain->uring)
+		tcpx_uring_close(tcpx_domain->uring);
+
 	free(tcpx_domain);
 	return FI_SUCCESS;
 }
@@ -167,6 +386,29 @@ int tcpx_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 	if (ret)
 		goto err;
 
+	if (!strcasecmp(tcpx_io_engine, "uring")) {
+		ret = tcpx_uring_open(&tcpx_domain->uring);
+		if (ret)
+			FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+				"io_uring unavailable (%s), using epoll\n",
+				fi_strerror(-ret));
+	}
+
+	if (tcpx_progress_thread &&
+	    info->domain_attr->data_progress == FI_PROGRESS_AUTO) {
+		/* The thread progresses the cqs and their endpoints behind
+		 * the application's back, so the util cq and ep locks must
+		 * be real locks whatever threading level was asked for. */
+		tcpx_domain->util_domain.threading = FI_THREAD_SAFE;
+		ret = tcpx_progress_start(tcpx_domain);
+		if (ret) {
+			if (tcpx_domain->uring)
+				tcpx_uring_close(tcpx_domain->uring);
+			ofi_domain_close(&tcpx_domain->util_domain);
+			goto err;
+		}
+	}
+
 	*domain = &tcpx_domain->util_domain.domain_fid;
 	(*domain)->fid.ops = &tcpx_domain_fi_ops;
 	(*domain)->ops = &tcpx_domain_ops;
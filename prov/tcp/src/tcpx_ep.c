@@ -61,6 +61,9 @@ void tcpx_hdr_bswap(struct tcpx_base_hdr *hdr)
 		ptr += sizeof(uint64_t);
 	}
 
+	if (hdr->op == ofi_op_tagged)
+		*tcpx_hdr_tag(hdr) = ntohll(*tcpx_hdr_tag(hdr));
+
 	rma_iov = (struct ofi_rma_iov *)ptr;
 	for ( i = 0; i < hdr->rma_iov_cnt; i++) {
 		rma_iov[i].addr = ntohll(rma_iov[i].addr);
@@ -116,6 +119,7 @@ static int tcpx_ep_connect(struct fid_ep *ep, const void *addr,
 
 	cm_ctx->fid = &tcpx_ep->util_ep.ep_fid.fid;
 	cm_ctx->type = CLIENT_SEND_CONNREQ;
+	tcpx_stream_listen(tcpx_ep, cm_ctx);
 
 	if (paramlen) {
 		cm_ctx->cm_data_sz = paramlen;
@@ -175,6 +179,7 @@ static int tcpx_ep_shutdown(struct fid_ep *ep, uint64_t flags)
 	if (ret && ofi_sockerr() != ENOTCONN) {
 		FI_WARN(&tcpx_prov, FI_LOG_EP_DATA, "ep shutdown unsuccessful\n");
 	}
+	tcpx_stream_shutdown(tcpx_ep);
 
 	fastlock_acquire(&tcpx_ep->lock);
 	ret = tcpx_ep_shutdown_report(tcpx_ep, &ep->fid);
@@ -341,6 +346,7 @@ static void tcpx_ep_tx_rx_queues_release(struct tcpx_ep *ep)
 	tcpx_ep_release_queue(&ep->tx_queue, tcpx_cq);
 	tcpx_ep_release_queue(&ep->rma_read_queue, tcpx_cq);
 	tcpx_ep_release_queue(&ep->tx_rsp_pend_queue, tcpx_cq);
+	tcpx_ep_release_queue(&ep->tx_zc_queue, tcpx_cq);
 
 	tcpx_cq = container_of(ep->util_ep.rx_cq, struct tcpx_cq, util_cq);
 	tcpx_ep_release_queue(&ep->rx_queue, tcpx_cq);
@@ -361,14 +367,21 @@ void tcpx_ep_wait_fd_del(struct tcpx_ep *ep)
 
 	/* eq->close_lock protects from processing stale connection events */
 	fastlock_acquire(&eq->close_lock);
-	if (ep->util_ep.rx_cq)
+	/* io_uring endpoints never add their socket to the cqs */
+	if (ep->util_ep.rx_cq && !ep->uring) {
 		ofi_wait_del_fd(ep->util_ep.rx_cq->wait, ep->sock);
+		tcpx_stream_wait_del(ep, ep->util_ep.rx_cq->wait);
+	}
 
-	if (ep->util_ep.tx_cq)
+	if (ep->util_ep.tx_cq && !ep->uring) {
 		ofi_wait_del_fd(ep->util_ep.tx_cq->wait, ep->sock);
+		tcpx_stream_wait_del(ep, ep->util_ep.tx_cq->wait);
+	}
 
-	if (ep->util_ep.eq->wait)
+	if (ep->util_ep.eq->wait) {
 		ofi_wait_del_fd(ep->util_ep.eq->wait, ep->sock);
+		tcpx_stream_cm_del(ep, ep->util_ep.eq->wait);
+	}
 
 	fastlock_release(&eq->close_lock);
 }
@@ -378,14 +391,19 @@ static int tcpx_ep_close(struct fid *fid)
 	struct tcpx_ep *ep = container_of(fid, struct tcpx_ep,
 					  util_ep.ep_fid.fid);
 
+	/* In flight io_uring requests reference the queued entries */
+	tcpx_uring_ep_close(ep);
 	tcpx_ep_tx_rx_queues_release(ep);
 
 	tcpx_ep_wait_fd_del(ep); /* ensure that everything is really released */
+	tcpx_ep_remove_ready(ep);
 
 	ofi_eq_remove_fid_events(ep->util_ep.eq, &ep->util_ep.ep_fid.fid);
+	tcpx_stream_close(ep);
 	ofi_close_socket(ep->sock);
 	ofi_endpoint_close(&ep->util_ep);
 	fastlock_destroy(&ep->lock);
+	free(ep->stage_buf.buf);
 
 	free(ep);
 	return 0;
@@ -503,10 +521,14 @@ int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 	struct tcpx_conn_handle *handle;
 	int ret;
 
+	if (info->ep_attr && info->ep_attr->type == FI_EP_RDM)
+		return tcpx_rdm_endpoint(domain, info, ep_fid, context);
+
 	ep = calloc(1, sizeof(*ep));
 	if (!ep)
 		return -FI_ENOMEM;
 
+	ep->stream_listen = INVALID_SOCKET;
 	ret = ofi_endpoint_init(domain, &tcpx_util_prov, info, &ep->util_ep,
 				context, NULL);
 	if (ret)
@@ -525,6 +547,8 @@ int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 			ep->sock = handle->sock;
 			ep->hdr_bswap = handle->endian_match ?
 					tcpx_hdr_none : tcpx_hdr_bswap;
+			ep->stream_req = handle->streams;
+			ep->stream_port = handle->stream_port;
 			free(handle);
 
 			ret = tcpx_setup_socket(ep->sock);
@@ -543,19 +567,26 @@ int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 			goto err3;
 	}
 
+	ret = tcpx_stage_buf_init(&ep->stage_buf);
+	if (ret)
+		goto err3;
+
 	ep->cm_state = TCPX_EP_CONNECTING;
 	ret = fastlock_init(&ep->lock);
 	if (ret)
-		goto err3;
+		goto err4;
 
 	slist_init(&ep->rx_queue);
 	slist_init(&ep->tx_queue);
 	slist_init(&ep->rma_read_queue);
 	slist_init(&ep->tx_rsp_pend_queue);
+	slist_init(&ep->tx_zc_queue);
 
 	ep->cur_rx_msg.done_len = 0;
 	ep->cur_rx_msg.hdr_len = sizeof(ep->cur_rx_msg.hdr.base_hdr);
 	ep->min_multi_recv_size = TCPX_MIN_MULTI_RECV;
+	ep->ready[0].ep = ep;
+	ep->ready[1].ep = ep;
 
 	*ep_fid = &ep->util_ep.ep_fid;
 	(*ep_fid)->fid.ops = &tcpx_ep_fi_ops;
@@ -570,6 +601,8 @@ int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 	ep->start_op[ofi_op_read_rsp] = tcpx_op_read_rsp;
 	ep->start_op[ofi_op_write] = tcpx_op_write;
 	return 0;
+err4:
+	free(ep->stage_buf.buf);
 err3:
 	ofi_close_socket(ep->sock);
 err2:
@@ -52,6 +52,18 @@ struct tcpx_port_range port_range = {
 	.high = 0,
 };
 
+size_t tcpx_zerocopy_size = SIZE_MAX;
+size_t tcpx_staging_size = 65536;
+size_t tcpx_direct_recv_size = 4096;
+int tcpx_progress_thread = 0;
+int tcpx_progress_spin = 50;
+char *tcpx_progress_affinity = NULL;
+char *tcpx_io_engine = "epoll";
+int tcpx_uring_sqpoll = 0;
+int tcpx_streams = 1;
+size_t tcpx_stripe_size = 256 * 1024;
+int tcpx_rdm_enabled = 0;
+
 static void tcpx_init_env(void)
 {
 	srand(getpid());
@@ -59,6 +71,49 @@ static void tcpx_init_env(void)
 	fi_param_get_int(&tcpx_prov, "port_high_range", &port_range.high);
 	fi_param_get_int(&tcpx_prov, "port_low_range", &port_range.low);
 
+	fi_param_get_size_t(&tcpx_prov, "zerocopy_size", &tcpx_zerocopy_size);
+	fi_param_get_size_t(&tcpx_prov, "staging_size", &tcpx_staging_size);
+	fi_param_get_size_t(&tcpx_prov, "direct_recv_size",
+			    &tcpx_direct_recv_size);
+
+	fi_param_get_bool(&tcpx_prov, "progress_thread", &tcpx_progress_thread);
+	fi_param_get_int(&tcpx_prov, "progress_spin", &tcpx_progress_spin);
+	fi_param_get_str(&tcpx_prov, "progress_affinity",
+			 &tcpx_progress_affinity);
+
+	fi_param_get_str(&tcpx_prov, "io_engine", &tcpx_io_engine);
+	fi_param_get_bool(&tcpx_prov, "uring_sqpoll", &tcpx_uring_sqpoll);
+
+	fi_param_get_int(&tcpx_prov, "streams", &tcpx_streams);
+	fi_param_get_size_t(&tcpx_prov, "stripe_size", &tcpx_stripe_size);
+
+	fi_param_get_bool(&tcpx_prov, "rdm", &tcpx_rdm_enabled);
+	if (tcpx_rdm_enabled)
+		tcpx_info.next = &tcpx_rdm_info;
+
+	if (tcpx_progress_spin < 0)
+		tcpx_progress_spin = 0;
+
+	if (strcasecmp(tcpx_io_engine, "epoll") &&
+	    strcasecmp(tcpx_io_engine, "uring")) {
+		FI_WARN(&tcpx_prov, FI_LOG_CORE,
+			"unknown io_engine %s, using epoll\n", tcpx_io_engine);
+		tcpx_io_engine = "epoll";
+	}
+
+	if (tcpx_streams < 1 || tcpx_streams > TCPX_MAX_STREAMS) {
+		FI_WARN(&tcpx_prov, FI_LOG_CORE,
+			"streams must be between 1 and %d, using 1\n",
+			TCPX_MAX_STREAMS);
+		tcpx_streams = 1;
+	}
+
+	if (tcpx_stripe_size < TCPX_MIN_STRIPE_SIZE)
+		tcpx_stripe_size = TCPX_MIN_STRIPE_SIZE;
+
+	if (tcpx_staging_size < STAGE_BUF_SIZE)
+		tcpx_staging_size = STAGE_BUF_SIZE;
+
 	if (port_range.high > TCPX_PORT_MAX_RANGE)
 		port_range.high = TCPX_PORT_MAX_RANGE;
 
@@ -99,6 +154,54 @@ TCP_INI
 	fi_param_define(&tcpx_prov,"port_high_range", FI_PARAM_INT,
 			"define port high range");
 
+	fi_param_define(&tcpx_prov, "zerocopy_size", FI_PARAM_SIZE_T,
+			"Send transfers of at least this many bytes with "
+			"MSG_ZEROCOPY, where supported (default: disabled)");
+
+	fi_param_define(&tcpx_prov, "staging_size", FI_PARAM_SIZE_T,
+			"Maximum size of the per endpoint receive staging "
+			"buffer, which grows while recvs fill it "
+			"(default: 64KB)");
+
+	fi_param_define(&tcpx_prov, "direct_recv_size", FI_PARAM_SIZE_T,
+			"Payloads of at least this many bytes are received "
+			"directly into the user buffer instead of through the "
+			"staging buffer (default: 4KB)");
+
+	fi_param_define(&tcpx_prov, "progress_thread", FI_PARAM_BOOL,
+			"Run a progress thread for each domain opened with "
+			"FI_PROGRESS_AUTO data progress (default: no)");
+
+	fi_param_define(&tcpx_prov, "progress_spin", FI_PARAM_INT,
+			"Microseconds the progress thread keeps polling after "
+			"the last event before it sleeps (default: 50)");
+
+	fi_param_define(&tcpx_prov, "progress_affinity", FI_PARAM_STRING,
+			"CPUs to bind the progress thread to, as "
+			"c1[-c2[:stride]][,...]");
+
+	fi_param_define(&tcpx_prov, "io_engine", FI_PARAM_STRING,
+			"Socket I/O engine of connected endpoints, epoll or "
+			"uring (io_uring, Linux only) (default: epoll)");
+
+	fi_param_define(&tcpx_prov, "uring_sqpoll", FI_PARAM_BOOL,
+			"Let a kernel thread poll the io_uring submission "
+			"queue, saving a system call per request "
+			"(default: no)");
+
+	fi_param_define(&tcpx_prov, "streams", FI_PARAM_INT,
+			"Number of sockets per connection, up to 16, over "
+			"which large transfers are striped (default: 1)");
+
+	fi_param_define(&tcpx_prov, "stripe_size", FI_PARAM_SIZE_T,
+			"Transfers with a payload of at least this many bytes "
+			"are striped across the sockets of a connection, "
+			"minimum 64KB (default: 256KB)");
+
+	fi_param_define(&tcpx_prov, "rdm", FI_PARAM_BOOL,
+			"Offer native FI_EP_RDM endpoints in addition to "
+			"FI_EP_MSG (default: no)");
+
 	tcpx_init_env();
 	return &tcpx_prov;
 }
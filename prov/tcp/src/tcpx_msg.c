@@ -95,6 +95,8 @@ static ssize_t tcpx_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
 
 	assert(msg->iov_count <= TCPX_IOV_LIMIT);
+	if ((flags & FI_MULTI_RECV) && msg->iov_count != 1)
+		return -FI_EINVAL;
 
 	recv_entry = tcpx_alloc_recv_entry(tcpx_ep);
 	if (!recv_entry)
@@ -106,6 +108,7 @@ static ssize_t tcpx_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 
 	recv_entry->flags = tcpx_ep->util_ep.rx_msg_flags | flags |
 			    FI_MSG | FI_RECV;
+	recv_entry->mrecv_cnt = 0;
 	recv_entry->context = msg->context;
 
 	tcpx_queue_recv(tcpx_ep, recv_entry);
@@ -128,8 +131,10 @@ static ssize_t tcpx_recv(struct fid_ep *ep, void *buf, size_t len, void *desc,
 	recv_entry->iov[0].iov_base = buf;
 	recv_entry->iov[0].iov_len = len;
 
-	recv_entry->flags = (tcpx_ep->util_ep.rx_op_flags & FI_COMPLETION) |
+	recv_entry->flags = (tcpx_ep->util_ep.rx_op_flags &
+			     (FI_COMPLETION | FI_MULTI_RECV)) |
 			    FI_MSG | FI_RECV;
+	recv_entry->mrecv_cnt = 0;
 	recv_entry->context = context;
 
 	tcpx_queue_recv(tcpx_ep, recv_entry);
@@ -145,6 +150,8 @@ static ssize_t tcpx_recvv(struct fid_ep *ep, const struct iovec *iov, void **des
 	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
 
 	assert(count <= TCPX_IOV_LIMIT);
+	if ((tcpx_ep->util_ep.rx_op_flags & FI_MULTI_RECV) && count != 1)
+		return -FI_EINVAL;
 
 	recv_entry = tcpx_alloc_recv_entry(tcpx_ep);
 	if (!recv_entry)
@@ -153,8 +160,10 @@ static ssize_t tcpx_recvv(struct fid_ep *ep, const struct iovec *iov, void **des
 	recv_entry->iov_cnt = count;
 	memcpy(recv_entry->iov, iov, count * sizeof(*iov));
 
-	recv_entry->flags = (tcpx_ep->util_ep.rx_op_flags & FI_COMPLETION) |
+	recv_entry->flags = (tcpx_ep->util_ep.rx_op_flags &
+			     (FI_COMPLETION | FI_MULTI_RECV)) |
 			    FI_MSG | FI_RECV;
+	recv_entry->mrecv_cnt = 0;
 	recv_entry->context = context;
 
 	tcpx_queue_recv(tcpx_ep, recv_entry);
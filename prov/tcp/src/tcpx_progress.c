@@ -92,14 +92,10 @@ int tcpx_ep_shutdown_report(struct tcpx_ep *ep, fid_t fid)
 	return FI_SUCCESS;
 }
 
-static void process_tx_entry(struct tcpx_xfer_entry *tx_entry)
+/* Retire the entry at the head of the tx queue once its send has ended */
+static void tcpx_tx_entry_done(struct tcpx_xfer_entry *tx_entry, int ret)
 {
 	struct tcpx_cq *tcpx_cq;
-	int ret;
-
-	ret = tcpx_send_msg(tx_entry);
-	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
-		return;
 
 	/* Keep this path below as a single pass path.*/
 	tx_entry->ep->hdr_bswap(&tx_entry->hdr.base_hdr);
@@ -118,6 +114,12 @@ static void process_tx_entry(struct tcpx_xfer_entry *tx_entry)
 					  &tx_entry->ep->tx_rsp_pend_queue);
 			return;
 		}
+		if (tx_entry->zc_pending) {
+			/* the kernel still references the buffers */
+			slist_insert_tail(&tx_entry->entry,
+					  &tx_entry->ep->tx_zc_queue);
+			return;
+		}
 		tcpx_cq_report_success(tx_entry->ep->util_ep.tx_cq, tx_entry);
 	}
 
@@ -126,12 +128,116 @@ static void process_tx_entry(struct tcpx_xfer_entry *tx_entry)
 	tcpx_xfer_entry_release(tcpx_cq, tx_entry);
 }
 
-static int tcpx_prepare_rx_entry_resp(struct tcpx_xfer_entry *rx_entry)
+static int process_tx_entry(struct tcpx_xfer_entry *tx_entry)
+{
+	int ret;
+
+	ret = tcpx_send_msg(tx_entry);
+	if (!OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+		tcpx_tx_entry_done(tx_entry, ret);
+	return ret;
+}
+
+/*
+ * Collect the leading entries of the tx queue into iov, up to
+ * TCPX_TX_GATHER_IOV iovecs and TCPX_TX_GATHER_SIZE bytes.  Zero-copy
+ * entries are sent on their own, so their ids map to a single entry, as
+ * are striped entries, which are sent over all streams.
+ * Returns the number of entries gathered.
+ */
+int tcpx_tx_gather(struct tcpx_ep *ep, struct iovec *iov, size_t *iov_cnt,
+		   size_t *len)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	struct slist_entry *item;
+	int entry_cnt = 0;
+
+	*iov_cnt = 0;
+	*len = 0;
+	for (item = ep->tx_queue.head; item; item = item->next) {
+		tx_entry = container_of(item, struct tcpx_xfer_entry, entry);
+		if (tcpx_tx_zerocopy(tx_entry) || tcpx_tx_striped(tx_entry) ||
+		    *iov_cnt + tx_entry->iov_cnt > TCPX_TX_GATHER_IOV ||
+		    (*len && *len + tx_entry->rem_len > TCPX_TX_GATHER_SIZE))
+			break;
+
+		memcpy(&iov[*iov_cnt], tx_entry->iov,
+		       tx_entry->iov_cnt * sizeof(*iov));
+		*iov_cnt += tx_entry->iov_cnt;
+		*len += tx_entry->rem_len;
+		entry_cnt++;
+	}
+	return entry_cnt;
+}
+
+/*
+ * Account for a send of gathered entries that took ret bytes, retiring
+ * every entry the socket accepted in full, or that failed with ret.
+ */
+void tcpx_tx_sent(struct tcpx_ep *ep, ssize_t ret)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	size_t sent;
+
+	tx_entry = container_of(ep->tx_queue.head,
+				struct tcpx_xfer_entry, entry);
+	if (ret < 0) {
+		tcpx_tx_entry_done(tx_entry, (int) ret);
+		return;
+	}
+
+	for (sent = ret; sent; ) {
+		tx_entry = container_of(ep->tx_queue.head,
+					struct tcpx_xfer_entry, entry);
+		if (sent < tx_entry->rem_len) {
+			tx_entry->rem_len -= sent;
+			ofi_consume_iov(tx_entry->iov, &tx_entry->iov_cnt,
+					sent);
+			break;
+		}
+		sent -= tx_entry->rem_len;
+		tx_entry->rem_len = 0;
+		tcpx_tx_entry_done(tx_entry, FI_SUCCESS);
+	}
+}
+
+/*
+ * Send the gathered entries with a single sendmsg.  The bytes on the wire
+ * are the same as sending the entries one at a time.
+ */
+static int tcpx_send_queued(struct tcpx_ep *ep)
+{
+	struct iovec iov[TCPX_TX_GATHER_IOV];
+	struct tcpx_xfer_entry *tx_entry;
+	size_t iov_cnt, len;
+	ssize_t ret;
+
+	if (ep->uring)
+		return tcpx_uring_send(ep);
+
+	if (tcpx_tx_gather(ep, iov, &iov_cnt, &len) < 2) {
+		tx_entry = container_of(ep->tx_queue.head,
+					struct tcpx_xfer_entry, entry);
+		return process_tx_entry(tx_entry);
+	}
+
+	ret = tcpx_send_iov(ep->sock, iov, iov_cnt);
+	if (ret < 0) {
+		if (!OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+			tcpx_tx_sent(ep, ret);
+		return (int) ret;
+	}
+
+	tcpx_tx_sent(ep, ret);
+	return (size_t) ret < len ? -FI_EAGAIN : FI_SUCCESS;
+}
+
+static int tcpx_queue_msg_resp(struct tcpx_ep *ep)
 {
 	struct tcpx_cq *tcpx_tx_cq;
 	struct tcpx_xfer_entry *resp_entry;
 
-	tcpx_tx_cq = container_of(rx_entry->ep->util_ep.tx_cq,
+	tcpx_tx_cq = container_of(ep->util_ep.tx_cq,
 			       struct tcpx_cq, util_cq);
 
 	resp_entry = tcpx_xfer_entry_alloc(tcpx_tx_cq, TCPX_OP_MSG_RESP);
@@ -150,10 +256,21 @@ static int tcpx_prepare_rx_entry_resp(struct tcpx_xfer_entry *rx_entry)
 	resp_entry->flags = 0;
 	resp_entry->context = NULL;
 	resp_entry->rem_len = sizeof(resp_entry->hdr.base_hdr);
-	resp_entry->ep = rx_entry->ep;
+	resp_entry->ep = ep;
 
 	resp_entry->ep->hdr_bswap(&resp_entry->hdr.base_hdr);
 	tcpx_tx_queue_insert(resp_entry->ep, resp_entry);
+	return FI_SUCCESS;
+}
+
+static int tcpx_prepare_rx_entry_resp(struct tcpx_xfer_entry *rx_entry)
+{
+	int ret;
+
+	ret = tcpx_queue_msg_resp(rx_entry->ep);
+	if (ret)
+		return ret;
+
 	tcpx_cq_report_success(rx_entry->ep->util_ep.rx_cq, rx_entry);
 
 	tcpx_rx_msg_release(rx_entry);
@@ -407,6 +524,25 @@ static void tcpx_rx_setup(struct tcpx_ep *ep, struct tcpx_xfer_entry *rx_entry,
 	ep->cur_rx_msg.done_len = 0;
 }
 
+/* The next message lands in the FI_MULTI_RECV buffer at the rx_queue head */
+static struct tcpx_xfer_entry *
+tcpx_ep_mrecv_entry(struct tcpx_ep *ep, struct tcpx_xfer_entry *mrecv,
+		    size_t msg_len)
+{
+	struct tcpx_xfer_entry *rx_entry;
+	struct tcpx_cq *tcpx_cq;
+
+	tcpx_cq = container_of(ep->util_ep.rx_cq, struct tcpx_cq, util_cq);
+	rx_entry = tcpx_xfer_entry_alloc(tcpx_cq, TCPX_OP_MSG_RECV);
+	if (!rx_entry)
+		return NULL;
+
+	if (tcpx_mrecv_carve(mrecv, rx_entry, msg_len,
+			     ep->min_multi_recv_size))
+		slist_remove_head(&ep->rx_queue);
+	return rx_entry;
+}
+
 int tcpx_op_msg(struct tcpx_ep *tcpx_ep)
 {
 	struct tcpx_xfer_entry *rx_entry;
@@ -421,16 +557,27 @@ int tcpx_op_msg(struct tcpx_ep *tcpx_ep)
 		tx_entry = container_of(tcpx_ep->tx_rsp_pend_queue.head,
 					struct tcpx_xfer_entry, entry);
 
+		slist_remove_head(&tx_entry->ep->tx_rsp_pend_queue);
+		if (tx_entry->zc_pending) {
+			/* the peer has the data, but the kernel may not
+			 * have reported the buffers released yet */
+			slist_insert_tail(&tx_entry->entry,
+					  &tcpx_ep->tx_zc_queue);
+			tcpx_rx_setup(tcpx_ep, NULL, NULL);
+			return -FI_EAGAIN;
+		}
+
 		tcpx_cq = container_of(tcpx_ep->util_ep.tx_cq, struct tcpx_cq,
 				       util_cq);
 		tcpx_cq_report_success(tx_entry->ep->util_ep.tx_cq, tx_entry);
-
-		slist_remove_head(&tx_entry->ep->tx_rsp_pend_queue);
 		tcpx_xfer_entry_release(tcpx_cq, tx_entry);
 		tcpx_rx_setup(tcpx_ep, NULL, NULL);
 		return -FI_EAGAIN;
 	}
 
+	if (tcpx_ep->conn)
+		return tcpx_rdm_start_recv(tcpx_ep);
+
 	msg_len = (tcpx_ep->cur_rx_msg.hdr.base_hdr.size -
 		   tcpx_ep->cur_rx_msg.hdr.base_hdr.payload_off);
 
@@ -447,10 +594,16 @@ int tcpx_op_msg(struct tcpx_ep *tcpx_ep)
 
 		rx_entry = container_of(tcpx_ep->rx_queue.head,
 					struct tcpx_xfer_entry, entry);
-
-		rx_entry->rem_len = ofi_total_iov_len(rx_entry->iov,
-						      rx_entry->iov_cnt) - msg_len;
-		slist_remove_head(&tcpx_ep->rx_queue);
+		if (rx_entry->flags & FI_MULTI_RECV) {
+			rx_entry = tcpx_ep_mrecv_entry(tcpx_ep, rx_entry,
+						       msg_len);
+			if (!rx_entry)
+				return -FI_EAGAIN;
+		} else {
+			rx_entry->rem_len = ofi_total_iov_len(rx_entry->iov,
+						rx_entry->iov_cnt) - msg_len;
+			slist_remove_head(&tcpx_ep->rx_queue);
+		}
 	}
 
 	memcpy(&rx_entry->hdr, &tcpx_ep->cur_rx_msg.hdr,
@@ -476,6 +629,127 @@ int tcpx_op_msg(struct tcpx_ep *tcpx_ep)
 	return FI_SUCCESS;
 }
 
+/* The unexpected data is all in, acknowledge it if the sender waits */
+static int tcpx_rdm_unexp_complete(struct tcpx_xfer_entry *unexp)
+{
+	struct tcpx_ep *ep = unexp->ep;
+
+	if ((unexp->hdr.base_hdr.flags & OFI_DELIVERY_COMPLETE) &&
+	    tcpx_queue_msg_resp(ep)) {
+		ep->cur_rx_proc_fn = tcpx_rdm_unexp_complete;
+		return -FI_EAGAIN;
+	}
+
+	ep->cur_rx_entry = NULL;
+	tcpx_rdm_unexp_done(ep->conn->rdm, unexp, FI_SUCCESS);
+	return FI_SUCCESS;
+}
+
+static int process_rdm_unexp(struct tcpx_xfer_entry *unexp)
+{
+	struct tcpx_ep *ep = unexp->ep;
+	int ret;
+
+	ret = tcpx_recv_msg_data(unexp);
+	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+		return ret;
+
+	if (!ret)
+		return tcpx_rdm_unexp_complete(unexp);
+
+	FI_WARN(&tcpx_prov, FI_LOG_EP_DATA,
+		"msg recv Failed ret = %d\n", ret);
+	tcpx_ep_shutdown_report(ep, &ep->util_ep.ep_fid.fid);
+	ep->cur_rx_entry = NULL;
+	tcpx_rdm_unexp_done(ep->conn->rdm, unexp, ret);
+	return ret;
+}
+
+/*
+ * FI_EP_RDM receive.  The message goes straight into the oldest matching
+ * posted receive if it fits.  Otherwise it is read into a bounce buffer
+ * and queued as unexpected, unless a receive too small for it matched,
+ * which then claims it to report the truncation once the data is in.
+ */
+int tcpx_rdm_start_recv(struct tcpx_ep *ep)
+{
+	struct tcpx_base_hdr *hdr = &ep->cur_rx_msg.hdr.base_hdr;
+	struct tcpx_rdm *rdm = ep->conn->rdm;
+	struct tcpx_xfer_entry *rx_entry = NULL, *unexp;
+	struct ofi_match_entry *match;
+	struct tcpx_cq *tcpx_cq;
+	int tagged = (hdr->op == ofi_op_tagged);
+	uint64_t tag = tagged ? *tcpx_hdr_tag(hdr) : 0;
+	fi_addr_t addr = tcpx_conn_addr(ep->conn);
+	size_t msg_len = hdr->size - hdr->payload_off;
+	void *buf = NULL;
+
+	fastlock_acquire(&rdm->rx_lock);
+	match = ofi_match_queue_find(&rdm->recv_queue[tagged], addr, tag, 0);
+	if (match) {
+		rx_entry = container_of(match, struct tcpx_xfer_entry, match);
+		if (ofi_total_iov_len(rx_entry->iov, rx_entry->iov_cnt) >=
+		    msg_len) {
+			ofi_match_queue_remove(&rdm->recv_queue[tagged], match);
+			fastlock_release(&rdm->rx_lock);
+
+			memcpy(&rx_entry->hdr, hdr, hdr->payload_off);
+			rx_entry->hdr.base_hdr.op_data = TCPX_OP_MSG_RECV;
+			rx_entry->ep = ep;
+			rx_entry->match.addr = addr;
+			ofi_truncate_iov(rx_entry->iov, &rx_entry->iov_cnt,
+					 msg_len);
+			tcpx_rx_setup(ep, rx_entry, process_rx_entry);
+			return FI_SUCCESS;
+		}
+	}
+
+	/* Leave the message in the socket while the buffered ones exceed
+	 * the budget, the sender stalls once TCP's window fills. */
+	if (!rx_entry && rdm->unexp_bytes &&
+	    rdm->unexp_bytes + msg_len > rdm->unexp_max) {
+		fastlock_release(&rdm->rx_lock);
+		return -FI_EAGAIN;
+	}
+
+	tcpx_cq = container_of(rdm->util_ep.rx_cq, struct tcpx_cq, util_cq);
+	unexp = tcpx_xfer_entry_alloc(tcpx_cq, TCPX_OP_MSG_RECV);
+	if (msg_len)
+		buf = malloc(msg_len);
+	if (!unexp || (msg_len && !buf)) {
+		fastlock_release(&rdm->rx_lock);
+		free(buf);
+		if (unexp)
+			tcpx_xfer_entry_release(tcpx_cq, unexp);
+		return -FI_EAGAIN;
+	}
+
+	memcpy(&unexp->hdr, hdr, hdr->payload_off);
+	unexp->hdr.base_hdr.op_data = TCPX_OP_MSG_RECV;
+	unexp->iov[0].iov_base = buf;
+	unexp->iov[0].iov_len = msg_len;
+	unexp->iov_cnt = 1;
+	unexp->mrecv_msg_start = buf;
+	unexp->ep = ep;
+	unexp->match.addr = addr;
+	unexp->match.tag = tag;
+	unexp->match.ignore = 0;
+	rdm->unexp_bytes += msg_len;
+
+	if (rx_entry) {
+		ofi_match_queue_remove(&rdm->recv_queue[tagged], match);
+		unexp->claim = rx_entry;
+	} else {
+		unexp->claim = NULL;
+		ofi_match_queue_insert(&rdm->unexp_queue[tagged],
+				       &unexp->match);
+	}
+	fastlock_release(&rdm->rx_lock);
+
+	tcpx_rx_setup(ep, unexp, process_rdm_unexp);
+	return FI_SUCCESS;
+}
+
 int tcpx_op_read_req(struct tcpx_ep *tcpx_ep)
 {
 	struct tcpx_xfer_entry *rx_entry;
@@ -581,7 +855,7 @@ static int tcpx_get_next_rx_hdr(struct tcpx_ep *ep)
 	if (ep->cur_rx_msg.done_len >= ep->cur_rx_msg.hdr_len)
 		return FI_SUCCESS;
 
-	ret = tcpx_recv_hdr(ep->sock, &ep->stage_buf, &ep->cur_rx_msg);
+	ret = tcpx_recv_hdr(ep);
 	if (ret < 0)
 		return ret;
 
@@ -592,8 +866,7 @@ static int tcpx_get_next_rx_hdr(struct tcpx_ep *ep)
 
 		if (ep->cur_rx_msg.hdr_len > ep->cur_rx_msg.done_len) {
 			/* Still more header to read */
-			ret = tcpx_recv_hdr(ep->sock, &ep->stage_buf,
-					    &ep->cur_rx_msg);
+			ret = tcpx_recv_hdr(ep);
 			if (ret < 0)
 				return ret;
 
@@ -616,7 +889,7 @@ void tcpx_progress_rx(struct tcpx_ep *ep)
 
 	if (!ep->cur_rx_entry &&
 	    (ep->stage_buf.cur_pos == ep->stage_buf.bytes_avail)) {
-		ret = tcpx_read_to_buffer(ep->sock, &ep->stage_buf);
+		ret = tcpx_read_to_buffer(ep);
 		if (ret)
 			goto err;
 	}
@@ -634,12 +907,25 @@ void tcpx_progress_rx(struct tcpx_ep *ep)
 		assert(ep->cur_rx_proc_fn);
 		ep->cur_rx_proc_fn(ep->cur_rx_entry);
 
+		/* The rest of a striped payload is still on the streams */
+		if (ep->rx_stripe)
+			return;
+
 	} while (ep->stage_buf.cur_pos < ep->stage_buf.bytes_avail);
 
+	/* io_uring keeps a recv armed while the buffer is drained */
+	if (ep->uring)
+		(void) tcpx_uring_recv(ep);
 	return;
 err:
-	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret)) {
+		/* epoll won't report bytes already staged */
+		if (ep->stage_buf.cur_pos < ep->stage_buf.bytes_avail)
+			tcpx_ep_queue_ready(ep);
+		else if (ep->uring)
+			(void) tcpx_uring_recv(ep);
 		return;
+	}
 
 	/* Failed current RX entry should clean itself */
 	assert(!ep->cur_rx_entry);
@@ -651,51 +937,88 @@ err:
 /* Must hold ep lock */
 void tcpx_progress_tx(struct tcpx_ep *ep)
 {
-	struct tcpx_xfer_entry *tx_entry;
-	struct slist_entry *entry;
-
-	if (!slist_empty(&ep->tx_queue)) {
-		entry = ep->tx_queue.head;
-		tx_entry = container_of(entry, struct tcpx_xfer_entry, entry);
-		process_tx_entry(tx_entry);
+	tcpx_progress_zerocopy(ep);
+	ep->tx_held = false;
+	ep->tx_held_iov = 0;
+	ep->tx_held_len = 0;
+
+	/* Drain the queue until the socket stops taking data */
+	while (!slist_empty(&ep->tx_queue)) {
+		if (tcpx_send_queued(ep))
+			break;
 	}
 }
 
-int tcpx_try_func(void *util_ep)
+static int tcpx_wait_mod(struct util_wait *wait, SOCKET sock, bool pollout,
+			 struct fid *fid)
 {
-	uint32_t events;
 	struct util_wait_fd *wait_fd;
-	struct tcpx_ep *ep;
-	int ret;
 
-	ep = container_of(util_ep, struct tcpx_ep, util_ep);
-	wait_fd = container_of(((struct util_ep *) util_ep)->tx_cq->wait,
-			       struct util_wait_fd, util_wait);
+	wait_fd = container_of(wait, struct util_wait_fd, util_wait);
+	if (wait_fd->util_wait.wait_obj == FI_WAIT_FD)
+		return ofi_epoll_mod(wait_fd->epoll_fd, sock, pollout ?
+				     (OFI_EPOLL_IN | OFI_EPOLL_OUT) :
+				     OFI_EPOLL_IN, fid);
 
-	fastlock_acquire(&ep->lock);
-	if (!slist_empty(&ep->tx_queue) && !ep->pollout_set) {
-		ep->pollout_set = true;
-		events = (wait_fd->util_wait.wait_obj == FI_WAIT_FD) ?
-			 (OFI_EPOLL_IN | OFI_EPOLL_OUT) : (POLLIN | POLLOUT);
-		goto epoll_mod;
-	} else if (slist_empty(&ep->tx_queue) && ep->pollout_set) {
-		ep->pollout_set = false;
-		events = (wait_fd->util_wait.wait_obj == FI_WAIT_FD) ?
-			 OFI_EPOLL_IN : POLLIN;
-		goto epoll_mod;
-	}
-	fastlock_release(&ep->lock);
-	return FI_SUCCESS;
+	return ofi_pollfds_mod(wait_fd->pollfds, sock, pollout ?
+			       (POLLIN | POLLOUT) : POLLIN, fid);
+}
 
-epoll_mod:
-	ret = (wait_fd->util_wait.wait_obj == FI_WAIT_FD) ?
-	      ofi_epoll_mod(wait_fd->epoll_fd, ep->sock, events,
-			    &ep->util_ep.ep_fid.fid) :
-	      ofi_pollfds_mod(wait_fd->pollfds, ep->sock, events,
-			      &ep->util_ep.ep_fid.fid);
+/*
+ * Update POLLOUT on sock in the wait sets of both cqs.  An application
+ * may only ever progress the rx cq, and queued sends, such as RMA read
+ * responses, must still go out then.  Must hold ep lock.
+ */
+int tcpx_wait_pollout(struct tcpx_ep *ep, SOCKET sock, bool pollout)
+{
+	struct util_ep *util_ep = &ep->util_ep;
+	int ret;
+
+	ret = tcpx_wait_mod(util_ep->tx_cq->wait, sock, pollout,
+			    &util_ep->ep_fid.fid);
+	if (!ret && util_ep->rx_cq && util_ep->rx_cq != util_ep->tx_cq)
+		ret = tcpx_wait_mod(util_ep->rx_cq->wait, sock, pollout,
+				    &util_ep->ep_fid.fid);
 	if (ret)
 		FI_WARN(&tcpx_prov, FI_LOG_EP_DATA,
 			"epoll modify failed\n");
+	return ret;
+}
+
+/*
+ * Request POLLOUT only while sends are queued, so progress is driven by
+ * the socket becoming writable rather than polling.  Must hold ep lock.
+ */
+int tcpx_update_pollout(struct tcpx_ep *ep)
+{
+	bool pollout;
+
+	/* io_uring sends are resubmitted from their completions */
+	if (ep->uring || !ep->util_ep.tx_cq ||
+	    ep->cm_state != TCPX_EP_CONNECTED)
+		return FI_SUCCESS;
+
+	/* A striped entry may be waiting on its other streams only */
+	pollout = !slist_empty(&ep->tx_queue) &&
+		  !(ep->tx_stripe && !ep->tx_stripe->rem_len);
+	if (ep->stream_cnt)
+		tcpx_stream_update_pollout(ep);
+
+	if (pollout == ep->pollout_set)
+		return FI_SUCCESS;
+
+	ep->pollout_set = pollout;
+	return tcpx_wait_pollout(ep, ep->sock, pollout);
+}
+
+int tcpx_try_func(void *util_ep)
+{
+	struct tcpx_ep *ep;
+	int ret;
+
+	ep = container_of(util_ep, struct tcpx_ep, util_ep);
+	fastlock_acquire(&ep->lock);
+	ret = tcpx_update_pollout(ep);
 	fastlock_release(&ep->lock);
 	return ret;
 }
@@ -706,13 +1029,33 @@ void tcpx_tx_queue_insert(struct tcpx_ep *tcpx_ep,
 	int empty;
 	struct util_wait *wait = tcpx_ep->util_ep.tx_cq->wait;
 
+	if (tcpx_ep->stream_cnt)
+		tcpx_stream_mark(tcpx_ep, tx_entry);
+
 	empty = slist_empty(&tcpx_ep->tx_queue);
 	slist_insert_tail(&tx_entry->entry, &tcpx_ep->tx_queue);
 
-	if (empty) {
-		process_tx_entry(tx_entry);
+	/* FI_MORE: hold the entry so it is sent together with the next ones.
+	 * The held entries are flushed by the first send posted without
+	 * FI_MORE, or once they fill a gathered sendmsg.  With io_uring,
+	 * entries queued behind a send in flight are gathered anyway. */
+	if ((tx_entry->flags & FI_MORE) && !tcpx_ep->uring) {
+		tcpx_ep->tx_held = true;
+		tcpx_ep->tx_held_iov += tx_entry->iov_cnt;
+		tcpx_ep->tx_held_len += tx_entry->rem_len;
+		if (tcpx_ep->tx_held_iov < TCPX_TX_GATHER_IOV &&
+		    tcpx_ep->tx_held_len < TCPX_TX_GATHER_SIZE)
+			return;
+	}
 
-		if (!slist_empty(&tcpx_ep->tx_queue) && wait)
-			wait->signal(wait);
+	if (empty || tcpx_ep->tx_held) {
+		tcpx_progress_tx(tcpx_ep);
+
+		/* io_uring sends stay queued until their completion */
+		if (!slist_empty(&tcpx_ep->tx_queue) && !tcpx_ep->uring) {
+			tcpx_update_pollout(tcpx_ep);
+			if (wait)
+				wait->signal(wait);
+		}
 	}
 }
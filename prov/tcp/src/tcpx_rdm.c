@@ -0,0 +1,1197 @@
+/*
+ * Copyright (c) 2020 Intel Corporation, Inc.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sched.h>
+
+#include <ofi_prov.h>
+#include <ofi_iov.h>
+#include "tcpx.h"
+
+#define TCPX_RDM_MATCH_SIZE	256
+
+struct tcpx_rdm_cm_msg {
+	struct fi_eq_cm_entry	entry;
+	uint8_t			data[TCPX_MAX_CM_DATA_SIZE];
+};
+
+static size_t tcpx_rdm_unexp_len(struct tcpx_xfer_entry *unexp)
+{
+	return unexp->hdr.base_hdr.size - unexp->hdr.base_hdr.payload_off;
+}
+
+/* Return the buffer space of an unexpected message to the rdm budget */
+static void tcpx_rdm_unbuffer(struct tcpx_rdm *rdm,
+			      struct tcpx_xfer_entry *unexp)
+{
+	fastlock_acquire(&rdm->rx_lock);
+	assert(rdm->unexp_bytes >= tcpx_rdm_unexp_len(unexp));
+	rdm->unexp_bytes -= tcpx_rdm_unexp_len(unexp);
+	fastlock_release(&rdm->rx_lock);
+	unexp->hdr.base_hdr.size = unexp->hdr.base_hdr.payload_off;
+}
+
+static void tcpx_rdm_free_unexp(struct tcpx_rdm *rdm,
+				struct tcpx_xfer_entry *unexp)
+{
+	tcpx_rdm_unbuffer(rdm, unexp);
+	free(unexp->mrecv_msg_start);
+	unexp->mrecv_msg_start = NULL;
+	unexp->ep = NULL;
+	tcpx_xfer_entry_release(container_of(rdm->util_ep.rx_cq,
+					     struct tcpx_cq, util_cq), unexp);
+}
+
+/* Complete a posted receive from an unexpected message and free the latter */
+static void tcpx_rdm_deliver(struct tcpx_rdm *rdm,
+			     struct tcpx_xfer_entry *rx_entry,
+			     struct tcpx_xfer_entry *unexp, int err)
+{
+	struct util_cq *cq = rdm->util_ep.rx_cq;
+	struct tcpx_base_hdr *hdr = &unexp->hdr.base_hdr;
+	size_t len, msg_len;
+	uint64_t data = 0, tag = 0;
+
+	memcpy(&rx_entry->hdr, hdr, hdr->payload_off);
+	rx_entry->match.addr = unexp->match.addr;
+	rx_entry->ep = NULL;
+
+	if (err) {
+		tcpx_cq_report_error(cq, rx_entry, -err);
+		goto out;
+	}
+
+	msg_len = hdr->size - hdr->payload_off;
+	len = ofi_copy_to_iov(rx_entry->iov, rx_entry->iov_cnt, 0,
+			      unexp->mrecv_msg_start, msg_len);
+	if (len == msg_len) {
+		tcpx_cq_report_success(cq, rx_entry);
+		goto out;
+	}
+
+	FI_WARN(&tcpx_prov, FI_LOG_EP_DATA,
+		"posted rx buffer size is not big enough\n");
+	if (hdr->flags & OFI_REMOTE_CQ_DATA) {
+		rx_entry->flags |= FI_REMOTE_CQ_DATA;
+		data = rx_entry->hdr.cq_data_hdr.cq_data;
+	}
+	if (hdr->op == ofi_op_tagged)
+		tag = *tcpx_hdr_tag(hdr);
+	ofi_cq_write_error_trunc(cq, rx_entry->context, rx_entry->flags, len,
+				 NULL, data, tag, msg_len - len);
+out:
+	tcpx_xfer_entry_release(container_of(cq, struct tcpx_cq, util_cq),
+				rx_entry);
+	tcpx_rdm_free_unexp(rdm, unexp);
+}
+
+/*
+ * Called once an unexpected message stops receiving, with the connection's
+ * ep lock held.  Clearing unexp->ep marks the data as complete; a receive
+ * that claimed the message while it arrived is completed now.
+ */
+void tcpx_rdm_unexp_done(struct tcpx_rdm *rdm, struct tcpx_xfer_entry *unexp,
+			 int err)
+{
+	struct tcpx_xfer_entry *rx_entry;
+	int tagged = (unexp->hdr.base_hdr.op == ofi_op_tagged);
+
+	fastlock_acquire(&rdm->rx_lock);
+	unexp->ep = NULL;
+	rx_entry = unexp->claim;
+	if (!rx_entry && err)
+		ofi_match_queue_remove(&rdm->unexp_queue[tagged],
+				       &unexp->match);
+	fastlock_release(&rdm->rx_lock);
+
+	if (rx_entry)
+		tcpx_rdm_deliver(rdm, rx_entry, unexp, err);
+	else if (err)
+		tcpx_rdm_free_unexp(rdm, unexp);
+}
+
+static ssize_t tcpx_rdm_peek(struct tcpx_rdm *rdm, struct fi_context *context,
+			     fi_addr_t addr, uint64_t tag, uint64_t ignore,
+			     uint64_t flags)
+{
+	struct util_cq *cq = rdm->util_ep.rx_cq;
+	struct tcpx_xfer_entry *unexp = NULL;
+	struct ofi_match_entry *match;
+	struct tcpx_base_hdr *hdr;
+	uint64_t data = 0;
+
+	fastlock_acquire(&rdm->rx_lock);
+	match = ofi_match_queue_find(&rdm->unexp_queue[1], addr, tag, ignore);
+	if (match) {
+		unexp = container_of(match, struct tcpx_xfer_entry, match);
+		/* only report messages whose data is in */
+		if (unexp->ep)
+			unexp = NULL;
+		else if (flags & (FI_CLAIM | FI_DISCARD))
+			ofi_match_queue_remove(&rdm->unexp_queue[1], match);
+	}
+	fastlock_release(&rdm->rx_lock);
+
+	if (!unexp)
+		return ofi_cq_write_error_peek(cq, tag, context);
+
+	hdr = &unexp->hdr.base_hdr;
+	if (hdr->flags & OFI_REMOTE_CQ_DATA) {
+		flags |= FI_REMOTE_CQ_DATA;
+		data = unexp->hdr.cq_data_hdr.cq_data;
+	}
+
+	if (flags & FI_DISCARD)
+		tcpx_rdm_free_unexp(rdm, unexp);
+	else if (flags & FI_CLAIM)
+		context->internal[0] = unexp;
+
+	return ofi_cq_write_src(cq, context, FI_TAGGED | FI_RECV |
+				(flags & FI_REMOTE_CQ_DATA),
+				hdr->size - hdr->payload_off, NULL, data,
+				*tcpx_hdr_tag(hdr), unexp->match.addr);
+}
+
+static ssize_t tcpx_rdm_claim(struct tcpx_rdm *rdm, const struct iovec *iov,
+			      size_t count, void *context, uint64_t flags)
+{
+	struct tcpx_xfer_entry *rx_entry, *unexp;
+	struct tcpx_cq *tcpx_cq;
+
+	unexp = ((struct fi_context *) context)->internal[0];
+	if (!unexp)
+		return -FI_EINVAL;
+
+	tcpx_cq = container_of(rdm->util_ep.rx_cq, struct tcpx_cq, util_cq);
+	rx_entry = tcpx_xfer_entry_alloc(tcpx_cq, TCPX_OP_MSG_RECV);
+	if (!rx_entry)
+		return -FI_EAGAIN;
+
+	rx_entry->flags = (flags & ~(FI_CLAIM | FI_DISCARD)) |
+			  FI_TAGGED | FI_RECV;
+	rx_entry->context = context;
+	rx_entry->iov_cnt = (flags & FI_DISCARD) ? 0 : count;
+	memcpy(rx_entry->iov, iov, rx_entry->iov_cnt * sizeof(*iov));
+
+	if (flags & FI_DISCARD)
+		tcpx_rdm_unbuffer(rdm, unexp);
+
+	tcpx_rdm_deliver(rdm, rx_entry, unexp, FI_SUCCESS);
+	return FI_SUCCESS;
+}
+
+static ssize_t tcpx_rdm_recv(struct tcpx_rdm *rdm, const struct iovec *iov,
+			     size_t count, fi_addr_t src_addr, uint64_t tag,
+			     uint64_t ignore, void *context, uint64_t flags,
+			     int tagged)
+{
+	struct tcpx_xfer_entry *rx_entry, *unexp;
+	struct ofi_match_entry *match;
+	struct tcpx_cq *tcpx_cq;
+
+	assert(count <= TCPX_IOV_LIMIT);
+	if (!(rdm->util_ep.caps & FI_DIRECTED_RECV))
+		src_addr = FI_ADDR_UNSPEC;
+
+	tcpx_cq = container_of(rdm->util_ep.rx_cq, struct tcpx_cq, util_cq);
+	rx_entry = tcpx_xfer_entry_alloc(tcpx_cq, TCPX_OP_MSG_RECV);
+	if (!rx_entry)
+		return -FI_EAGAIN;
+
+	rx_entry->iov_cnt = count;
+	memcpy(rx_entry->iov, iov, count * sizeof(*iov));
+	rx_entry->flags = flags | FI_RECV | (tagged ? FI_TAGGED : FI_MSG);
+	rx_entry->context = context;
+	rx_entry->ep = NULL;
+	rx_entry->match.addr = src_addr;
+	rx_entry->match.tag = tag;
+	rx_entry->match.ignore = ignore;
+
+	fastlock_acquire(&rdm->rx_lock);
+	match = ofi_match_queue_remove_first(&rdm->unexp_queue[tagged],
+					     src_addr, tag, ignore);
+	if (!match) {
+		ofi_match_queue_insert(&rdm->recv_queue[tagged],
+				       &rx_entry->match);
+		fastlock_release(&rdm->rx_lock);
+		return FI_SUCCESS;
+	}
+
+	unexp = container_of(match, struct tcpx_xfer_entry, match);
+	if (unexp->ep) {
+		/* still arriving, delivered once its data is in */
+		unexp->claim = rx_entry;
+		fastlock_release(&rdm->rx_lock);
+		return FI_SUCCESS;
+	}
+	fastlock_release(&rdm->rx_lock);
+
+	tcpx_rdm_deliver(rdm, rx_entry, unexp, FI_SUCCESS);
+	return FI_SUCCESS;
+}
+
+static int tcpx_rdm_conn_init(struct tcpx_rdm *rdm, struct tcpx_conn *conn,
+			      struct fi_info *info)
+{
+	struct fid_ep *ep_fid;
+	int ret;
+
+	ret = fi_endpoint(&rdm->util_ep.domain->domain_fid, info, &ep_fid,
+			  conn);
+	if (ret)
+		return ret;
+
+	conn->rdm = rdm;
+	conn->ep = container_of(ep_fid, struct tcpx_ep, util_ep.ep_fid);
+	conn->ep->conn = conn;
+	conn->ep->start_op[ofi_op_tagged] = tcpx_rdm_start_recv;
+
+	ret = fi_ep_bind(ep_fid, &rdm->eq->fid, 0);
+	if (ret)
+		goto err;
+
+	ret = fi_ep_bind(ep_fid, &rdm->util_ep.tx_cq->cq_fid.fid, FI_TRANSMIT);
+	if (ret)
+		goto err;
+
+	ret = fi_ep_bind(ep_fid, &rdm->util_ep.rx_cq->cq_fid.fid, FI_RECV);
+	if (ret)
+		goto err;
+
+	ret = fi_enable(ep_fid);
+	if (ret)
+		goto err;
+
+	dlist_insert_tail(&conn->entry, &rdm->conn_list);
+	return FI_SUCCESS;
+err:
+	fi_close(&ep_fid->fid);
+	return ret;
+}
+
+/* Must hold rdm lock */
+static void tcpx_rdm_conn_close(struct tcpx_conn *conn)
+{
+	struct tcpx_rdm *rdm = conn->rdm;
+	struct tcpx_xfer_entry *rx_entry;
+	struct tcpx_ep *ep = conn->ep;
+
+	if (conn->fi_addr != FI_ADDR_NOTAVAIL &&
+	    ofi_idm_lookup(&rdm->conn_idm, (int) conn->fi_addr) == conn)
+		ofi_idm_clear(&rdm->conn_idm, (int) conn->fi_addr);
+	dlist_remove(&conn->entry);
+
+	/* A message in flight belongs to the rdm queues, not the ep */
+	fastlock_acquire(&ep->lock);
+	rx_entry = ep->cur_rx_entry;
+	if (rx_entry && rx_entry->hdr.base_hdr.op_data == TCPX_OP_MSG_RECV) {
+		ep->cur_rx_entry = NULL;
+		if (rx_entry->flags & FI_RECV) {
+			rx_entry->ep = NULL;
+			tcpx_cq_report_error(rdm->util_ep.rx_cq, rx_entry,
+					     FI_ECANCELED);
+			tcpx_xfer_entry_release(container_of(rdm->util_ep.rx_cq,
+						struct tcpx_cq, util_cq),
+						rx_entry);
+		} else {
+			tcpx_rdm_unexp_done(rdm, rx_entry, -FI_ECANCELED);
+		}
+	}
+	fastlock_release(&ep->lock);
+
+	fi_close(&ep->util_ep.ep_fid.fid);
+	free(conn);
+}
+
+/* Must hold rdm lock */
+static int tcpx_rdm_connect(struct tcpx_rdm *rdm, fi_addr_t fi_addr,
+			    struct tcpx_conn **conn_ptr)
+{
+	struct tcpx_conn *conn;
+	void *addr;
+	int ret;
+
+	addr = ofi_av_get_addr(rdm->util_ep.av, fi_addr);
+	if (!addr)
+		return -FI_EINVAL;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return -FI_ENOMEM;
+
+	conn->fi_addr = fi_addr;
+	ret = tcpx_rdm_conn_init(rdm, conn, rdm->msg_info);
+	if (ret)
+		goto free;
+
+	ret = ofi_idm_set(&rdm->conn_idm, (int) fi_addr, conn);
+	if (ret < 0) {
+		ret = -FI_ENOMEM;
+		goto close;
+	}
+
+	ret = fi_connect(&conn->ep->util_ep.ep_fid, addr, &rdm->name,
+			 sizeof(rdm->name));
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"connect to peer failed: %s\n", fi_strerror(-ret));
+		goto close;
+	}
+
+	*conn_ptr = conn;
+	return FI_SUCCESS;
+close:
+	tcpx_rdm_conn_close(conn);
+	return ret;
+free:
+	free(conn);
+	return ret;
+}
+
+/* Must hold rdm lock */
+static void tcpx_rdm_accept(struct tcpx_rdm *rdm, struct tcpx_rdm_cm_msg *msg,
+			    size_t data_len)
+{
+	struct tcpx_conn *conn;
+	int ret;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		goto reject;
+
+	memcpy(&conn->peer_name, msg->data,
+	       MIN(data_len, sizeof(conn->peer_name)));
+	conn->fi_addr = FI_ADDR_NOTAVAIL;
+
+	ret = tcpx_rdm_conn_init(rdm, conn, msg->entry.info);
+	if (ret) {
+		free(conn);
+		goto reject;
+	}
+
+	ret = fi_accept(&conn->ep->util_ep.ep_fid, NULL, 0);
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"accept failed: %s\n", fi_strerror(-ret));
+		tcpx_rdm_conn_close(conn);
+	}
+	fi_freeinfo(msg->entry.info);
+	return;
+reject:
+	FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL, "rejecting connection\n");
+	fi_reject(rdm->pep, msg->entry.info->handle, NULL, 0);
+	fi_freeinfo(msg->entry.info);
+}
+
+/* Must hold rdm lock */
+static void tcpx_rdm_handle_cm(struct tcpx_rdm *rdm)
+{
+	struct util_eq *eq = container_of(rdm->eq, struct util_eq, eq_fid);
+	struct fi_eq_err_entry err_entry;
+	struct tcpx_rdm_cm_msg msg;
+	struct tcpx_conn *conn;
+	uint32_t event;
+	ssize_t ret;
+
+	/* The eq signal stays set after its events are read */
+	fd_signal_reset(&container_of(eq->wait, struct util_wait_fd,
+				      util_wait)->signal);
+
+	for (;;) {
+		ret = fi_eq_read(rdm->eq, &event, &msg, sizeof(msg), 0);
+		if (ret == -FI_EAVAIL) {
+			memset(&err_entry, 0, sizeof(err_entry));
+			ret = fi_eq_readerr(rdm->eq, &err_entry, 0);
+			if (ret < 0)
+				break;
+
+			FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+				"connection error: %s\n",
+				fi_strerror(err_entry.err));
+			if (err_entry.fid &&
+			    err_entry.fid->fclass == FI_CLASS_EP)
+				tcpx_rdm_conn_close(err_entry.fid->context);
+			continue;
+		}
+		if (ret < 0)
+			break;
+
+		switch (event) {
+		case FI_CONNREQ:
+			tcpx_rdm_accept(rdm, &msg,
+					(size_t) ret - sizeof(msg.entry));
+			break;
+		case FI_CONNECTED:
+			conn = msg.entry.fid->context;
+			conn->connected = true;
+			break;
+		case FI_SHUTDOWN:
+			tcpx_rdm_conn_close(msg.entry.fid->context);
+			break;
+		default:
+			FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+				"unexpected cm event %u\n", event);
+			break;
+		}
+	}
+}
+
+void tcpx_rdm_progress_cm(struct tcpx_rdm *rdm)
+{
+	fastlock_acquire(&rdm->lock);
+	tcpx_rdm_handle_cm(rdm);
+	fastlock_release(&rdm->lock);
+}
+
+/* Must hold rdm lock */
+static ssize_t tcpx_rdm_get_conn(struct tcpx_rdm *rdm, fi_addr_t fi_addr,
+				 struct tcpx_conn **conn)
+{
+	ssize_t ret;
+
+	*conn = ofi_idm_lookup(&rdm->conn_idm, (int) fi_addr);
+	if (!*conn) {
+		ret = tcpx_rdm_connect(rdm, fi_addr, conn);
+		if (ret)
+			return ret;
+	}
+
+	if (!(*conn)->connected) {
+		tcpx_rdm_handle_cm(rdm);
+		*conn = ofi_idm_lookup(&rdm->conn_idm, (int) fi_addr);
+		if (!*conn || !(*conn)->connected)
+			return -FI_EAGAIN;
+	}
+	return FI_SUCCESS;
+}
+
+/*
+ * A send is a single header, carrying the tag for tagged messages,
+ * followed by the payload, queued on the connection to the peer.
+ */
+static ssize_t tcpx_rdm_send(struct tcpx_rdm *rdm, const struct iovec *iov,
+			     size_t count, fi_addr_t dest_addr, uint64_t data,
+			     uint64_t tag, void *context, uint64_t flags,
+			     int tagged)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	struct tcpx_conn *conn;
+	struct tcpx_cq *tcpx_cq;
+	struct tcpx_ep *ep;
+	uint64_t data_len;
+	size_t offset;
+	ssize_t ret;
+
+	assert(count <= TCPX_IOV_LIMIT);
+	data_len = ofi_total_iov_len(iov, count);
+	assert(!(flags & FI_INJECT) || (data_len <= TCPX_MAX_INJECT_SZ));
+
+	fastlock_acquire(&rdm->lock);
+	ret = tcpx_rdm_get_conn(rdm, dest_addr, &conn);
+	if (ret)
+		goto unlock;
+
+	ep = conn->ep;
+	tcpx_cq = container_of(rdm->util_ep.tx_cq, struct tcpx_cq, util_cq);
+	tx_entry = tcpx_xfer_entry_alloc(tcpx_cq, tagged ? TCPX_OP_TAGGED_SEND :
+						      TCPX_OP_MSG_SEND);
+	if (!tx_entry) {
+		ret = -FI_EAGAIN;
+		goto unlock;
+	}
+
+	offset = sizeof(tx_entry->hdr.base_hdr);
+	if (flags & FI_REMOTE_CQ_DATA) {
+		tx_entry->hdr.base_hdr.flags |= OFI_REMOTE_CQ_DATA;
+		tx_entry->hdr.cq_data_hdr.cq_data = data;
+		offset += sizeof(data);
+	}
+	if (tagged) {
+		*(uint64_t *) ((uint8_t *) &tx_entry->hdr + offset) = tag;
+		offset += sizeof(tag);
+	}
+
+	tx_entry->hdr.base_hdr.payload_off = (uint8_t) offset;
+	tx_entry->hdr.base_hdr.size = offset + data_len;
+	if (flags & FI_INJECT) {
+		ofi_copy_iov_buf(iov, count, 0,
+				 (uint8_t *) &tx_entry->hdr + offset,
+				 data_len, OFI_COPY_IOV_TO_BUF);
+		tx_entry->iov_cnt = 1;
+		offset += data_len;
+	} else {
+		memcpy(&tx_entry->iov[1], iov, count * sizeof(*iov));
+		tx_entry->iov_cnt = count + 1;
+	}
+	tx_entry->iov[0].iov_base = (void *) &tx_entry->hdr;
+	tx_entry->iov[0].iov_len = offset;
+
+	tx_entry->flags = flags | FI_SEND | (tagged ? FI_TAGGED : FI_MSG);
+	if (flags & (FI_TRANSMIT_COMPLETE | FI_DELIVERY_COMPLETE))
+		tx_entry->hdr.base_hdr.flags |= OFI_DELIVERY_COMPLETE;
+
+	tx_entry->ep = ep;
+	tx_entry->context = context;
+	tx_entry->rem_len = tx_entry->hdr.base_hdr.size;
+
+	ep->hdr_bswap(&tx_entry->hdr.base_hdr);
+	fastlock_acquire(&ep->lock);
+	tcpx_tx_queue_insert(ep, tx_entry);
+	fastlock_release(&ep->lock);
+unlock:
+	fastlock_release(&rdm->lock);
+	return ret;
+}
+
+static inline struct tcpx_rdm *tcpx_rdm_ep(struct fid_ep *ep_fid)
+{
+	return container_of(ep_fid, struct tcpx_rdm, util_ep.ep_fid);
+}
+
+static ssize_t tcpx_rdm_recvmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
+				uint64_t flags)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+
+	return tcpx_rdm_recv(rdm, msg->msg_iov, msg->iov_count, msg->addr,
+			     0, 0, msg->context,
+			     flags | rdm->util_ep.rx_msg_flags, 0);
+}
+
+static ssize_t tcpx_rdm_recvv(struct fid_ep *ep_fid, const struct iovec *iov,
+			      void **desc, size_t count, fi_addr_t src_addr,
+			      void *context)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+
+	return tcpx_rdm_recv(rdm, iov, count, src_addr, 0, 0, context,
+			     rdm->util_ep.rx_op_flags & FI_COMPLETION, 0);
+}
+
+static ssize_t tcpx_rdm_recv_buf(struct fid_ep *ep_fid, void *buf, size_t len,
+				 void *desc, fi_addr_t src_addr, void *context)
+{
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_recvv(ep_fid, &iov, &desc, 1, src_addr, context);
+}
+
+static ssize_t tcpx_rdm_sendmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
+				uint64_t flags)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+
+	return tcpx_rdm_send(rdm, msg->msg_iov, msg->iov_count, msg->addr,
+			     msg->data, 0, msg->context,
+			     flags | rdm->util_ep.tx_msg_flags, 0);
+}
+
+static ssize_t tcpx_rdm_sendv(struct fid_ep *ep_fid, const struct iovec *iov,
+			      void **desc, size_t count, fi_addr_t dest_addr,
+			      void *context)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+
+	return tcpx_rdm_send(rdm, iov, count, dest_addr, 0, 0, context,
+			     rdm->util_ep.tx_op_flags & ~FI_INJECT, 0);
+}
+
+static ssize_t tcpx_rdm_send_buf(struct fid_ep *ep_fid, const void *buf,
+				 size_t len, void *desc, fi_addr_t dest_addr,
+				 void *context)
+{
+	struct iovec iov = {
+		.iov_base = (void *) buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_sendv(ep_fid, &iov, &desc, 1, dest_addr, context);
+}
+
+static ssize_t tcpx_rdm_inject(struct fid_ep *ep_fid, const void *buf,
+			       size_t len, fi_addr_t dest_addr)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+	struct iovec iov = {
+		.iov_base = (void *) buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_send(rdm, &iov, 1, dest_addr, 0, 0, NULL,
+			     rdm->util_ep.inject_op_flags, 0);
+}
+
+static ssize_t tcpx_rdm_senddata(struct fid_ep *ep_fid, const void *buf,
+				 size_t len, void *desc, uint64_t data,
+				 fi_addr_t dest_addr, void *context)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+	struct iovec iov = {
+		.iov_base = (void *) buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_send(rdm, &iov, 1, dest_addr, data, 0, context,
+			     (rdm->util_ep.tx_op_flags & ~FI_INJECT) |
+			     FI_REMOTE_CQ_DATA, 0);
+}
+
+static ssize_t tcpx_rdm_injectdata(struct fid_ep *ep_fid, const void *buf,
+				   size_t len, uint64_t data,
+				   fi_addr_t dest_addr)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+	struct iovec iov = {
+		.iov_base = (void *) buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_send(rdm, &iov, 1, dest_addr, data, 0, NULL,
+			     rdm->util_ep.inject_op_flags | FI_REMOTE_CQ_DATA,
+			     0);
+}
+
+static struct fi_ops_msg tcpx_rdm_msg_ops = {
+	.size = sizeof(struct fi_ops_msg),
+	.recv = tcpx_rdm_recv_buf,
+	.recvv = tcpx_rdm_recvv,
+	.recvmsg = tcpx_rdm_recvmsg,
+	.send = tcpx_rdm_send_buf,
+	.sendv = tcpx_rdm_sendv,
+	.sendmsg = tcpx_rdm_sendmsg,
+	.inject = tcpx_rdm_inject,
+	.senddata = tcpx_rdm_senddata,
+	.injectdata = tcpx_rdm_injectdata,
+};
+
+static ssize_t tcpx_rdm_trecvmsg(struct fid_ep *ep_fid,
+				 const struct fi_msg_tagged *msg,
+				 uint64_t flags)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+
+	if (flags & FI_PEEK)
+		return tcpx_rdm_peek(rdm, msg->context, msg->addr, msg->tag,
+				     msg->ignore, flags);
+
+	flags |= rdm->util_ep.rx_msg_flags;
+	if (flags & FI_CLAIM)
+		return tcpx_rdm_claim(rdm, msg->msg_iov, msg->iov_count,
+				      msg->context, flags);
+
+	return tcpx_rdm_recv(rdm, msg->msg_iov, msg->iov_count, msg->addr,
+			     msg->tag, msg->ignore, msg->context, flags, 1);
+}
+
+static ssize_t tcpx_rdm_trecvv(struct fid_ep *ep_fid, const struct iovec *iov,
+			       void **desc, size_t count, fi_addr_t src_addr,
+			       uint64_t tag, uint64_t ignore, void *context)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+
+	return tcpx_rdm_recv(rdm, iov, count, src_addr, tag, ignore, context,
+			     rdm->util_ep.rx_op_flags & FI_COMPLETION, 1);
+}
+
+static ssize_t tcpx_rdm_trecv(struct fid_ep *ep_fid, void *buf, size_t len,
+			      void *desc, fi_addr_t src_addr, uint64_t tag,
+			      uint64_t ignore, void *context)
+{
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_trecvv(ep_fid, &iov, &desc, 1, src_addr, tag, ignore,
+			       context);
+}
+
+static ssize_t tcpx_rdm_tsendmsg(struct fid_ep *ep_fid,
+				 const struct fi_msg_tagged *msg,
+				 uint64_t flags)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+
+	return tcpx_rdm_send(rdm, msg->msg_iov, msg->iov_count, msg->addr,
+			     msg->data, msg->tag, msg->context,
+			     flags | rdm->util_ep.tx_msg_flags, 1);
+}
+
+static ssize_t tcpx_rdm_tsendv(struct fid_ep *ep_fid, const struct iovec *iov,
+			       void **desc, size_t count, fi_addr_t dest_addr,
+			       uint64_t tag, void *context)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+
+	return tcpx_rdm_send(rdm, iov, count, dest_addr, 0, tag, context,
+			     rdm->util_ep.tx_op_flags & ~FI_INJECT, 1);
+}
+
+static ssize_t tcpx_rdm_tsend(struct fid_ep *ep_fid, const void *buf,
+			      size_t len, void *desc, fi_addr_t dest_addr,
+			      uint64_t tag, void *context)
+{
+	struct iovec iov = {
+		.iov_base = (void *) buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_tsendv(ep_fid, &iov, &desc, 1, dest_addr, tag,
+			       context);
+}
+
+static ssize_t tcpx_rdm_tinject(struct fid_ep *ep_fid, const void *buf,
+				size_t len, fi_addr_t dest_addr, uint64_t tag)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+	struct iovec iov = {
+		.iov_base = (void *) buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_send(rdm, &iov, 1, dest_addr, 0, tag, NULL,
+			     rdm->util_ep.inject_op_flags, 1);
+}
+
+static ssize_t tcpx_rdm_tsenddata(struct fid_ep *ep_fid, const void *buf,
+				  size_t len, void *desc, uint64_t data,
+				  fi_addr_t dest_addr, uint64_t tag,
+				  void *context)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+	struct iovec iov = {
+		.iov_base = (void *) buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_send(rdm, &iov, 1, dest_addr, data, tag, context,
+			     (rdm->util_ep.tx_op_flags & ~FI_INJECT) |
+			     FI_REMOTE_CQ_DATA, 1);
+}
+
+static ssize_t tcpx_rdm_tinjectdata(struct fid_ep *ep_fid, const void *buf,
+				    size_t len, uint64_t data,
+				    fi_addr_t dest_addr, uint64_t tag)
+{
+	struct tcpx_rdm *rdm = tcpx_rdm_ep(ep_fid);
+	struct iovec iov = {
+		.iov_base = (void *) buf,
+		.iov_len = len,
+	};
+
+	return tcpx_rdm_send(rdm, &iov, 1, dest_addr, data, tag, NULL,
+			     rdm->util_ep.inject_op_flags | FI_REMOTE_CQ_DATA,
+			     1);
+}
+
+static struct fi_ops_tagged tcpx_rdm_tagged_ops = {
+	.size = sizeof(struct fi_ops_tagged),
+	.recv = tcpx_rdm_trecv,
+	.recvv = tcpx_rdm_trecvv,
+	.recvmsg = tcpx_rdm_trecvmsg,
+	.send = tcpx_rdm_tsend,
+	.sendv = tcpx_rdm_tsendv,
+	.sendmsg = tcpx_rdm_tsendmsg,
+	.inject = tcpx_rdm_tinject,
+	.senddata = tcpx_rdm_tsenddata,
+	.injectdata = tcpx_rdm_tinjectdata,
+};
+
+static int tcpx_rdm_getname(fid_t fid, void *addr, size_t *addrlen)
+{
+	struct tcpx_rdm *rdm;
+	size_t addrlen_in = *addrlen;
+
+	rdm = container_of(fid, struct tcpx_rdm, util_ep.ep_fid.fid);
+	*addrlen = ofi_sizeofaddr(&rdm->name.sa);
+	memcpy(addr, &rdm->name, MIN(addrlen_in, *addrlen));
+
+	return (addrlen_in < *addrlen) ? -FI_ETOOSMALL : FI_SUCCESS;
+}
+
+static struct fi_ops_cm tcpx_rdm_cm_ops = {
+	.size = sizeof(struct fi_ops_cm),
+	.setname = fi_no_setname,
+	.getname = tcpx_rdm_getname,
+	.getpeer = fi_no_getpeer,
+	.connect = fi_no_connect,
+	.listen = fi_no_listen,
+	.accept = fi_no_accept,
+	.reject = fi_no_reject,
+	.shutdown = fi_no_shutdown,
+	.join = fi_no_join,
+};
+
+/* Must hold rx_lock */
+static struct tcpx_xfer_entry *
+tcpx_rdm_remove_recv(struct ofi_match_queue *queue, void *context)
+{
+	struct tcpx_xfer_entry *rx_entry;
+	struct dlist_entry *item;
+
+	dlist_foreach(&queue->list, item) {
+		rx_entry = container_of(item, struct tcpx_xfer_entry,
+					match.entry);
+		if (rx_entry->context == context) {
+			ofi_match_queue_remove(queue, &rx_entry->match);
+			return rx_entry;
+		}
+	}
+	return NULL;
+}
+
+static void tcpx_rdm_cancel_recv(struct tcpx_rdm *rdm,
+				 struct tcpx_xfer_entry *rx_entry)
+{
+	tcpx_cq_report_error(rdm->util_ep.rx_cq, rx_entry, FI_ECANCELED);
+	tcpx_xfer_entry_release(container_of(rdm->util_ep.rx_cq,
+					     struct tcpx_cq, util_cq),
+				rx_entry);
+}
+
+/* Only receives still waiting for a message can be canceled */
+static ssize_t tcpx_rdm_cancel(fid_t fid, void *context)
+{
+	struct tcpx_xfer_entry *rx_entry = NULL;
+	struct tcpx_rdm *rdm;
+	int i;
+
+	rdm = container_of(fid, struct tcpx_rdm, util_ep.ep_fid.fid);
+	fastlock_acquire(&rdm->rx_lock);
+	for (i = 0; i < 2 && !rx_entry; i++)
+		rx_entry = tcpx_rdm_remove_recv(&rdm->recv_queue[i], context);
+	fastlock_release(&rdm->rx_lock);
+
+	if (rx_entry)
+		tcpx_rdm_cancel_recv(rdm, rx_entry);
+	return 0;
+}
+
+static struct fi_ops_ep tcpx_rdm_ep_ops = {
+	.size = sizeof(struct fi_ops_ep),
+	.cancel = tcpx_rdm_cancel,
+	.getopt = fi_no_getopt,
+	.setopt = fi_no_setopt,
+	.tx_ctx = fi_no_tx_ctx,
+	.rx_ctx = fi_no_rx_ctx,
+	.rx_size_left = fi_no_rx_size_left,
+	.tx_size_left = fi_no_tx_size_left,
+};
+
+static void tcpx_rdm_cq_del_eq_fd(struct util_cq *cq, struct tcpx_rdm *rdm)
+{
+	ofi_wait_del_fd(cq->wait, rdm->eq_fd);
+
+	/* A progress call that polled the fd before it was removed takes
+	 * its reference under the ep list lock */
+	cq->cq_fastlock_acquire(&cq->ep_list_lock);
+	cq->cq_fastlock_release(&cq->ep_list_lock);
+}
+
+/*
+ * Connection events are handled by cq progress after it drops the ep list
+ * lock, since handling them binds new endpoints to the cq.  Once the eq fd
+ * is out of the wait sets, wait for the calls still holding a reference.
+ */
+static void tcpx_rdm_cq_del_eq(struct tcpx_rdm *rdm)
+{
+	if (rdm->util_ep.rx_cq)
+		tcpx_rdm_cq_del_eq_fd(rdm->util_ep.rx_cq, rdm);
+	if (rdm->util_ep.tx_cq && rdm->util_ep.tx_cq != rdm->util_ep.rx_cq)
+		tcpx_rdm_cq_del_eq_fd(rdm->util_ep.tx_cq, rdm);
+
+	while (ofi_atomic_get32(&rdm->cm_ref))
+		sched_yield();
+}
+
+static void tcpx_rdm_free_queue(struct tcpx_rdm *rdm,
+				struct ofi_match_queue *queue, bool unexp)
+{
+	struct tcpx_xfer_entry *xfer_entry;
+	struct ofi_match_entry *match;
+
+	while (!ofi_match_queue_empty(queue)) {
+		match = container_of(queue->list.next, struct ofi_match_entry,
+				     entry);
+		ofi_match_queue_remove(queue, match);
+		xfer_entry = container_of(match, struct tcpx_xfer_entry, match);
+		if (unexp)
+			tcpx_rdm_free_unexp(rdm, xfer_entry);
+		else
+			tcpx_rdm_cancel_recv(rdm, xfer_entry);
+	}
+	ofi_match_queue_close(queue);
+}
+
+static int tcpx_rdm_close(struct fid *fid)
+{
+	struct tcpx_rdm *rdm;
+	struct tcpx_conn *conn;
+	int i;
+
+	rdm = container_of(fid, struct tcpx_rdm, util_ep.ep_fid.fid);
+	tcpx_rdm_cq_del_eq(rdm);
+
+	fastlock_acquire(&rdm->lock);
+	while (!dlist_empty(&rdm->conn_list)) {
+		conn = container_of(rdm->conn_list.next, struct tcpx_conn,
+				    entry);
+		tcpx_rdm_conn_close(conn);
+	}
+	fastlock_release(&rdm->lock);
+	ofi_idm_reset(&rdm->conn_idm);
+
+	fi_close(&rdm->pep->fid);
+	fi_close(&rdm->eq->fid);
+
+	for (i = 0; i < 2; i++) {
+		tcpx_rdm_free_queue(rdm, &rdm->recv_queue[i], false);
+		tcpx_rdm_free_queue(rdm, &rdm->unexp_queue[i], true);
+	}
+
+	ofi_endpoint_close(&rdm->util_ep);
+	fi_freeinfo(rdm->msg_info);
+	fastlock_destroy(&rdm->rx_lock);
+	fastlock_destroy(&rdm->lock);
+	free(rdm);
+	return 0;
+}
+
+/* Connection events wake and are progressed through the cq wait sets */
+static int tcpx_rdm_enable(struct tcpx_rdm *rdm)
+{
+	int ret;
+
+	if (!rdm->util_ep.rx_cq || !rdm->util_ep.tx_cq)
+		return -FI_ENOCQ;
+
+	if (!rdm->util_ep.av)
+		return -FI_ENOAV;
+
+	ret = ofi_wait_add_fd(rdm->util_ep.rx_cq->wait, rdm->eq_fd, POLLIN,
+			      tcpx_eq_wait_try_func, NULL, &rdm->eq->fid);
+	if (ret)
+		return ret;
+
+	if (rdm->util_ep.tx_cq != rdm->util_ep.rx_cq) {
+		ret = ofi_wait_add_fd(rdm->util_ep.tx_cq->wait, rdm->eq_fd,
+				      POLLIN, tcpx_eq_wait_try_func, NULL,
+				      &rdm->eq->fid);
+		if (ret) {
+			ofi_wait_del_fd(rdm->util_ep.rx_cq->wait, rdm->eq_fd);
+			return ret;
+		}
+	}
+	return FI_SUCCESS;
+}
+
+static int tcpx_rdm_ctrl(struct fid *fid, int command, void *arg)
+{
+	struct tcpx_rdm *rdm;
+
+	rdm = container_of(fid, struct tcpx_rdm, util_ep.ep_fid.fid);
+	switch (command) {
+	case FI_ENABLE:
+		return tcpx_rdm_enable(rdm);
+	default:
+		return -FI_ENOSYS;
+	}
+}
+
+static int tcpx_rdm_bind(struct fid *fid, struct fid *bfid, uint64_t flags)
+{
+	struct tcpx_rdm *rdm;
+
+	rdm = container_of(fid, struct tcpx_rdm, util_ep.ep_fid.fid);
+	switch (bfid->fclass) {
+	case FI_CLASS_AV:
+	case FI_CLASS_CQ:
+		return ofi_ep_bind(&rdm->util_ep, bfid, flags);
+	default:
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"invalid FID class for binding\n");
+		return -FI_EINVAL;
+	}
+}
+
+static struct fi_ops tcpx_rdm_fi_ops = {
+	.size = sizeof(struct fi_ops),
+	.close = tcpx_rdm_close,
+	.bind = tcpx_rdm_bind,
+	.control = tcpx_rdm_ctrl,
+	.ops_open = fi_no_ops_open,
+};
+
+/* Connections are plain FI_EP_MSG endpoints of this provider */
+static int tcpx_rdm_msg_info(struct tcpx_rdm *rdm, struct fi_info *info)
+{
+	struct sockaddr_in *sin;
+
+	rdm->msg_info = fi_dupinfo(info);
+	if (!rdm->msg_info)
+		return -FI_ENOMEM;
+
+	rdm->msg_info->handle = NULL;
+	rdm->msg_info->ep_attr->type = FI_EP_MSG;
+	rdm->msg_info->caps &= tcpx_info.caps;
+	rdm->msg_info->tx_attr->caps &= tcpx_info.tx_attr->caps;
+	rdm->msg_info->rx_attr->caps &= tcpx_info.rx_attr->caps;
+	rdm->msg_info->tx_attr->msg_order = tcpx_info.tx_attr->msg_order;
+	rdm->msg_info->rx_attr->msg_order = tcpx_info.rx_attr->msg_order;
+	rdm->msg_info->tx_attr->comp_order = tcpx_info.tx_attr->comp_order;
+	rdm->msg_info->rx_attr->comp_order = tcpx_info.rx_attr->comp_order;
+	rdm->msg_info->ep_attr->mem_tag_format = 0;
+
+	free(rdm->msg_info->dest_addr);
+	rdm->msg_info->dest_addr = NULL;
+	rdm->msg_info->dest_addrlen = 0;
+
+	if (!rdm->msg_info->src_addr) {
+		sin = calloc(1, sizeof(*sin));
+		if (!sin)
+			return -FI_ENOMEM;
+		sin->sin_family = AF_INET;
+		rdm->msg_info->src_addr = sin;
+		rdm->msg_info->src_addrlen = sizeof(*sin);
+		rdm->msg_info->addr_format = FI_SOCKADDR_IN;
+	}
+	return FI_SUCCESS;
+}
+
+static int tcpx_rdm_listen(struct tcpx_rdm *rdm)
+{
+	struct fid_fabric *fabric = &rdm->util_ep.domain->fabric->fabric_fid;
+	struct fi_eq_attr eq_attr = {
+		.wait_obj = FI_WAIT_FD,
+	};
+	size_t len;
+	int ret;
+
+	ret = fi_eq_open(fabric, &eq_attr, &rdm->eq, rdm);
+	if (ret)
+		return ret;
+
+	ret = fi_control(&rdm->eq->fid, FI_GETWAIT, &rdm->eq_fd);
+	if (ret)
+		goto close_eq;
+
+	ret = fi_passive_ep(fabric, rdm->msg_info, &rdm->pep, rdm);
+	if (ret)
+		goto close_eq;
+
+	ret = fi_pep_bind(rdm->pep, &rdm->eq->fid, 0);
+	if (ret)
+		goto close_pep;
+
+	ret = fi_listen(rdm->pep);
+	if (ret)
+		goto close_pep;
+
+	len = sizeof(rdm->name);
+	ret = fi_getname(&rdm->pep->fid, &rdm->name, &len);
+	if (ret)
+		goto close_pep;
+
+	return FI_SUCCESS;
+close_pep:
+	fi_close(&rdm->pep->fid);
+close_eq:
+	fi_close(&rdm->eq->fid);
+	return ret;
+}
+
+int tcpx_rdm_endpoint(struct fid_domain *domain, struct fi_info *info,
+		      struct fid_ep **ep_fid, void *context)
+{
+	struct tcpx_rdm *rdm;
+	int ret, i;
+
+	rdm = calloc(1, sizeof(*rdm));
+	if (!rdm)
+		return -FI_ENOMEM;
+
+	ret = ofi_endpoint_init(domain, &tcpx_util_prov, info, &rdm->util_ep,
+				context, NULL);
+	if (ret)
+		goto err1;
+
+	ret = tcpx_rdm_msg_info(rdm, info);
+	if (ret)
+		goto err2;
+
+	for (i = 0; i < 2; i++) {
+		ret = ofi_match_queue_init(&rdm->recv_queue[i],
+					   TCPX_RDM_MATCH_SIZE);
+		if (ret)
+			goto err3;
+		ret = ofi_match_queue_init(&rdm->unexp_queue[i],
+					   TCPX_RDM_MATCH_SIZE);
+		if (ret)
+			goto err3;
+	}
+
+	ret = tcpx_rdm_listen(rdm);
+	if (ret)
+		goto err3;
+
+	fastlock_init(&rdm->lock);
+	fastlock_init(&rdm->rx_lock);
+	ofi_atomic_initialize32(&rdm->cm_ref, 0);
+	dlist_init(&rdm->conn_list);
+	rdm->unexp_max = info->rx_attr->total_buffered_recv ?
+			 info->rx_attr->total_buffered_recv :
+			 TCPX_RDM_BUFFERED_RECV;
+
+	*ep_fid = &rdm->util_ep.ep_fid;
+	(*ep_fid)->fid.ops = &tcpx_rdm_fi_ops;
+	(*ep_fid)->ops = &tcpx_rdm_ep_ops;
+	(*ep_fid)->cm = &tcpx_rdm_cm_ops;
+	(*ep_fid)->msg = &tcpx_rdm_msg_ops;
+	(*ep_fid)->tagged = &tcpx_rdm_tagged_ops;
+	return FI_SUCCESS;
+err3:
+	for (i = 0; i < 2; i++) {
+		ofi_match_queue_close(&rdm->recv_queue[i]);
+		ofi_match_queue_close(&rdm->unexp_queue[i]);
+	}
+err2:
+	fi_freeinfo(rdm->msg_info);
+	ofi_endpoint_close(&rdm->util_ep);
+err1:
+	free(rdm);
+	return ret;
+}
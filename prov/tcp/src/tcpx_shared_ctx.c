@@ -49,11 +49,73 @@ void tcpx_srx_xfer_release(struct tcpx_rx_ctx *srx_ctx,
 	fastlock_release(&srx_ctx->lock);
 }
 
+/*
+ * Set up rx_entry to receive the next msg_len bytes message at the start
+ * of the posted FI_MULTI_RECV buffer and move the buffer past it.  Returns
+ * true once less than min_size bytes are left, the caller then dequeues
+ * the buffer.  It is released, and FI_MULTI_RECV reported, by the last
+ * of its receives to complete, see tcpx_mrecv_put.
+ */
+bool tcpx_mrecv_carve(struct tcpx_xfer_entry *mrecv,
+		      struct tcpx_xfer_entry *rx_entry,
+		      size_t msg_len, size_t min_size)
+{
+	size_t len = MIN(msg_len, mrecv->iov[0].iov_len);
+
+	rx_entry->flags = (mrecv->flags & ~FI_MULTI_RECV) |
+			  TCPX_MULTI_RECV_PART;
+	rx_entry->context = mrecv->context;
+	rx_entry->iov_cnt = 1;
+	rx_entry->iov[0] = mrecv->iov[0];
+	rx_entry->rem_len = mrecv->iov[0].iov_len - len;
+	rx_entry->mrecv = mrecv;
+	mrecv->mrecv_cnt++;
+
+	mrecv->iov[0].iov_base = (uint8_t *) mrecv->iov[0].iov_base + len;
+	mrecv->iov[0].iov_len -= len;
+	if (mrecv->iov[0].iov_len >= min_size)
+		return false;
+
+	mrecv->flags &= ~FI_MULTI_RECV;
+	return true;
+}
+
+/*
+ * Drop rx_entry's reference on its FI_MULTI_RECV buffer.  Returns true
+ * when that released the dequeued buffer, rx_entry then reports
+ * FI_MULTI_RECV.  Receives of a shared context may complete out of
+ * order, so the one that dequeued the buffer need not be the last.
+ */
+bool tcpx_mrecv_put(struct tcpx_xfer_entry *rx_entry)
+{
+	struct tcpx_xfer_entry *mrecv = rx_entry->mrecv;
+	struct tcpx_rx_ctx *srx_ctx = rx_entry->ep->srx_ctx;
+	struct tcpx_cq *tcpx_cq;
+	bool last;
+
+	if (srx_ctx)
+		fastlock_acquire(&srx_ctx->lock);
+
+	last = !--mrecv->mrecv_cnt && !(mrecv->flags & FI_MULTI_RECV);
+	if (last && srx_ctx) {
+		ofi_buf_free(mrecv);
+	} else if (last) {
+		tcpx_cq = container_of(rx_entry->ep->util_ep.rx_cq,
+				       struct tcpx_cq, util_cq);
+		tcpx_xfer_entry_release(tcpx_cq, mrecv);
+	}
+
+	if (srx_ctx)
+		fastlock_release(&srx_ctx->lock);
+	return last;
+}
+
 struct tcpx_xfer_entry *
 tcpx_srx_next_xfer_entry(struct tcpx_rx_ctx *srx_ctx,
 			struct tcpx_ep *ep, size_t entry_size)
 {
 	struct tcpx_xfer_entry *xfer_entry = NULL;
+	struct tcpx_xfer_entry *mrecv;
 
 	fastlock_acquire(&srx_ctx->lock);
 	if (slist_empty(&srx_ctx->rx_queue))
@@ -61,6 +123,18 @@ tcpx_srx_next_xfer_entry(struct tcpx_rx_ctx *srx_ctx,
 
 	xfer_entry = container_of(srx_ctx->rx_queue.head,
 				  struct tcpx_xfer_entry, entry);
+	if (xfer_entry->flags & FI_MULTI_RECV) {
+		mrecv = xfer_entry;
+		xfer_entry = ofi_buf_alloc(srx_ctx->buf_pool);
+		if (!xfer_entry)
+			goto out;
+
+		if (tcpx_mrecv_carve(mrecv, xfer_entry, entry_size,
+				     srx_ctx->min_multi_recv_size))
+			slist_remove_head(&srx_ctx->rx_queue);
+		goto out;
+	}
+
 	xfer_entry->rem_len = ofi_total_iov_len(xfer_entry->iov,
 						xfer_entry->iov_cnt) - entry_size;
 	slist_remove_head(&srx_ctx->rx_queue);
@@ -78,6 +152,8 @@ static ssize_t tcpx_srx_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 
 	srx_ctx = container_of(ep, struct tcpx_rx_ctx, rx_fid);
 	assert(msg->iov_count <= TCPX_IOV_LIMIT);
+	if ((flags & FI_MULTI_RECV) && msg->iov_count != 1)
+		return -FI_EINVAL;
 
 	fastlock_acquire(&srx_ctx->lock);
 	recv_entry = ofi_buf_alloc(srx_ctx->buf_pool);
@@ -87,6 +163,7 @@ static ssize_t tcpx_srx_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 	}
 
 	recv_entry->flags = flags | FI_MSG | FI_RECV;
+	recv_entry->mrecv_cnt = 0;
 	recv_entry->context = msg->context;
 	recv_entry->iov_cnt = msg->iov_count;
 	memcpy(&recv_entry->iov[0], msg->msg_iov,
@@ -114,7 +191,9 @@ static ssize_t tcpx_srx_recv(struct fid_ep *ep, void *buf, size_t len, void *des
 		goto unlock;
 	}
 
-	recv_entry->flags = FI_MSG | FI_RECV;
+	recv_entry->flags = (srx_ctx->op_flags & FI_MULTI_RECV) |
+			    FI_MSG | FI_RECV;
+	recv_entry->mrecv_cnt = 0;
 	recv_entry->context = context;
 	recv_entry->iov_cnt = 1;
 	recv_entry->iov[0].iov_base = buf;
@@ -136,6 +215,8 @@ static ssize_t tcpx_srx_recvv(struct fid_ep *ep, const struct iovec *iov, void *
 
 	srx_ctx = container_of(ep, struct tcpx_rx_ctx, rx_fid);
 	assert(count <= TCPX_IOV_LIMIT);
+	if ((srx_ctx->op_flags & FI_MULTI_RECV) && count != 1)
+		return -FI_EINVAL;
 
 	fastlock_acquire(&srx_ctx->lock);
 	recv_entry = ofi_buf_alloc(srx_ctx->buf_pool);
@@ -144,7 +225,9 @@ static ssize_t tcpx_srx_recvv(struct fid_ep *ep, const struct iovec *iov, void *
 		goto unlock;
 	}
 
-	recv_entry->flags = FI_MSG | FI_RECV;
+	recv_entry->flags = (srx_ctx->op_flags & FI_MULTI_RECV) |
+			    FI_MSG | FI_RECV;
+	recv_entry->mrecv_cnt = 0;
 	recv_entry->context = context;
 	recv_entry->iov_cnt = count;
 	memcpy(&recv_entry->iov[0], iov, count * sizeof(*iov));
@@ -0,0 +1,602 @@
+/*
+ * Copyright (c) 2020 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Multi-stream connections
+ *
+ * With FI_TCP_STREAMS > 1 a connection is made of the endpoint socket and
+ * up to FI_TCP_STREAMS - 1 streams next to it.  The client listens on an
+ * ephemeral port and sends it with its connection request.  The server
+ * connects the streams to it before it sends the response, which carries
+ * the number of sockets it set up, so the client only has to accept them.
+ * The server's connects are non-blocking and completed by the CM poll
+ * loop, which sends the response once the last one is through.
+ *
+ * Transfers with a payload of at least tcpx_stripe_size bytes are marked
+ * TCPX_STRIPED.  Their header and first payload slice go over the ep
+ * socket and the rest is cut into equal slices, one per stream.  Both
+ * sides derive the slices from the payload size, and every socket carries
+ * its slices in transfer order, so no framing is needed on the streams.
+ * A striped transfer holds its place at the head of the tx queue, and of
+ * the rx side, until all of its slices are through, so smaller transfers
+ * on the ep socket keep their order with it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+
+#include <ofi_iov.h>
+#include "tcpx.h"
+
+static struct tcpx_domain *tcpx_ep_domain(struct tcpx_ep *ep)
+{
+	return container_of(ep->util_ep.domain, struct tcpx_domain,
+			    util_domain);
+}
+
+static int tcpx_stream_setup(SOCKET sock)
+{
+	int optval = 1;
+
+	if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *) &optval,
+		       sizeof(optval)))
+		return -ofi_sockerr();
+
+	return fi_fd_nonblock(sock);
+}
+
+static void tcpx_stream_free(struct tcpx_ep *ep)
+{
+	size_t i;
+
+	for (i = 0; i < ep->stream_cnt; i++) {
+		if (ep->streams[i].sock != INVALID_SOCKET)
+			ofi_close_socket(ep->streams[i].sock);
+	}
+	free(ep->streams);
+	ep->streams = NULL;
+	ep->stream_cnt = 0;
+}
+
+/* Client: listen for the streams of the connection being requested */
+void tcpx_stream_listen(struct tcpx_ep *ep, struct tcpx_cm_context *cm_ctx)
+{
+	union ofi_sock_ip addr;
+	socklen_t len = sizeof(addr);
+	SOCKET sock;
+
+	cm_ctx->streams = 0;
+	cm_ctx->stream_port = 0;
+	if (tcpx_streams <= 1 || tcpx_ep_domain(ep)->uring)
+		return;
+
+	if (ofi_getsockname(ep->sock, &addr.sa, &len))
+		goto err;
+
+	sock = ofi_socket(addr.sa.sa_family, SOCK_STREAM, 0);
+	if (sock == INVALID_SOCKET)
+		goto err;
+
+	ofi_addr_set_port(&addr.sa, 0);
+	if (bind(sock, &addr.sa, len) || listen(sock, TCPX_MAX_STREAMS) ||
+	    ofi_getsockname(sock, &addr.sa, &len)) {
+		ofi_close_socket(sock);
+		goto err;
+	}
+
+	ep->stream_listen = sock;
+	cm_ctx->streams = tcpx_streams;
+	cm_ctx->stream_port = ofi_addr_get_port(&addr.sa);
+	return;
+err:
+	FI_INFO(&tcpx_prov, FI_LOG_EP_CTRL,
+		"cannot listen for streams, using a single socket: %s\n",
+		strerror(ofi_sockerr()));
+}
+
+/*
+ * Server: start connecting the streams the client asked for, as far as
+ * both sides allow.  The connects complete in the CM poll loop, and the
+ * accept response waits for them, see tcpx_stream_connected().  Returns
+ * -FI_EINPROGRESS if cm_ctx was held back for that, 0 without streams.
+ */
+int tcpx_stream_connect(struct tcpx_ep *ep, struct util_wait *wait,
+			struct tcpx_cm_context *cm_ctx)
+{
+	struct tcpx_cm_context *stream_ctx;
+	union ofi_sock_ip addr;
+	socklen_t len = sizeof(addr);
+	uint32_t streams, i;
+	SOCKET sock;
+
+	streams = MIN(ep->stream_req, (uint32_t) MAX(tcpx_streams, 1));
+	ep->stream_req = 0;
+	if (streams <= 1 || tcpx_ep_domain(ep)->uring)
+		return 0;
+
+	if (ofi_getpeername(ep->sock, &addr.sa, &len))
+		return 0;
+	ofi_addr_set_port(&addr.sa, ep->stream_port);
+
+	ep->streams = calloc(streams - 1, sizeof(*ep->streams));
+	if (!ep->streams)
+		return 0;
+
+	for (i = 0; i < streams - 1; i++) {
+		sock = ofi_socket(addr.sa.sa_family, SOCK_STREAM, 0);
+		if (sock == INVALID_SOCKET)
+			break;
+
+		stream_ctx = calloc(1, sizeof(*stream_ctx));
+		if (!stream_ctx) {
+			ofi_close_socket(sock);
+			break;
+		}
+		stream_ctx->fid = cm_ctx->fid;
+		stream_ctx->type = SERVER_STREAM_CONNECT;
+
+		if (tcpx_stream_setup(sock) ||
+		    (connect(sock, &addr.sa, len) &&
+		     !OFI_SOCK_TRY_CONN_AGAIN(ofi_sockerr())) ||
+		    ofi_wait_add_fd(wait, sock, POLLOUT, tcpx_eq_wait_try_func,
+				    NULL, stream_ctx)) {
+			free(stream_ctx);
+			ofi_close_socket(sock);
+			break;
+		}
+		ep->streams[i].sock = sock;
+		ep->streams[i].cm_ctx = stream_ctx;
+	}
+
+	ep->stream_cnt = i;
+	if (!ep->stream_cnt) {
+		FI_INFO(&tcpx_prov, FI_LOG_EP_CTRL,
+			"cannot connect streams, using a single socket\n");
+		tcpx_stream_free(ep);
+		return 0;
+	}
+
+	ep->stream_pending = ep->stream_cnt;
+	ep->stream_cm_ctx = cm_ctx;
+	return -FI_EINPROGRESS;
+}
+
+/*
+ * Server: one of the stream connects finished.  After the last one, the
+ * streams that made it are numbered and tell the client their number.
+ * Returns -FI_EINPROGRESS while other connects are outstanding.
+ */
+int tcpx_stream_connected(struct tcpx_ep *ep, struct util_wait *wait,
+			  struct tcpx_cm_context *stream_ctx)
+{
+	struct tcpx_stream *stream = NULL;
+	struct ofi_ctrl_hdr hdr;
+	size_t i, cnt, started;
+	socklen_t len;
+	int status;
+	SOCKET sock;
+
+	for (i = 0; i < ep->stream_cnt; i++) {
+		if (ep->streams[i].cm_ctx == stream_ctx) {
+			stream = &ep->streams[i];
+			break;
+		}
+	}
+	assert(stream);
+
+	ofi_wait_del_fd(wait, stream->sock);
+	free(stream_ctx);
+	stream->cm_ctx = NULL;
+
+	len = sizeof(status);
+	if (getsockopt(stream->sock, SOL_SOCKET, SO_ERROR, (char *) &status,
+		       &len) || status) {
+		ofi_close_socket(stream->sock);
+		stream->sock = INVALID_SOCKET;
+	}
+
+	if (--ep->stream_pending)
+		return -FI_EINPROGRESS;
+
+	started = ep->stream_cnt;
+	for (i = 0, cnt = 0; i < started; i++) {
+		sock = ep->streams[i].sock;
+		ep->streams[i].sock = INVALID_SOCKET;
+		if (sock != INVALID_SOCKET)
+			ep->streams[cnt++].sock = sock;
+	}
+	ep->stream_cnt = cnt;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = TCPX_CTRL_HDR_VERSION;
+	hdr.type = ofi_ctrl_connreq;
+	for (i = 0; i < cnt; i++) {
+		hdr.seg_no = htonl((uint32_t) i);
+		if (ofi_send_socket(ep->streams[i].sock, &hdr, sizeof(hdr),
+				    MSG_NOSIGNAL) != sizeof(hdr))
+			break;
+	}
+
+	/* The client is only told about the streams if all are numbered */
+	if (i < cnt)
+		cnt = 0;
+
+	if (cnt < started)
+		FI_INFO(&tcpx_prov, FI_LOG_EP_CTRL,
+			"connected %zu of %zu streams\n", cnt, started);
+
+	if (!cnt)
+		tcpx_stream_free(ep);
+	return 0;
+}
+
+/* Abandon the stream connects of an ep leaving the CM poll loop */
+void tcpx_stream_cm_del(struct tcpx_ep *ep, struct util_wait *wait)
+{
+	size_t i;
+
+	for (i = 0; i < ep->stream_cnt; i++) {
+		if (!ep->streams[i].cm_ctx)
+			continue;
+
+		ofi_wait_del_fd(wait, ep->streams[i].sock);
+		free(ep->streams[i].cm_ctx);
+		ep->streams[i].cm_ctx = NULL;
+	}
+	ep->stream_pending = 0;
+	free(ep->stream_cm_ctx);
+	ep->stream_cm_ctx = NULL;
+}
+
+/* Client: accept the streams the server connected, closing the listener */
+int tcpx_stream_accept(struct tcpx_ep *ep, uint32_t streams)
+{
+	struct ofi_ctrl_hdr hdr;
+	struct pollfd fds;
+	uint32_t i, idx;
+	SOCKET sock;
+	int ret = 0;
+
+	if (streams <= 1)
+		goto out;
+
+	if (ep->stream_listen == INVALID_SOCKET ||
+	    streams > TCPX_MAX_STREAMS) {
+		ret = -FI_ENOPROTOOPT;
+		goto out;
+	}
+
+	ep->streams = calloc(streams - 1, sizeof(*ep->streams));
+	if (!ep->streams) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+	ep->stream_cnt = streams - 1;
+	for (i = 0; i < ep->stream_cnt; i++)
+		ep->streams[i].sock = INVALID_SOCKET;
+
+	fds.fd = ep->stream_listen;
+	fds.events = POLLIN;
+	for (i = 0; i < ep->stream_cnt; i++) {
+		/* The server connected them before it responded */
+		if (poll(&fds, 1, TCPX_STREAM_TIMEOUT_MS) <= 0) {
+			ret = -FI_ETIMEDOUT;
+			goto out;
+		}
+
+		sock = accept(ep->stream_listen, NULL, 0);
+		if (sock == INVALID_SOCKET) {
+			ret = -ofi_sockerr();
+			goto out;
+		}
+
+		if (ofi_recv_socket(sock, &hdr, sizeof(hdr),
+				    MSG_WAITALL) != sizeof(hdr)) {
+			ofi_close_socket(sock);
+			ret = -FI_EIO;
+			goto out;
+		}
+
+		idx = ntohl(hdr.seg_no);
+		if (hdr.version != TCPX_CTRL_HDR_VERSION ||
+		    hdr.type != ofi_ctrl_connreq || idx >= ep->stream_cnt ||
+		    ep->streams[idx].sock != INVALID_SOCKET) {
+			ofi_close_socket(sock);
+			ret = -FI_ECONNREFUSED;
+			goto out;
+		}
+		ep->streams[idx].sock = sock;
+
+		ret = tcpx_stream_setup(sock);
+		if (ret)
+			goto out;
+	}
+out:
+	if (ep->stream_listen != INVALID_SOCKET) {
+		ofi_close_socket(ep->stream_listen);
+		ep->stream_listen = INVALID_SOCKET;
+	}
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"failed to accept streams: %s\n", fi_strerror(-ret));
+		tcpx_stream_free(ep);
+	}
+	return ret;
+}
+
+int tcpx_stream_wait_add(struct tcpx_ep *ep, struct util_wait *wait)
+{
+	size_t i;
+	int ret;
+
+	for (i = 0; i < ep->stream_cnt; i++) {
+		ret = ofi_wait_add_fd(wait, ep->streams[i].sock, POLLIN,
+				      tcpx_try_func, (void *) &ep->util_ep,
+				      &ep->util_ep.ep_fid.fid);
+		if (ret)
+			return ret;
+	}
+	return FI_SUCCESS;
+}
+
+void tcpx_stream_wait_del(struct tcpx_ep *ep, struct util_wait *wait)
+{
+	size_t i;
+
+	for (i = 0; i < ep->stream_cnt; i++)
+		ofi_wait_del_fd(wait, ep->streams[i].sock);
+}
+
+/* Wait for POLLOUT on the streams with a slice left to send */
+void tcpx_stream_update_pollout(struct tcpx_ep *ep)
+{
+	struct tcpx_stream *stream;
+	size_t i;
+
+	for (i = 0; i < ep->stream_cnt; i++) {
+		stream = &ep->streams[i];
+		if ((stream->tx_len != 0) == stream->pollout_set)
+			continue;
+
+		stream->pollout_set = (stream->tx_len != 0);
+		(void) tcpx_wait_pollout(ep, stream->sock,
+					 stream->pollout_set);
+	}
+}
+
+void tcpx_stream_shutdown(struct tcpx_ep *ep)
+{
+	size_t i;
+
+	for (i = 0; i < ep->stream_cnt; i++)
+		ofi_shutdown(ep->streams[i].sock, SHUT_RDWR);
+}
+
+void tcpx_stream_close(struct tcpx_ep *ep)
+{
+	tcpx_stream_free(ep);
+	if (ep->stream_listen != INVALID_SOCKET) {
+		ofi_close_socket(ep->stream_listen);
+		ep->stream_listen = INVALID_SOCKET;
+	}
+}
+
+/* Must hold ep lock, before the entry's header is swapped */
+void tcpx_stream_mark(struct tcpx_ep *ep, struct tcpx_xfer_entry *tx_entry)
+{
+	if (tx_entry->rem_len - tx_entry->hdr.base_hdr.payload_off <
+	    tcpx_stripe_size)
+		return;
+
+	tx_entry->hdr.base_hdr.flags |= (ep->hdr_bswap == tcpx_hdr_bswap) ?
+					htons(TCPX_STRIPED) : TCPX_STRIPED;
+}
+
+/*
+ * Cut the payload, which follows prefix bytes of iov, into a slice per
+ * socket.  iov keeps the prefix and the first slice, which also takes
+ * what is left over from dividing the payload.
+ */
+static int tcpx_stream_split(struct tcpx_ep *ep, struct iovec *iov,
+			     size_t *iov_cnt, size_t prefix, size_t payload,
+			     bool tx)
+{
+	struct iovec src[TCPX_IOV_LIMIT + 1];
+	struct tcpx_stream *stream;
+	size_t src_cnt = *iov_cnt, index = 0, offset = 0, slice, i;
+	int ret;
+
+	assert(src_cnt <= TCPX_IOV_LIMIT + 1);
+	memcpy(src, iov, src_cnt * sizeof(*iov));
+	slice = payload / (ep->stream_cnt + 1);
+
+	ret = ofi_copy_iov_desc(iov, NULL, iov_cnt, src, NULL, src_cnt,
+				&index, &offset,
+				prefix + payload - slice * ep->stream_cnt);
+	for (i = 0; !ret && i < ep->stream_cnt; i++) {
+		stream = &ep->streams[i];
+		if (tx) {
+			ret = ofi_copy_iov_desc(stream->tx_iov, NULL,
+						&stream->tx_iov_cnt, src, NULL,
+						src_cnt, &index, &offset,
+						slice);
+			stream->tx_len = slice;
+		} else {
+			ret = ofi_copy_iov_desc(stream->rx_iov, NULL,
+						&stream->rx_iov_cnt, src, NULL,
+						src_cnt, &index, &offset,
+						slice);
+			stream->rx_len = slice;
+		}
+	}
+	return ret;
+}
+
+static void tcpx_stream_reset(struct tcpx_ep *ep)
+{
+	size_t i;
+
+	for (i = 0; i < ep->stream_cnt; i++) {
+		ep->streams[i].tx_len = 0;
+		ep->streams[i].rx_len = 0;
+	}
+}
+
+/* Must hold ep lock */
+int tcpx_stream_send(struct tcpx_xfer_entry *tx_entry)
+{
+	struct tcpx_ep *ep = tx_entry->ep;
+	struct tcpx_stream *stream;
+	bool done = true;
+	ssize_t ret;
+	size_t i;
+
+	if (ep->tx_stripe != tx_entry) {
+		ret = tcpx_stream_split(ep, tx_entry->iov, &tx_entry->iov_cnt,
+					tx_entry->hdr.base_hdr.payload_off,
+					tx_entry->rem_len -
+					tx_entry->hdr.base_hdr.payload_off,
+					true);
+		if (ret)
+			return (int) ret;
+
+		tx_entry->rem_len = ofi_total_iov_len(tx_entry->iov,
+						      tx_entry->iov_cnt);
+		ep->tx_stripe = tx_entry;
+	}
+
+	if (tx_entry->rem_len) {
+		ret = tcpx_send_entry(tx_entry);
+		if (ret && !OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+			goto err;
+		done = !ret;
+	}
+
+	for (i = 0; i < ep->stream_cnt; i++) {
+		stream = &ep->streams[i];
+		if (!stream->tx_len)
+			continue;
+
+		ret = tcpx_send_iov(stream->sock, stream->tx_iov,
+				    stream->tx_iov_cnt);
+		if (ret < 0) {
+			if (!OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+				goto err;
+			done = false;
+			continue;
+		}
+
+		stream->tx_len -= ret;
+		if (stream->tx_len) {
+			ofi_consume_iov(stream->tx_iov, &stream->tx_iov_cnt,
+					ret);
+			done = false;
+		}
+	}
+
+	if (!done)
+		return -FI_EAGAIN;
+
+	ep->tx_stripe = NULL;
+	return FI_SUCCESS;
+err:
+	ep->tx_stripe = NULL;
+	tcpx_stream_reset(ep);
+	return (int) ret;
+}
+
+/* Must hold ep lock */
+int tcpx_stream_recv(struct tcpx_xfer_entry *rx_entry)
+{
+	struct tcpx_ep *ep = rx_entry->ep;
+	struct tcpx_base_hdr *hdr = &rx_entry->hdr.base_hdr;
+	struct tcpx_stream *stream;
+	bool done;
+	ssize_t ret;
+	size_t i;
+
+	if (!ep->rx_stripe) {
+		if (!ep->stream_cnt ||
+		    ofi_truncate_iov(rx_entry->iov, &rx_entry->iov_cnt,
+				     hdr->size - hdr->payload_off)) {
+			FI_WARN(&tcpx_prov, FI_LOG_EP_DATA,
+				"unexpected striped transfer\n");
+			return -FI_EIO;
+		}
+
+		ret = tcpx_stream_split(ep, rx_entry->iov, &rx_entry->iov_cnt,
+					0, hdr->size - hdr->payload_off, false);
+		if (ret)
+			return (int) ret;
+		ep->rx_stripe = true;
+	}
+
+	ret = tcpx_recv_entry_data(rx_entry);
+	if (ret && !OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+		goto err;
+	done = !ret;
+
+	for (i = 0; i < ep->stream_cnt; i++) {
+		stream = &ep->streams[i];
+		if (!stream->rx_len)
+			continue;
+
+		ret = ofi_readv_socket(stream->sock, stream->rx_iov,
+				       stream->rx_iov_cnt);
+		if (ret <= 0) {
+			ret = ret ? -ofi_sockerr() : -FI_ENOTCONN;
+			if (!OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+				goto err;
+			done = false;
+			continue;
+		}
+
+		stream->rx_len -= ret;
+		if (stream->rx_len) {
+			ofi_consume_iov(stream->rx_iov, &stream->rx_iov_cnt,
+					ret);
+			done = false;
+		}
+	}
+
+	if (!done)
+		return -FI_EAGAIN;
+
+	ep->rx_stripe = false;
+	return FI_SUCCESS;
+err:
+	ep->rx_stripe = false;
+	tcpx_stream_reset(ep);
+	return (int) ret;
+}
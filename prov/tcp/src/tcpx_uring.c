@@ -0,0 +1,642 @@
+/*
+ * Copyright (c) 2020 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * io_uring I/O engine
+ *
+ * With FI_TCP_IO_ENGINE=uring a domain owns one io_uring, and the sockets
+ * of its connected endpoints are no longer polled.  Each endpoint keeps a
+ * recv into its staging buffer in flight whenever the buffer is drained,
+ * and sends the gathered head of its tx queue with one sendmsg request
+ * at a time.  Completions are reaped by cq progress, which hands them to
+ * the usual rx state machine and tx queue accounting.  The ring fd sits
+ * in every cq wait set, so blocking reads sleep until a request completes.
+ *
+ * The ring is driven with the raw system calls, without liburing.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "tcpx.h"
+
+#if HAVE_TCP_URING
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Request types, kept in the low bits of the user_data ep pointer */
+enum {
+	TCPX_URING_RX = 1,
+	TCPX_URING_TX,
+	TCPX_URING_RX_POLL,
+	TCPX_URING_TX_POLL,
+	TCPX_URING_CANCEL,
+};
+
+#define TCPX_URING_OP_MASK	7
+#define TCPX_URING_RX_BIT	(1 << 0)
+#define TCPX_URING_TX_BIT	(1 << 1)
+#define TCPX_URING_REAP_CNT	64
+
+struct tcpx_uring {
+	struct fid		fid;
+	int			fd;
+	bool			sqpoll;
+	/* protects the queues, taken with an ep lock held */
+	fastlock_t		lock;
+
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_mask;
+	unsigned		*sq_flags;
+	unsigned		*sq_array;
+	unsigned		sq_entries;
+	/* requests written to the queue the kernel has not taken yet */
+	unsigned		sq_pending;
+	struct io_uring_sqe	*sqes;
+
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void			*sq_ptr;
+	void			*cq_ptr;
+	size_t			sq_size;
+	size_t			cq_size;
+	size_t			sqes_size;
+};
+
+static int tcpx_uring_enter(struct tcpx_uring *ring, unsigned to_submit,
+			    unsigned flags)
+{
+	int ret;
+
+	ret = (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, 0,
+			    flags, NULL, 0);
+	return ret < 0 ? -errno : ret;
+}
+
+static inline uint64_t tcpx_uring_data(struct tcpx_ep *ep, int op)
+{
+	return (uint64_t) (uintptr_t) ep | op;
+}
+
+/* Must hold ring lock */
+static void tcpx_uring_flush_locked(struct tcpx_uring *ring)
+{
+	int ret;
+
+	if (!ring->sq_pending)
+		return;
+
+	if (ring->sqpoll) {
+		/* Order the tail update before the wakeup flag check */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) &
+		    IORING_SQ_NEED_WAKEUP)
+			(void) tcpx_uring_enter(ring, 0,
+						IORING_ENTER_SQ_WAKEUP);
+		ring->sq_pending = 0;
+		return;
+	}
+
+	ret = tcpx_uring_enter(ring, ring->sq_pending, 0);
+	if (ret >= 0) {
+		ring->sq_pending -= MIN((unsigned) ret, ring->sq_pending);
+	} else if (ret != -FI_EAGAIN && ret != -FI_EBUSY && ret != -FI_EINTR) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_DATA,
+			"io_uring submit failed: %s\n", strerror(-ret));
+	}
+}
+
+void tcpx_uring_flush(struct tcpx_uring *ring)
+{
+	fastlock_acquire(&ring->lock);
+	tcpx_uring_flush_locked(ring);
+	fastlock_release(&ring->lock);
+}
+
+/* Must hold ring lock */
+static struct io_uring_sqe *tcpx_uring_get_sqe(struct tcpx_uring *ring)
+{
+	unsigned head, tail;
+
+	tail = *ring->sq_tail;
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head >= ring->sq_entries) {
+		tcpx_uring_flush_locked(ring);
+#ifdef IORING_ENTER_SQ_WAIT
+		if (ring->sqpoll)
+			(void) tcpx_uring_enter(ring, 0, IORING_ENTER_SQ_WAIT);
+#endif
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (tail - head >= ring->sq_entries)
+			return NULL;
+	}
+
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	return &ring->sqes[tail & *ring->sq_mask];
+}
+
+/*
+ * Queue a request.  Receives are left for the next flush, which comes at
+ * the end of the progress pass that armed them, while sends go out now.
+ */
+static int tcpx_uring_submit(struct tcpx_uring *ring,
+			     const struct io_uring_sqe *req, bool flush)
+{
+	struct io_uring_sqe *sqe;
+
+	fastlock_acquire(&ring->lock);
+	sqe = tcpx_uring_get_sqe(ring);
+	if (!sqe) {
+		fastlock_release(&ring->lock);
+		return -FI_EAGAIN;
+	}
+
+	*sqe = *req;
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+	ring->sq_pending++;
+	if (flush)
+		tcpx_uring_flush_locked(ring);
+	fastlock_release(&ring->lock);
+	return FI_SUCCESS;
+}
+
+static int tcpx_uring_poll(struct tcpx_ep *ep, int op, short events)
+{
+	struct io_uring_sqe sqe = {0};
+
+	sqe.opcode = IORING_OP_POLL_ADD;
+	sqe.fd = ep->sock;
+	sqe.poll_events = events;
+	sqe.user_data = tcpx_uring_data(ep, op);
+	return tcpx_uring_submit(ep->uring->ring, &sqe, true);
+}
+
+/*
+ * Arm a recv into the drained staging buffer.  The data shows up with the
+ * completion, so the caller always sees -FI_EAGAIN.  Must hold ep lock.
+ */
+int tcpx_uring_recv(struct tcpx_ep *ep)
+{
+	struct tcpx_uring_ep *uep = ep->uring;
+	struct io_uring_sqe sqe = {0};
+
+	if ((uep->ops & TCPX_URING_RX_BIT) || uep->closing ||
+	    ep->cm_state != TCPX_EP_CONNECTED)
+		return -FI_EAGAIN;
+
+	assert(ep->stage_buf.cur_pos == ep->stage_buf.bytes_avail);
+	sqe.opcode = IORING_OP_RECV;
+	sqe.fd = ep->sock;
+	sqe.addr = (uintptr_t) ep->stage_buf.buf;
+	sqe.len = (uint32_t) ep->stage_buf.read_len;
+	sqe.user_data = tcpx_uring_data(ep, TCPX_URING_RX);
+
+	if (tcpx_uring_submit(uep->ring, &sqe, false))
+		tcpx_ep_queue_ready(ep);
+	else
+		uep->ops |= TCPX_URING_RX_BIT;
+	return -FI_EAGAIN;
+}
+
+/*
+ * Send the gathered head of the tx queue.  The entries are accounted for
+ * when the request completes, so the caller always sees -FI_EAGAIN.
+ * Must hold ep lock.
+ */
+int tcpx_uring_send(struct tcpx_ep *ep)
+{
+	struct tcpx_uring_ep *uep = ep->uring;
+	struct io_uring_sqe sqe = {0};
+	size_t iov_cnt, len;
+
+	if ((uep->ops & TCPX_URING_TX_BIT) || uep->closing)
+		return -FI_EAGAIN;
+
+	(void) tcpx_tx_gather(ep, uep->iov, &iov_cnt, &len);
+	uep->msg.msg_iov = uep->iov;
+	uep->msg.msg_iovlen = iov_cnt;
+
+	sqe.opcode = IORING_OP_SENDMSG;
+	sqe.fd = ep->sock;
+	sqe.addr = (uintptr_t) &uep->msg;
+	sqe.len = 1;
+	sqe.msg_flags = MSG_NOSIGNAL;
+	sqe.user_data = tcpx_uring_data(ep, TCPX_URING_TX);
+
+	if (tcpx_uring_submit(uep->ring, &sqe, true))
+		tcpx_ep_queue_ready(ep);
+	else
+		uep->ops |= TCPX_URING_TX_BIT;
+	return -FI_EAGAIN;
+}
+
+/* Must hold ep lock */
+static void tcpx_uring_rx_done(struct tcpx_ep *ep, int res)
+{
+	if (res == -EAGAIN) {
+		if (tcpx_uring_poll(ep, TCPX_URING_RX_POLL, POLLIN))
+			tcpx_ep_queue_ready(ep);
+		else
+			ep->uring->ops |= TCPX_URING_RX_BIT;
+		return;
+	}
+
+	if (res <= 0) {
+		FI_DBG(&tcpx_prov, FI_LOG_EP_DATA, "recv failed: %s\n",
+		       res ? strerror(-res) : "connection closed");
+		tcpx_ep_shutdown_report(ep, &ep->util_ep.ep_fid.fid);
+		return;
+	}
+
+	tcpx_stage_buf_fill(&ep->stage_buf, res);
+	tcpx_progress_rx(ep);
+}
+
+/* Must hold ep lock */
+static void tcpx_uring_tx_done(struct tcpx_ep *ep, int res)
+{
+	if (res == -EAGAIN) {
+		if (tcpx_uring_poll(ep, TCPX_URING_TX_POLL, POLLOUT))
+			tcpx_ep_queue_ready(ep);
+		else
+			ep->uring->ops |= TCPX_URING_TX_BIT;
+		return;
+	}
+
+	if (res < 0)
+		tcpx_tx_sent(ep, res == -EPIPE ? -FI_ENOTCONN : res);
+	else
+		tcpx_tx_sent(ep, res);
+	tcpx_progress_tx(ep);
+}
+
+static void tcpx_uring_complete(const struct io_uring_cqe *cqe)
+{
+	struct tcpx_uring_ep *uep;
+	struct tcpx_ep *ep;
+	int op;
+
+	op = (int) (cqe->user_data & TCPX_URING_OP_MASK);
+	if (op == TCPX_URING_CANCEL)
+		return;
+
+	ep = (struct tcpx_ep *) (uintptr_t)
+	     (cqe->user_data & ~(uint64_t) TCPX_URING_OP_MASK);
+	uep = ep->uring;
+
+	fastlock_acquire(&ep->lock);
+	if (op == TCPX_URING_RX || op == TCPX_URING_RX_POLL)
+		uep->ops &= ~TCPX_URING_RX_BIT;
+	else
+		uep->ops &= ~TCPX_URING_TX_BIT;
+
+	/* A closing ep only waits for its requests to finish */
+	if (uep->closing)
+		goto unlock;
+
+	switch (op) {
+	case TCPX_URING_RX:
+		tcpx_uring_rx_done(ep, cqe->res);
+		break;
+	case TCPX_URING_TX:
+		tcpx_uring_tx_done(ep, cqe->res);
+		break;
+	case TCPX_URING_RX_POLL:
+		(void) tcpx_uring_recv(ep);
+		break;
+	case TCPX_URING_TX_POLL:
+		tcpx_progress_tx(ep);
+		break;
+	}
+unlock:
+	fastlock_release(&ep->lock);
+}
+
+/* Returns the number of completions handled */
+int tcpx_uring_progress(struct tcpx_uring *ring)
+{
+	struct io_uring_cqe cqes[TCPX_URING_REAP_CNT];
+	unsigned head, tail;
+	int cnt, i, total = 0;
+
+	do {
+		cnt = 0;
+		fastlock_acquire(&ring->lock);
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail && cnt < TCPX_URING_REAP_CNT)
+			cqes[cnt++] = ring->cqes[head++ & *ring->cq_mask];
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+#ifdef IORING_SQ_CQ_OVERFLOW
+		/* Completions the ring had no room for wait in the kernel */
+		if (!cnt && (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) &
+			     IORING_SQ_CQ_OVERFLOW))
+			(void) tcpx_uring_enter(ring, 0,
+						IORING_ENTER_GETEVENTS);
+#endif
+		fastlock_release(&ring->lock);
+
+		for (i = 0; i < cnt; i++)
+			tcpx_uring_complete(&cqes[i]);
+		total += cnt;
+	} while (cnt == TCPX_URING_REAP_CNT);
+
+	tcpx_uring_flush(ring);
+	return total;
+}
+
+/* Keeps a blocked cq read awake while completions are waiting */
+static int tcpx_uring_wait_try(void *arg)
+{
+	struct tcpx_uring *ring = arg;
+
+	tcpx_uring_flush(ring);
+	return (*ring->cq_head !=
+		__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) ?
+	       -FI_EAGAIN : FI_SUCCESS;
+}
+
+int tcpx_uring_wait_add(struct tcpx_uring *ring, struct util_wait *wait)
+{
+	return ofi_wait_add_fd(wait, ring->fd, POLLIN, tcpx_uring_wait_try,
+			       ring, &ring->fid);
+}
+
+void tcpx_uring_wait_del(struct tcpx_uring *ring, struct util_wait *wait)
+{
+	ofi_wait_del_fd(wait, ring->fd);
+}
+
+int tcpx_uring_ep_enable(struct tcpx_ep *ep, struct tcpx_uring *ring)
+{
+	ep->uring = calloc(1, sizeof(*ep->uring));
+	if (!ep->uring)
+		return -FI_ENOMEM;
+
+	ep->uring->ring = ring;
+	return FI_SUCCESS;
+}
+
+/*
+ * Cancel the requests of the ep and wait for them to complete, as they
+ * still reference its staging buffer and tx entries.
+ */
+void tcpx_uring_ep_close(struct tcpx_ep *ep)
+{
+	struct tcpx_uring_ep *uep = ep->uring;
+	struct io_uring_sqe sqe = {0};
+	static const int ops[] = {
+		TCPX_URING_RX, TCPX_URING_RX_POLL,
+		TCPX_URING_TX, TCPX_URING_TX_POLL,
+	};
+	uint8_t pending;
+	int i;
+
+	if (!uep)
+		return;
+
+	fastlock_acquire(&ep->lock);
+	uep->closing = true;
+	pending = uep->ops;
+	sqe.opcode = IORING_OP_ASYNC_CANCEL;
+	sqe.user_data = tcpx_uring_data(ep, TCPX_URING_CANCEL);
+	for (i = 0; i < 4; i++) {
+		if (!(pending & (i < 2 ? TCPX_URING_RX_BIT :
+					 TCPX_URING_TX_BIT)))
+			continue;
+		sqe.addr = tcpx_uring_data(ep, ops[i]);
+		(void) tcpx_uring_submit(uep->ring, &sqe, false);
+	}
+	fastlock_release(&ep->lock);
+
+	if (pending) {
+		/* Requests that already started finish once the socket
+		 * is shut down */
+		shutdown(ep->sock, SHUT_RDWR);
+		tcpx_uring_flush(uep->ring);
+	}
+
+	while (pending) {
+		if (!tcpx_uring_progress(uep->ring))
+			sched_yield();
+
+		fastlock_acquire(&ep->lock);
+		pending = uep->ops;
+		fastlock_release(&ep->lock);
+	}
+
+	free(uep);
+	ep->uring = NULL;
+}
+
+int tcpx_uring_open(struct tcpx_uring **ring_ptr)
+{
+	struct io_uring_params params = {0};
+	struct tcpx_uring *ring;
+	int ret;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return -FI_ENOMEM;
+
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = TCPX_URING_CQ_SIZE;
+	if (tcpx_uring_sqpoll) {
+		params.flags |= IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = TCPX_URING_SQ_IDLE_MS;
+	}
+
+	ring->fd = (int) syscall(__NR_io_uring_setup, TCPX_URING_SQ_SIZE,
+				 &params);
+	if (ring->fd < 0) {
+		ret = -errno;
+		goto free;
+	}
+
+	/* Dropped completions would strand their endpoints */
+	if (!(params.features & IORING_FEAT_NODROP)) {
+		ret = -FI_ENOSYS;
+		goto close;
+	}
+
+	ring->sqpoll = !!(params.flags & IORING_SETUP_SQPOLL);
+	ring->sq_entries = params.sq_entries;
+	ring->sq_size = params.sq_off.array +
+			params.sq_entries * sizeof(unsigned);
+	ring->cq_size = params.cq_off.cqes +
+			params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_size = ring->cq_size = MAX(ring->sq_size,
+						    ring->cq_size);
+
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd,
+			    IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		ret = -errno;
+		goto close;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_size,
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd,
+				    IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			ret = -errno;
+			goto unmap_sq;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ret = -errno;
+		goto unmap_cq;
+	}
+
+	ring->sq_head = (unsigned *) ((char *) ring->sq_ptr +
+				      params.sq_off.head);
+	ring->sq_tail = (unsigned *) ((char *) ring->sq_ptr +
+				      params.sq_off.tail);
+	ring->sq_mask = (unsigned *) ((char *) ring->sq_ptr +
+				      params.sq_off.ring_mask);
+	ring->sq_flags = (unsigned *) ((char *) ring->sq_ptr +
+				       params.sq_off.flags);
+	ring->sq_array = (unsigned *) ((char *) ring->sq_ptr +
+				       params.sq_off.array);
+	ring->cq_head = (unsigned *) ((char *) ring->cq_ptr +
+				      params.cq_off.head);
+	ring->cq_tail = (unsigned *) ((char *) ring->cq_ptr +
+				      params.cq_off.tail);
+	ring->cq_mask = (unsigned *) ((char *) ring->cq_ptr +
+				      params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr +
+					      params.cq_off.cqes);
+
+	/* The ring fd sits in the cq wait sets next to endpoint sockets */
+	ring->fid.fclass = FI_CLASS_UNSPEC;
+	fastlock_init(&ring->lock);
+
+	FI_INFO(&tcpx_prov, FI_LOG_DOMAIN,
+		"io_uring engine with %u sq and %u cq entries%s\n",
+		params.sq_entries, params.cq_entries,
+		ring->sqpoll ? ", sq polling" : "");
+	*ring_ptr = ring;
+	return FI_SUCCESS;
+
+unmap_cq:
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_size);
+unmap_sq:
+	munmap(ring->sq_ptr, ring->sq_size);
+close:
+	close(ring->fd);
+free:
+	free(ring);
+	return ret;
+}
+
+void tcpx_uring_close(struct tcpx_uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_size);
+	munmap(ring->sq_ptr, ring->sq_size);
+	close(ring->fd);
+	fastlock_destroy(&ring->lock);
+	free(ring);
+}
+
+#else /* HAVE_TCP_URING */
+
+int tcpx_uring_open(struct tcpx_uring **ring)
+{
+	return -FI_ENOSYS;
+}
+
+void tcpx_uring_close(struct tcpx_uring *ring)
+{
+}
+
+int tcpx_uring_progress(struct tcpx_uring *ring)
+{
+	return 0;
+}
+
+void tcpx_uring_flush(struct tcpx_uring *ring)
+{
+}
+
+int tcpx_uring_wait_add(struct tcpx_uring *ring, struct util_wait *wait)
+{
+	return -FI_ENOSYS;
+}
+
+void tcpx_uring_wait_del(struct tcpx_uring *ring, struct util_wait *wait)
+{
+}
+
+int tcpx_uring_ep_enable(struct tcpx_ep *ep, struct tcpx_uring *ring)
+{
+	return -FI_ENOSYS;
+}
+
+void tcpx_uring_ep_close(struct tcpx_ep *ep)
+{
+}
+
+int tcpx_uring_recv(struct tcpx_ep *ep)
+{
+	return -FI_ENOSYS;
+}
+
+int tcpx_uring_send(struct tcpx_ep *ep)
+{
+	return -FI_ENOSYS;
+}
+
+#endif /* HAVE_TCP_URING */
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2020 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <ofi.h>
+#include <ofi_match.h>
+
+
+static inline struct dlist_entry *
+ofi_match_bucket(struct ofi_match_queue *queue, fi_addr_t addr, uint64_t tag)
+{
+	uint64_t key;
+
+	key = tag ^ ((uint64_t) addr * 0x9e3779b97f4a7c15ULL);
+	key ^= key >> 31;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 29;
+	return &queue->hash[key & queue->hash_mask];
+}
+
+/* Oldest entry in the bucket with exactly this (addr, tag) */
+static struct ofi_match_entry *
+ofi_match_find_bucket(struct ofi_match_queue *queue, fi_addr_t addr,
+		      uint64_t tag)
+{
+	struct ofi_match_entry *entry;
+	struct dlist_entry *bucket;
+
+	bucket = ofi_match_bucket(queue, addr, tag);
+	dlist_foreach_container(bucket, struct ofi_match_entry, entry,
+				hash_entry) {
+		if (entry->addr == addr && entry->tag == tag)
+			return entry;
+	}
+	return NULL;
+}
+
+static struct ofi_match_entry *
+ofi_match_find_list(struct dlist_entry *list, size_t offset, fi_addr_t addr,
+		    uint64_t tag, uint64_t ignore)
+{
+	struct ofi_match_entry *entry;
+	struct dlist_entry *item;
+
+	dlist_foreach(list, item) {
+		entry = (struct ofi_match_entry *) ((char *) item - offset);
+		if (ofi_match_entry_matches(entry, addr, tag, ignore))
+			return entry;
+	}
+	return NULL;
+}
+
+static inline struct ofi_match_entry *
+ofi_match_oldest(struct ofi_match_entry *a, struct ofi_match_entry *b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	return a->seq < b->seq ? a : b;
+}
+
+static inline struct dlist_entry *
+ofi_match_hash_list(struct ofi_match_queue *queue, struct ofi_match_entry *entry)
+{
+	return entry->ignore ? &queue->wildcard :
+	       ofi_match_bucket(queue, entry->addr, entry->tag);
+}
+
+int ofi_match_queue_init(struct ofi_match_queue *queue, size_t size)
+{
+	size_t i;
+
+	size = roundup_power_of_two(size ? size : 1);
+	queue->hash = calloc(size, sizeof(*queue->hash));
+	if (!queue->hash)
+		return -FI_ENOMEM;
+
+	for (i = 0; i < size; i++)
+		dlist_init(&queue->hash[i]);
+
+	dlist_init(&queue->list);
+	dlist_init(&queue->wildcard);
+	queue->hash_mask = size - 1;
+	queue->seq = 1ULL << 63;
+	return 0;
+}
+
+void ofi_match_queue_close(struct ofi_match_queue *queue)
+{
+	free(queue->hash);
+	queue->hash = NULL;
+}
+
+void ofi_match_queue_insert(struct ofi_match_queue *queue,
+			    struct ofi_match_entry *entry)
+{
+	entry->seq = queue->seq++;
+	dlist_insert_tail(&entry->entry, &queue->list);
+	dlist_insert_tail(&entry->hash_entry, ofi_match_hash_list(queue, entry));
+}
+
+void ofi_match_queue_insert_head(struct ofi_match_queue *queue,
+				 struct ofi_match_entry *entry)
+{
+	struct ofi_match_entry *first;
+
+	if (dlist_empty(&queue->list)) {
+		entry->seq = queue->seq - 1;
+	} else {
+		first = container_of(queue->list.next, struct ofi_match_entry,
+				     entry);
+		entry->seq = first->seq - 1;
+	}
+	dlist_insert_head(&entry->entry, &queue->list);
+	dlist_insert_head(&entry->hash_entry, ofi_match_hash_list(queue, entry));
+}
+
+void ofi_match_queue_update(struct ofi_match_queue *queue,
+			    struct ofi_match_entry *entry)
+{
+	struct ofi_match_entry *next;
+	struct dlist_entry *list, *item;
+
+	dlist_remove(&entry->hash_entry);
+	list = ofi_match_hash_list(queue, entry);
+	dlist_foreach(list, item) {
+		next = container_of(item, struct ofi_match_entry, hash_entry);
+		if (next->seq > entry->seq)
+			break;
+	}
+	dlist_insert_before(&entry->hash_entry, item);
+}
+
+void ofi_match_queue_remove(struct ofi_match_queue *queue,
+			    struct ofi_match_entry *entry)
+{
+	dlist_remove(&entry->entry);
+	dlist_remove(&entry->hash_entry);
+}
+
+struct ofi_match_entry *
+ofi_match_queue_find(struct ofi_match_queue *queue, fi_addr_t addr,
+		     uint64_t tag, uint64_t ignore)
+{
+	struct ofi_match_entry *match;
+
+	if (ignore || addr == FI_ADDR_UNSPEC) {
+		return ofi_match_find_list(&queue->list,
+				offsetof(struct ofi_match_entry, entry),
+				addr, tag, ignore);
+	}
+
+	match = ofi_match_find_bucket(queue, addr, tag);
+	match = ofi_match_oldest(match,
+			ofi_match_find_bucket(queue, FI_ADDR_UNSPEC, tag));
+	return ofi_match_oldest(match,
+			ofi_match_find_list(&queue->wildcard,
+				offsetof(struct ofi_match_entry, hash_entry),
+				addr, tag, 0));
+}
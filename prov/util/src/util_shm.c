@@ -85,9 +85,11 @@ void smr_cma_check(struct smr_region *smr, struct smr_region *peer_smr)
 }
 
 size_t smr_calculate_size_offsets(size_t tx_count, size_t rx_count,
-				  size_t *cmd_offset, size_t *resp_offset,
-				  size_t *inject_offset, size_t *sar_offset,
-				  size_t *peer_offset, size_t *name_offset)
+				  size_t peer_count, size_t sar_seg_count,
+				  size_t *cmd_offset,
+				  size_t *resp_offset, size_t *inject_offset,
+				  size_t *sar_offset, size_t *peer_offset,
+				  size_t *name_offset)
 {
 	size_t cmd_queue_offset, resp_queue_offset, inject_pool_offset;
 	size_t sar_pool_offset, peer_data_offset, ep_name_offset;
@@ -98,14 +100,17 @@ size_t smr_calculate_size_offsets(size_t tx_count, size_t rx_count,
 
 	cmd_queue_offset = sizeof(struct smr_region);
 	resp_queue_offset = cmd_queue_offset + sizeof(struct smr_cmd_queue) +
-			    sizeof(struct smr_cmd) * rx_size;
+			    sizeof(struct smr_cmd_queue_entry) * rx_size;
 	inject_pool_offset = resp_queue_offset + sizeof(struct smr_resp_queue) +
 			     sizeof(struct smr_resp) * tx_size;
 	sar_pool_offset = inject_pool_offset + sizeof(struct smr_inject_pool) +
 			  sizeof(struct smr_inject_pool_entry) * rx_size;
 	peer_data_offset = sar_pool_offset + sizeof(struct smr_sar_pool) +
-			   sizeof(struct smr_sar_pool_entry) * SMR_MAX_PEERS;
-	ep_name_offset = peer_data_offset + sizeof(struct smr_peer_data) * SMR_MAX_PEERS;
+			   sizeof(struct smr_sar_pool_entry) * peer_count +
+			   sizeof(struct smr_sar_buf) * sar_seg_count *
+			   peer_count;
+	ep_name_offset = peer_data_offset +
+			 sizeof(struct smr_peer_data) * peer_count;
 
 	if (cmd_offset)
 		*cmd_offset = cmd_queue_offset;
@@ -131,6 +136,33 @@ size_t smr_calculate_size_offsets(size_t tx_count, size_t rx_count,
 	return total_size;
 }
 
+/*
+ * Place the region on the owner's NUMA node so that the command queue and
+ * inject pool, which every sender writes into, are local to the process
+ * draining them.  The header, queues and inject pool are faulted in up
+ * front; the rest of the region follows the same policy when first used.
+ */
+static void smr_place_region(const struct fi_provider *prov, void *addr,
+			     size_t size, size_t hot_size, int node)
+{
+	volatile char *page;
+	long page_size;
+	int ret;
+
+	ret = ofi_numa_prefer(addr, size, node);
+	if (ret && ret != -FI_ENOSYS)
+		FI_INFO(prov, FI_LOG_EP_CTRL,
+			"unable to set NUMA policy for region (%s)\n",
+			fi_strerror(-ret));
+
+	page_size = ofi_get_page_size();
+	if (page_size <= 0)
+		return;
+
+	for (page = addr; page < (char *) addr + hot_size; page += page_size)
+		*page = 0;
+}
+
 /* TODO: Determine if aligning SMR data helps performance */
 int smr_create(const struct fi_provider *prov, struct smr_map *map,
 	       const struct smr_attr *attr, struct smr_region **smr)
@@ -139,13 +171,18 @@ int smr_create(const struct fi_provider *prov, struct smr_map *map,
 	size_t total_size, cmd_queue_offset, peer_data_offset;
 	size_t resp_queue_offset, inject_pool_offset, name_offset;
 	size_t sar_pool_offset;
-	int fd, ret, i;
+	struct smr_sar_pool *sar_pool;
+	struct smr_sar_msg *sar_msg;
+	struct smr_sar_buf *sar_segs;
+	int fd, ret, i, node;
 	void *mapped_addr;
 	size_t tx_size, rx_size;
 
 	tx_size = roundup_power_of_two(attr->tx_count);
 	rx_size = roundup_power_of_two(attr->rx_count);
-	total_size = smr_calculate_size_offsets(tx_size, rx_size, &cmd_queue_offset,
+	total_size = smr_calculate_size_offsets(tx_size, rx_size,
+					attr->peer_count, attr->sar_seg_count,
+					&cmd_queue_offset,
 					&resp_queue_offset, &inject_pool_offset,
 					&sar_pool_offset, &peer_data_offset,
 					&name_offset);
@@ -181,6 +218,8 @@ int smr_create(const struct fi_provider *prov, struct smr_map *map,
 	}
 
 	close(fd);
+	node = ofi_numa_node();
+	smr_place_region(prov, mapped_addr, total_size, sar_pool_offset, node);
 
 	ep_name->region = mapped_addr;
 	pthread_mutex_unlock(&ep_list_lock);
@@ -193,6 +232,7 @@ int smr_create(const struct fi_provider *prov, struct smr_map *map,
 	(*smr)->version = SMR_VERSION;
 	(*smr)->flags = SMR_FLAG_ATOMIC | SMR_FLAG_DEBUG;
 	(*smr)->pid = getpid();
+	(*smr)->node = node;
 	(*smr)->cma_cap = SMR_CMA_CAP_NA;
 	(*smr)->base_addr = *smr;
 
@@ -203,15 +243,24 @@ int smr_create(const struct fi_provider *prov, struct smr_map *map,
 	(*smr)->sar_pool_offset = sar_pool_offset;
 	(*smr)->peer_data_offset = peer_data_offset;
 	(*smr)->name_offset = name_offset;
-	(*smr)->cmd_cnt = rx_size;
+	ofi_atomic_initialize64(&(*smr)->cmd_cnt, rx_size);
 	/* Limit of 1 outstanding SAR message per peer */
-	(*smr)->sar_cnt = SMR_MAX_PEERS;
+	(*smr)->sar_cnt = attr->peer_count;
+	(*smr)->max_peers = attr->peer_count;
 
 	smr_cmd_queue_init(smr_cmd_queue(*smr), rx_size);
 	smr_resp_queue_init(smr_resp_queue(*smr), tx_size);
 	smr_inject_pool_init(smr_inject_pool(*smr), rx_size);
-	smr_sar_pool_init(smr_sar_pool(*smr), SMR_MAX_PEERS); 
-	for (i = 0; i < SMR_MAX_PEERS; i++) {
+	sar_pool = smr_sar_pool(*smr);
+	smr_sar_pool_init(sar_pool, attr->peer_count);
+	sar_segs = (struct smr_sar_buf *) &sar_pool->entry[attr->peer_count];
+	for (i = 0; i < attr->peer_count; i++) {
+		sar_msg = &sar_pool->entry[i].buf;
+		sar_msg->seg_cnt = attr->sar_seg_count;
+		sar_msg->seg_offset = (char *) &sar_segs[i * attr->sar_seg_count] -
+				      (char *) sar_msg;
+	}
+	for (i = 0; i < attr->peer_count; i++) {
 		smr_peer_addr_init(&smr_peer_data(*smr)[i].addr);
 		smr_peer_data(*smr)[i].sar_status = 0;
 	}
@@ -235,20 +284,18 @@ void smr_free(struct smr_region *smr)
 	munmap(smr, smr->total_size);
 }
 
-int smr_map_create(const struct fi_provider *prov, int peer_count,
+int smr_map_create(const struct fi_provider *prov, size_t max_mapped,
 		   struct smr_map **map)
 {
-	int i;
-
 	(*map) = calloc(1, sizeof(struct smr_map));
 	if (!*map) {
 		FI_WARN(prov, FI_LOG_DOMAIN, "failed to create SHM region group\n");
 		return -FI_ENOMEM;
 	}
 
-	for (i = 0; i < peer_count; i++)
-		smr_peer_addr_init(&(*map)->peers[i].peer);
-
+	(*map)->prov = prov;
+	(*map)->max_mapped = max_mapped;
+	dlist_init(&(*map)->lru_list);
 	fastlock_init(&(*map)->lock);
 
 	return 0;
@@ -303,6 +350,11 @@ int smr_map_to_region(const struct fi_provider *prov, struct smr_peer *peer_buf)
 	munmap(peer, sizeof(*peer));
 
 	peer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (peer == MAP_FAILED) {
+		FI_WARN(prov, FI_LOG_AV, "mmap error\n");
+		ret = -errno;
+		goto out;
+	}
 	peer_buf->region = peer;
 
 out:
@@ -310,111 +362,245 @@ out:
 	return ret;
 }
 
-void smr_map_to_endpoint(struct smr_region *region, int index)
+static void smr_exchange_peer(struct smr_region *region, int index,
+			      struct smr_region *peer_smr)
 {
-	struct smr_region *peer_smr;
 	struct smr_peer_data *local_peers, *peer_peers;
 	int peer_index;
 
 	local_peers = smr_peer_data(region);
-
-	strncpy(smr_peer_data(region)[index].addr.name,
-		region->map->peers[index].peer.name, NAME_MAX - 1);
-	smr_peer_data(region)[index].addr.name[NAME_MAX - 1] = '\0';
-	if (region->map->peers[index].peer.addr == FI_ADDR_UNSPEC)
-		return;
-
-	peer_smr = smr_peer_region(region, index);
 	peer_peers = smr_peer_data(peer_smr);
 
 	if (region->cma_cap == SMR_CMA_CAP_NA)
 		smr_cma_check(region, peer_smr);
 
-	for (peer_index = 0; peer_index < SMR_MAX_PEERS; peer_index++) {
+	for (peer_index = 0; peer_index < peer_smr->max_peers; peer_index++) {
 		if (!strncmp(smr_name(region),
 		    peer_peers[peer_index].addr.name, NAME_MAX))
 			break;
 	}
-	if (peer_index != SMR_MAX_PEERS) {
+	if (peer_index != peer_smr->max_peers) {
 		peer_peers[peer_index].addr.addr = index;
 		local_peers[index].addr.addr = peer_index;
 	}
 }
 
-void smr_unmap_from_endpoint(struct smr_region *region, int index)
+/*
+ * Publishes the name of peer index in the peer data of region.  If the peer
+ * region is already mapped, the endpoint and the peer also exchange their
+ * indices in each other's peer data.  Otherwise the exchange is done by the
+ * first transfer to the peer, see smr_verify_peer.
+ */
+void smr_map_to_endpoint(struct smr_region *region, int index)
 {
-	struct smr_region *peer_smr;
-	struct smr_peer_data *local_peers, *peer_peers;
-	int peer_index;
+	struct smr_peer_data *local_peers;
+	struct smr_peer *peer;
+
+	peer = smr_map_peer(region->map, index);
+	if (!peer || index >= region->max_peers)
+		return;
 
 	local_peers = smr_peer_data(region);
+	strncpy(local_peers[index].addr.name, peer->peer.name, NAME_MAX - 1);
+	local_peers[index].addr.name[NAME_MAX - 1] = '\0';
 
-	memset(local_peers[index].addr.name, 0, NAME_MAX);
-	peer_index = region->map->peers[index].peer.addr;
-	if (peer_index == FI_ADDR_UNSPEC)
+	if (local_peers[index].addr.addr != FI_ADDR_UNSPEC ||
+	    !smr_peer_tryacquire(peer))
 		return;
 
-	peer_smr = smr_peer_region(region, index);
-	peer_peers = smr_peer_data(peer_smr);
+	smr_exchange_peer(region, index, peer->region);
+	ofi_atomic_dec32(&peer->ref);
+}
 
-	peer_peers[peer_index].addr.addr = FI_ADDR_UNSPEC;
+void smr_unmap_from_endpoint(struct smr_region *region, int index)
+{
+	struct smr_peer_data *local_peers;
+
+	if (index < 0 || index >= region->max_peers)
+		return;
+
+	local_peers = smr_peer_data(region);
+
+	memset(local_peers[index].addr.name, 0, NAME_MAX);
+	local_peers[index].addr.addr = FI_ADDR_UNSPEC;
 }
 
 void smr_exchange_all_peers(struct smr_region *region)
 {
 	int i;
-	for (i = 0; i < SMR_MAX_PEERS; i++)
+	for (i = 0; i < region->map->num_peers; i++)
 		smr_map_to_endpoint(region, i);
 }
 
 int smr_map_add(const struct fi_provider *prov, struct smr_map *map,
 		const char *name, int id)
 {
+	struct smr_peer *peer;
 	int ret = 0;
 
 	fastlock_acquire(&map->lock);
-	strncpy(map->peers[id].peer.name, name, NAME_MAX);
-	map->peers[id].peer.name[NAME_MAX - 1] = '\0';
-	ret = smr_map_to_region(prov, &map->peers[id]);
-	if (!ret)
-		map->peers[id].peer.addr = id;
+	peer = smr_map_peer(map, id);
+	if (!peer) {
+		peer = calloc(1, sizeof(*peer));
+		if (!peer) {
+			ret = -FI_ENOMEM;
+			goto out;
+		}
+		smr_peer_addr_init(&peer->peer);
+		ofi_atomic_initialize32(&peer->ref, -SMR_PEER_UNMAPPED);
+		dlist_init(&peer->lru_entry);
+		if (ofi_idm_set(&map->peers, id, peer) < 0) {
+			FI_WARN(prov, FI_LOG_AV, "failed to grow peer map\n");
+			free(peer);
+			ret = -FI_ENOMEM;
+			goto out;
+		}
+		if (id >= map->num_peers)
+			map->num_peers = id + 1;
+	}
+
+	strncpy(peer->peer.name, name, NAME_MAX);
+	peer->peer.name[NAME_MAX - 1] = '\0';
+out:
 	fastlock_release(&map->lock);
 
-	return ret == -ENOENT ? 0 : ret;
+	return ret;
+}
+
+/* Caller holds the map lock and has locked out new users of the region */
+static void smr_map_unmap_peer(struct smr_map *map, struct smr_peer *peer)
+{
+	if (!dlist_empty(&peer->lru_entry)) {
+		dlist_remove_init(&peer->lru_entry);
+		munmap(peer->region, peer->region->total_size);
+		map->num_mapped--;
+		map->unmap_cnt++;
+	}
+	peer->region = NULL;
+	peer->peer.addr = FI_ADDR_UNSPEC;
+	peer->del_pending = 0;
+}
+
+static void smr_map_evict(struct smr_map *map)
+{
+	struct smr_peer *peer;
+	size_t i;
+
+	for (i = 0; i < 2 * map->num_mapped; i++) {
+		peer = container_of(map->lru_list.next, struct smr_peer,
+				    lru_entry);
+		if (!peer->accessed &&
+		    ofi_atomic_cas_bool_strong32(&peer->ref, 0,
+						 -SMR_PEER_UNMAPPED)) {
+			smr_map_unmap_peer(map, peer);
+			return;
+		}
+		peer->accessed = 0;
+		dlist_remove(&peer->lru_entry);
+		dlist_insert_tail(&peer->lru_entry, &map->lru_list);
+	}
+
+	/* every mapped region is in use, go over the limit */
+	map->over_limit_cnt++;
+}
+
+int smr_map_acquire(struct smr_map *map, int id, struct smr_region **region)
+{
+	struct smr_peer *peer;
+	int ret = 0;
+
+	peer = smr_map_peer(map, id);
+	if (!peer)
+		return -FI_EINVAL;
+
+	fastlock_acquire(&map->lock);
+	if (smr_peer_tryacquire(peer))
+		goto out;
+
+	if (peer->del_pending) {
+		if (ofi_atomic_get32(&peer->ref) != -SMR_PEER_UNMAPPED) {
+			ret = -FI_EAGAIN;
+			goto unlock;
+		}
+		smr_map_unmap_peer(map, peer);
+	}
+
+	if (map->max_mapped && map->num_mapped >= map->max_mapped &&
+	    !dlist_empty(&map->lru_list))
+		smr_map_evict(map);
+
+	ret = smr_map_to_region(map->prov, peer);
+	if (ret) {
+		peer->region = NULL;
+		goto unlock;
+	}
+
+	/* regions of endpoints in this process are never unmapped */
+	if (peer->region->pid != getpid()) {
+		dlist_insert_tail(&peer->lru_entry, &map->lru_list);
+		map->num_mapped++;
+		map->map_cnt++;
+	}
+	peer->peer.addr = id;
+	peer->accessed = 1;
+	ofi_atomic_add32(&peer->ref, SMR_PEER_UNMAPPED + 1);
+out:
+	*region = peer->region;
+unlock:
+	fastlock_release(&map->lock);
+	return ret;
 }
 
 void smr_map_del(struct smr_map *map, int id)
 {
-	struct dlist_entry *entry;
+	struct smr_peer *peer;
 
-	if (id >= SMR_MAX_PEERS || id < 0 ||
-	    map->peers[id].peer.addr == FI_ADDR_UNSPEC)
+	peer = smr_map_peer(map, id);
+	if (!peer)
 		return;
 
-	pthread_mutex_lock(&ep_list_lock);
-	entry = dlist_find_first_match(&ep_name_list, smr_match_name,
-				       map->peers[id].peer.name);
-	pthread_mutex_unlock(&ep_list_lock);
-	if (!entry)
-		munmap(map->peers[id].region, map->peers[id].region->total_size);
+	fastlock_acquire(&map->lock);
+	if (peer->region && !peer->del_pending) {
+		if (ofi_atomic_sub32(&peer->ref, SMR_PEER_UNMAPPED) ==
+		    -SMR_PEER_UNMAPPED)
+			smr_map_unmap_peer(map, peer);
+		else
+			peer->del_pending = 1;
+	}
+	fastlock_release(&map->lock);
+}
+
+/* Called by the last smr_peer_release of a peer removed while in use */
+void smr_map_put_deleted(struct smr_map *map, int id)
+{
+	struct smr_peer *peer;
 
-	map->peers[id].peer.addr = FI_ADDR_UNSPEC;
+	peer = smr_map_peer(map, id);
+	fastlock_acquire(&map->lock);
+	if (peer->del_pending &&
+	    ofi_atomic_get32(&peer->ref) == -SMR_PEER_UNMAPPED)
+		smr_map_unmap_peer(map, peer);
+	fastlock_release(&map->lock);
 }
 
 void smr_map_free(struct smr_map *map)
 {
 	int i;
 
-	for (i = 0; i < SMR_MAX_PEERS; i++)
+	for (i = 0; i < map->num_peers; i++) {
+		if (!smr_map_peer(map, i))
+			continue;
 		smr_map_del(map, i);
+		/* the endpoints are gone, drop regions still marked in use */
+		if (smr_map_peer(map, i)->del_pending)
+			smr_map_unmap_peer(map, smr_map_peer(map, i));
+		free(ofi_idm_clear(&map->peers, i));
+	}
 
-	free(map);
-}
-
-struct smr_region *smr_map_get(struct smr_map *map, int id)
-{
-	if (id < 0 || id >= SMR_MAX_PEERS)
-		return NULL;
+	FI_INFO(map->prov, FI_LOG_AV, "peer regions mapped %zu, unmapped %zu, "
+		"mapped over limit %zu\n", map->map_cnt, map->unmap_cnt,
+		map->over_limit_cnt);
 
-	return map->peers[id].region;
+	fastlock_destroy(&map->lock);
+	free(map);
 }